@@ -0,0 +1,199 @@
+#include "autotuner.h"
+#include "cpu_executor.h"
+#include "kernel_optimizer.h"
+#include "spirv_generator.h"
+#include "clang/AST/PrettyPrinter.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+namespace cspir {
+
+// Work-groups launched per tuning run of a reduction, so every work-item
+// iterates its grid-stride loop and unroll variants differ
+static const uint64_t TuningReductionGroups = 16;
+
+Autotuner::Autotuner(clang::ASTContext* Context, const CodeGenOptions& Options)
+    : Context(Context), Options(Options) {
+    if (!Options.Tuning.DatabasePath.empty()) {
+        Loaded = Database.load(Options.Tuning.DatabasePath);
+    }
+}
+
+std::string Autotuner::getLoopHash(clang::ForStmt* FS, clang::ASTContext& Context,
+                                   clang::QualType ElementType) {
+    std::string Text;
+    llvm::raw_string_ostream OS(Text);
+    FS->printPretty(OS, nullptr, clang::PrintingPolicy(Context.getLangOpts()));
+    OS << "\n" << (ElementType.isNull() ? "float" : ElementType.getAsString());
+
+    llvm::MD5 Hash;
+    Hash.update(OS.str());
+    llvm::MD5::MD5Result Result;
+    Hash.final(Result);
+    return Result.digest().str().str();
+}
+
+bool Autotuner::apply(clang::ForStmt* FS, VectorizationInfo& Info) {
+    if (!Loaded) {
+        return false;
+    }
+
+    std::string Hash = getLoopHash(FS, *Context, Info.ElementType);
+    const TuningRecord* Record = Database.lookup(Hash, Options.Device.Name);
+    TuningRecord Tuned;
+    if (!Record && Options.Tuning.Autotune && tune(FS, Info, Tuned)) {
+        Database.insert(Hash, Options.Device.Name, Tuned);
+        Record = &Tuned;
+    }
+    if (!Record) {
+        return false;
+    }
+
+    // A stale record must never exceed a literal trip count
+    if (Record->VectorWidth > Info.MaxLegalWidth) {
+        Info.Reasons.push_back("Tuning database width " + std::to_string(Record->VectorWidth) +
+                               " exceeds the legal width " + std::to_string(Info.MaxLegalWidth) +
+                               ", ignored");
+        return false;
+    }
+
+    Info.RecommendedWidth = Record->VectorWidth;
+    Info.WorkGroupSize = Record->WorkGroupSize;
+    Info.UnrollFactor = Info.IsReduction ? Record->Unroll : 1;
+    Info.CoarseningFactor = Info.IsReduction ? 1 : Record->Coarsening;
+    std::string Reason = "Tuning database: width " + std::to_string(Record->VectorWidth) +
+                         ", work-group " + std::to_string(Record->WorkGroupSize);
+    if (Info.UnrollFactor > 1) {
+        Reason += ", unroll " + std::to_string(Info.UnrollFactor);
+    }
+    if (Info.CoarseningFactor > 1) {
+        Reason += ", coarsening " + std::to_string(Info.CoarseningFactor);
+    }
+    Reason += " (best of " + std::to_string(Record->Candidates) + " variants on the host CPU, " +
+              std::to_string(Record->Seconds * 1e3) + " ms)";
+    Info.Reasons.push_back(Reason);
+    return true;
+}
+
+bool Autotuner::tune(clang::ForStmt* FS, const VectorizationInfo& Info, TuningRecord& Best) {
+    clang::QualType QT = Info.ElementType.isNull() ? Context->FloatTy : Info.ElementType;
+    auto Candidates = getKernelVariants(Options.Variants, Info.MaxLegalWidth,
+                                        Context->getTypeSize(QT), Info.IsReduction);
+
+    unsigned Measured = 0;
+    for (const auto& Variant : Candidates) {
+        double Seconds = 0;
+        std::string Error;
+        if (!measure(FS, Info, Variant, Seconds, Error)) {
+            llvm::errs() << "Warning: Cannot time variant" << Variant.getSuffix() << ": "
+                         << Error << "\n";
+            continue;
+        }
+        if (!Measured++ || Seconds < Best.Seconds) {
+            Best.VectorWidth = Variant.VectorWidth;
+            Best.WorkGroupSize = Variant.WorkGroupSize;
+            Best.Unroll = Variant.Unroll;
+            Best.Coarsening = Variant.Coarsening;
+            Best.Seconds = Seconds;
+        }
+    }
+    Best.Candidates = Measured;
+    return Measured > 0;
+}
+
+bool Autotuner::measure(clang::ForStmt* FS, const VectorizationInfo& Info,
+                        const KernelVariant& Variant, double& Seconds, std::string& Error) {
+    // A scratch module per candidate keeps the TU module untouched
+    CodeGenOptions ScratchOptions = Options;
+    ScratchOptions.Variants.Enabled = false;
+    SPIRVGenerator Scratch(Context, ScratchOptions);
+    std::string LoopName = Scratch.getKernelName(FS);
+    if (!Scratch.generateVariant(FS, Info, Variant, LoopName, LoopName) ||
+        !Scratch.finalizeModule()) {
+        Error = "kernel generation failed";
+        return false;
+    }
+    const KernelInfo& KInfo = Scratch.getLastKernel();
+
+    // Time what would be shipped
+    KernelOptimizer Optimizer(Options.OptLevel);
+    KernelOptStats Stats;
+    if (!Optimizer.run(*Scratch.getModule(), Stats)) {
+        Error = "kernel optimization failed";
+        return false;
+    }
+
+    CPUExecutor Executor;
+    if (!Executor.load(*Scratch.getModule(), Error)) {
+        return false;
+    }
+
+    Seconds = 0;
+    uint64_t Width = KInfo.VectorWidth;
+    uint64_t GroupSize = KInfo.Dispatch.RequiredWorkGroupSize ? KInfo.Dispatch.RequiredWorkGroupSize
+                                                              : KInfo.PreferredWorkGroupSize;
+    for (uint64_t Size : Options.Tuning.Sizes) {
+        uint64_t TripCount = KInfo.StaticTripCount ? KInfo.StaticTripCount : Size;
+
+        KernelLaunch Launch;
+        Launch.Kernel = KInfo.Name;
+        Launch.LocalSize = GroupSize;
+        Launch.BufferElements = static_cast<uint64_t>(std::max<int64_t>(KInfo.LowerBound, 0)) + TripCount;
+        for (unsigned I = 0; I < KInfo.Arguments.size(); ++I) {
+            if (KInfo.Arguments[I].Kind == ArgKind::TripCount) {
+                Launch.TripCountArg = I;
+                Launch.TripCount = KInfo.LowerBound + static_cast<int64_t>(TripCount) -
+                                   (KInfo.InclusiveBound ? 1 : 0);
+            }
+        }
+
+        if (KInfo.Dispatch.StaticGlobalSize) {
+            Launch.GlobalSize = KInfo.Dispatch.StaticGlobalSize;
+        } else if (KInfo.IsReduction) {
+            uint64_t Groups = (TripCount + Width * GroupSize - 1) / (Width * GroupSize);
+            Launch.GlobalSize = std::min(Groups, TuningReductionGroups) * GroupSize;
+        } else {
+            uint64_t PerWorkItem = KInfo.Dispatch.ElementsPerWorkItem;
+            uint64_t WorkItems = (TripCount + PerWorkItem - 1) / PerWorkItem;
+            Launch.GlobalSize = (WorkItems + GroupSize - 1) / GroupSize * GroupSize;
+        }
+
+        double SizeSeconds = 0;
+        if (!Executor.run(Launch, Options.Tuning.Repetitions, SizeSeconds, Error)) {
+            return false;
+        }
+        Seconds += SizeSeconds;
+
+        // Two-stage reductions pay for their combine launch as well; it
+        // folds one partial per work-group of the first stage
+        if (Scratch.getModule()->getFunction(KInfo.Name + "_combine")) {
+            KernelLaunch Combine;
+            Combine.Kernel = KInfo.Name + "_combine";
+            Combine.GlobalSize = KInfo.PreferredWorkGroupSize;
+            Combine.LocalSize = KInfo.PreferredWorkGroupSize;
+            Combine.BufferElements = Launch.GlobalSize / GroupSize;
+            Combine.TripCountArg = SPIRVGenerator::CombineCountArg;
+            Combine.TripCount = static_cast<int64_t>(Combine.BufferElements);
+            if (!Executor.run(Combine, Options.Tuning.Repetitions, SizeSeconds, Error)) {
+                return false;
+            }
+            Seconds += SizeSeconds;
+        }
+
+        // The trip count is baked in, so other sizes would time the same
+        if (KInfo.StaticTripCount) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool Autotuner::save() {
+    if (!Loaded || !Database.isModified()) {
+        return true;
+    }
+    return Database.save(Options.Tuning.DatabasePath);
+}
+
+} // namespace cspir
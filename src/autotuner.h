@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+#include "tuning_database.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Stmt.h"
+#include <string>
+
+namespace cspir {
+    // Replaces the analyzer's vector width and the generator's default
+    // work-group size with measured choices from the tuning database. In
+    // --autotune mode, loops without a record are benchmarked first: every
+    // candidate variant is generated, optimized and timed on the host CPU.
+    class Autotuner {
+    public:
+        Autotuner(clang::ASTContext* Context, const CodeGenOptions& Options);
+
+        // False when the heuristics stay in charge of this loop
+        bool apply(clang::ForStmt* FS, VectorizationInfo& Info);
+        // Writes the database back if tuning added records
+        bool save();
+
+        // Stable across runs and formatting: MD5 of the pretty-printed loop
+        // and its element type
+        static std::string getLoopHash(clang::ForStmt* FS, clang::ASTContext& Context,
+                                       clang::QualType ElementType);
+
+    private:
+        bool tune(clang::ForStmt* FS, const VectorizationInfo& Info, TuningRecord& Best);
+        bool measure(clang::ForStmt* FS, const VectorizationInfo& Info,
+                     const KernelVariant& Variant, double& Seconds, std::string& Error);
+
+        clang::ASTContext* Context;
+        const CodeGenOptions& Options;
+        TuningDatabase Database;
+        bool Loaded = false;
+    };
+} // namespace cspir
@@ -0,0 +1,547 @@
+#include "cpu_executor.h"
+#include "types.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <ucontext.h>
+
+namespace cspir {
+
+namespace {
+    // Host side of the OpenCL work-item builtins for the launch in flight
+    struct WorkItem {
+        ucontext_t Context;
+        bool Done = false;
+    };
+
+    struct LaunchState {
+        uint32_t GlobalSize = 1;
+        uint32_t LocalSize = 1;
+        uint32_t GroupId = 0;
+        uint32_t Current = 0;  // Local id of the running work-item
+        void (*Entry)(int64_t*) = nullptr;
+        int64_t* Args = nullptr;
+        std::vector<WorkItem> Items;
+        ucontext_t Scheduler;
+    };
+
+    LaunchState State;
+    std::mutex LaunchMutex;  // The builtins see one launch at a time
+
+    uint32_t hostGetGlobalId(uint32_t Dim) {
+        return Dim ? 0 : State.GroupId * State.LocalSize + State.Current;
+    }
+    uint32_t hostGetLocalId(uint32_t Dim) { return Dim ? 0 : State.Current; }
+    uint32_t hostGetGroupId(uint32_t Dim) { return Dim ? 0 : State.GroupId; }
+    uint32_t hostGetLocalSize(uint32_t Dim) { return Dim ? 1 : State.LocalSize; }
+    uint32_t hostGetGlobalSize(uint32_t Dim) { return Dim ? 1 : State.GlobalSize; }
+
+    // Sub-groups of one work-item, which OpenCL allows: the reduction's
+    // per-sub-group values then go through local memory one per work-item
+    uint32_t hostGetSubGroupId() { return State.Current; }
+    uint32_t hostGetSubGroupLocalId() { return 0; }
+    uint32_t hostGetSubGroupSize() { return 1; }
+    uint32_t hostGetNumSubGroups() { return State.LocalSize; }
+
+    // IEEE binary16 bits, widened to 32 bits so neither side relies on
+    // how the other extends an i16
+    float hostHalfToFloat(uint32_t Bits) {
+        uint32_t Sign = (Bits & 0x8000) << 16;
+        uint32_t Exponent = (Bits >> 10) & 0x1f;
+        uint32_t Mantissa = Bits & 0x3ff;
+        if (!Exponent) {
+            float Value = std::ldexp(static_cast<float>(Mantissa), -24);
+            return Sign ? -Value : Value;
+        }
+        uint32_t Out = Sign | (Exponent == 0x1f ? 0x7f800000 : (Exponent + 112) << 23) | (Mantissa << 13);
+        float Value;
+        std::memcpy(&Value, &Out, sizeof(Value));
+        return Value;
+    }
+
+    uint32_t hostFloatToHalfRTE(float Value) {
+        uint32_t Bits;
+        std::memcpy(&Bits, &Value, sizeof(Bits));
+        uint32_t Sign = (Bits >> 16) & 0x8000;
+        uint32_t Abs = Bits & 0x7fffffff;
+        if (Abs > 0x7f800000) {
+            return Sign | 0x7e00;  // Quiet NaN
+        }
+        if (Abs >= 0x477ff000) {
+            return Sign | 0x7c00;  // 65520 and up round to infinity
+        }
+        if (Abs < 0x38800000) {
+            // Subnormal: a multiple of 2^-24, rounded to nearest even
+            float Magnitude;
+            std::memcpy(&Magnitude, &Abs, sizeof(Magnitude));
+            return Sign | static_cast<uint32_t>(std::nearbyint(Magnitude * 16777216.0f));
+        }
+        // Round the 13 dropped mantissa bits to nearest even, then rebias
+        Abs += 0xfff + ((Abs >> 13) & 1);
+        return Sign | ((Abs - 0x38000000) >> 13);
+    }
+
+    void hostBarrier(uint32_t) {
+        // Yield; the scheduler resumes this work-item once every other one
+        // in the group has reached the barrier too
+        swapcontext(&State.Items[State.Current].Context, &State.Scheduler);
+    }
+
+    void runWorkItem() {
+        State.Entry(State.Args);
+        State.Items[State.Current].Done = true;
+    }
+
+    // Host-side helpers the builtin definitions below call
+    const char* HalfToFloatName = "cspir.half_to_float";
+    const char* FloatToHalfName = "cspir.float_to_half_rte";
+
+    // "tanh" for _Z4tanhDv4_f; empty for names that are not mangled
+    llvm::StringRef getMangledBaseName(llvm::StringRef Name) {
+        size_t Length;
+        if (!Name.consume_front("_Z") || Name.consumeInteger(10, Length) || Length > Name.size()) {
+            return llvm::StringRef();
+        }
+        return Name.take_front(Length);
+    }
+
+    // Fiber stacks only hold the kernel frame and a builtin call
+    const size_t FiberStackBytes = 64 * 1024;
+    // Elements of slack before and after every buffer for offset accesses
+    const uint64_t BufferPadding = 1024;
+} // namespace
+
+float convertHalfToFloat(uint16_t Bits) {
+    return hostHalfToFloat(Bits);
+}
+
+uint16_t convertFloatToHalf(float Value) {
+    return static_cast<uint16_t>(hostFloatToHalfRTE(Value));
+}
+
+bool CPUExecutor::load(const llvm::Module& M, std::string& Error) {
+    static std::once_flag TargetInit;
+    std::call_once(TargetInit, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+    });
+
+    // Round-trip through bitcode so the JIT owns an independent context
+    llvm::SmallVector<char, 0> Bitcode;
+    llvm::raw_svector_ostream OS(Bitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+    auto Ctx = std::make_unique<llvm::LLVMContext>();
+    auto Clone = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(Bitcode.data(), Bitcode.size()), "kernels"), *Ctx);
+    if (!Clone) {
+        Error = llvm::toString(Clone.takeError());
+        return false;
+    }
+
+    auto Built = llvm::orc::LLJITBuilder().create();
+    if (!Built) {
+        Error = llvm::toString(Built.takeError());
+        return false;
+    }
+    JIT = std::move(*Built);
+    (*Clone)->setTargetTriple(JIT->getTargetTriple().str());
+    (*Clone)->setDataLayout(JIT->getDataLayout());
+
+    if (!defineBuiltins(**Clone, Error)) {
+        return false;
+    }
+
+    Kernels.clear();
+    std::vector<llvm::Function*> KernelFuncs;
+    for (auto& F : **Clone) {
+        if (!F.isDeclaration() && F.getCallingConv() == llvm::CallingConv::SPIR_KERNEL) {
+            KernelFuncs.push_back(&F);
+        }
+    }
+    for (auto* F : KernelFuncs) {
+        if (!createEntry(*F, Error)) {
+            return false;
+        }
+    }
+
+    auto& Dylib = JIT->getMainJITDylib();
+    auto Symbol = [&](void* Fn) {
+        return llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(Fn),
+                                        llvm::JITSymbolFlags::Exported |
+                                        llvm::JITSymbolFlags::Callable);
+    };
+    llvm::orc::SymbolMap Builtins;
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_GLOBAL_ID)] =
+        Symbol(reinterpret_cast<void*>(&hostGetGlobalId));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_LOCAL_ID)] =
+        Symbol(reinterpret_cast<void*>(&hostGetLocalId));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_GROUP_ID)] =
+        Symbol(reinterpret_cast<void*>(&hostGetGroupId));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_LOCAL_SIZE)] =
+        Symbol(reinterpret_cast<void*>(&hostGetLocalSize));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_GLOBAL_SIZE)] =
+        Symbol(reinterpret_cast<void*>(&hostGetGlobalSize));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::BARRIER)] =
+        Symbol(reinterpret_cast<void*>(&hostBarrier));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_SUB_GROUP_ID)] =
+        Symbol(reinterpret_cast<void*>(&hostGetSubGroupId));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_SUB_GROUP_LOCAL_ID)] =
+        Symbol(reinterpret_cast<void*>(&hostGetSubGroupLocalId));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_SUB_GROUP_SIZE)] =
+        Symbol(reinterpret_cast<void*>(&hostGetSubGroupSize));
+    Builtins[JIT->mangleAndIntern(OpenCLBuiltins::GET_NUM_SUB_GROUPS)] =
+        Symbol(reinterpret_cast<void*>(&hostGetNumSubGroups));
+    Builtins[JIT->mangleAndIntern(HalfToFloatName)] =
+        Symbol(reinterpret_cast<void*>(&hostHalfToFloat));
+    Builtins[JIT->mangleAndIntern(FloatToHalfName)] =
+        Symbol(reinterpret_cast<void*>(&hostFloatToHalfRTE));
+    if (auto Err = Dylib.define(llvm::orc::absoluteSymbols(std::move(Builtins)))) {
+        Error = llvm::toString(std::move(Err));
+        return false;
+    }
+
+    // The libm functions the math builtins were defined with resolve
+    // against the host process
+    auto Process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        JIT->getDataLayout().getGlobalPrefix());
+    if (!Process) {
+        Error = llvm::toString(Process.takeError());
+        return false;
+    }
+    Dylib.addGenerator(std::move(*Process));
+
+    if (auto Err = JIT->addIRModule(llvm::orc::ThreadSafeModule(std::move(*Clone), std::move(Ctx)))) {
+        Error = llvm::toString(std::move(Err));
+        return false;
+    }
+    return true;
+}
+
+bool CPUExecutor::defineBuiltins(llvm::Module& M, std::string& Error) {
+    // The mangled OpenCL builtins the generator calls get bodies that work
+    // lane by lane: math through libm in float or double, half storage
+    // through the host conversions, and sub-group sums of one work-item
+    auto& Ctx = M.getContext();
+    auto* I16 = llvm::Type::getInt16Ty(Ctx);
+    auto* I32 = llvm::Type::getInt32Ty(Ctx);
+    auto* FloatTy = llvm::Type::getFloatTy(Ctx);
+    auto HalfToFloat = M.getOrInsertFunction(HalfToFloatName, FloatTy, I32);
+    auto FloatToHalf = M.getOrInsertFunction(FloatToHalfName, I32, FloatTy);
+
+    std::vector<llvm::Function*> Declarations;
+    for (auto& F : M) {
+        if (F.isDeclaration() && !F.isIntrinsic() && !getMangledBaseName(F.getName()).empty()) {
+            Declarations.push_back(&F);
+        }
+    }
+    for (auto* F : Declarations) {
+        llvm::StringRef Name = getMangledBaseName(F->getName());
+        auto* FTy = F->getFunctionType();
+        auto* Entry = llvm::BasicBlock::Create(Ctx, "entry", F);
+        llvm::IRBuilder<> Builder(Entry);
+        F->setLinkage(llvm::GlobalValue::InternalLinkage);
+        // The bodies call host helpers the declared memory effects omit
+        for (auto Kind : {llvm::Attribute::ReadNone, llvm::Attribute::ReadOnly,
+                          llvm::Attribute::WriteOnly, llvm::Attribute::ArgMemOnly}) {
+            F->removeFnAttr(Kind);
+        }
+
+        // Lanes of V, or V itself when it is a scalar
+        auto LaneCount = [](llvm::Type* Ty) {
+            auto* VecTy = llvm::dyn_cast<llvm::FixedVectorType>(Ty);
+            return VecTy ? VecTy->getNumElements() : 1u;
+        };
+        auto GetLane = [&](llvm::Value* V, unsigned Lane) {
+            return V->getType()->isVectorTy() ? Builder.CreateExtractElement(V, Lane) : V;
+        };
+        auto SetLane = [&](llvm::Value* V, llvm::Value* Element, unsigned Lane) {
+            return V ? Builder.CreateInsertElement(V, Element, Lane) : Element;
+        };
+
+        if (Name == OpenCLBuiltins::SUB_GROUP_REDUCE_ADD && FTy->getNumParams() == 1) {
+            Builder.CreateRet(F->getArg(0));
+        } else if (Name.startswith("vload_half") && FTy->getNumParams() == 2) {
+            // vload_halfn(offset, p) reads n halves at p + offset * n
+            auto* RetTy = FTy->getReturnType();
+            unsigned Lanes = LaneCount(RetTy);
+            auto* Ptr = Builder.CreateBitCast(
+                F->getArg(1), llvm::PointerType::get(I16, F->getArg(1)->getType()->getPointerAddressSpace()));
+            auto* Base = Builder.CreateMul(F->getArg(0), Builder.getInt64(Lanes));
+            llvm::Value* Result = RetTy->isVectorTy() ? llvm::UndefValue::get(RetTy) : nullptr;
+            for (unsigned Lane = 0; Lane < Lanes; ++Lane) {
+                auto* Bits = Builder.CreateLoad(I16, Builder.CreateGEP(
+                    I16, Ptr, Builder.CreateAdd(Base, Builder.getInt64(Lane))));
+                auto* Element = Builder.CreateCall(HalfToFloat, {Builder.CreateZExt(Bits, I32)});
+                Result = SetLane(Result, Element, Lane);
+            }
+            Builder.CreateRet(Result);
+        } else if (Name.startswith("vstore_half") && FTy->getNumParams() == 3) {
+            // vstore_halfn_rte(v, offset, p) writes n halves at p + offset * n
+            unsigned Lanes = LaneCount(FTy->getParamType(0));
+            auto* Ptr = Builder.CreateBitCast(
+                F->getArg(2), llvm::PointerType::get(I16, F->getArg(2)->getType()->getPointerAddressSpace()));
+            auto* Base = Builder.CreateMul(F->getArg(1), Builder.getInt64(Lanes));
+            for (unsigned Lane = 0; Lane < Lanes; ++Lane) {
+                auto* Bits = Builder.CreateCall(FloatToHalf, {GetLane(F->getArg(0), Lane)});
+                Builder.CreateStore(Builder.CreateTrunc(Bits, I16), Builder.CreateGEP(
+                    I16, Ptr, Builder.CreateAdd(Base, Builder.getInt64(Lane))));
+            }
+            Builder.CreateRetVoid();
+        } else {
+            // Math: native_ and half_ variants run the exact function
+            auto* Ty = FTy->getReturnType();
+            bool Uniform = Ty->isFPOrFPVectorTy() &&
+                           std::all_of(FTy->param_begin(), FTy->param_end(),
+                                       [&](llvm::Type* P) { return P == Ty; });
+            if (!Uniform) {
+                Error = "no host definition for " + F->getName().str();
+                return false;
+            }
+            if (!Name.consume_front("native_")) {
+                Name.consume_front("half_");
+            }
+            auto* Scalar = Ty->getScalarType();
+            auto* CallTy = Scalar->isDoubleTy() ? Scalar : FloatTy;
+            std::vector<llvm::Type*> CallArgs(FTy->getNumParams(), CallTy);
+            auto LibM = M.getOrInsertFunction(Name.str() + (Scalar->isDoubleTy() ? "" : "f"),
+                                              llvm::FunctionType::get(CallTy, CallArgs, false));
+            llvm::Value* Result = Ty->isVectorTy() ? llvm::UndefValue::get(Ty) : nullptr;
+            for (unsigned Lane = 0; Lane < LaneCount(Ty); ++Lane) {
+                std::vector<llvm::Value*> Args;
+                for (auto& Arg : F->args()) {
+                    Args.push_back(Builder.CreateFPCast(GetLane(&Arg, Lane), CallTy));
+                }
+                auto* Element = Builder.CreateFPCast(Builder.CreateCall(LibM, Args), Scalar);
+                Result = SetLane(Result, Element, Lane);
+            }
+            Builder.CreateRet(Result);
+        }
+    }
+    return true;
+}
+
+bool CPUExecutor::createEntry(llvm::Function& Kernel, std::string& Error) {
+    // <kernel>.entry(i64* args) unpacks one 64-bit slot per parameter, so
+    // every kernel is called through the same host signature
+    auto& Ctx = Kernel.getContext();
+    auto* I64 = llvm::Type::getInt64Ty(Ctx);
+    auto* EntryTy = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx),
+                                            {llvm::PointerType::get(I64, 0)}, false);
+    auto* Entry = llvm::Function::Create(EntryTy, llvm::Function::ExternalLinkage,
+                                         Kernel.getName() + ".entry", Kernel.getParent());
+    llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Ctx, "entry", Entry));
+
+    KernelEntry Info;
+    std::vector<llvm::Value*> Args;
+    for (auto& Param : Kernel.args()) {
+        auto* Ty = Param.getType();
+        auto* Slot = Builder.CreateLoad(I64, Builder.CreateConstGEP1_32(I64, Entry->getArg(0),
+                                                                       Param.getArgNo()));
+        Parameter P;
+        if (auto* PtrTy = llvm::dyn_cast<llvm::PointerType>(Ty)) {
+            auto* ElemTy = PtrTy->getPointerElementType();
+            P.IsBuffer = true;
+            P.IsFloat = ElemTy->isFloatingPointTy();
+            P.Bytes = ElemTy->getPrimitiveSizeInBits() / 8;
+            Args.push_back(Builder.CreateIntToPtr(Slot, Ty));
+        } else if (Ty->isIntegerTy()) {
+            P.Bytes = Ty->getPrimitiveSizeInBits() / 8;
+            Args.push_back(Builder.CreateTrunc(Slot, Ty));
+        } else if (Ty->isFloatingPointTy()) {
+            P.IsFloat = true;
+            P.Bytes = Ty->getPrimitiveSizeInBits() / 8;
+            Args.push_back(Builder.CreateFPTrunc(Builder.CreateBitCast(Slot, Builder.getDoubleTy()), Ty));
+        } else {
+            P.Bytes = 0;
+        }
+        if (!P.Bytes) {
+            Error = "unsupported parameter type in " + Kernel.getName().str();
+            return false;
+        }
+        Info.Parameters.push_back(P);
+    }
+
+    // Kernels are plain host functions here
+    Kernel.setCallingConv(llvm::CallingConv::C);
+    Builder.CreateCall(&Kernel, Args);
+    Builder.CreateRetVoid();
+
+    for (auto& I : llvm::instructions(Kernel)) {
+        auto* Call = llvm::dyn_cast<llvm::CallInst>(&I);
+        auto* Callee = Call ? Call->getCalledFunction() : nullptr;
+        if (Callee && Callee->getName() == OpenCLBuiltins::BARRIER) {
+            Info.UsesBarrier = true;
+        }
+    }
+    Kernels[Kernel.getName().str()] = Info;
+    return true;
+}
+
+const CPUExecutor::KernelEntry* CPUExecutor::findKernel(const KernelLaunch& Launch,
+                                                       std::string& Error) const {
+    auto It = Kernels.find(Launch.Kernel);
+    if (!JIT || It == Kernels.end()) {
+        Error = "kernel " + Launch.Kernel + " is not loaded";
+        return nullptr;
+    }
+    if (!Launch.LocalSize || Launch.GlobalSize % Launch.LocalSize != 0) {
+        Error = "global size is not a multiple of the work-group size";
+        return nullptr;
+    }
+    return &It->second;
+}
+
+bool CPUExecutor::launch(const KernelLaunch& Launch, std::vector<int64_t>& Args, std::string& Error) {
+    const auto* Entry = findKernel(Launch, Error);
+    if (!Entry) {
+        return false;
+    }
+    if (Args.size() != Entry->Parameters.size()) {
+        Error = "kernel " + Launch.Kernel + " takes " + std::to_string(Entry->Parameters.size()) +
+                " arguments, not " + std::to_string(Args.size());
+        return false;
+    }
+    double Seconds;
+    return execute(Launch, *Entry, Args.data(), 1, Seconds, Error);
+}
+
+bool CPUExecutor::run(const KernelLaunch& Launch, unsigned Repetitions, double& Seconds,
+                      std::string& Error) {
+    const auto* Found = findKernel(Launch, Error);
+    if (!Found) {
+        return false;
+    }
+    const auto& Entry = *Found;
+
+    // Buffers hold pseudo-random data, the same for every variant, so
+    // data-dependent branches and searches take their real paths. Floats
+    // lie in [1, 2) and integers in [1, BufferElements], so divisions stay
+    // defined and gathers through index buffers stay in the padding;
+    // scalars other than the trip count are 1
+    std::vector<std::unique_ptr<char[]>> Storage;
+    std::vector<int64_t> Args;
+    for (unsigned I = 0; I < Entry.Parameters.size(); ++I) {
+        const auto& P = Entry.Parameters[I];
+        if (!P.IsBuffer) {
+            double One = 1.0;
+            int64_t Value = I == Launch.TripCountArg ? Launch.TripCount : 1;
+            if (P.IsFloat) {
+                std::memcpy(&Value, &One, sizeof(Value));
+            }
+            Args.push_back(Value);
+            continue;
+        }
+
+        uint64_t Elements = Launch.BufferElements + 2 * BufferPadding;
+        Storage.emplace_back(new char[Elements * P.Bytes + 64]);
+        char* Data = Storage.back().get();
+        Data += (64 - reinterpret_cast<uintptr_t>(Data) % 64) % 64;
+        uint64_t IntRange = std::max<uint64_t>(
+            std::min<uint64_t>(Launch.BufferElements, (uint64_t(1) << (8 * P.Bytes - 1)) - 1), 1);
+        std::mt19937_64 Random(I + 1);
+        for (uint64_t E = 0; E < Elements; ++E) {
+            char* Element = Data + E * P.Bytes;
+            uint64_t Bits = Random();
+            if (P.IsFloat && P.Bytes == 8) {
+                double Value = 1.0 + static_cast<double>(Bits % 4096) / 4096.0;
+                std::memcpy(Element, &Value, 8);
+            } else if (P.IsFloat && P.Bytes == 4) {
+                float Value = 1.0f + static_cast<float>(Bits % 4096) / 4096.0f;
+                std::memcpy(Element, &Value, 4);
+            } else if (P.IsFloat && P.Bytes == 2) {
+                uint16_t Value = 0x3c00 | (Bits & 0x3ff);  // IEEE half in [1, 2)
+                std::memcpy(Element, &Value, 2);
+            } else {
+                uint64_t Value = 1 + Bits % IntRange;
+                std::memcpy(Element, &Value, P.Bytes);  // Little-endian host
+            }
+        }
+        Args.push_back(static_cast<int64_t>(reinterpret_cast<uintptr_t>(Data + BufferPadding * P.Bytes)));
+    }
+
+    return execute(Launch, Entry, Args.data(), std::max(Repetitions, 1u) + 1, Seconds, Error);
+}
+
+bool CPUExecutor::execute(const KernelLaunch& Launch, const KernelEntry& Entry, int64_t* Args,
+                          unsigned Runs, double& Seconds, std::string& Error) {
+    auto Symbol = JIT->lookup(Launch.Kernel + ".entry");
+    if (!Symbol) {
+        Error = llvm::toString(Symbol.takeError());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> Lock(LaunchMutex);
+    State.Entry = reinterpret_cast<void (*)(int64_t*)>(Symbol->getAddress());
+    State.Args = Args;
+    State.GlobalSize = static_cast<uint32_t>(Launch.GlobalSize);
+    State.LocalSize = static_cast<uint32_t>(Launch.LocalSize);
+    State.Items.assign(Launch.LocalSize, WorkItem());
+    std::vector<std::unique_ptr<char[]>> Stacks;
+    if (Entry.UsesBarrier) {
+        for (size_t I = 0; I < Launch.LocalSize; ++I) {
+            Stacks.emplace_back(new char[FiberStackBytes]);
+        }
+    }
+
+    auto RunGroup = [&](uint32_t Group) {
+        State.GroupId = Group;
+        if (!Entry.UsesBarrier) {
+            for (State.Current = 0; State.Current < State.LocalSize; ++State.Current) {
+                State.Entry(State.Args);
+            }
+            return;
+        }
+
+        for (uint32_t L = 0; L < State.LocalSize; ++L) {
+            auto& Item = State.Items[L];
+            Item.Done = false;
+            getcontext(&Item.Context);
+            Item.Context.uc_stack.ss_sp = Stacks[L].get();
+            Item.Context.uc_stack.ss_size = FiberStackBytes;
+            Item.Context.uc_link = &State.Scheduler;
+            makecontext(&Item.Context, &runWorkItem, 0);
+        }
+        // Round-robin until every work-item has returned; each round
+        // advances all of them to the next barrier
+        bool Pending = true;
+        while (Pending) {
+            Pending = false;
+            for (State.Current = 0; State.Current < State.LocalSize; ++State.Current) {
+                if (!State.Items[State.Current].Done) {
+                    swapcontext(&State.Scheduler, &State.Items[State.Current].Context);
+                    Pending |= !State.Items[State.Current].Done;
+                }
+            }
+        }
+    };
+
+    uint64_t Groups = Launch.GlobalSize / Launch.LocalSize;
+    Seconds = 0;
+    for (unsigned Run = 0; Run < Runs; ++Run) {
+        auto Start = std::chrono::steady_clock::now();
+        for (uint64_t Group = 0; Group < Groups; ++Group) {
+            RunGroup(static_cast<uint32_t>(Group));
+        }
+        double Elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+        // The first launch only warms caches and the JIT's lazy state
+        if (Run <= 1 || Elapsed < Seconds) {
+            Seconds = Elapsed;
+        }
+    }
+    return true;
+}
+
+} // namespace cspir
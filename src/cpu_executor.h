@@ -0,0 +1,68 @@
+#pragma once
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/Module.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cspir {
+    // One NDRange launch of a kernel in the loaded module
+    struct KernelLaunch {
+        std::string Kernel;
+        uint64_t GlobalSize = 0;      // Must be a multiple of LocalSize
+        size_t LocalSize = 1;
+        uint64_t BufferElements = 0;  // Every buffer argument gets this many elements
+        unsigned TripCountArg = ~0u;  // Parameter receiving TripCount; other scalars get 1
+        int64_t TripCount = 0;
+    };
+
+    // IEEE binary16 conversions the host-side half storage builtins use
+    float convertHalfToFloat(uint16_t Bits);
+    uint16_t convertFloatToHalf(float Value);  // Round to nearest even
+
+    // Runs SPIR kernels on the host CPU through ORC. Work-items of a group
+    // run as fibers that switch at barriers, one group after another on the
+    // calling thread, so timings rank variants against each other rather
+    // than predict device throughput. Sub-groups hold one work-item, and
+    // math, vload_half and vstore_half builtins are defined lane by lane
+    // on top of the host libm.
+    class CPUExecutor {
+    public:
+        // Compiles a copy of M for the host; M itself is left untouched
+        bool load(const llvm::Module& M, std::string& Error);
+        // Best wall time of Repetitions launches after one warm-up
+        bool run(const KernelLaunch& Launch, unsigned Repetitions, double& Seconds,
+                 std::string& Error);
+        // One launch over caller-owned arguments, a 64-bit slot per kernel
+        // parameter: a buffer address, an integer, or a double's bits.
+        // Launch.BufferElements, TripCountArg and TripCount are unused.
+        bool launch(const KernelLaunch& Launch, std::vector<int64_t>& Args, std::string& Error);
+
+    private:
+        // How to materialize one kernel parameter on the host
+        struct Parameter {
+            bool IsBuffer = false;
+            bool IsFloat = false;
+            unsigned Bytes = 0;  // Element size for buffers
+        };
+
+        struct KernelEntry {
+            std::vector<Parameter> Parameters;
+            bool UsesBarrier = false;
+        };
+
+        bool defineBuiltins(llvm::Module& M, std::string& Error);
+        bool createEntry(llvm::Function& Kernel, std::string& Error);
+        const KernelEntry* findKernel(const KernelLaunch& Launch, std::string& Error) const;
+        // Launches Runs times; Seconds is the best run after the first
+        // unless there is only one
+        bool execute(const KernelLaunch& Launch, const KernelEntry& Entry, int64_t* Args,
+                     unsigned Runs, double& Seconds, std::string& Error);
+
+        std::unique_ptr<llvm::orc::LLJIT> JIT;
+        std::map<std::string, KernelEntry> Kernels;
+    };
+} // namespace cspir
@@ -0,0 +1,36 @@
+#include "device_profile.h"
+
+namespace cspir {
+
+static const DeviceProfile KnownProfiles[] = {
+    // Name          VecBits  Regs  MaxWG  LocalMem  ConstMem  SubGroup  WIOverhead  Strided
+    {"generic",      128,     16,   1024,  32768,    65536,    16,       8,          true},
+    {"cpu-sse",      128,     16,   8192,  32768,    131072,   4,        32,         false},
+    {"cpu-avx2",     256,     16,   8192,  32768,    131072,   8,        32,         false},
+    {"cpu-avx512",   512,     32,   8192,  32768,    131072,   16,       32,         false},
+    {"gpu",          128,     64,   1024,  49152,    65536,    32,       4,          true},
+    {"igpu",         128,     32,   256,   65536,    65536,    16,       8,          true},
+};
+
+const DeviceProfile* findDeviceProfile(llvm::StringRef Name) {
+    for (const auto& Profile : KnownProfiles) {
+        if (Name == Profile.Name) {
+            return &Profile;
+        }
+    }
+    return nullptr;
+}
+
+const DeviceProfile& getDefaultDeviceProfile() {
+    return KnownProfiles[0];
+}
+
+std::vector<std::string> getDeviceProfileNames() {
+    std::vector<std::string> Names;
+    for (const auto& Profile : KnownProfiles) {
+        Names.push_back(Profile.Name);
+    }
+    return Names;
+}
+
+} // namespace cspir
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cspir {
+    // Target device characteristics used by the vectorization heuristics
+    struct DeviceProfile {
+        std::string Name;
+        unsigned PreferredVectorBits;   // Width of one native vector register
+        unsigned NumVectorRegisters;    // Vector registers available to a work-item
+        size_t MaxWorkGroupSize;
+        size_t LocalMemBytes;
+        size_t ConstantMemBytes;        // __constant data one kernel may use
+        unsigned SubGroupSize;
+        unsigned WorkItemOverhead;  // Scheduling cost of a work-item, in body operations
+        bool StridedAccess;         // Neighbouring work-items should touch neighbouring vectors
+    };
+
+    // Returns nullptr for unknown profile names
+    const DeviceProfile* findDeviceProfile(llvm::StringRef Name);
+    const DeviceProfile& getDefaultDeviceProfile();
+    std::vector<std::string> getDeviceProfileNames();
+} // namespace cspir
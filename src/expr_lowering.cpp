@@ -0,0 +1,1475 @@
+#include "expr_lowering.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include <algorithm>
+#include <vector>
+
+namespace cspir {
+
+const clang::VarDecl* getInductionVariable(const clang::ForStmt* FS) {
+    // Handles both "i = 0" and "int i = 0" initializers
+    if (auto* Init = FS->getInit()) {
+        if (auto* BO = llvm::dyn_cast<clang::BinaryOperator>(Init)) {
+            if (BO->getOpcode() == clang::BO_Assign) {
+                if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(
+                        BO->getLHS()->IgnoreParenImpCasts())) {
+                    return llvm::dyn_cast<clang::VarDecl>(DRE->getDecl());
+                }
+            }
+        } else if (auto* DS = llvm::dyn_cast<clang::DeclStmt>(Init)) {
+            if (DS->isSingleDecl()) {
+                return llvm::dyn_cast<clang::VarDecl>(DS->getSingleDecl());
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool getLoopBounds(const clang::ForStmt* FS, LoopBounds& Bounds) {
+    Bounds.IV = getInductionVariable(FS);
+    if (!Bounds.IV || !FS->getCond() || !FS->getInc()) {
+        return false;
+    }
+
+    const clang::Expr* Init = nullptr;
+    if (auto* BO = llvm::dyn_cast_or_null<clang::BinaryOperator>(FS->getInit())) {
+        Init = BO->getRHS();
+    } else {
+        Init = Bounds.IV->getInit();
+    }
+    auto* Lit = Init ? llvm::dyn_cast<clang::IntegerLiteral>(Init->IgnoreParenImpCasts()) : nullptr;
+    if (!Lit) {
+        return false;
+    }
+    Bounds.Lower = Lit->getValue().getSExtValue();
+
+    auto IsIV = [&](const clang::Expr* E) {
+        auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(E->IgnoreParenImpCasts());
+        return DRE && DRE->getDecl() == Bounds.IV;
+    };
+
+    auto* Cond = llvm::dyn_cast<clang::BinaryOperator>(FS->getCond()->IgnoreParens());
+    if (!Cond || !IsIV(Cond->getLHS()) ||
+        (Cond->getOpcode() != clang::BO_LT && Cond->getOpcode() != clang::BO_LE &&
+         Cond->getOpcode() != clang::BO_NE)) {
+        return false;
+    }
+    Bounds.Upper = Cond->getRHS();
+    Bounds.Inclusive = Cond->getOpcode() == clang::BO_LE;
+
+    // i++, ++i, i += 1 or i = i + 1
+    auto IsOne = [](const clang::Expr* E) {
+        auto* One = llvm::dyn_cast<clang::IntegerLiteral>(E->IgnoreParenImpCasts());
+        return One && One->getValue() == 1;
+    };
+    auto* Inc = FS->getInc()->IgnoreParens();
+    if (auto* UO = llvm::dyn_cast<clang::UnaryOperator>(Inc)) {
+        return UO->isIncrementOp() && IsIV(UO->getSubExpr());
+    }
+    if (auto* BO = llvm::dyn_cast<clang::BinaryOperator>(Inc)) {
+        if (BO->getOpcode() == clang::BO_AddAssign) {
+            return IsIV(BO->getLHS()) && IsOne(BO->getRHS());
+        }
+        if (BO->getOpcode() == clang::BO_Assign && IsIV(BO->getLHS())) {
+            auto* Add = llvm::dyn_cast<clang::BinaryOperator>(BO->getRHS()->IgnoreParenImpCasts());
+            return Add && Add->getOpcode() == clang::BO_Add &&
+                   ((IsIV(Add->getLHS()) && IsOne(Add->getRHS())) ||
+                    (IsOne(Add->getLHS()) && IsIV(Add->getRHS())));
+        }
+    }
+    return false;
+}
+
+bool getIndexOffset(const clang::Expr* Idx, const clang::VarDecl* IV, int64_t& Offset) {
+    Idx = Idx->IgnoreParenImpCasts();
+    if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(Idx)) {
+        Offset = 0;
+        return DRE->getDecl() == IV;
+    }
+
+    auto* BO = llvm::dyn_cast<clang::BinaryOperator>(Idx);
+    if (!BO || !BO->isAdditiveOp()) {
+        return false;
+    }
+    auto* LHS = BO->getLHS()->IgnoreParenImpCasts();
+    auto* RHS = BO->getRHS()->IgnoreParenImpCasts();
+    if (BO->getOpcode() == clang::BO_Add && llvm::isa<clang::IntegerLiteral>(LHS)) {
+        std::swap(LHS, RHS);
+    }
+
+    auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(LHS);
+    auto* Lit = llvm::dyn_cast<clang::IntegerLiteral>(RHS);
+    if (!DRE || !Lit || DRE->getDecl() != IV) {
+        return false;
+    }
+    Offset = Lit->getValue().getSExtValue();
+    if (BO->getOpcode() == clang::BO_Sub) {
+        Offset = -Offset;
+    }
+    return true;
+}
+
+// Adds Sign times the terms of E; false on any term that is not iv, a
+// literal, p or k*p
+static bool addStencilTerms(const clang::Expr* E, int64_t Sign, const clang::VarDecl* IV,
+                            const clang::ValueDecl*& Pitch, int64_t& IVCount,
+                            int64_t& Row, int64_t& Col) {
+    E = E->IgnoreParenImpCasts();
+    auto IsPitch = [&](const clang::Expr* P) {
+        auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(P->IgnoreParenImpCasts());
+        auto* VD = DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+        if (!VD || VD == IV || !VD->getType()->isIntegerType() || (Pitch && Pitch != VD)) {
+            return false;
+        }
+        Pitch = VD;
+        return true;
+    };
+
+    if (auto* Lit = llvm::dyn_cast<clang::IntegerLiteral>(E)) {
+        Col += Sign * Lit->getValue().getSExtValue();
+        return true;
+    }
+    if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(E)) {
+        if (DRE->getDecl() == IV) {
+            IVCount += Sign;
+            return true;
+        }
+        if (!IsPitch(E)) {
+            return false;
+        }
+        Row += Sign;
+        return true;
+    }
+    if (auto* UO = llvm::dyn_cast<clang::UnaryOperator>(E)) {
+        return UO->getOpcode() == clang::UO_Minus &&
+               addStencilTerms(UO->getSubExpr(), -Sign, IV, Pitch, IVCount, Row, Col);
+    }
+    auto* BO = llvm::dyn_cast<clang::BinaryOperator>(E);
+    if (!BO) {
+        return false;
+    }
+    if (BO->isAdditiveOp()) {
+        int64_t RHSSign = BO->getOpcode() == clang::BO_Sub ? -Sign : Sign;
+        return addStencilTerms(BO->getLHS(), Sign, IV, Pitch, IVCount, Row, Col) &&
+               addStencilTerms(BO->getRHS(), RHSSign, IV, Pitch, IVCount, Row, Col);
+    }
+    if (BO->getOpcode() == clang::BO_Mul) {
+        auto* LHS = BO->getLHS()->IgnoreParenImpCasts();
+        auto* RHS = BO->getRHS()->IgnoreParenImpCasts();
+        if (llvm::isa<clang::IntegerLiteral>(RHS)) {
+            std::swap(LHS, RHS);
+        }
+        auto* Lit = llvm::dyn_cast<clang::IntegerLiteral>(LHS);
+        if (!Lit || !IsPitch(RHS)) {
+            return false;
+        }
+        Row += Sign * Lit->getValue().getSExtValue();
+        return true;
+    }
+    return false;
+}
+
+bool getStencilOffset(const clang::Expr* Idx, const clang::VarDecl* IV,
+                      const clang::ValueDecl*& Pitch, int64_t& Row, int64_t& Col) {
+    Pitch = nullptr;
+    Row = 0;
+    Col = 0;
+    int64_t IVCount = 0;
+    if (!addStencilTerms(Idx, 1, IV, Pitch, IVCount, Row, Col) || IVCount != 1) {
+        return false;
+    }
+    if (Row == 0) {
+        Pitch = nullptr;
+    }
+    return true;
+}
+
+// C math functions and their OpenCL builtins. Those LLVM models exactly
+// stay intrinsics, which the kernel pipeline can fold; native_ variants
+// are implementation-defined, half_ ones good to at least 11 bits.
+static const MathBuiltin MathBuiltins[] = {
+    {"sqrt", "sqrt", "native_sqrt", "half_sqrt", 1, llvm::Intrinsic::sqrt},
+    {"fabs", "fabs", nullptr, nullptr, 1, llvm::Intrinsic::fabs},
+    {"sin", "sin", "native_sin", "half_sin", 1, llvm::Intrinsic::sin},
+    {"cos", "cos", "native_cos", "half_cos", 1, llvm::Intrinsic::cos},
+    {"tan", "tan", "native_tan", "half_tan", 1, llvm::Intrinsic::not_intrinsic},
+    {"asin", "asin", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"acos", "acos", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"atan", "atan", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"atan2", "atan2", nullptr, nullptr, 2, llvm::Intrinsic::not_intrinsic},
+    {"sinh", "sinh", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"cosh", "cosh", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"tanh", "tanh", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"exp", "exp", "native_exp", "half_exp", 1, llvm::Intrinsic::exp},
+    {"exp2", "exp2", "native_exp2", "half_exp2", 1, llvm::Intrinsic::exp2},
+    {"expm1", "expm1", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"log", "log", "native_log", "half_log", 1, llvm::Intrinsic::log},
+    {"log2", "log2", "native_log2", "half_log2", 1, llvm::Intrinsic::log2},
+    {"log10", "log10", "native_log10", "half_log10", 1, llvm::Intrinsic::log10},
+    {"log1p", "log1p", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"cbrt", "cbrt", nullptr, nullptr, 1, llvm::Intrinsic::not_intrinsic},
+    {"hypot", "hypot", nullptr, nullptr, 2, llvm::Intrinsic::not_intrinsic},
+    {"fmod", "fmod", nullptr, nullptr, 2, llvm::Intrinsic::not_intrinsic},
+    {"floor", "floor", nullptr, nullptr, 1, llvm::Intrinsic::floor},
+    {"ceil", "ceil", nullptr, nullptr, 1, llvm::Intrinsic::ceil},
+    {"trunc", "trunc", nullptr, nullptr, 1, llvm::Intrinsic::trunc},
+    {"round", "round", nullptr, nullptr, 1, llvm::Intrinsic::round},
+    // native_powr and half_powr need x >= 0, which pow does not promise
+    {"pow", "pow", nullptr, nullptr, 2, llvm::Intrinsic::pow},
+    {"fmin", "fmin", nullptr, nullptr, 2, llvm::Intrinsic::minnum},
+    {"fmax", "fmax", nullptr, nullptr, 2, llvm::Intrinsic::maxnum},
+    {"copysign", "copysign", nullptr, nullptr, 2, llvm::Intrinsic::copysign},
+    {"fma", "fma", nullptr, nullptr, 3, llvm::Intrinsic::fma},
+};
+
+const MathBuiltin* getMathBuiltin(const clang::FunctionDecl* FD) {
+    // Only the C library's functions as Clang recognizes them; a static
+    // or defined sqrt of the program's own means something else, and
+    // -fno-builtin clears the ID too
+    unsigned ID = FD && FD->getIdentifier() ? FD->getBuiltinID() : 0;
+    if (!ID || FD->isDefined() || !FD->getASTContext().BuiltinInfo.isPredefinedLibFunction(ID)) {
+        return nullptr;
+    }
+
+    auto Lookup = [](llvm::StringRef N) -> const MathBuiltin* {
+        for (const auto& Builtin : MathBuiltins) {
+            if (N == Builtin.Name) {
+                return &Builtin;
+            }
+        }
+        return nullptr;
+    };
+    // "sqrtf" shares the entry of "sqrt"; long double "sqrtl" has no
+    // OpenCL type and is rejected
+    llvm::StringRef Name = FD->getName();
+    const MathBuiltin* Builtin = Lookup(Name);
+    if (!Builtin && Name.endswith("f")) {
+        Builtin = Lookup(Name.drop_back());
+    }
+    return Builtin;
+}
+
+// Itanium mangling of an OpenCL builtin taking NumArgs arguments of Ty:
+// _Z3powff, and _Z3powDv4_fS_ once the vector type is substituted
+static std::string getMangledMathName(llvm::StringRef Name, llvm::Type* Ty, unsigned NumArgs) {
+    auto* VecTy = llvm::dyn_cast<llvm::FixedVectorType>(Ty);
+    auto* ScalarTy = Ty->getScalarType();
+    std::string Code = ScalarTy->isHalfTy() ? "Dh" : ScalarTy->isDoubleTy() ? "d" : "f";
+    if (VecTy) {
+        Code = "Dv" + std::to_string(VecTy->getNumElements()) + "_" + Code;
+    }
+    std::string Mangled = "_Z" + std::to_string(Name.size()) + Name.str() + Code;
+    for (unsigned I = 1; I < NumArgs; ++I) {
+        Mangled += VecTy ? "S_" : Code;
+    }
+    return Mangled;
+}
+
+static bool isSupportedCast(clang::CastKind Kind) {
+    switch (Kind) {
+        case clang::CK_LValueToRValue:
+        case clang::CK_NoOp:
+        case clang::CK_IntegralCast:
+        case clang::CK_IntegralToFloating:
+        case clang::CK_FloatingToIntegral:
+        case clang::CK_FloatingCast:
+        case clang::CK_IntegralToBoolean:
+        case clang::CK_FloatingToBoolean:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static const clang::VarDecl* getArrayBase(const clang::ArraySubscriptExpr* ASE) {
+    auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts());
+    return DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+}
+
+namespace {
+    // Mirrors what ExprLowering accepts and checks that no iteration reads
+    // or writes another iteration's elements
+    class BodyChecker {
+    public:
+        BodyChecker(const clang::VarDecl* IV, std::string& Reason) : IV(IV), Reason(Reason) {}
+
+        bool check(const clang::Stmt* Body) {
+            if (!checkStmt(Body)) {
+                return false;
+            }
+            for (const auto* ASE : Reads) {
+                const auto* Base = getArrayBase(ASE);
+                int64_t Offset;
+                if (Written.count(Base) &&
+                    (!getIndexOffset(ASE->getIdx(), IV, Offset) || Offset != 0)) {
+                    return reject("array '" + Base->getNameAsString() +
+                                  "' is read at another iteration's element");
+                }
+            }
+            return true;
+        }
+
+        // Expressions never write, so any element they read is fine. Every
+        // iteration evaluates E, including those past the one where C
+        // stops, so nothing in it may trap or read out of range there.
+        bool checkSpeculative(const clang::Expr* E) {
+            Speculative = true;
+            return checkExpr(E);
+        }
+
+    private:
+        bool reject(const std::string& Message) {
+            Reason = Message;
+            return false;
+        }
+
+        bool checkStmt(const clang::Stmt* S) {
+            if (auto* CS = llvm::dyn_cast<clang::CompoundStmt>(S)) {
+                for (const auto* Child : CS->body()) {
+                    if (!checkStmt(Child)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            if (llvm::isa<clang::NullStmt>(S)) {
+                return true;
+            }
+            if (auto* DS = llvm::dyn_cast<clang::DeclStmt>(S)) {
+                for (const auto* D : DS->decls()) {
+                    auto* VD = llvm::dyn_cast<clang::VarDecl>(D);
+                    if (!VD || !VD->getType()->isArithmeticType()) {
+                        return reject("local declaration '" + D->getDeclKindName() +
+                                      std::string("' is not an arithmetic variable"));
+                    }
+                    if (VD->hasInit() && !checkExpr(VD->getInit())) {
+                        return false;
+                    }
+                    Locals.insert(VD);
+                }
+                return true;
+            }
+            auto* BO = llvm::dyn_cast<clang::BinaryOperator>(S);
+            if (!BO || !BO->isAssignmentOp()) {
+                return reject(std::string("statement '") + S->getStmtClassName() +
+                              "' has no kernel equivalent");
+            }
+
+            auto* LHS = BO->getLHS()->IgnoreParens();
+            if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(LHS)) {
+                const auto* Base = getArrayBase(ASE);
+                int64_t Offset;
+                if (!Base || !getIndexOffset(ASE->getIdx(), IV, Offset) || Offset != 0) {
+                    return reject("store is not indexed by the induction variable");
+                }
+                Written.insert(Base);
+                if (BO->isCompoundAssignmentOp()) {
+                    Reads.push_back(ASE);
+                }
+            } else if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(LHS)) {
+                if (DRE->getDecl() == IV) {
+                    return reject("body modifies the induction variable");
+                }
+                if (!Locals.count(DRE->getDecl())) {
+                    return reject("body writes '" + DRE->getDecl()->getNameAsString() +
+                                  "' declared outside the loop");
+                }
+            } else {
+                return reject("unsupported assignment target");
+            }
+            return checkExpr(BO->getRHS());
+        }
+
+        bool checkExpr(const clang::Expr* E) {
+            E = E->IgnoreParens();
+            if (llvm::isa<clang::IntegerLiteral>(E) || llvm::isa<clang::FloatingLiteral>(E) ||
+                llvm::isa<clang::CharacterLiteral>(E)) {
+                return true;
+            }
+            if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(E)) {
+                auto* VD = llvm::dyn_cast<clang::VarDecl>(DRE->getDecl());
+                if (!VD || !VD->getType()->isArithmeticType()) {
+                    return reject("'" + DRE->getDecl()->getNameAsString() +
+                                  "' is not an arithmetic variable");
+                }
+                return true;
+            }
+            if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(E)) {
+                const auto* Base = getArrayBase(ASE);
+                if (!Base || !ASE->getType()->isArithmeticType()) {
+                    return reject("array base is not a variable of arithmetic elements");
+                }
+                // Every lane loads, the scalar tail included, so a read C
+                // would skip must be one the iteration may make anyway:
+                // a[i] itself. A gather or a[i + 1] can run off the end.
+                int64_t Offset;
+                bool Indexed = getIndexOffset(ASE->getIdx(), IV, Offset);
+                if (Conditional && !Indexed) {
+                    return reject("array '" + Base->getNameAsString() +
+                                  "' is gathered under a condition");
+                }
+                if (Speculative && !Indexed) {
+                    return reject("array '" + Base->getNameAsString() +
+                                  "' is gathered at iterations C may never reach");
+                }
+                if (Conditional && Offset != 0) {
+                    return reject("array '" + Base->getNameAsString() + "' is read at offset " +
+                                  std::to_string(Offset) + " under a condition");
+                }
+                Reads.push_back(ASE);
+                return checkExpr(ASE->getIdx());
+            }
+            if (auto* CE = llvm::dyn_cast<clang::CastExpr>(E)) {
+                if (!isSupportedCast(CE->getCastKind())) {
+                    return reject(std::string("unsupported cast '") + CE->getCastKindName() + "'");
+                }
+                return checkExpr(CE->getSubExpr());
+            }
+            if (auto* UO = llvm::dyn_cast<clang::UnaryOperator>(E)) {
+                switch (UO->getOpcode()) {
+                    case clang::UO_Plus:
+                    case clang::UO_Minus:
+                    case clang::UO_Not:
+                    case clang::UO_LNot:
+                        return checkExpr(UO->getSubExpr());
+                    default:
+                        return reject("unsupported unary operator '" +
+                                      clang::UnaryOperator::getOpcodeStr(UO->getOpcode()).str() + "'");
+                }
+            }
+            if (auto* BO = llvm::dyn_cast<clang::BinaryOperator>(E)) {
+                if (BO->isAssignmentOp() || BO->getOpcode() == clang::BO_Comma ||
+                    !BO->getLHS()->getType()->isArithmeticType() ||
+                    !BO->getRHS()->getType()->isArithmeticType()) {
+                    return reject("unsupported binary operator '" + BO->getOpcodeStr().str() + "'");
+                }
+                // Guards only hold back lanes C skips within an iteration
+                if (Speculative && (BO->getOpcode() == clang::BO_Div || BO->getOpcode() == clang::BO_Rem) &&
+                    BO->getType()->isIntegerType()) {
+                    return reject("integer division at iterations C may never reach");
+                }
+                if (BO->isLogicalOp()) {
+                    return checkExpr(BO->getLHS()) && checkConditional(BO->getRHS());
+                }
+                return checkExpr(BO->getLHS()) && checkExpr(BO->getRHS());
+            }
+            if (auto* CO = llvm::dyn_cast<clang::ConditionalOperator>(E)) {
+                return checkExpr(CO->getCond()) && checkConditional(CO->getTrueExpr()) &&
+                       checkConditional(CO->getFalseExpr());
+            }
+            if (auto* Call = llvm::dyn_cast<clang::CallExpr>(E)) {
+                auto* FD = Call->getDirectCallee();
+                const MathBuiltin* Builtin = getMathBuiltin(FD);
+                if (!Builtin || !Call->getType()->isRealFloatingType() ||
+                    Call->getNumArgs() != Builtin->NumArgs) {
+                    return reject("call to '" + (FD ? FD->getNameAsString() : std::string("?")) +
+                                  "' has no kernel equivalent");
+                }
+                for (const auto* Arg : Call->arguments()) {
+                    if (!checkExpr(Arg)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            return reject(std::string("unsupported expression '") + E->getStmtClassName() + "'");
+        }
+
+        // An operand C evaluates only for some lanes
+        bool checkConditional(const clang::Expr* E) {
+            ++Conditional;
+            bool Result = checkExpr(E);
+            --Conditional;
+            return Result;
+        }
+
+        const clang::VarDecl* IV;
+        std::string& Reason;
+        unsigned Conditional = 0;
+        bool Speculative = false;  // Evaluated past the iteration where C stops
+        llvm::SmallPtrSet<const clang::ValueDecl*, 8> Locals;
+        llvm::SmallPtrSet<const clang::ValueDecl*, 8> Written;
+        std::vector<const clang::ArraySubscriptExpr*> Reads;
+    };
+} // namespace
+
+bool ExprLowering::canLower(const clang::Stmt* Body, const clang::VarDecl* IV,
+                            std::string& Reason) {
+    if (!IV) {
+        Reason = "no induction variable";
+        return false;
+    }
+    BodyChecker Checker(IV, Reason);
+    return Checker.check(Body);
+}
+
+bool ExprLowering::canLowerExpr(const clang::Expr* E, const clang::VarDecl* IV,
+                                std::string& Reason) {
+    if (!IV) {
+        Reason = "no induction variable";
+        return false;
+    }
+    BodyChecker Checker(IV, Reason);
+    return Checker.checkSpeculative(E);
+}
+
+llvm::Type* ExprLowering::convertType(clang::ASTContext& Context, llvm::LLVMContext& Ctx,
+                                      clang::QualType QT) {
+    if (QT.isNull()) {
+        return nullptr;
+    }
+    QT = QT.getCanonicalType();
+    if (QT->isHalfType() || QT->isFloat16Type()) {
+        return llvm::Type::getHalfTy(Ctx);
+    }
+    if (QT->isSpecificBuiltinType(clang::BuiltinType::Float)) {
+        return llvm::Type::getFloatTy(Ctx);
+    }
+    if (QT->isSpecificBuiltinType(clang::BuiltinType::Double)) {
+        return llvm::Type::getDoubleTy(Ctx);
+    }
+    if (QT->isIntegerType()) {
+        return llvm::Type::getIntNTy(Ctx, Context.getTypeSize(QT));
+    }
+    // long double, complex and aggregate elements have no OpenCL equivalent
+    return nullptr;
+}
+
+void ExprLowering::setIteration(llvm::Value* NewIndex, unsigned NewWidth, bool NewAligned) {
+    Index = NewIndex;
+    Width = NewWidth;
+    Aligned = NewAligned;
+    Locals.clear();
+    Elements.clear();
+    Guard = nullptr;
+    Error.clear();
+}
+
+void ExprLowering::continueIteration(llvm::Value* NewIndex, int64_t Shift) {
+    // Element Col of the old iterations is element Col - Shift of the new
+    std::map<ElementKey, llvm::Value*> Shifted;
+    for (const auto& Element : Elements) {
+        ElementKey Key = Element.first;
+        std::get<3>(Key) -= Shift;
+        Shifted[Key] = Element.second;
+    }
+    Elements = std::move(Shifted);
+    Index = NewIndex;
+    Aligned = Aligned && Shift % Width == 0;
+    Locals.clear();
+    Error.clear();
+}
+
+llvm::Type* ExprLowering::getType(clang::QualType QT) {
+    if (NarrowToFloat && QT->isSpecificBuiltinType(clang::BuiltinType::Double)) {
+        return Builder.getFloatTy();
+    }
+    auto* Ty = convertType(Context, Builder.getContext(), QT);
+    if (!Ty) {
+        fail("type '" + QT.getAsString() + "' has no kernel equivalent");
+    }
+    return Ty;
+}
+
+llvm::Type* ExprLowering::widen(llvm::Type* Ty) const {
+    return Width == 1 ? Ty : llvm::FixedVectorType::get(Ty, Width);
+}
+
+llvm::Value* ExprLowering::splat(llvm::Value* Scalar) {
+    return Width == 1 ? Scalar : Builder.CreateVectorSplat(Width, Scalar);
+}
+
+llvm::Value* ExprLowering::fail(const std::string& Message) {
+    if (Error.empty()) {
+        Error = Message;
+    }
+    return nullptr;
+}
+
+llvm::Value* ExprLowering::getInductionValue(clang::QualType QT) {
+    auto* Ty = getType(QT);
+    if (!Ty) {
+        return nullptr;
+    }
+    auto* Base = splat(Builder.CreateIntCast(Index, Ty, true));
+    if (Width == 1) {
+        return Base;
+    }
+    // Lane l sees IV = Index + l
+    std::vector<llvm::Constant*> Steps;
+    for (unsigned Lane = 0; Lane < Width; ++Lane) {
+        Steps.push_back(llvm::ConstantInt::get(Ty, Lane));
+    }
+    return Builder.CreateAdd(Base, llvm::ConstantVector::get(Steps), "iv");
+}
+
+llvm::Value* ExprLowering::toBool(llvm::Value* V) {
+    auto* Zero = llvm::Constant::getNullValue(V->getType());
+    if (V->getType()->isFPOrFPVectorTy()) {
+        return Builder.CreateFCmpUNE(V, Zero);
+    }
+    return Builder.CreateICmpNE(V, Zero);
+}
+
+llvm::Value* ExprLowering::convert(llvm::Value* V, clang::QualType From, clang::QualType To) {
+    From = From.getCanonicalType().getUnqualifiedType();
+    To = To.getCanonicalType().getUnqualifiedType();
+    if (!V || From == To) {
+        return V;
+    }
+    auto* ScalarTy = getType(To);
+    if (!ScalarTy) {
+        return nullptr;
+    }
+    auto* Ty = widen(ScalarTy);
+
+    if (To->isBooleanType()) {
+        return Builder.CreateZExt(toBool(V), Ty);
+    }
+    bool FromFloat = From->isRealFloatingType();
+    bool ToFloat = To->isRealFloatingType();
+    if (FromFloat && ToFloat) {
+        return Builder.CreateFPCast(V, Ty);
+    }
+    if (FromFloat) {
+        return To->isSignedIntegerType() ? Builder.CreateFPToSI(V, Ty) : Builder.CreateFPToUI(V, Ty);
+    }
+    if (ToFloat) {
+        return From->isSignedIntegerType() ? Builder.CreateSIToFP(V, Ty) : Builder.CreateUIToFP(V, Ty);
+    }
+    return Builder.CreateIntCast(V, Ty, From->isSignedIntegerType());
+}
+
+llvm::Value* ExprLowering::createBinOp(clang::BinaryOperatorKind Op, llvm::Value* L,
+                                       llvm::Value* R, clang::QualType OperandType) {
+    bool IsFloat = OperandType->isRealFloatingType();
+    bool IsSigned = OperandType->isSignedIntegerType();
+    // Lanes C would not evaluate divide by 1 instead of trapping on 0 or
+    // INT_MIN / -1
+    if (!IsFloat && Guard && (Op == clang::BO_Div || Op == clang::BO_Rem)) {
+        R = Builder.CreateSelect(Guard, R, llvm::ConstantInt::get(R->getType(), 1));
+    }
+    switch (Op) {
+        case clang::BO_Add:
+            return IsFloat ? Builder.CreateFAdd(L, R) : Builder.CreateAdd(L, R);
+        case clang::BO_Sub:
+            return IsFloat ? Builder.CreateFSub(L, R) : Builder.CreateSub(L, R);
+        case clang::BO_Mul:
+            return IsFloat ? Builder.CreateFMul(L, R) : Builder.CreateMul(L, R);
+        case clang::BO_Div:
+            if (IsFloat) return Builder.CreateFDiv(L, R);
+            return IsSigned ? Builder.CreateSDiv(L, R) : Builder.CreateUDiv(L, R);
+        case clang::BO_Rem:
+            if (IsFloat) return Builder.CreateFRem(L, R);
+            return IsSigned ? Builder.CreateSRem(L, R) : Builder.CreateURem(L, R);
+        case clang::BO_Shl:
+            return Builder.CreateShl(L, Builder.CreateIntCast(R, L->getType(), false));
+        case clang::BO_Shr:
+            R = Builder.CreateIntCast(R, L->getType(), false);
+            return IsSigned ? Builder.CreateAShr(L, R) : Builder.CreateLShr(L, R);
+        case clang::BO_And:
+            return Builder.CreateAnd(L, R);
+        case clang::BO_Or:
+            return Builder.CreateOr(L, R);
+        case clang::BO_Xor:
+            return Builder.CreateXor(L, R);
+        default:
+            return fail("unsupported binary operator '" +
+                        clang::BinaryOperator::getOpcodeStr(Op).str() + "'");
+    }
+}
+
+const clang::BinaryOperator* ExprLowering::getContractibleMul(const clang::Expr* E,
+                                                              clang::QualType Ty) const {
+    if (!Builder.getFastMathFlags().allowContract() || !Ty->isRealFloatingType()) {
+        return nullptr;
+    }
+    auto* Mul = llvm::dyn_cast<clang::BinaryOperator>(E->IgnoreParens());
+    if (!Mul || Mul->getOpcode() != clang::BO_Mul ||
+        !Context.hasSameUnqualifiedType(Mul->getType(), Ty)) {
+        return nullptr;
+    }
+    return Mul;
+}
+
+llvm::Value* ExprLowering::createMulAdd(const clang::BinaryOperator* Mul, llvm::Value* Addend,
+                                        bool NegateProduct) {
+    auto* A = Addend ? lowerExpr(Mul->getLHS()) : nullptr;
+    auto* B = A ? lowerExpr(Mul->getRHS()) : nullptr;
+    if (!B) {
+        return nullptr;
+    }
+    if (NegateProduct) {
+        A = Builder.CreateFNeg(A);
+    }
+    // fmuladd leaves the choice between a fused and a separate multiply-add
+    // to the device, exactly what FP_CONTRACT permits
+    auto* Decl = llvm::Intrinsic::getDeclaration(Builder.GetInsertBlock()->getModule(),
+                                                 llvm::Intrinsic::fmuladd, {A->getType()});
+    return Builder.CreateCall(Decl, {A, B, Addend});
+}
+
+llvm::Value* ExprLowering::lowerExpr(const clang::Expr* E) {
+    E = E->IgnoreParens();
+
+    if (auto* IL = llvm::dyn_cast<clang::IntegerLiteral>(E)) {
+        return splat(llvm::ConstantInt::get(Builder.getContext(), IL->getValue()));
+    }
+    if (auto* FL = llvm::dyn_cast<clang::FloatingLiteral>(E)) {
+        if (NarrowToFloat) {
+            return splat(llvm::ConstantFP::get(Builder.getFloatTy(), FL->getValueAsApproximateDouble()));
+        }
+        return splat(llvm::ConstantFP::get(Builder.getContext(), FL->getValue()));
+    }
+    if (auto* CL = llvm::dyn_cast<clang::CharacterLiteral>(E)) {
+        auto* Ty = getType(E->getType());
+        return Ty ? splat(llvm::ConstantInt::get(Ty, CL->getValue())) : nullptr;
+    }
+
+    if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(E)) {
+        const auto* D = DRE->getDecl();
+        if (D == IV) {
+            return getInductionValue(E->getType());
+        }
+        auto Local = Locals.find(D);
+        if (Local != Locals.end()) {
+            return Local->second;
+        }
+        auto Scalar = Scalars.find(D);
+        if (Scalar != Scalars.end()) {
+            return splat(Scalar->second);
+        }
+        return fail("'" + D->getNameAsString() + "' is not available in the kernel");
+    }
+
+    if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(E)) {
+        return lowerLoad(ASE);
+    }
+    if (auto* CE = llvm::dyn_cast<clang::CastExpr>(E)) {
+        return lowerCast(CE);
+    }
+    if (auto* Call = llvm::dyn_cast<clang::CallExpr>(E)) {
+        return lowerCall(Call);
+    }
+
+    if (auto* UO = llvm::dyn_cast<clang::UnaryOperator>(E)) {
+        auto* V = lowerExpr(UO->getSubExpr());
+        if (!V) {
+            return nullptr;
+        }
+        switch (UO->getOpcode()) {
+            case clang::UO_Plus:
+                return V;
+            case clang::UO_Minus:
+                return V->getType()->isFPOrFPVectorTy() ? Builder.CreateFNeg(V) : Builder.CreateNeg(V);
+            case clang::UO_Not:
+                return Builder.CreateNot(V);
+            case clang::UO_LNot: {
+                auto* Ty = getType(E->getType());
+                return Ty ? Builder.CreateZExt(Builder.CreateNot(toBool(V)), widen(Ty)) : nullptr;
+            }
+            default:
+                return fail("unsupported unary operator '" +
+                            clang::UnaryOperator::getOpcodeStr(UO->getOpcode()).str() + "'");
+        }
+    }
+
+    if (auto* BO = llvm::dyn_cast<clang::BinaryOperator>(E)) {
+        if (BO->isAssignmentOp()) {
+            return fail("assignment inside an expression");
+        }
+
+        // c + a*b, c - a*b, a*b + c and a*b - c
+        bool IsAdd = BO->getOpcode() == clang::BO_Add;
+        if (IsAdd || BO->getOpcode() == clang::BO_Sub) {
+            if (auto* Mul = getContractibleMul(BO->getRHS(), E->getType())) {
+                return createMulAdd(Mul, lowerExpr(BO->getLHS()), !IsAdd);
+            }
+            if (auto* Mul = getContractibleMul(BO->getLHS(), E->getType())) {
+                auto* C = lowerExpr(BO->getRHS());
+                return createMulAdd(Mul, C && !IsAdd ? Builder.CreateFNeg(C) : C, false);
+            }
+        }
+
+        auto* L = lowerExpr(BO->getLHS());
+        llvm::Value* R = nullptr;
+        if (L && BO->isLogicalOp()) {
+            // C evaluates the right side only where the left one does not
+            // decide; the other lanes compute it and discard it
+            R = lowerGuarded(BO->getRHS(), BO->getOpcode() == clang::BO_LAnd
+                ? toBool(L) : Builder.CreateNot(toBool(L)));
+        } else if (L) {
+            R = lowerExpr(BO->getRHS());
+        }
+        if (!R) {
+            return nullptr;
+        }
+
+        if (BO->isComparisonOp() || BO->isLogicalOp()) {
+            auto* Ty = getType(E->getType());
+            if (!Ty) {
+                return nullptr;
+            }
+            llvm::Value* Cond;
+            if (BO->isLogicalOp()) {
+                Cond = BO->getOpcode() == clang::BO_LAnd
+                    ? Builder.CreateAnd(toBool(L), toBool(R))
+                    : Builder.CreateOr(toBool(L), toBool(R));
+            } else if (L->getType()->isFPOrFPVectorTy()) {
+                auto Pred = llvm::StringSwitch<llvm::CmpInst::Predicate>(BO->getOpcodeStr())
+                    .Case("<", llvm::CmpInst::FCMP_OLT)
+                    .Case(">", llvm::CmpInst::FCMP_OGT)
+                    .Case("<=", llvm::CmpInst::FCMP_OLE)
+                    .Case(">=", llvm::CmpInst::FCMP_OGE)
+                    .Case("==", llvm::CmpInst::FCMP_OEQ)
+                    .Default(llvm::CmpInst::FCMP_UNE);
+                Cond = Builder.CreateFCmp(Pred, L, R);
+            } else {
+                bool IsSigned = BO->getLHS()->getType()->isSignedIntegerType();
+                auto Pred = llvm::StringSwitch<llvm::CmpInst::Predicate>(BO->getOpcodeStr())
+                    .Case("<", IsSigned ? llvm::CmpInst::ICMP_SLT : llvm::CmpInst::ICMP_ULT)
+                    .Case(">", IsSigned ? llvm::CmpInst::ICMP_SGT : llvm::CmpInst::ICMP_UGT)
+                    .Case("<=", IsSigned ? llvm::CmpInst::ICMP_SLE : llvm::CmpInst::ICMP_ULE)
+                    .Case(">=", IsSigned ? llvm::CmpInst::ICMP_SGE : llvm::CmpInst::ICMP_UGE)
+                    .Case("==", llvm::CmpInst::ICMP_EQ)
+                    .Default(llvm::CmpInst::ICMP_NE);
+                Cond = Builder.CreateICmp(Pred, L, R);
+            }
+            return Builder.CreateZExt(Cond, widen(Ty));
+        }
+        return createBinOp(BO->getOpcode(), L, R, E->getType());
+    }
+
+    if (auto* CO = llvm::dyn_cast<clang::ConditionalOperator>(E)) {
+        // Both arms are computed for every lane, each guarded by the
+        // lanes that select it; the checker only lets them load a[i]
+        auto* Cond = lowerExpr(CO->getCond());
+        auto* Taken = Cond ? toBool(Cond) : nullptr;
+        auto* T = Taken ? lowerGuarded(CO->getTrueExpr(), Taken) : nullptr;
+        auto* F = T ? lowerGuarded(CO->getFalseExpr(), Builder.CreateNot(Taken)) : nullptr;
+        return F ? Builder.CreateSelect(Taken, T, F) : nullptr;
+    }
+
+    return fail(std::string("unsupported expression '") + E->getStmtClassName() + "'");
+}
+
+llvm::Value* ExprLowering::lowerGuarded(const clang::Expr* E, llvm::Value* Lanes) {
+    llvm::Value* Outer = Guard;
+    Guard = Outer ? Builder.CreateAnd(Outer, Lanes) : Lanes;
+    auto* V = lowerExpr(E);
+    Guard = Outer;
+    return V;
+}
+
+bool ExprLowering::isFloatOperand(const clang::Expr* E) const {
+    E = E->IgnoreParens();
+    if (auto* ICE = llvm::dyn_cast<clang::ImplicitCastExpr>(E)) {
+        auto From = ICE->getSubExpr()->getType();
+        return ICE->getCastKind() == clang::CK_FloatingCast && From->isRealFloatingType() &&
+               Context.getTypeSize(From) <= 32;
+    }
+    // Literals float holds exactly, unless fast allows rounding them
+    if (auto* FL = llvm::dyn_cast<clang::FloatingLiteral>(E)) {
+        llvm::APFloat Value = FL->getValue();
+        bool LosesInfo;
+        Value.convert(llvm::APFloat::IEEEsingle(), llvm::APFloat::rmNearestTiesToEven, &LosesInfo);
+        return !LosesInfo || Builder.getFastMathFlags().approxFunc();
+    }
+    if (auto* UO = llvm::dyn_cast<clang::UnaryOperator>(E)) {
+        return (UO->getOpcode() == clang::UO_Minus || UO->getOpcode() == clang::UO_Plus) &&
+               isFloatOperand(UO->getSubExpr());
+    }
+    return false;
+}
+
+bool ExprLowering::isFloatOnly(const clang::Expr* E) const {
+    E = E->IgnoreParens();
+    if (isFloatOperand(E)) {
+        return true;
+    }
+    if (!E->getType()->isSpecificBuiltinType(clang::BuiltinType::Double)) {
+        return false;
+    }
+    // Double carries more than twice float's precision, so one correctly
+    // rounded + - * / or sqrt of float operands rounds to the float result.
+    // A chain rounds more than once and other calls are not correctly
+    // rounded, so only fast may narrow them
+    bool Fast = Builder.getFastMathFlags().approxFunc();
+    auto IsOperand = [this, Fast](const clang::Expr* Op) {
+        return Fast ? isFloatOnly(Op) : isFloatOperand(Op);
+    };
+    if (auto* BO = llvm::dyn_cast<clang::BinaryOperator>(E)) {
+        switch (BO->getOpcode()) {
+            case clang::BO_Add:
+            case clang::BO_Sub:
+            case clang::BO_Mul:
+            case clang::BO_Div:
+                return IsOperand(BO->getLHS()) && IsOperand(BO->getRHS());
+            default:
+                return false;
+        }
+    }
+    // Negation is exact
+    if (auto* UO = llvm::dyn_cast<clang::UnaryOperator>(E)) {
+        return (UO->getOpcode() == clang::UO_Minus || UO->getOpcode() == clang::UO_Plus) &&
+               isFloatOnly(UO->getSubExpr());
+    }
+    if (auto* Call = llvm::dyn_cast<clang::CallExpr>(E)) {
+        const MathBuiltin* Builtin = getMathBuiltin(Call->getDirectCallee());
+        if (!Builtin || Call->getNumArgs() != Builtin->NumArgs ||
+            (!Fast && Builtin->Intrinsic != llvm::Intrinsic::sqrt)) {
+            return false;
+        }
+        return std::all_of(Call->arg_begin(), Call->arg_end(), IsOperand);
+    }
+    return false;
+}
+
+llvm::Value* ExprLowering::lowerCast(const clang::CastExpr* CE) {
+    if (!isSupportedCast(CE->getCastKind())) {
+        return fail(std::string("unsupported cast '") + CE->getCastKindName() + "'");
+    }
+    // Float math that C promotes, as in y[i] = sqrt(x[i]) or x[i] * 2.0,
+    // stays in float instead of needing fp64 where contract or fast
+    // allows it
+    if (CE->getCastKind() == clang::CK_FloatingCast && !NarrowToFloat &&
+        Builder.getFastMathFlags().allowContract() &&
+        CE->getType()->isSpecificBuiltinType(clang::BuiltinType::Float) &&
+        isFloatOnly(CE->getSubExpr())) {
+        NarrowToFloat = true;
+        auto* V = lowerExpr(CE->getSubExpr());
+        NarrowToFloat = false;
+        return V;
+    }
+    // A call whose result is rounded to half right away only needs half_
+    // accuracy
+    if (CE->getCastKind() == clang::CK_FloatingCast &&
+        (CE->getType()->isHalfType() || CE->getType()->isFloat16Type())) {
+        HalfResult = llvm::dyn_cast<clang::CallExpr>(CE->getSubExpr()->IgnoreParens());
+    }
+    // The float operands of a narrowed expression are lowered as written
+    bool Narrowing = NarrowToFloat;
+    NarrowToFloat = false;
+    auto* V = lowerExpr(CE->getSubExpr());
+    NarrowToFloat = Narrowing;
+    if (CE->getCastKind() == clang::CK_LValueToRValue || CE->getCastKind() == clang::CK_NoOp) {
+        return V;
+    }
+    return convert(V, CE->getSubExpr()->getType(), CE->getType());
+}
+
+llvm::Value* ExprLowering::lowerCall(const clang::CallExpr* CE) {
+    auto* FD = CE->getDirectCallee();
+    const MathBuiltin* Builtin = getMathBuiltin(FD);
+    if (!Builtin || CE->getNumArgs() != Builtin->NumArgs) {
+        return fail("call to '" + (FD ? FD->getNameAsString() : std::string("?")) +
+                    "' has no kernel equivalent");
+    }
+    bool NarrowedToHalf = CE == HalfResult;
+    HalfResult = nullptr;
+
+    auto* Ty = getType(CE->getType());
+    if (!Ty || !Ty->isFloatingPointTy()) {
+        return fail("call to '" + FD->getNameAsString() + "' does not return a floating type");
+    }
+
+    std::vector<llvm::Value*> Args;
+    for (const auto* Arg : CE->arguments()) {
+        auto* V = convert(lowerExpr(Arg), Arg->getType(), CE->getType());
+        if (!V) {
+            return nullptr;
+        }
+        Args.push_back(V);
+    }
+
+    // Approximate functions are allowed only by the fast precision
+    // policy; native_ and half_ variants exist for float alone
+    const char* Approximate = nullptr;
+    if (Builder.getFastMathFlags().approxFunc() && Ty->isFloatTy()) {
+        Approximate = NarrowedToHalf && Builtin->Half ? Builtin->Half : Builtin->Native;
+    }
+    const char* Name = Approximate ? Approximate : Builtin->Builtin;
+
+    // Both the intrinsics and the builtins are overloaded on the vector
+    // type, so every lane maps onto the device's vector math
+    auto* Module = Builder.GetInsertBlock()->getModule();
+    if (!Approximate && Builtin->Intrinsic != llvm::Intrinsic::not_intrinsic) {
+        auto* Decl = llvm::Intrinsic::getDeclaration(Module, Builtin->Intrinsic, {widen(Ty)});
+        return Builder.CreateCall(Decl, Args);
+    }
+    std::vector<llvm::Type*> ArgTypes(Builtin->NumArgs, widen(Ty));
+    auto Callee = Module->getOrInsertFunction(getMangledMathName(Name, widen(Ty), Builtin->NumArgs),
+                                              llvm::FunctionType::get(widen(Ty), ArgTypes, false));
+    if (auto* Func = llvm::dyn_cast<llvm::Function>(Callee.getCallee())) {
+        // Pure, so the kernel pipeline may hoist and combine calls
+        Func->addFnAttr(llvm::Attribute::NoUnwind);
+        Func->addFnAttr(llvm::Attribute::ReadNone);
+        Func->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    return Builder.CreateCall(Callee, Args);
+}
+
+llvm::Value* ExprLowering::getElementPtr(const clang::ArraySubscriptExpr* ASE, bool& IsAligned,
+                                         llvm::Value*& Indices) {
+    const auto* Base = getArrayBase(ASE);
+    auto Array = Base ? Arrays.find(Base) : Arrays.end();
+    if (Array == Arrays.end()) {
+        return fail("array is not a kernel buffer");
+    }
+    auto* ElemTy = getType(ASE->getType());
+    if (!ElemTy) {
+        return nullptr;
+    }
+    // Reduced-precision buffers hold 16-bit elements
+    if (getStorage(ASE) != StorageFormat::Native) {
+        ElemTy = getStorage(ASE) == StorageFormat::Half ? Builder.getHalfTy() : Builder.getInt16Ty();
+    }
+
+    Indices = nullptr;
+    int64_t Offset;
+    if (getIndexOffset(ASE->getIdx(), IV, Offset)) {
+        // Shifted accesses, or any access from an unaligned Index, lose
+        // the buffer's vector alignment
+        IsAligned = Aligned && Offset % Width == 0;
+        auto* Idx = Offset ? Builder.CreateAdd(Index, Builder.getInt32(static_cast<uint32_t>(Offset)))
+                           : Index;
+        return Builder.CreateInBoundsGEP(ElemTy, Array->second, {Idx});
+    }
+
+    // Any other subscript is evaluated per lane and gathered
+    Indices = lowerExpr(ASE->getIdx());
+    return Indices ? Array->second : nullptr;
+}
+
+llvm::Value* ExprLowering::getTileElementPtr(const clang::ArraySubscriptExpr* ASE) {
+    const auto* Base = getArrayBase(ASE);
+    auto It = Base ? Tiles.find(Base) : Tiles.end();
+    const clang::ValueDecl* Pitch;
+    int64_t Row, Col;
+    if (It == Tiles.end() || !getStencilOffset(ASE->getIdx(), IV, Pitch, Row, Col) ||
+        (Pitch && Pitch != It->second.RowPitch)) {
+        return nullptr;
+    }
+
+    // Tail lanes run at other iterations than the anchor
+    const auto& Tile = It->second;
+    llvm::Value* Idx = Tile.Origin;
+    if (Index != Tile.Anchor) {
+        Idx = Builder.CreateAdd(Idx, Builder.CreateSub(Index, Tile.Anchor));
+    }
+    int64_t Shift = Row * static_cast<int64_t>(Tile.TilePitch) + Col;
+    if (Shift) {
+        Idx = Builder.CreateAdd(Idx, Builder.getInt32(static_cast<uint32_t>(Shift)));
+    }
+    return Builder.CreateInBoundsGEP(Tile.Tile->getValueType(), Tile.Tile,
+                                     {Builder.getInt32(0), Idx});
+}
+
+bool ExprLowering::getElementKey(const clang::ArraySubscriptExpr* ASE, ElementKey& Key) const {
+    // Body locals change between and within iterations, so only a kernel
+    // argument may serve as the pitch
+    const auto* Base = getArrayBase(ASE);
+    const clang::ValueDecl* Pitch;
+    int64_t Row, Col;
+    if (!Base || !getStencilOffset(ASE->getIdx(), IV, Pitch, Row, Col) ||
+        (Pitch && !Scalars.count(Pitch))) {
+        return false;
+    }
+    Key = ElementKey(Base, Pitch, Row, Col);
+    return true;
+}
+
+void ExprLowering::collectReads(const clang::Stmt* S) {
+    auto* BO = llvm::dyn_cast<clang::BinaryOperator>(S);
+    if (BO && BO->getOpcode() == clang::BO_Assign) {
+        // The target of a plain store is not read
+        if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(BO->getLHS()->IgnoreParens())) {
+            collectReads(ASE->getIdx());
+            collectReads(BO->getRHS());
+            return;
+        }
+    }
+    ElementKey Key;
+    auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(S);
+    if (ASE && getElementKey(ASE, Key)) {
+        Reads.insert(Key);
+    }
+    for (const auto* Child : S->children()) {
+        if (Child) {
+            collectReads(Child);
+        }
+    }
+}
+
+llvm::Value* ExprLowering::findElements(const clang::ArraySubscriptExpr* ASE, const ElementKey& Key) {
+    auto It = Elements.find(Key);
+    if (It != Elements.end()) {
+        return It->second;
+    }
+    // Unaligned vectors of a 1-D global buffer are a shuffle of two known
+    // vectors Width apart, such as a[i-1] of a[i-W] and a[i]. One of them
+    // may be loaded here when the body reads it anyway, which keeps every
+    // load inside the elements the iterations touch.
+    const auto* Array = std::get<0>(Key);
+    if (Width == 1 || std::get<1>(Key) || Tiles.count(Array) ||
+        getStorage(ASE) != StorageFormat::Native) {
+        return nullptr;
+    }
+    auto* ElemTy = getType(ASE->getType());
+    if (!ElemTy) {
+        return nullptr;
+    }
+    int64_t Col = std::get<3>(Key);
+    auto Known = [&](int64_t At, bool MayLoad) -> llvm::Value* {
+        ElementKey Other(Array, nullptr, 0, At);
+        auto Found = Elements.find(Other);
+        if (Found != Elements.end()) {
+            return Found->second;
+        }
+        if (!MayLoad || !Reads.count(Other)) {
+            return nullptr;
+        }
+        return Elements[Other] = loadVector(Other, ElemTy);
+    };
+    for (bool MayLoad : {false, true}) {
+        for (int64_t Low = Col - Width + 1; Low < Col; ++Low) {
+            // Loading one half only pays when the other is already known
+            auto* Lower = Known(Low, false);
+            auto* Upper = Known(Low + Width, MayLoad && Lower);
+            Lower = Lower ? Lower : Known(Low, MayLoad && Upper);
+            if (!Lower || !Upper) {
+                continue;
+            }
+            std::vector<int> Mask;
+            for (unsigned Lane = 0; Lane < Width; ++Lane) {
+                Mask.push_back(static_cast<int>(Col - Low + Lane));
+            }
+            return Elements[Key] = Builder.CreateShuffleVector(Lower, Upper, Mask);
+        }
+    }
+    return nullptr;
+}
+
+llvm::Value* ExprLowering::loadVector(const ElementKey& Key, llvm::Type* ElemTy) {
+    int64_t Offset = std::get<3>(Key);
+    auto* Idx = Offset ? Builder.CreateAdd(Index, Builder.getInt32(static_cast<uint32_t>(Offset)))
+                       : Index;
+    auto* Ptr = Builder.CreateInBoundsGEP(ElemTy, Arrays.lookup(std::get<0>(Key)), {Idx});
+    auto* VecTy = llvm::FixedVectorType::get(ElemTy, Width);
+    auto* CastPtr = Builder.CreateBitCast(
+        Ptr, llvm::PointerType::get(VecTy, Ptr->getType()->getPointerAddressSpace()));
+    unsigned ElemSize = ElemTy->getPrimitiveSizeInBits() / 8;
+    bool IsAligned = Aligned && Offset % Width == 0;
+    return Builder.CreateAlignedLoad(VecTy, CastPtr, llvm::Align(ElemSize * (IsAligned ? Width : 1)));
+}
+
+void ExprLowering::invalidateElements(const clang::ValueDecl* Stored) {
+    // A store may change any element of a buffer it could alias. Only
+    // tiles, module constants and read-only noalias arguments are safe.
+    for (auto It = Elements.begin(); It != Elements.end();) {
+        const auto* Array = std::get<0>(It->first);
+        auto* Ptr = Arrays.lookup(Array);
+        auto* Arg = llvm::dyn_cast_or_null<llvm::Argument>(Ptr);
+        bool Unaliased = Tiles.count(Array) || llvm::isa_and_nonnull<llvm::Constant>(Ptr) ||
+                         (Arg && Arg->hasNoAliasAttr() && Arg->onlyReadsMemory());
+        if (Array != Stored && Unaliased) {
+            ++It;
+        } else {
+            It = Elements.erase(It);
+        }
+    }
+}
+
+llvm::Value* ExprLowering::lowerLoad(const clang::ArraySubscriptExpr* ASE) {
+    // Each element is read once per iteration, and values carried over
+    // from earlier iterations are not read again
+    ElementKey Key;
+    if (!getElementKey(ASE, Key)) {
+        return loadElement(ASE);
+    }
+    if (auto* Known = findElements(ASE, Key)) {
+        return Known;
+    }
+    auto* V = loadElement(ASE);
+    if (V) {
+        Elements[Key] = V;
+    }
+    return V;
+}
+
+llvm::Value* ExprLowering::loadElement(const clang::ArraySubscriptExpr* ASE) {
+    // Tile rows are padded by the halo, so tile reads only keep element
+    // alignment
+    bool IsAligned = false;
+    llvm::Value* Indices = nullptr;
+    auto* Ptr = getTileElementPtr(ASE);
+    // Tiles are staged in float whatever the buffer's storage
+    StorageFormat Format = Ptr ? StorageFormat::Native : getStorage(ASE);
+    if (!Ptr) {
+        Ptr = getElementPtr(ASE, IsAligned, Indices);
+    }
+    if (!Ptr) {
+        return nullptr;
+    }
+    auto* ElemTy = getType(ASE->getType());
+    unsigned ElemSize = ElemTy->getPrimitiveSizeInBits() / 8;
+
+    if (Format != StorageFormat::Native) {
+        if (!Indices) {
+            return loadReduced(Format, Ptr, Width, llvm::Align(2 * (IsAligned ? Width : 1)));
+        }
+        llvm::Value* Result = llvm::UndefValue::get(widen(ElemTy));
+        for (unsigned Lane = 0; Lane < Width; ++Lane) {
+            auto* LanePtr = Builder.CreateInBoundsGEP(
+                Format == StorageFormat::Half ? Builder.getHalfTy() : Builder.getInt16Ty(), Ptr,
+                {Width == 1 ? Indices : Builder.CreateExtractElement(Indices, Lane)});
+            auto* Value = loadReduced(Format, LanePtr, 1, llvm::Align(2));
+            Result = Width == 1 ? Value : Builder.CreateInsertElement(Result, Value, Lane);
+        }
+        return Result;
+    }
+
+    if (!Indices) {
+        if (Width == 1) {
+            return Builder.CreateLoad(ElemTy, Ptr);
+        }
+        auto* VecTy = llvm::FixedVectorType::get(ElemTy, Width);
+        auto* CastPtr = Builder.CreateBitCast(
+            Ptr, llvm::PointerType::get(VecTy, Ptr->getType()->getPointerAddressSpace()));
+        return Builder.CreateAlignedLoad(VecTy, CastPtr, llvm::Align(ElemSize * (IsAligned ? Width : 1)));
+    }
+
+    if (Width == 1) {
+        return Builder.CreateLoad(ElemTy, Builder.CreateInBoundsGEP(ElemTy, Ptr, {Indices}));
+    }
+    llvm::Value* Result = llvm::UndefValue::get(widen(ElemTy));
+    for (unsigned Lane = 0; Lane < Width; ++Lane) {
+        auto* LanePtr = Builder.CreateInBoundsGEP(ElemTy, Ptr,
+            {Builder.CreateExtractElement(Indices, Lane)});
+        Result = Builder.CreateInsertElement(Result, Builder.CreateLoad(ElemTy, LanePtr), Lane);
+    }
+    return Result;
+}
+
+bool ExprLowering::lowerStore(const clang::ArraySubscriptExpr* ASE, llvm::Value* V) {
+    bool IsAligned = false;
+    llvm::Value* Indices = nullptr;
+    auto* Ptr = getElementPtr(ASE, IsAligned, Indices);
+    if (!Ptr) {
+        return false;
+    }
+    // Later reads of the element see V without a load; reduced buffers
+    // would return it rounded, so those are read back
+    invalidateElements(getArrayBase(ASE));
+    ElementKey Key;
+    if (getStorage(ASE) == StorageFormat::Native && getElementKey(ASE, Key)) {
+        Elements[Key] = V;
+    }
+    auto* ElemTy = getType(ASE->getType());
+    unsigned ElemSize = ElemTy->getPrimitiveSizeInBits() / 8;
+
+    StorageFormat Format = getStorage(ASE);
+    if (Format != StorageFormat::Native) {
+        if (!Indices) {
+            storeReduced(Format, V, Ptr, llvm::Align(2 * (IsAligned ? Width : 1)));
+            return true;
+        }
+        for (unsigned Lane = 0; Lane < Width; ++Lane) {
+            auto* LanePtr = Builder.CreateInBoundsGEP(
+                Format == StorageFormat::Half ? Builder.getHalfTy() : Builder.getInt16Ty(), Ptr,
+                {Width == 1 ? Indices : Builder.CreateExtractElement(Indices, Lane)});
+            storeReduced(Format, Width == 1 ? V : Builder.CreateExtractElement(V, Lane), LanePtr,
+                         llvm::Align(2));
+        }
+        return true;
+    }
+
+    if (!Indices) {
+        if (Width == 1) {
+            Builder.CreateStore(V, Ptr);
+            return true;
+        }
+        auto* CastPtr = Builder.CreateBitCast(
+            Ptr, llvm::PointerType::get(V->getType(), Ptr->getType()->getPointerAddressSpace()));
+        Builder.CreateAlignedStore(V, CastPtr, llvm::Align(ElemSize * (IsAligned ? Width : 1)));
+        return true;
+    }
+
+    if (Width == 1) {
+        Builder.CreateStore(V, Builder.CreateInBoundsGEP(ElemTy, Ptr, {Indices}));
+        return true;
+    }
+    for (unsigned Lane = 0; Lane < Width; ++Lane) {
+        auto* LanePtr = Builder.CreateInBoundsGEP(ElemTy, Ptr,
+            {Builder.CreateExtractElement(Indices, Lane)});
+        Builder.CreateStore(Builder.CreateExtractElement(V, Lane), LanePtr);
+    }
+    return true;
+}
+
+StorageFormat ExprLowering::getStorage(const clang::ArraySubscriptExpr* ASE) const {
+    auto It = Storage.find(getArrayBase(ASE));
+    return It == Storage.end() ? StorageFormat::Native : It->second;
+}
+
+llvm::Value* ExprLowering::loadReduced(StorageFormat Format, llvm::Value* Ptr, unsigned Count,
+                                       llvm::Align Alignment) {
+    llvm::Type* FloatTy = Builder.getFloatTy();
+    if (Count > 1) {
+        FloatTy = llvm::FixedVectorType::get(FloatTy, Count);
+    }
+    if (Format == StorageFormat::BFloat16) {
+        // A bfloat16 is the upper half of the float it rounds
+        auto* BitsTy = FloatTy->getWithNewType(Builder.getInt16Ty());
+        auto* CastPtr = Builder.CreateBitCast(
+            Ptr, llvm::PointerType::get(BitsTy, Ptr->getType()->getPointerAddressSpace()));
+        auto* Bits = Builder.CreateZExt(Builder.CreateAlignedLoad(BitsTy, CastPtr, Alignment),
+                                        FloatTy->getWithNewType(Builder.getInt32Ty()));
+        return Builder.CreateBitCast(Builder.CreateShl(Bits, 16), FloatTy);
+    }
+
+    // vload_halfn(0, p) reads n halves at p with only element alignment:
+    // _Z11vload_half4mPU3AS1KDh on spir64
+    std::string Name = "vload_half" + (Count > 1 ? std::to_string(Count) : std::string());
+    auto* Module = Builder.GetInsertBlock()->getModule();
+    auto Callee = Module->getOrInsertFunction(
+        "_Z" + std::to_string(Name.size()) + Name + "mPU3AS1KDh",
+        llvm::FunctionType::get(FloatTy, {Builder.getInt64Ty(), Ptr->getType()}, false));
+    if (auto* Func = llvm::dyn_cast<llvm::Function>(Callee.getCallee())) {
+        Func->addFnAttr(llvm::Attribute::NoUnwind);
+        Func->addFnAttr(llvm::Attribute::ReadOnly);
+        Func->addFnAttr(llvm::Attribute::ArgMemOnly);
+        Func->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    return Builder.CreateCall(Callee, {Builder.getInt64(0), Ptr});
+}
+
+void ExprLowering::storeReduced(StorageFormat Format, llvm::Value* V, llvm::Value* Ptr,
+                                llvm::Align Alignment) {
+    auto* VecTy = llvm::dyn_cast<llvm::FixedVectorType>(V->getType());
+    if (Format == StorageFormat::BFloat16) {
+        // Round to nearest even on the dropped half; NaNs stay quiet NaNs
+        // instead of rounding up into infinity
+        auto* IntTy = V->getType()->getWithNewType(Builder.getInt32Ty());
+        auto* Bits = Builder.CreateBitCast(V, IntTy);
+        auto Splat = [&](uint32_t C) { return llvm::ConstantInt::get(IntTy, C); };
+        auto* Odd = Builder.CreateAnd(Builder.CreateLShr(Bits, Splat(16)), Splat(1));
+        auto* Rounded = Builder.CreateAdd(Bits, Builder.CreateAdd(Odd, Splat(0x7FFF)));
+        auto* Quiet = Builder.CreateOr(Bits, Splat(0x400000));
+        auto* Result = Builder.CreateSelect(Builder.CreateFCmpUNO(V, V), Quiet, Rounded);
+        auto* BitsTy = V->getType()->getWithNewType(Builder.getInt16Ty());
+        auto* Upper = Builder.CreateTrunc(Builder.CreateLShr(Result, Splat(16)), BitsTy);
+        auto* CastPtr = Builder.CreateBitCast(
+            Ptr, llvm::PointerType::get(BitsTy, Ptr->getType()->getPointerAddressSpace()));
+        Builder.CreateAlignedStore(Upper, CastPtr, Alignment);
+        return;
+    }
+
+    // vstore_halfn_rte(v, 0, p) rounds to nearest even whatever the
+    // device's default: _Z16vstore_half4_rteDv4_fmPU3AS1Dh on spir64
+    std::string Count = VecTy ? std::to_string(VecTy->getNumElements()) : std::string();
+    std::string Name = "vstore_half" + Count + "_rte";
+    std::string Data = VecTy ? "Dv" + Count + "_f" : "f";
+    auto* Module = Builder.GetInsertBlock()->getModule();
+    auto Callee = Module->getOrInsertFunction(
+        "_Z" + std::to_string(Name.size()) + Name + Data + "mPU3AS1Dh",
+        llvm::FunctionType::get(Builder.getVoidTy(), {V->getType(), Builder.getInt64Ty(), Ptr->getType()},
+                                false));
+    if (auto* Func = llvm::dyn_cast<llvm::Function>(Callee.getCallee())) {
+        Func->addFnAttr(llvm::Attribute::NoUnwind);
+        Func->addFnAttr(llvm::Attribute::WriteOnly);
+        Func->addFnAttr(llvm::Attribute::ArgMemOnly);
+        Func->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    Builder.CreateCall(Callee, {V, Builder.getInt64(0), Ptr});
+}
+
+bool ExprLowering::lowerAssignment(const clang::BinaryOperator* BO) {
+    auto* LHS = BO->getLHS()->IgnoreParens();
+    llvm::Value* V;
+    if (auto* CAO = llvm::dyn_cast<clang::CompoundAssignOperator>(BO)) {
+        auto Op = clang::BinaryOperator::getOpForCompoundAssignment(BO->getOpcode());
+        auto* Cur = convert(lowerExpr(LHS), LHS->getType(), CAO->getComputationLHSType());
+        auto* Mul = Op == clang::BO_Add || Op == clang::BO_Sub
+            ? getContractibleMul(BO->getRHS(), CAO->getComputationResultType()) : nullptr;
+        if (Mul) {
+            // x += a*b contracts like x = x + a*b
+            V = createMulAdd(Mul, Cur, Op == clang::BO_Sub);
+        } else {
+            auto* R = Cur ? convert(lowerExpr(BO->getRHS()), BO->getRHS()->getType(),
+                                    CAO->getComputationResultType())
+                          : nullptr;
+            V = R ? createBinOp(Op, Cur, R, CAO->getComputationResultType()) : nullptr;
+        }
+        V = convert(V, CAO->getComputationResultType(), LHS->getType());
+    } else {
+        V = lowerExpr(BO->getRHS());
+    }
+    if (!V) {
+        return false;
+    }
+
+    if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(LHS)) {
+        return lowerStore(ASE, V);
+    }
+    if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(LHS)) {
+        if (Locals.count(DRE->getDecl())) {
+            Locals[DRE->getDecl()] = V;
+            return true;
+        }
+    }
+    fail("unsupported assignment target");
+    return false;
+}
+
+bool ExprLowering::lowerBody(const clang::Stmt* Body) {
+    Reads.clear();
+    collectReads(Body);
+    return lowerStmt(Body);
+}
+
+bool ExprLowering::lowerStmt(const clang::Stmt* Body) {
+    if (auto* CS = llvm::dyn_cast<clang::CompoundStmt>(Body)) {
+        for (const auto* Child : CS->body()) {
+            if (!lowerStmt(Child)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (llvm::isa<clang::NullStmt>(Body)) {
+        return true;
+    }
+    if (auto* DS = llvm::dyn_cast<clang::DeclStmt>(Body)) {
+        for (const auto* D : DS->decls()) {
+            auto* VD = llvm::dyn_cast<clang::VarDecl>(D);
+            if (!VD) {
+                fail("unsupported declaration in loop body");
+                return false;
+            }
+            llvm::Value* V;
+            if (VD->hasInit()) {
+                V = lowerExpr(VD->getInit());
+            } else {
+                auto* Ty = getType(VD->getType());
+                V = Ty ? llvm::Constant::getNullValue(widen(Ty)) : nullptr;
+            }
+            if (!V) {
+                return false;
+            }
+            Locals[VD] = V;
+        }
+        return true;
+    }
+    if (auto* BO = llvm::dyn_cast<clang::BinaryOperator>(Body)) {
+        if (BO->isAssignmentOp()) {
+            return lowerAssignment(BO);
+        }
+    }
+    fail(std::string("statement '") + Body->getStmtClassName() + "' has no kernel equivalent");
+    return false;
+}
+
+} // namespace cspir
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "types.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+
+namespace cspir {
+    // for (iv = Lower; iv < Upper; iv++) with a literal lower bound and a
+    // unit step; "<=" conditions are reported as Inclusive
+    struct LoopBounds {
+        const clang::VarDecl* IV = nullptr;
+        int64_t Lower = 0;
+        const clang::Expr* Upper = nullptr;
+        bool Inclusive = false;
+    };
+
+    // Loop shape helpers shared by the analyzer and the generator
+    const clang::VarDecl* getInductionVariable(const clang::ForStmt* FS);
+    bool getLoopBounds(const clang::ForStmt* FS, LoopBounds& Bounds);
+    // Matches subscripts of the form iv, iv + c, c + iv and iv - c
+    bool getIndexOffset(const clang::Expr* Idx, const clang::VarDecl* IV, int64_t& Offset);
+    // Matches sums of iv, integer literals, p and k*p for one loop-invariant
+    // integer p: the subscript of a flattened 2-D grid with row pitch p.
+    // Pitch is null when no term names p, and Row is then 0.
+    bool getStencilOffset(const clang::Expr* Idx, const clang::VarDecl* IV,
+                          const clang::ValueDecl*& Pitch, int64_t& Row, int64_t& Col);
+
+    // A C math function and the OpenCL builtins it maps to. Intrinsic is
+    // used instead of Builtin when LLVM models the function exactly.
+    struct MathBuiltin {
+        const char* Name;     // Double variant; the "f" suffix shares it
+        const char* Builtin;  // Overloaded on half, float and double vectors
+        const char* Native;   // native_ variant, null when there is none
+        const char* Half;     // half_ variant, null when there is none
+        unsigned NumArgs;
+        llvm::Intrinsic::ID Intrinsic;
+    };
+    // Null for functions with no kernel equivalent, including anything
+    // that is not a C library builtin
+    const MathBuiltin* getMathBuiltin(const clang::FunctionDecl* FD);
+
+    // A stencil input staged in __local memory: lane 0 of iteration Anchor
+    // reads element Origin of Tile, and one row of the grid is TilePitch
+    // elements of the tile
+    struct TileBinding {
+        llvm::GlobalVariable* Tile = nullptr;
+        llvm::Value* Origin = nullptr;
+        llvm::Value* Anchor = nullptr;
+        uint64_t TilePitch = 0;
+        const clang::ValueDecl* RowPitch = nullptr;
+    };
+
+    // Lowers the statements and expressions of a loop body into IR that
+    // computes Width consecutive iterations at once: lane l evaluates the
+    // body with IV = Index + l. Width 1 produces scalar code, so the same
+    // engine emits vector bodies and their tails. Elements at iv-relative
+    // subscripts are loaded once: later reads reuse the load or the value
+    // stored there, and neighbouring vectors are shuffled from known ones.
+    class ExprLowering {
+    public:
+        ExprLowering(clang::ASTContext& Context, llvm::IRBuilder<>& Builder,
+                     const clang::VarDecl* IV)
+            : Context(Context), Builder(Builder), IV(IV) {}
+
+        // Buffers are bound to global pointers of their element type, or
+        // of the storage format of a reduced-precision float buffer;
+        // scalars to by-value kernel arguments
+        void bindArray(const clang::ValueDecl* D, llvm::Value* Ptr,
+                       StorageFormat Format = StorageFormat::Native) {
+            Arrays[D] = Ptr;
+            Storage[D] = Format;
+        }
+        void bindScalar(const clang::ValueDecl* D, llvm::Value* Value) { Scalars[D] = Value; }
+        // Reads of D at stencil offsets come from the tile; others and
+        // stores still go to the buffer
+        void bindTile(const clang::ValueDecl* D, const TileBinding& Tile) { Tiles[D] = Tile; }
+        // Aligned: Index is a multiple of Width, so unshifted vector
+        // accesses keep the buffer's vector alignment
+        void setIteration(llvm::Value* Index, unsigned Width, bool Aligned = true);
+        // The Shift iterations after the current ones, lowered where the
+        // current ones dominate: their loaded values carry over
+        void continueIteration(llvm::Value* Index, int64_t Shift);
+
+        // Array stores, local declarations and assignments to locals
+        bool lowerBody(const clang::Stmt* Body);
+        llvm::Value* lowerExpr(const clang::Expr* E);
+        llvm::Value* convert(llvm::Value* V, clang::QualType From, clang::QualType To);
+        // a*b + c style fusion, only when the builder's flags allow
+        // contraction: E as a product of type Ty that may fuse with an add
+        const clang::BinaryOperator* getContractibleMul(const clang::Expr* E,
+                                                        clang::QualType Ty) const;
+        llvm::Value* createMulAdd(const clang::BinaryOperator* Mul, llvm::Value* Addend,
+                                  bool NegateProduct);
+        const std::string& getError() const { return Error; }
+
+        // Checks without emitting IR whether lowerBody can handle Body and
+        // whether its iterations are independent of each other
+        static bool canLower(const clang::Stmt* Body, const clang::VarDecl* IV,
+                             std::string& Reason);
+        // The same for a value lowerExpr computes for every iteration, even
+        // those past where C stops, such as a search condition
+        static bool canLowerExpr(const clang::Expr* E, const clang::VarDecl* IV,
+                                 std::string& Reason);
+        static llvm::Type* convertType(clang::ASTContext& Context, llvm::LLVMContext& Ctx,
+                                       clang::QualType QT);
+
+    private:
+        llvm::Type* getType(clang::QualType QT);
+        llvm::Type* widen(llvm::Type* Ty) const;
+        llvm::Value* splat(llvm::Value* Scalar);
+        llvm::Value* getInductionValue(clang::QualType QT);
+        llvm::Value* toBool(llvm::Value* V);
+        llvm::Value* createBinOp(clang::BinaryOperatorKind Op, llvm::Value* L, llvm::Value* R,
+                                 clang::QualType OperandType);
+        // E as C evaluates it only for Lanes: integer divisions of the
+        // other lanes cannot trap
+        llvm::Value* lowerGuarded(const clang::Expr* E, llvm::Value* Lanes);
+        llvm::Value* lowerCast(const clang::CastExpr* CE);
+        // A double expression C only computes from float operands and
+        // literals that may be evaluated in float: any such expression
+        // under fast, a single + - * / or sqrt of them under contract
+        bool isFloatOnly(const clang::Expr* E) const;
+        // A float operand C promoted, or a literal float holds
+        bool isFloatOperand(const clang::Expr* E) const;
+        llvm::Value* lowerCall(const clang::CallExpr* CE);
+        // Array, pitch, row and column of a subscript iv + row*pitch + col
+        using ElementKey = std::tuple<const clang::ValueDecl*, const clang::ValueDecl*, int64_t, int64_t>;
+        bool getElementKey(const clang::ArraySubscriptExpr* ASE, ElementKey& Key) const;
+        void collectReads(const clang::Stmt* S);
+        llvm::Value* findElements(const clang::ArraySubscriptExpr* ASE, const ElementKey& Key);
+        llvm::Value* loadVector(const ElementKey& Key, llvm::Type* ElemTy);
+        void invalidateElements(const clang::ValueDecl* Stored);
+        bool lowerStmt(const clang::Stmt* S);
+        llvm::Value* lowerLoad(const clang::ArraySubscriptExpr* ASE);
+        llvm::Value* loadElement(const clang::ArraySubscriptExpr* ASE);
+        bool lowerStore(const clang::ArraySubscriptExpr* ASE, llvm::Value* V);
+        bool lowerAssignment(const clang::BinaryOperator* BO);
+        llvm::Value* getElementPtr(const clang::ArraySubscriptExpr* ASE, bool& IsAligned,
+                                   llvm::Value*& Indices);
+        llvm::Value* getTileElementPtr(const clang::ArraySubscriptExpr* ASE);
+        StorageFormat getStorage(const clang::ArraySubscriptExpr* ASE) const;
+        // Count consecutive floats at Ptr of a reduced-precision buffer;
+        // half accesses go through builtins that need element alignment only
+        llvm::Value* loadReduced(StorageFormat Format, llvm::Value* Ptr, unsigned Count,
+                                 llvm::Align Alignment);
+        void storeReduced(StorageFormat Format, llvm::Value* V, llvm::Value* Ptr,
+                          llvm::Align Alignment);
+        llvm::Value* fail(const std::string& Message);
+
+        clang::ASTContext& Context;
+        llvm::IRBuilder<>& Builder;
+        const clang::VarDecl* IV;
+        llvm::Value* Index = nullptr;
+        unsigned Width = 1;
+        bool Aligned = true;
+        llvm::DenseMap<const clang::ValueDecl*, llvm::Value*> Arrays;
+        llvm::DenseMap<const clang::ValueDecl*, StorageFormat> Storage;
+        llvm::DenseMap<const clang::ValueDecl*, llvm::Value*> Scalars;
+        llvm::DenseMap<const clang::ValueDecl*, llvm::Value*> Locals;  // Already Width wide
+        llvm::DenseMap<const clang::ValueDecl*, TileBinding> Tiles;
+        const clang::CallExpr* HalfResult = nullptr;  // Call being lowered for a half result
+        bool NarrowToFloat = false;  // Lowering a float-only expression; double means float
+        llvm::Value* Guard = nullptr;  // Lanes that evaluate the current operand; null for all
+        std::map<ElementKey, llvm::Value*> Elements;  // Loaded or stored by these iterations
+        std::set<ElementKey> Reads;                   // Of the body being lowered
+        std::string Error;
+    };
+} // namespace cspir
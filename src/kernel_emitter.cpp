@@ -0,0 +1,242 @@
+#include "kernel_emitter.h"
+#include "kernel_variants.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <mutex>
+
+namespace cspir {
+
+// Triple understood by LLVM's SPIR-V backend, when it is built in
+static const char* SPIRVTriple = "spirv64-unknown-unknown";
+
+static bool isKernel(const llvm::Function* F) {
+    return F && !F->isDeclaration() && F->getCallingConv() == llvm::CallingConv::SPIR_KERNEL;
+}
+
+// The second stage of a two-stage reduction, which only runs after the
+// kernel it is named after and ships in the same file
+static bool isCombineKernel(const llvm::Module& M, const llvm::Function& F) {
+    llvm::StringRef FirstStage = F.getName();
+    return FirstStage.consume_back("_combine") && isKernel(M.getFunction(FirstStage));
+}
+
+bool KernelEmitter::emit(llvm::Module& M, const std::string& BaseName) {
+    if (Options.OutputDir.empty()) {
+        M.print(llvm::outs(), nullptr);
+        return true;
+    }
+
+    std::string Stem = llvm::sys::path::stem(BaseName).str();
+    std::vector<Artifact> Artifacts;
+
+    // Serialization touches the shared LLVMContext and stays on this thread
+    if (Options.SplitKernels) {
+        for (auto& F : M) {
+            if (!isKernel(&F) || isCombineKernel(M, F)) {
+                continue;
+            }
+            auto KernelModule = extractKernel(M, F);
+            if (!serialize(*KernelModule, Stem + "." + F.getName().str(), Artifacts)) {
+                return false;
+            }
+        }
+    } else if (!serialize(M, Stem, Artifacts)) {
+        return false;
+    }
+
+    return writeArtifacts(Artifacts);
+}
+
+std::unique_ptr<llvm::Module> KernelEmitter::extractKernel(llvm::Module& M,
+                                                           llvm::Function& Kernel) {
+    // Clone only this kernel's body and its combine kernel's, if any;
+    // other kernels become declarations
+    const llvm::Function* Combine = M.getFunction((Kernel.getName() + "_combine").str());
+    llvm::ValueToValueMapTy VMap;
+    auto Clone = llvm::CloneModule(M, VMap, [&](const llvm::GlobalValue* GV) {
+        auto* F = llvm::dyn_cast<llvm::Function>(GV);
+        return !F || F == &Kernel || F == Combine ||
+               F->getCallingConv() != llvm::CallingConv::SPIR_KERNEL;
+    });
+
+    // The file holds one variant of its loop, so its !cspir.variants row
+    // is the only one left and must match unconditionally, like a table's
+    // last entry
+    if (auto* Table = Clone->getNamedMetadata("cspir.variants")) {
+        llvm::MDNode* Row = nullptr;
+        for (auto* Entry : Table->operands()) {
+            if (getVariantKernel(Entry) == Clone->getFunction(Kernel.getName())) {
+                Row = Entry;
+            }
+        }
+        Table->clearOperands();
+        if (Row) {
+            Table->addOperand(getUnconditionalVariantRow(Row));
+        } else {
+            Table->eraseFromParent();
+        }
+    }
+
+    // Drop whatever the other kernels left behind, helpers only they call
+    // included
+    bool Changed = true;
+    while (Changed) {
+        Changed = false;
+        for (auto It = Clone->begin(); It != Clone->end();) {
+            llvm::Function& F = *It++;
+            if (!isKernel(&F) && F.use_empty()) {
+                F.eraseFromParent();
+                Changed = true;
+            }
+        }
+        for (auto It = Clone->global_begin(); It != Clone->global_end();) {
+            llvm::GlobalVariable& GV = *It++;
+            if (GV.hasLocalLinkage() && GV.use_empty()) {
+                GV.eraseFromParent();
+                Changed = true;
+            }
+        }
+    }
+    return Clone;
+}
+
+bool KernelEmitter::serialize(llvm::Module& M, const std::string& Stem,
+                              std::vector<Artifact>& Artifacts) {
+    auto PathFor = [&](llvm::StringRef Ext) {
+        llvm::SmallString<256> Path(Options.OutputDir);
+        llvm::sys::path::append(Path, Stem + Ext.str());
+        return Path.str().str();
+    };
+
+    bool WantBitcode = false;
+    for (auto Format : Options.Formats) {
+        Artifact Out;
+        switch (Format) {
+            case EmitFormat::Bitcode:
+                WantBitcode = true;
+                break;
+            case EmitFormat::Assembly: {
+                Out.Path = PathFor(".ll");
+                std::string Text;
+                llvm::raw_string_ostream TextOS(Text);
+                M.print(TextOS, nullptr);
+                TextOS.flush();
+                Out.Data.assign(Text.begin(), Text.end());
+                Artifacts.push_back(std::move(Out));
+                break;
+            }
+            case EmitFormat::SPIRV:
+                if (!emitSPIRV(M, Out.Data)) {
+                    return false;
+                }
+                if (Out.Data.empty()) {
+                    // No backend: bitcode, never under a .spv name, can
+                    // still be turned into SPIR-V with llvm-spirv
+                    WantBitcode = true;
+                    break;
+                }
+                Out.Path = PathFor(".spv");
+                Artifacts.push_back(std::move(Out));
+                break;
+        }
+    }
+
+    if (WantBitcode) {
+        llvm::SmallVector<char, 0> Buffer;
+        llvm::raw_svector_ostream OS(Buffer);
+        llvm::WriteBitcodeToFile(M, OS);
+        Artifacts.push_back({PathFor(".bc"), std::vector<char>(Buffer.begin(), Buffer.end())});
+    }
+    return true;
+}
+
+bool KernelEmitter::emitSPIRV(llvm::Module& M, std::vector<char>& Data) {
+    static std::once_flag InitTargets;
+    std::call_once(InitTargets, [] {
+        llvm::InitializeAllTargetInfos();
+        llvm::InitializeAllTargets();
+        llvm::InitializeAllTargetMCs();
+        llvm::InitializeAllAsmPrinters();
+    });
+
+    std::string Error;
+    const auto* Target = llvm::TargetRegistry::lookupTarget(SPIRVTriple, Error);
+    if (!Target) {
+        static std::once_flag Warned;
+        std::call_once(Warned, [] {
+            llvm::errs() << "Warning: LLVM was built without the SPIR-V backend; "
+                            "writing .bc for llvm-spirv instead of .spv\n";
+        });
+        Data.clear();
+        return true;
+    }
+
+    std::unique_ptr<llvm::TargetMachine> TM(Target->createTargetMachine(
+        SPIRVTriple, "", "", llvm::TargetOptions(), llvm::None));
+
+    // Codegen rewrites the module, so work on a copy with the backend's triple
+    auto Copy = llvm::CloneModule(M);
+    Copy->setTargetTriple(SPIRVTriple);
+    Copy->setDataLayout(TM->createDataLayout());
+
+    llvm::SmallVector<char, 0> Buffer;
+    llvm::raw_svector_ostream OS(Buffer);
+    llvm::legacy::PassManager PM;
+    if (TM->addPassesToEmitFile(PM, OS, nullptr, llvm::CGFT_ObjectFile)) {
+        llvm::errs() << "Error: SPIR-V backend cannot emit object files\n";
+        return false;
+    }
+    PM.run(*Copy);
+
+    Data.assign(Buffer.begin(), Buffer.end());
+    return true;
+}
+
+bool KernelEmitter::writeArtifacts(const std::vector<Artifact>& Artifacts) {
+    if (auto EC = llvm::sys::fs::create_directories(Options.OutputDir)) {
+        llvm::errs() << "Error: Could not create " << Options.OutputDir << ": "
+                     << EC.message() << "\n";
+        return false;
+    }
+
+    std::mutex ReportMutex;
+    bool Success = true;
+    llvm::ThreadPool Pool(llvm::hardware_concurrency());
+    for (const auto& Out : Artifacts) {
+        Pool.async([&Out, &ReportMutex, &Success] {
+            std::error_code EC;
+            llvm::raw_fd_ostream OS(Out.Path, EC, llvm::sys::fs::OF_None);
+            if (!EC) {
+                OS.write(Out.Data.data(), Out.Data.size());
+                OS.close();
+                EC = OS.error();
+                // Reported below instead of aborting in the destructor
+                OS.clear_error();
+            }
+
+            std::lock_guard<std::mutex> Lock(ReportMutex);
+            if (EC) {
+                llvm::errs() << "Error: Could not write " << Out.Path << ": "
+                             << EC.message() << "\n";
+                Success = false;
+            } else {
+                llvm::outs() << "Wrote " << Out.Path << " (" << Out.Data.size() << " bytes)\n";
+            }
+        });
+    }
+    Pool.wait();
+    return Success;
+}
+
+} // namespace cspir
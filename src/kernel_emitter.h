@@ -0,0 +1,39 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include <string>
+#include <vector>
+
+namespace cspir {
+    enum class EmitFormat { Bitcode, SPIRV, Assembly };
+
+    struct EmitterOptions {
+        std::string OutputDir;                // Empty: print textual IR to stdout
+        std::vector<EmitFormat> Formats = {EmitFormat::SPIRV, EmitFormat::Bitcode};
+        bool SplitKernels = false;            // One file per kernel instead of per TU
+    };
+
+    // Serializes the finalized kernel module and writes the artifacts to
+    // the output directory on a thread pool
+    class KernelEmitter {
+    public:
+        explicit KernelEmitter(const EmitterOptions& Options) : Options(Options) {}
+
+        bool emit(llvm::Module& M, const std::string& BaseName);
+
+    private:
+        struct Artifact {
+            std::string Path;
+            std::vector<char> Data;
+        };
+
+        bool serialize(llvm::Module& M, const std::string& Stem,
+                       std::vector<Artifact>& Artifacts);
+        // Data stays empty when LLVM has no SPIR-V backend
+        bool emitSPIRV(llvm::Module& M, std::vector<char>& Data);
+        std::unique_ptr<llvm::Module> extractKernel(llvm::Module& M, llvm::Function& Kernel);
+        bool writeArtifacts(const std::vector<Artifact>& Artifacts);
+
+        const EmitterOptions& Options;
+    };
+} // namespace cspir
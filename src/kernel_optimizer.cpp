@@ -0,0 +1,86 @@
+#include "kernel_optimizer.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cspir {
+
+// Cleans up the alloca traffic, duplicated address computations and
+// unrolled reduction blocks produced by IRBuilder without touching the
+// barriers between them
+static const char* KernelPipeline =
+    "function(sroa,early-cse<memssa>,instcombine,simplifycfg,gvn,"
+    "loop-mssa(licm),loop-unroll<O3>,instcombine,adce,simplifycfg),"
+    "globaldce";
+
+const char* KernelOptimizer::getLevelName(KernelOptLevel Level) {
+    switch (Level) {
+        case KernelOptLevel::O0: return "O0";
+        case KernelOptLevel::O1: return "O1";
+        case KernelOptLevel::O2: return "O2";
+        case KernelOptLevel::O3: return "O3";
+        case KernelOptLevel::Kernel: return "kernel";
+    }
+    return "unknown";
+}
+
+unsigned KernelOptimizer::countInstructions(const llvm::Module& M) {
+    unsigned Count = 0;
+    for (const auto& F : M) {
+        Count += F.getInstructionCount();
+    }
+    return Count;
+}
+
+bool KernelOptimizer::run(llvm::Module& M, KernelOptStats& Stats) {
+    Stats.InstructionsBefore = countInstructions(M);
+    Stats.InstructionsAfter = Stats.InstructionsBefore;
+    if (Level == KernelOptLevel::O0) {
+        return true;
+    }
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassBuilder PB;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM;
+    switch (Level) {
+        case KernelOptLevel::O1:
+            MPM = PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O1);
+            break;
+        case KernelOptLevel::O2:
+            MPM = PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+            break;
+        case KernelOptLevel::O3:
+            MPM = PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3);
+            break;
+        case KernelOptLevel::Kernel:
+            if (auto Err = PB.parsePassPipeline(MPM, KernelPipeline)) {
+                llvm::errs() << "Error: Invalid kernel pipeline: "
+                             << llvm::toString(std::move(Err)) << "\n";
+                return false;
+            }
+            break;
+        case KernelOptLevel::O0:
+            break;
+    }
+
+    MPM.run(M, MAM);
+
+    Stats.InstructionsAfter = countInstructions(M);
+    return !llvm::verifyModule(M, &llvm::errs());
+}
+
+} // namespace cspir
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+
+namespace cspir {
+    // O0-O3 map to LLVM's default pipelines; Kernel is a short pipeline
+    // tuned for the straight-line code the generator emits
+    enum class KernelOptLevel { O0, O1, O2, O3, Kernel };
+
+    struct KernelOptStats {
+        unsigned InstructionsBefore = 0;
+        unsigned InstructionsAfter = 0;
+    };
+
+    class KernelOptimizer {
+    public:
+        explicit KernelOptimizer(KernelOptLevel Level) : Level(Level) {}
+
+        bool run(llvm::Module& M, KernelOptStats& Stats);
+        static const char* getLevelName(KernelOptLevel Level);
+
+    private:
+        static unsigned countInstructions(const llvm::Module& M);
+
+        KernelOptLevel Level;
+    };
+} // namespace cspir
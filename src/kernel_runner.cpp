@@ -0,0 +1,312 @@
+#include "kernel_runner.h"
+#include "cpu_executor.h"
+#include "spirv_generator.h"
+#include "types.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace cspir {
+
+namespace {
+    // Work-groups launched for grid-stride reductions and searches, so
+    // several groups combine and work-items stride more than once
+    const uint64_t RunGridGroups = 8;
+    // Elements of slack on both sides of a buffer on top of n, for
+    // offsets and pitches up to n
+    const int64_t RunPadding = 1024;
+
+    // One buffer argument with padding on both sides, kept 64-byte aligned
+    // for the vector loads the kernels assume
+    class RunBuffer {
+    public:
+        RunBuffer(llvm::Type* ElemTy, StorageFormat Storage, bool Signed, int64_t Elements,
+                  int64_t Padding)
+            : ElemTy(ElemTy), Storage(Storage), Signed(Signed),
+              Bytes(ElemTy->getPrimitiveSizeInBits() / 8), Elements(Elements), Padding(Padding),
+              Memory(new char[(Elements + 2 * Padding) * Bytes + 64]) {
+            Data = Memory.get() + (64 - reinterpret_cast<uintptr_t>(Memory.get()) % 64) % 64;
+        }
+
+        llvm::Type* getType() const { return ElemTy; }
+        bool isSigned() const { return Signed; }
+        int64_t getAddress() const {
+            return static_cast<int64_t>(reinterpret_cast<uintptr_t>(Data + Padding * Bytes));
+        }
+
+        // Element e, padding included, is 1 + (e + Parameter) mod 8
+        void fill(unsigned Parameter) {
+            for (int64_t E = -Padding; E < Elements + Padding; ++E) {
+                set(E, 1 + ((E + Parameter) % 8 + 8) % 8);
+            }
+        }
+
+        void fill(double Value) {
+            for (int64_t E = -Padding; E < Elements + Padding; ++E) {
+                set(E, Value);
+            }
+        }
+
+        void snapshot() { Initial.assign(Data, Data + (Elements + 2 * Padding) * Bytes); }
+
+        double get(int64_t E) const {
+            const char* Element = at(E);
+            if (ElemTy->isFloatTy()) {
+                float Value;
+                std::memcpy(&Value, Element, sizeof(Value));
+                return Value;
+            }
+            if (ElemTy->isDoubleTy()) {
+                double Value;
+                std::memcpy(&Value, Element, sizeof(Value));
+                return Value;
+            }
+            uint64_t Bits = 0;
+            std::memcpy(&Bits, Element, Bytes);  // Little-endian host
+            if (ElemTy->isHalfTy()) {
+                return convertHalfToFloat(static_cast<uint16_t>(Bits));
+            }
+            if (Storage == StorageFormat::BFloat16) {
+                uint32_t Wide = static_cast<uint32_t>(Bits) << 16;
+                float Value;
+                std::memcpy(&Value, &Wide, sizeof(Value));
+                return Value;
+            }
+            if (Signed) {
+                return static_cast<double>(llvm::SignExtend64(Bits, 8 * Bytes));
+            }
+            return static_cast<double>(Bits);
+        }
+
+        // Sum of (e + 1) * x[e]: positions count, so misplaced elements show
+        double getChecksum() const {
+            double Checksum = 0;
+            for (int64_t E = 0; E < Elements; ++E) {
+                Checksum += static_cast<double>(E + 1) * get(E);
+            }
+            return Checksum;
+        }
+
+        uint64_t countOutsideWrites() const {
+            uint64_t Count = 0;
+            for (int64_t E = 1; E <= Padding; ++E) {
+                Count += isModified(-E) + isModified(Elements - 1 + E);
+            }
+            return Count;
+        }
+
+        bool isModified() const {
+            return std::memcmp(Data, Initial.data(), Initial.size()) != 0;
+        }
+
+    private:
+        const char* at(int64_t E) const { return Data + (Padding + E) * Bytes; }
+        char* at(int64_t E) { return Data + (Padding + E) * Bytes; }
+
+        bool isModified(int64_t E) const {
+            return std::memcmp(at(E), Initial.data() + (Padding + E) * Bytes, Bytes) != 0;
+        }
+
+        void set(int64_t E, double Value) {
+            char* Element = at(E);
+            if (ElemTy->isFloatTy()) {
+                float Narrow = static_cast<float>(Value);
+                std::memcpy(Element, &Narrow, sizeof(Narrow));
+                return;
+            }
+            if (ElemTy->isDoubleTy()) {
+                std::memcpy(Element, &Value, sizeof(Value));
+                return;
+            }
+            uint64_t Bits;
+            if (ElemTy->isHalfTy()) {
+                Bits = convertFloatToHalf(static_cast<float>(Value));
+            } else if (Storage == StorageFormat::BFloat16) {
+                // Fill values are small integers, exact in bfloat16
+                float Narrow = static_cast<float>(Value);
+                uint32_t Wide;
+                std::memcpy(&Wide, &Narrow, sizeof(Wide));
+                Bits = Wide >> 16;
+            } else {
+                Bits = static_cast<uint64_t>(static_cast<int64_t>(Value));
+            }
+            std::memcpy(Element, &Bits, Bytes);
+        }
+
+        llvm::Type* ElemTy;
+        StorageFormat Storage;
+        bool Signed;
+        int64_t Bytes;
+        int64_t Elements;
+        int64_t Padding;
+        std::unique_ptr<char[]> Memory;
+        char* Data;
+        std::vector<char> Initial;
+    };
+
+    // Position of a buffer among its function's parameters; 0 for arrays
+    // that are not parameters
+    unsigned getParameterIndex(const clang::VarDecl* VD) {
+        auto* Param = llvm::dyn_cast<clang::ParmVarDecl>(VD);
+        return Param ? Param->getFunctionScopeIndex() : 0;
+    }
+} // namespace
+
+bool KernelRunner::run(const llvm::Module& M, const std::vector<KernelInfo>& Kernels,
+                       llvm::raw_ostream& OS) {
+    CPUExecutor Executor;
+    std::string Error;
+    if (!Executor.load(M, Error)) {
+        llvm::errs() << "Error: Cannot load the kernel module on the host: " << Error << "\n";
+        return false;
+    }
+
+    bool Success = true;
+    for (const auto& KInfo : Kernels) {
+        // Variants found to duplicate another one are dropped again
+        if (M.getFunction(KInfo.Name)) {
+            Success = runKernel(Executor, M, KInfo, OS) && Success;
+        }
+    }
+    return Success;
+}
+
+bool KernelRunner::runKernel(CPUExecutor& Executor, const llvm::Module& M, const KernelInfo& KInfo,
+                             llvm::raw_ostream& OS) {
+    const llvm::Function* Func = M.getFunction(KInfo.Name);
+    int64_t Bound = Options.Bound;
+    int64_t End = Bound + (KInfo.InclusiveBound ? 1 : 0);
+    uint64_t TripCount = End > KInfo.LowerBound ? static_cast<uint64_t>(End - KInfo.LowerBound) : 0;
+
+    // The launch the kernel fixes, a few groups for grid-stride kernels,
+    // or enough work-items for the iterations; at least one group
+    KernelLaunch Launch;
+    Launch.Kernel = KInfo.Name;
+    Launch.LocalSize = KInfo.Dispatch.RequiredWorkGroupSize ? KInfo.Dispatch.RequiredWorkGroupSize
+                                                            : KInfo.PreferredWorkGroupSize;
+    uint64_t Groups;
+    if (KInfo.Dispatch.StaticGlobalSize) {
+        Groups = KInfo.Dispatch.StaticGlobalSize / Launch.LocalSize;
+    } else if (KInfo.IsReduction || KInfo.Search.Condition) {
+        uint64_t PerGroup = static_cast<uint64_t>(KInfo.VectorWidth) * Launch.LocalSize;
+        Groups = std::min((TripCount + PerGroup - 1) / PerGroup, RunGridGroups);
+    } else {
+        uint64_t PerGroup = static_cast<uint64_t>(KInfo.Dispatch.ElementsPerWorkItem) * Launch.LocalSize;
+        Groups = (TripCount + PerGroup - 1) / PerGroup;
+    }
+    Groups = std::max<uint64_t>(Groups, 1);
+    Launch.GlobalSize = KInfo.Dispatch.StaticGlobalSize ? KInfo.Dispatch.StaticGlobalSize
+                                                        : Groups * Launch.LocalSize;
+
+    // Room for n x n nests, the iteration space and one partial per group
+    uint64_t Magnitude = static_cast<uint64_t>(Bound < 0 ? -Bound : Bound);
+    uint64_t Space = static_cast<uint64_t>(std::max<int64_t>(KInfo.LowerBound, 0)) +
+                     std::max(TripCount, KInfo.StaticTripCount);
+    int64_t Elements = static_cast<int64_t>(std::max({Magnitude * Magnitude, Space, Groups}));
+    int64_t Padding = RunPadding + static_cast<int64_t>(llvm::alignTo(Magnitude, 64));
+
+    // Buffers parallel to the arguments, null for scalars
+    std::vector<std::unique_ptr<RunBuffer>> Buffers;
+    std::vector<int64_t> Args;
+    RunBuffer* Result = nullptr;
+    auto Param = Func->arg_begin();
+    for (const auto& Arg : KInfo.Arguments) {
+        llvm::Type* Ty = (Param++)->getType();
+        if (Arg.Kind != ArgKind::Buffer) {
+            int64_t Value = Bound;
+            if (Ty->isFloatingPointTy()) {
+                double Two = 2.0;
+                std::memcpy(&Value, &Two, sizeof(Value));
+            }
+            Args.push_back(Value);
+            Buffers.emplace_back();
+            continue;
+        }
+
+        bool Signed = !Arg.Type.isNull() && Arg.Type->isSignedIntegerType();
+        auto Buffer = std::make_unique<RunBuffer>(Ty->getPointerElementType(), Arg.Storage, Signed,
+                                                  Elements, Padding);
+        if (Arg.Decl) {
+            Buffer->fill(getParameterIndex(Arg.Decl));
+        } else if (KInfo.Search.Condition) {
+            // The no-match answer: where the C loop leaves its index
+            Buffer->fill(static_cast<double>(std::max(End, KInfo.LowerBound)));
+            Result = Buffer.get();
+        } else {
+            Buffer->fill(0.0);
+            Result = Buffer.get();
+        }
+        Buffer->snapshot();
+        Args.push_back(Buffer->getAddress());
+        Buffers.push_back(std::move(Buffer));
+    }
+
+    std::string Error;
+    if (!Executor.launch(Launch, Args, Error)) {
+        llvm::errs() << "Error: Cannot run " << KInfo.Name << ": " << Error << "\n";
+        return false;
+    }
+
+    // The second stage of a two-stage reduction folds one partial per
+    // work-group of the first
+    std::unique_ptr<RunBuffer> Total;
+    std::string Combine = KInfo.Name + "_combine";
+    if (Result && M.getFunction(Combine)) {
+        Total = std::make_unique<RunBuffer>(Result->getType(), StorageFormat::Native,
+                                            Result->isSigned(), 1, Padding);
+        Total->fill(0.0);
+        Total->snapshot();
+        std::vector<int64_t> CombineArgs = {Result->getAddress(), Total->getAddress(), 0};
+        CombineArgs[SPIRVGenerator::CombineCountArg] = static_cast<int64_t>(Groups);
+
+        KernelLaunch Second;
+        Second.Kernel = Combine;
+        Second.GlobalSize = KInfo.PreferredWorkGroupSize;
+        Second.LocalSize = KInfo.PreferredWorkGroupSize;
+        if (!Executor.launch(Second, CombineArgs, Error)) {
+            llvm::errs() << "Error: Cannot run " << Combine << ": " << Error << "\n";
+            return false;
+        }
+    }
+
+    OS << "\nRun of " << KInfo.Name << " with n = " << Bound << ":\n";
+    bool Success = true;
+    auto CheckBounds = [&](const RunBuffer& Buffer, const std::string& Name) {
+        if (uint64_t Outside = Buffer.countOutsideWrites()) {
+            llvm::errs() << "Error: " << KInfo.Name << " wrote " << Outside
+                         << " elements outside " << Name << "\n";
+            Success = false;
+        }
+    };
+    for (size_t I = 0; I < KInfo.Arguments.size(); ++I) {
+        const auto& Arg = KInfo.Arguments[I];
+        const RunBuffer* Buffer = Buffers[I].get();
+        if (!Buffer) {
+            continue;
+        }
+        CheckBounds(*Buffer, Arg.Name);
+        if (Buffer == Result) {
+            continue;
+        }
+        if (Arg.Access == ArgAccess::Read) {
+            if (Buffer->isModified()) {
+                llvm::errs() << "Error: " << KInfo.Name << " wrote to read-only " << Arg.Name << "\n";
+                Success = false;
+            }
+            continue;
+        }
+        OS << "- " << Arg.Name << ": checksum " << llvm::format("%.17g", Buffer->getChecksum()) << "\n";
+    }
+    if (Total) {
+        CheckBounds(*Total, "result");
+    }
+    if (Result) {
+        OS << "- result: " << llvm::format("%.17g", (Total ? *Total : *Result).get(0)) << "\n";
+    }
+    return Success;
+}
+
+} // namespace cspir
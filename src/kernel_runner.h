@@ -0,0 +1,39 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <vector>
+
+namespace cspir {
+    struct KernelInfo;
+    class CPUExecutor;
+
+    struct RunOptions {
+        bool Enabled = false;
+        int64_t Bound = 0;  // Value of every integer scalar, loop bounds included
+    };
+
+    // Runs every generated kernel once on the host CPU and prints what it
+    // wrote, so tests can check results instead of IR. Inputs are fixed:
+    // element e of the buffer for a function's p-th parameter holds
+    // 1 + (e + p) mod 8, integer scalars hold the bound n and floating
+    // ones 2. Buffers have max(n*n, iteration space) elements and are
+    // reported as the weighted sum of (e + 1) * x[e]. Reduction results
+    // start at 0 and search results at the loop end, as a host must set
+    // them; elementwise launches round up to at least one work-group.
+    class KernelRunner {
+    public:
+        explicit KernelRunner(const RunOptions& Options) : Options(Options) {}
+
+        // False when a kernel fails to launch or writes outside its buffers
+        bool run(const llvm::Module& M, const std::vector<KernelInfo>& Kernels,
+                 llvm::raw_ostream& OS);
+
+    private:
+        bool runKernel(CPUExecutor& Executor, const llvm::Module& M, const KernelInfo& KInfo,
+                       llvm::raw_ostream& OS);
+
+        const RunOptions& Options;
+    };
+} // namespace cspir
@@ -0,0 +1,126 @@
+#include "kernel_variants.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <set>
+#include <tuple>
+
+namespace cspir {
+
+std::string KernelVariant::getSuffix() const {
+    std::string Suffix = "_w" + std::to_string(VectorWidth) + "_g" + std::to_string(WorkGroupSize);
+    if (Unroll > 1) {
+        Suffix += "_u" + std::to_string(Unroll);
+    }
+    if (Coarsening > 1) {
+        Suffix += "_c" + std::to_string(Coarsening);
+    }
+    return Suffix;
+}
+
+bool isValidWorkGroupSize(size_t Size, size_t MaxSize) {
+    return llvm::isPowerOf2_64(Size) && Size <= MaxSize;
+}
+
+std::vector<KernelVariant> getKernelVariants(const VariantOptions& Options,
+                                             unsigned MaxWidth, unsigned ElemBits,
+                                             bool IsReduction) {
+    // Only OpenCL vector widths; reductions unroll their loop, elementwise
+    // kernels coarsen instead
+    std::set<std::tuple<unsigned, size_t, unsigned, unsigned>> Configs;
+    for (unsigned Width : Options.Widths) {
+        Width = std::min({Width, MaxWidth, 16u});
+        Width = Width ? static_cast<unsigned>(llvm::PowerOf2Floor(Width)) : 1;
+        for (size_t GroupSize : Options.WorkGroupSizes) {
+            if (!GroupSize) {
+                continue;
+            }
+            if (IsReduction) {
+                for (unsigned Unroll : Options.UnrollFactors) {
+                    Configs.insert({Width, GroupSize, std::max(Unroll, 1u), 1});
+                }
+            } else {
+                for (unsigned Coarsening : Options.CoarseningFactors) {
+                    Configs.insert({Width, GroupSize, 1, std::max(Coarsening, 1u)});
+                }
+            }
+        }
+    }
+
+    std::vector<KernelVariant> Variants;
+    for (const auto& Config : Configs) {
+        KernelVariant Variant;
+        std::tie(Variant.VectorWidth, Variant.WorkGroupSize, Variant.Unroll,
+                 Variant.Coarsening) = Config;
+        // The analyzer picks two native registers per work-item, so a width
+        // is the right choice from half its bit width upwards
+        Variant.MinVectorBits = Variant.VectorWidth > 1 ? Variant.VectorWidth * ElemBits / 2 : 0;
+        // Wider, unrolled or coarsened variants pay off once one
+        // work-group's worth of work-items all have full vectors
+        Variant.MinTripCount = uint64_t(Variant.VectorWidth) * Variant.WorkGroupSize *
+                               Variant.Unroll * Variant.Coarsening;
+        Variants.push_back(Variant);
+    }
+    if (Variants.empty()) {
+        return Variants;
+    }
+
+    std::sort(Variants.begin(), Variants.end(), [](const KernelVariant& A, const KernelVariant& B) {
+        return std::make_tuple(A.MinVectorBits, A.MinTripCount, A.WorkGroupSize) >
+               std::make_tuple(B.MinVectorBits, B.MinTripCount, B.WorkGroupSize);
+    });
+    Variants.back().MinVectorBits = 0;
+    Variants.back().MinTripCount = 0;
+    return Variants;
+}
+
+void addVariantTable(llvm::Module& M, llvm::StringRef LoopName,
+                     llvm::ArrayRef<std::pair<llvm::Function*, KernelVariant>> Variants) {
+    auto& Ctx = M.getContext();
+    auto* I32 = llvm::Type::getInt32Ty(Ctx);
+    auto* I64 = llvm::Type::getInt64Ty(Ctx);
+    auto* Table = M.getOrInsertNamedMetadata("cspir.variants");
+    for (const auto& Entry : Variants) {
+        // Keep the last entry unconditional even if the real fallback
+        // failed to build
+        auto Variant = Entry.second;
+        if (&Entry == &Variants.back()) {
+            Variant.MinVectorBits = 0;
+            Variant.MinTripCount = 0;
+        }
+        auto Int = [](llvm::Type* Ty, uint64_t Value) {
+            return llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(Ty, Value));
+        };
+        llvm::Metadata* MDArgs[NumVariantRowOperands];
+        MDArgs[VariantLoop] = llvm::MDString::get(Ctx, LoopName);
+        MDArgs[VariantKernel] = llvm::ValueAsMetadata::get(Entry.first);
+        MDArgs[VariantWidth] = Int(I32, Variant.VectorWidth);
+        MDArgs[VariantWorkGroupSize] = Int(I32, Variant.WorkGroupSize);
+        MDArgs[VariantUnroll] = Int(I32, Variant.Unroll);
+        MDArgs[VariantCoarsening] = Int(I32, Variant.Coarsening);
+        MDArgs[VariantMinVectorBits] = Int(I32, Variant.MinVectorBits);
+        MDArgs[VariantMinTripCount] = Int(I64, Variant.MinTripCount);
+        Table->addOperand(llvm::MDNode::get(Ctx, MDArgs));
+    }
+}
+
+llvm::Function* getVariantKernel(const llvm::MDNode* Row) {
+    if (Row->getNumOperands() != NumVariantRowOperands) {
+        return nullptr;
+    }
+    return llvm::mdconst::dyn_extract_or_null<llvm::Function>(Row->getOperand(VariantKernel));
+}
+
+llvm::MDNode* getUnconditionalVariantRow(const llvm::MDNode* Row) {
+    auto& Ctx = Row->getContext();
+    llvm::SmallVector<llvm::Metadata*, NumVariantRowOperands> Operands(Row->op_begin(), Row->op_end());
+    Operands[VariantMinVectorBits] = llvm::ConstantAsMetadata::get(
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(Ctx), 0));
+    Operands[VariantMinTripCount] = llvm::ConstantAsMetadata::get(
+        llvm::ConstantInt::get(llvm::Type::getInt64Ty(Ctx), 0));
+    return llvm::MDNode::get(Ctx, Operands);
+}
+
+} // namespace cspir
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cspir {
+    // The configuration space --multi-version builds for every loop
+    struct VariantOptions {
+        bool Enabled = false;
+        std::vector<unsigned> Widths = {1, 4, 8, 16};
+        std::vector<size_t> WorkGroupSizes = {64, 256};
+        std::vector<unsigned> UnrollFactors = {1, 4};  // Reductions only
+        std::vector<unsigned> CoarseningFactors = {1, 4};  // Elementwise kernels only
+    };
+
+    // One specialization of a loop kernel and the conditions under which
+    // the host should prefer it
+    struct KernelVariant {
+        unsigned VectorWidth = 1;
+        size_t WorkGroupSize = 256;
+        unsigned Unroll = 1;         // Unroll count of the grid-stride loop
+        unsigned Coarsening = 1;     // Vectors per work-item
+        unsigned MinVectorBits = 0;  // Narrowest native vector the width is tuned for
+        uint64_t MinTripCount = 0;   // Below this a narrower variant idles fewer lanes
+
+        // "_w8_g256", plus "_u4" when unrolled and "_c4" when coarsened
+        std::string getSuffix() const;
+    };
+
+    // Work-group sizes a kernel can be built for: powers of two, which the
+    // work-group reduction tree and stencil tile shapes assume, up to the
+    // device's limit
+    bool isValidWorkGroupSize(size_t Size, size_t MaxSize);
+
+    // Widths above MaxWidth exceed a literal trip count and are never built.
+    // The result is ordered best-first and ends with an unconditional
+    // fallback, so the first entry a device accepts is the one to launch.
+    std::vector<KernelVariant> getKernelVariants(const VariantOptions& Options,
+                                                 unsigned MaxWidth, unsigned ElemBits,
+                                                 bool IsReduction);
+
+    // Appends one selector entry per variant to !cspir.variants:
+    //   !{!"loop", kernel, i32 width, i32 wg size, i32 unroll, i32 coarsening,
+    //     i32 min vector bits, i64 min trip count}
+    // A host scans a loop's entries in order and launches the first whose
+    // min vector bits <= the device's native vector bits, wg size <= its
+    // max work-group size and min trip count <= n. Entries describe the
+    // kernels as generated, so wg size is the size to launch with.
+    void addVariantTable(llvm::Module& M, llvm::StringRef LoopName,
+                         llvm::ArrayRef<std::pair<llvm::Function*, KernelVariant>> Variants);
+
+    // Operand positions of a !cspir.variants entry
+    enum VariantRowOperand : unsigned {
+        VariantLoop,
+        VariantKernel,
+        VariantWidth,
+        VariantWorkGroupSize,
+        VariantUnroll,
+        VariantCoarsening,
+        VariantMinVectorBits,
+        VariantMinTripCount,
+        NumVariantRowOperands
+    };
+
+    // The kernel an entry selects, null when it is not a function
+    llvm::Function* getVariantKernel(const llvm::MDNode* Row);
+
+    // Row with its conditions cleared, so that it matches on any device
+    // like a table's last entry; for a module holding that variant alone
+    llvm::MDNode* getUnconditionalVariantRow(const llvm::MDNode* Row);
+} // namespace cspir
@@ -1,14 +1,200 @@
 // main.cpp
 #include "parser.h"
+#include "llvm/Support/CommandLine.h"
+
+static llvm::cl::OptionCategory CspirCategory("cspir options");
+
+static llvm::cl::opt<std::string> InputFile(
+    llvm::cl::Positional, llvm::cl::desc("<source-file>"),
+    llvm::cl::Required, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<std::string> DeviceName(
+    "device", llvm::cl::desc("Target device profile used for vector width selection"),
+    llvm::cl::init("generic"), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<cspir::KernelOptLevel> OptLevel(
+    "kernel-opt", llvm::cl::desc("Optimization pipeline run over the kernel module"),
+    llvm::cl::values(
+        clEnumValN(cspir::KernelOptLevel::O0, "O0", "No optimization"),
+        clEnumValN(cspir::KernelOptLevel::O1, "O1", "LLVM default O1 pipeline"),
+        clEnumValN(cspir::KernelOptLevel::O2, "O2", "LLVM default O2 pipeline"),
+        clEnumValN(cspir::KernelOptLevel::O3, "O3", "LLVM default O3 pipeline"),
+        clEnumValN(cspir::KernelOptLevel::Kernel, "kernel",
+                   "Kernel-oriented SROA/GVN/unroll/DCE pipeline")),
+    llvm::cl::init(cspir::KernelOptLevel::Kernel), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<cspir::ReductionStrategy> Reduction(
+    "reduction-strategy", llvm::cl::desc("How reduction kernels combine values within a work-group"),
+    llvm::cl::values(
+        clEnumValN(cspir::ReductionStrategy::WorkGroupTree, "tree",
+                   "Local-memory tree with a barrier per step"),
+        clEnumValN(cspir::ReductionStrategy::SubGroup, "subgroup",
+                   "sub_group_reduce_add (cl_khr_subgroups) with one local-memory pass")),
+    llvm::cl::init(cspir::ReductionStrategy::WorkGroupTree), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<cspir::ReductionCombine> Combine(
+    "reduction-combine", llvm::cl::desc("How reduction kernels merge work-group results"),
+    llvm::cl::values(
+        clEnumValN(cspir::ReductionCombine::Atomic, "atomic",
+                   "One relaxed atomic add per work-group"),
+        clEnumValN(cspir::ReductionCombine::TwoStage, "two-stage",
+                   "Per-group partials reduced by a second kernel, no atomics"),
+        clEnumValN(cspir::ReductionCombine::Deterministic, "deterministic",
+                   "Two-stage over a fixed grid, bitwise reproducible results")),
+    llvm::cl::init(cspir::ReductionCombine::Atomic), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<cspir::PrecisionPolicy> Precision(
+    "precision", llvm::cl::desc("Floating-point freedom of the generated kernels"),
+    llvm::cl::values(
+        clEnumValN(cspir::PrecisionPolicy::Strict, "strict",
+                   "IEEE operations exactly as written in the loop"),
+        clEnumValN(cspir::PrecisionPolicy::Contract, "contract",
+                   "Fuse a*b+c into llvm.fmuladd within an expression"),
+        clEnumValN(cspir::PrecisionPolicy::Fast, "fast",
+                   "All fast-math flags; reductions may reassociate")),
+    llvm::cl::init(cspir::PrecisionPolicy::Strict), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<cspir::StorageFormat> Storage(
+    "storage", llvm::cl::desc("In-memory format of float buffers; kernels still compute in float"),
+    llvm::cl::values(
+        clEnumValN(cspir::StorageFormat::Native, "native", "Buffers keep their declared type"),
+        clEnumValN(cspir::StorageFormat::Half, "half",
+                   "IEEE half through vload_half/vstore_half_rte"),
+        clEnumValN(cspir::StorageFormat::BFloat16, "bf16",
+                   "bfloat16 as ushort, rounded to nearest even")),
+    llvm::cl::init(cspir::StorageFormat::Native), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<std::string> StorageBuffers(
+    "storage-buffers", llvm::cl::desc("Float buffers stored in the --storage format (default: all)"),
+    llvm::cl::value_desc("name,..."), llvm::cl::CommaSeparated, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<std::string> DeterministicKernels(
+    "deterministic", llvm::cl::desc("Reduction kernels that use the deterministic combine"),
+    llvm::cl::value_desc("kernel_line_N,..."), llvm::cl::CommaSeparated,
+    llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<bool> MultiVersion(
+    "multi-version", llvm::cl::desc("Emit several variants per loop plus a launch-time selector table"),
+    llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<unsigned> VariantWidths(
+    "variant-widths", llvm::cl::desc("Vector widths built with --multi-version (default 1,4,8,16)"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<unsigned> VariantGroupSizes(
+    "variant-group-sizes", llvm::cl::desc("Work-group sizes built with --multi-version (default 64,256)"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<unsigned> VariantUnroll(
+    "variant-unroll", llvm::cl::desc("Reduction loop unroll counts built with --multi-version (default 1,4)"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<unsigned> VariantCoarsening(
+    "variant-coarsening", llvm::cl::desc("Elementwise vectors per work-item built with --multi-version (default 1,4)"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<std::string> TuningDB(
+    "tuning-db", llvm::cl::desc("Tuning database consulted instead of the width and work-group heuristics (default: none)"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<bool> Autotune(
+    "autotune", llvm::cl::desc("Time the variants of untuned loops on the host CPU and record the winner in --tuning-db"),
+    llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<unsigned> TuneSizes(
+    "tune-sizes", llvm::cl::desc("Trip counts each variant is timed at (default 65536,1048576)"),
+    llvm::cl::CommaSeparated, llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<int> RunBound(
+    "run", llvm::cl::desc("Run each kernel once on the host CPU with every integer scalar set to n and print checksums of what it wrote"),
+    llvm::cl::value_desc("n"), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<std::string> OutputDir(
+    "o", llvm::cl::desc("Directory for emitted kernel files (default: print IR to stdout)"),
+    llvm::cl::value_desc("dir"), llvm::cl::cat(CspirCategory));
+
+static llvm::cl::list<cspir::EmitFormat> EmitFormats(
+    "emit", llvm::cl::desc("Kernel file formats written to the output directory"),
+    llvm::cl::CommaSeparated,
+    llvm::cl::values(
+        clEnumValN(cspir::EmitFormat::SPIRV, "spv", "SPIR-V binary (.bc plus a warning when LLVM has no SPIR-V backend)"),
+        clEnumValN(cspir::EmitFormat::Bitcode, "bc", "LLVM bitcode"),
+        clEnumValN(cspir::EmitFormat::Assembly, "ll", "Textual LLVM IR")),
+    llvm::cl::cat(CspirCategory));
+
+static llvm::cl::opt<bool> SplitKernels(
+    "split-kernels", llvm::cl::desc("Write one file per kernel instead of one per source file"),
+    llvm::cl::cat(CspirCategory));
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        llvm::errs() << "Usage: " << argv[0] << " <source-file>\n";
+    llvm::cl::HideUnrelatedOptions(CspirCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "C89 loop to SPIR-V kernel generator\n");
+
+    cspir::CodeGenOptions Options;
+    if (const auto *Profile = cspir::findDeviceProfile(DeviceName)) {
+        Options.Device = *Profile;
+    } else {
+        llvm::errs() << "Unknown device profile '" << DeviceName << "'. Available:";
+        for (const auto &Name : cspir::getDeviceProfileNames()) {
+            llvm::errs() << " " << Name;
+        }
+        llvm::errs() << "\n";
         return 1;
     }
 
-    cspir::C89Parser Parser;
-    if (!Parser.parseFile(argv[1])) {
+    Options.OptLevel = OptLevel;
+    Options.Reduction = Reduction;
+    Options.Combine = Combine;
+    Options.Precision = Precision;
+    Options.Storage = Storage;
+    Options.StorageBuffers.assign(StorageBuffers.begin(), StorageBuffers.end());
+    Options.DeterministicKernels.assign(DeterministicKernels.begin(), DeterministicKernels.end());
+    Options.Variants.Enabled = MultiVersion;
+    if (!VariantWidths.empty()) {
+        Options.Variants.Widths.assign(VariantWidths.begin(), VariantWidths.end());
+    }
+    for (unsigned Size : VariantGroupSizes) {
+        if (!cspir::isValidWorkGroupSize(Size, Options.Device.MaxWorkGroupSize)) {
+            llvm::errs() << "--variant-group-sizes: " << Size << " must be a power of two no larger than "
+                         << Options.Device.MaxWorkGroupSize << " (device '" << Options.Device.Name
+                         << "')\n";
+            return 1;
+        }
+    }
+    if (!VariantGroupSizes.empty()) {
+        Options.Variants.WorkGroupSizes.assign(VariantGroupSizes.begin(), VariantGroupSizes.end());
+    }
+    if (!VariantUnroll.empty()) {
+        Options.Variants.UnrollFactors.assign(VariantUnroll.begin(), VariantUnroll.end());
+    }
+    if (!VariantCoarsening.empty()) {
+        Options.Variants.CoarseningFactors.assign(VariantCoarsening.begin(), VariantCoarsening.end());
+    }
+    if (Autotune && TuningDB.empty()) {
+        llvm::errs() << "--autotune needs a --tuning-db file to record into\n";
+        return 1;
+    }
+    // Timings come from the host CPU, so they only stand for CPU profiles
+    if (Autotune && !llvm::StringRef(Options.Device.Name).startswith("cpu-")) {
+        llvm::errs() << "--autotune times kernels on the host CPU; pick a cpu-* --device, not '"
+                     << Options.Device.Name << "'\n";
+        return 1;
+    }
+    Options.Tuning.DatabasePath = TuningDB;
+    Options.Tuning.Autotune = Autotune;
+    if (!TuneSizes.empty()) {
+        Options.Tuning.Sizes.assign(TuneSizes.begin(), TuneSizes.end());
+    }
+    Options.Run.Enabled = RunBound.getNumOccurrences() > 0;
+    Options.Run.Bound = RunBound;
+    Options.Emit.OutputDir = OutputDir;
+    Options.Emit.SplitKernels = SplitKernels;
+    if (!EmitFormats.empty()) {
+        Options.Emit.Formats.assign(EmitFormats.begin(), EmitFormats.end());
+    }
+
+    cspir::C89Parser Parser(Options);
+    if (!Parser.parseFile(InputFile)) {
         llvm::errs() << "Error parsing file\n";
         return 1;
     }
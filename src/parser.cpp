@@ -1,11 +1,805 @@
 // Parser.cpp
 #include "parser.h"
+#include "expr_lowering.h"
 #include "clang/Tooling/CompilationDatabase.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Tooling/CommonOptionsParser.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cstdlib>
+#include <map>
 
 namespace cspir {
 
+    uint64_t LoopAnalyzer::getDependenceDistance(clang::ForStmt *FS, VectorizationInfo &Info) {
+        const clang::VarDecl *IV = getInductionVariable(FS);
+        if (!IV) {
+            return 0;
+        }
+
+        class AccessCollector : public clang::RecursiveASTVisitor<AccessCollector> {
+        public:
+            const clang::VarDecl *IV;
+            llvm::SmallPtrSet<const clang::ArraySubscriptExpr*, 8> Writes;
+            // Per array: (offset from the induction variable, is a write)
+            std::map<const clang::ValueDecl*, std::vector<std::pair<int64_t, bool>>> Accesses;
+
+            explicit AccessCollector(const clang::VarDecl *IV) : IV(IV) {}
+
+            bool VisitBinaryOperator(clang::BinaryOperator *BO) {
+                if (BO->isAssignmentOp()) {
+                    if (auto *ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(
+                            BO->getLHS()->IgnoreParenImpCasts())) {
+                        Writes.insert(ASE);
+                    }
+                }
+                return true;
+            }
+
+            bool VisitUnaryOperator(clang::UnaryOperator *UO) {
+                if (UO->isIncrementDecrementOp()) {
+                    if (auto *ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(
+                            UO->getSubExpr()->IgnoreParenImpCasts())) {
+                        Writes.insert(ASE);
+                    }
+                }
+                return true;
+            }
+
+            bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *ASE) {
+                int64_t Offset;
+                auto *Base = llvm::dyn_cast<clang::DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts());
+                if (Base && getIndexOffset(ASE->getIdx(), IV, Offset)) {
+                    Accesses[Base->getDecl()].push_back({Offset, Writes.count(ASE) != 0});
+                }
+                return true;
+            }
+        };
+
+        AccessCollector Collector(IV);
+        Collector.TraverseStmt(FS->getBody());
+
+        uint64_t MinDistance = 0;
+        const clang::ValueDecl *MinArray = nullptr;
+        for (const auto &Entry : Collector.Accesses) {
+            for (const auto &Write : Entry.second) {
+                if (!Write.second) {
+                    continue;
+                }
+                for (const auto &Other : Entry.second) {
+                    uint64_t Distance = static_cast<uint64_t>(std::abs(Write.first - Other.first));
+                    if (Distance != 0 && (MinDistance == 0 || Distance < MinDistance)) {
+                        MinDistance = Distance;
+                        MinArray = Entry.first;
+                    }
+                }
+            }
+        }
+        if (MinArray) {
+            Info.Reasons.push_back("Dependence distance " + std::to_string(MinDistance) +
+                                   " on array: " + MinArray->getNameAsString());
+        }
+        return MinDistance;
+    }
+
+    unsigned LoopAnalyzer::selectVectorWidth(clang::ForStmt *FS, VectorizationInfo &Info) {
+        const DeviceProfile &Device = Options.Device;
+        clang::QualType ElemTy = Info.ElementType.isNull() ? Context->FloatTy : Info.ElementType;
+        unsigned ElemBits = Context->getTypeSize(ElemTy);
+
+        // Start from two native registers per work-item to hide latency,
+        // capped at the widest OpenCL vector
+        unsigned Width = std::max(1u, std::min(16u, 2 * Device.PreferredVectorBits / ElemBits));
+        Info.Reasons.push_back("Vector width " + std::to_string(Width) + " from " +
+                               std::to_string(ElemBits) + "-bit " + ElemTy.getAsString() +
+                               " elements and " + std::to_string(Device.PreferredVectorBits) +
+                               "-bit registers (" + Device.Name + " profile)");
+
+        // Rough register pressure: every array reference and arithmetic
+        // result may be live at once, plus the store or accumulator value
+        class PressureEstimator : public clang::RecursiveASTVisitor<PressureEstimator> {
+        public:
+            unsigned LiveValues = 1;
+
+            bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *) {
+                ++LiveValues;
+                return true;
+            }
+
+            bool VisitBinaryOperator(clang::BinaryOperator *BO) {
+                if (BO->isMultiplicativeOp() || BO->isAdditiveOp()) {
+                    ++LiveValues;
+                }
+                return true;
+            }
+
+            bool VisitCallExpr(clang::CallExpr *) {
+                ++LiveValues;
+                return true;
+            }
+        };
+
+        PressureEstimator Estimator;
+        Estimator.TraverseStmt(FS->getBody());
+
+        auto RegistersNeeded = [&](unsigned W) {
+            unsigned PerVector = (W * ElemBits + Device.PreferredVectorBits - 1) /
+                                 Device.PreferredVectorBits;
+            return Estimator.LiveValues * PerVector;
+        };
+        if (RegistersNeeded(Width) > Device.NumVectorRegisters) {
+            while (Width > 1 && RegistersNeeded(Width) > Device.NumVectorRegisters) {
+                Width /= 2;
+            }
+            Info.Reasons.push_back("Register pressure (~" + std::to_string(Estimator.LiveValues) +
+                                   " live vectors, " + std::to_string(Device.NumVectorRegisters) +
+                                   " registers) limits vector width to " + std::to_string(Width));
+        }
+
+        // The device limits above are preferences, the trip count is a
+        // hard limit. Loops with a dependence never get here: their
+        // iterations would run on different work-items, so no width is legal.
+        if (Info.HasConstantTripCount && Info.TripCount > 0 && Info.TripCount < Info.MaxLegalWidth) {
+            Info.MaxLegalWidth = static_cast<unsigned>(llvm::PowerOf2Floor(Info.TripCount));
+        }
+        if (Info.HasConstantTripCount && Info.TripCount > 0 && Width > Info.TripCount) {
+            Width = static_cast<unsigned>(llvm::PowerOf2Floor(Info.TripCount));
+            Info.Reasons.push_back("Trip count limits vector width to " + std::to_string(Width));
+        }
+
+        return Width;
+    }
+
+    unsigned LoopAnalyzer::selectCoarsening(clang::ForStmt *FS, VectorizationInfo &Info) {
+        const DeviceProfile &Device = Options.Device;
+
+        // Rough per-iteration cost: memory accesses and arithmetic count
+        // one each, math calls several
+        class CostEstimator : public clang::RecursiveASTVisitor<CostEstimator> {
+        public:
+            unsigned Cost = 0;
+
+            bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *) {
+                ++Cost;
+                return true;
+            }
+
+            bool VisitBinaryOperator(clang::BinaryOperator *BO) {
+                if (!BO->isAssignmentOp() || BO->isCompoundAssignmentOp()) {
+                    ++Cost;
+                }
+                return true;
+            }
+
+            bool VisitCallExpr(clang::CallExpr *) {
+                Cost += 4;
+                return true;
+            }
+        };
+
+        CostEstimator Estimator;
+        Estimator.TraverseStmt(FS->getBody());
+        unsigned Cost = std::max(Estimator.Cost, 1u);
+
+        // A constant trip count is specialized exactly instead
+        if (Info.HasConstantTripCount || Cost >= Device.WorkItemOverhead) {
+            return 1;
+        }
+
+        // Amortize the work-item's scheduling cost over several vectors
+        unsigned Factor = std::min(8u, static_cast<unsigned>(
+            llvm::PowerOf2Floor(Device.WorkItemOverhead / Cost)));
+        Info.Reasons.push_back("Body cost ~" + std::to_string(Cost) + " against a work-item overhead of " +
+                               std::to_string(Device.WorkItemOverhead) + ": coarsening by " +
+                               std::to_string(Factor));
+        return Factor;
+    }
+
+    bool LoopAnalyzer::analyzeStencil(clang::ForStmt *FS, VectorizationInfo &Info) {
+        const clang::VarDecl *IV = getInductionVariable(FS);
+        if (!IV) {
+            return false;
+        }
+
+        // Reads of every array the body never writes, by stencil offset
+        class StencilCollector : public clang::RecursiveASTVisitor<StencilCollector> {
+        public:
+            struct Access {
+                const clang::VarDecl *Array;
+                clang::QualType Type;
+                const clang::ValueDecl *Pitch;  // Null for a plain or irregular subscript
+                int64_t Row, Col;
+                bool IsStencil;
+            };
+
+            const clang::VarDecl *IV;
+            llvm::SmallPtrSet<const clang::ValueDecl*, 8> Written;
+            llvm::SmallPtrSet<const clang::ValueDecl*, 8> Locals;
+            llvm::SmallPtrSet<const clang::ArraySubscriptExpr*, 8> Stores;
+            std::vector<Access> Reads;
+
+            explicit StencilCollector(const clang::VarDecl *IV) : IV(IV) {}
+
+            bool VisitVarDecl(clang::VarDecl *VD) {
+                Locals.insert(VD);
+                return true;
+            }
+
+            bool VisitBinaryOperator(clang::BinaryOperator *BO) {
+                if (BO->isAssignmentOp()) {
+                    markWritten(BO->getLHS());
+                }
+                return true;
+            }
+
+            bool VisitUnaryOperator(clang::UnaryOperator *UO) {
+                if (UO->isIncrementDecrementOp()) {
+                    markWritten(UO->getSubExpr());
+                }
+                return true;
+            }
+
+            bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *ASE) {
+                auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts());
+                auto *Array = DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+                if (!Array || Stores.count(ASE)) {
+                    return true;
+                }
+                Access A{Array, ASE->getType(), nullptr, 0, 0, false};
+                A.IsStencil = getStencilOffset(ASE->getIdx(), IV, A.Pitch, A.Row, A.Col);
+                Reads.push_back(A);
+                return true;
+            }
+
+        private:
+            void markWritten(clang::Expr *E) {
+                if (auto *ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(E->IgnoreParenImpCasts())) {
+                    Stores.insert(ASE);
+                    if (auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts())) {
+                        Written.insert(DRE->getDecl());
+                    }
+                }
+            }
+        };
+
+        StencilCollector Collector(IV);
+        Collector.TraverseStmt(FS->getBody());
+
+        // The row pitch must be one value for the whole launch
+        const clang::ValueDecl *Pitch = nullptr;
+        llvm::SmallPtrSet<const clang::ValueDecl*, 8> Irregular;
+        for (const auto &Read : Collector.Reads) {
+            if (!Read.IsStencil || Collector.Locals.count(Read.Pitch) ||
+                (Read.Pitch && Pitch && Read.Pitch != Pitch)) {
+                Irregular.insert(Read.Array);
+            } else if (Read.Pitch) {
+                Pitch = Read.Pitch;
+            }
+        }
+
+        // Inputs read at two or more offsets share elements between
+        // neighbouring iterations; one offset gains nothing from a tile
+        StencilInfo Stencil;
+        for (const auto &Read : Collector.Reads) {
+            if (Collector.Written.count(Read.Array) || Irregular.count(Read.Array)) {
+                continue;
+            }
+            auto It = std::find_if(Stencil.Inputs.begin(), Stencil.Inputs.end(),
+                                   [&](const StencilInput &I) { return I.Array == Read.Array; });
+            if (It == Stencil.Inputs.end()) {
+                StencilInput Input;
+                Input.Array = Read.Array;
+                Input.Type = Read.Type.getUnqualifiedType();
+                Input.MinRow = Input.MaxRow = Read.Row;
+                Input.MinCol = Input.MaxCol = Read.Col;
+                Stencil.Inputs.push_back(Input);
+                It = std::prev(Stencil.Inputs.end());
+            }
+            std::pair<int64_t, int64_t> Offset(Read.Row, Read.Col);
+            if (std::find(It->Offsets.begin(), It->Offsets.end(), Offset) == It->Offsets.end()) {
+                It->Offsets.push_back(Offset);
+                It->MinRow = std::min(It->MinRow, Read.Row);
+                It->MaxRow = std::max(It->MaxRow, Read.Row);
+                It->MinCol = std::min(It->MinCol, Read.Col);
+                It->MaxCol = std::max(It->MaxCol, Read.Col);
+            }
+        }
+        Stencil.Inputs.erase(std::remove_if(Stencil.Inputs.begin(), Stencil.Inputs.end(),
+                                            [](const StencilInput &I) { return I.Offsets.size() < 2; }),
+                             Stencil.Inputs.end());
+        if (Stencil.Inputs.empty()) {
+            return false;
+        }
+
+        bool IsPitched = false;
+        for (const auto &Input : Stencil.Inputs) {
+            IsPitched |= Input.MinRow != Input.MaxRow || Input.MinRow != 0;
+            std::string Shape = "columns " + std::to_string(Input.MinCol) + ".." +
+                                std::to_string(Input.MaxCol);
+            if (Input.MinRow != 0 || Input.MaxRow != 0) {
+                Shape = "rows " + std::to_string(Input.MinRow) + ".." +
+                        std::to_string(Input.MaxRow) + " of pitch " +
+                        Pitch->getNameAsString() + ", " + Shape;
+            }
+            Info.Reasons.push_back("Stencil input '" + Input.Array->getNameAsString() + "': " +
+                                   std::to_string(Input.Offsets.size()) + " neighbouring reads (" +
+                                   Shape + ")");
+        }
+        Stencil.Pitch = IsPitched ? llvm::cast<clang::VarDecl>(Pitch) : nullptr;
+        Info.Stencil = Stencil;
+        return true;
+    }
+
+    // S itself, or the only statement of a block around it
+    static const clang::Stmt *getOnlyStmt(const clang::Stmt *S) {
+        while (auto *CS = llvm::dyn_cast_or_null<clang::CompoundStmt>(S)) {
+            if (CS->size() != 1) {
+                return nullptr;
+            }
+            S = CS->body_front();
+        }
+        return S;
+    }
+
+    // Matches Array[r][c] of a 2-D array, and the flattened Array[r*ld + c],
+    // Array[c + r*ld] and Array[ld*r + c], where r and c are distinct
+    // loop variables of the nest and ld is a literal or an integer variable
+    static bool matchMatrixOperand(const clang::Expr *E, llvm::ArrayRef<const clang::VarDecl*> Vars,
+                                 clang::ASTContext &Context, MatrixOperand &Op,
+                                 const clang::VarDecl *&Row, const clang::VarDecl *&Col) {
+        auto GetVar = [](const clang::Expr *X) -> const clang::VarDecl* {
+            auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(X->IgnoreParenImpCasts());
+            return DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+        };
+        auto GetLoopVar = [&](const clang::Expr *X) -> const clang::VarDecl* {
+            auto *VD = GetVar(X);
+            return VD && llvm::is_contained(Vars, VD) ? VD : nullptr;
+        };
+
+        auto *ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(E->IgnoreParenImpCasts());
+        if (!ASE) {
+            return false;
+        }
+        Op = MatrixOperand();
+        if (auto *Inner = llvm::dyn_cast<clang::ArraySubscriptExpr>(ASE->getBase()->IgnoreParenImpCasts())) {
+            auto *RowType = Context.getAsConstantArrayType(Inner->getType());
+            Op.Array = GetVar(Inner->getBase());
+            Row = GetLoopVar(Inner->getIdx());
+            Col = GetLoopVar(ASE->getIdx());
+            if (!RowType || !Op.Array || !Row || !Col || Row == Col) {
+                return false;
+            }
+            Op.ConstantStride = RowType->getSize().getZExtValue();
+            return true;
+        }
+
+        Op.Array = GetVar(ASE->getBase());
+        auto *Add = llvm::dyn_cast<clang::BinaryOperator>(ASE->getIdx()->IgnoreParenImpCasts());
+        if (!Op.Array || !Add || Add->getOpcode() != clang::BO_Add) {
+            return false;
+        }
+        const clang::Expr *ColExpr = Add->getRHS();
+        auto *Mul = llvm::dyn_cast<clang::BinaryOperator>(Add->getLHS()->IgnoreParenImpCasts());
+        if (!Mul || Mul->getOpcode() != clang::BO_Mul) {
+            ColExpr = Add->getLHS();
+            Mul = llvm::dyn_cast<clang::BinaryOperator>(Add->getRHS()->IgnoreParenImpCasts());
+        }
+        if (!Mul || Mul->getOpcode() != clang::BO_Mul) {
+            return false;
+        }
+        const clang::Expr *Stride = Mul->getRHS();
+        Row = GetLoopVar(Mul->getLHS());
+        if (!Row) {
+            Row = GetLoopVar(Mul->getRHS());
+            Stride = Mul->getLHS();
+        }
+        Col = GetLoopVar(ColExpr);
+        if (!Row || !Col || Row == Col) {
+            return false;
+        }
+
+        if (auto *Lit = llvm::dyn_cast<clang::IntegerLiteral>(Stride->IgnoreParenImpCasts())) {
+            Op.ConstantStride = Lit->getValue().getZExtValue();
+            return Op.ConstantStride > 0;
+        }
+        Op.Stride = GetVar(Stride);
+        return Op.Stride && !GetLoopVar(Stride) && Op.Stride->getType()->isIntegerType();
+    }
+
+    // A loop of a blocked nest: counted from 0 to a literal or an integer
+    // variable
+    static bool getNestBounds(const clang::ForStmt *Loop, LoopBounds &Bounds) {
+        if (!Loop || !getLoopBounds(Loop, Bounds) || Bounds.Lower != 0 || Bounds.Inclusive) {
+            return false;
+        }
+        auto *Upper = Bounds.Upper->IgnoreParenImpCasts();
+        auto *Ref = llvm::dyn_cast<clang::DeclRefExpr>(Upper);
+        auto *Var = Ref ? llvm::dyn_cast<clang::VarDecl>(Ref->getDecl()) : nullptr;
+        return llvm::isa<clang::IntegerLiteral>(Upper) || (Var && Var->getType()->isIntegerType());
+    }
+
+    // "a[k][i]" for element (Row, Col) of Op as the source indexes it
+    static std::string describeElement(const MatrixOperand &Op, const clang::VarDecl *Row,
+                                       const clang::VarDecl *Col) {
+        return Op.Array->getNameAsString() + "[" + (Op.Transposed ? Col : Row)->getNameAsString() +
+               "][" + (Op.Transposed ? Row : Col)->getNameAsString() + "]";
+    }
+
+    static std::string printExpr(const clang::Expr *E, clang::ASTContext &Context) {
+        std::string Text;
+        llvm::raw_string_ostream OS(Text);
+        E->printPretty(OS, nullptr, Context.getPrintingPolicy());
+        return OS.str();
+    }
+
+    bool LoopAnalyzer::analyzeGemm(clang::ForStmt *FS, VectorizationInfo &Info) {
+        LoopBounds Outer, Middle, Inner;
+        auto *MiddleLoop = llvm::dyn_cast_or_null<clang::ForStmt>(getOnlyStmt(FS->getBody()));
+        if (!getNestBounds(FS, Outer) || !getNestBounds(MiddleLoop, Middle)) {
+            return false;
+        }
+
+        auto IsZero = [](const clang::Expr *E) {
+            E = E->IgnoreParenImpCasts();
+            if (auto *Int = llvm::dyn_cast<clang::IntegerLiteral>(E)) {
+                return Int->getValue() == 0;
+            }
+            auto *FP = llvm::dyn_cast<clang::FloatingLiteral>(E);
+            return FP && FP->getValue().isPosZero();
+        };
+        auto GetZeroed = [&](const clang::Stmt *S) -> const clang::VarDecl* {
+            if (auto *DS = llvm::dyn_cast<clang::DeclStmt>(S)) {
+                auto *VD = DS->isSingleDecl() ? llvm::dyn_cast<clang::VarDecl>(DS->getSingleDecl()) : nullptr;
+                return VD && VD->getInit() && IsZero(VD->getInit()) ? VD : nullptr;
+            }
+            auto *BO = llvm::dyn_cast<clang::BinaryOperator>(S);
+            if (!BO || BO->getOpcode() != clang::BO_Assign || !IsZero(BO->getRHS())) {
+                return nullptr;
+            }
+            auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(BO->getLHS()->IgnoreParenImpCasts());
+            return DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+        };
+
+        // The products go straight into C, or a scalar sums them first:
+        // s = 0; for (k ...) s += A*B; C = s;
+        auto *InnerLoop = llvm::dyn_cast_or_null<clang::ForStmt>(getOnlyStmt(MiddleLoop->getBody()));
+        const clang::VarDecl *Sum = nullptr;
+        const clang::Stmt *Store = nullptr;
+        if (!InnerLoop) {
+            auto *Block = llvm::dyn_cast<clang::CompoundStmt>(MiddleLoop->getBody());
+            if (!Block || Block->size() != 3) {
+                return false;
+            }
+            auto It = Block->body_begin();
+            Sum = GetZeroed(*It);
+            InnerLoop = llvm::dyn_cast<clang::ForStmt>(*++It);
+            Store = *++It;
+            if (!Sum || !InnerLoop) {
+                return false;
+            }
+        }
+        if (!getNestBounds(InnerLoop, Inner) || Outer.IV == Middle.IV || Outer.IV == Inner.IV ||
+            Middle.IV == Inner.IV) {
+            return false;
+        }
+        const clang::VarDecl *Vars[] = {Outer.IV, Middle.IV, Inner.IV};
+
+        // T += x, T = T + x or T = x + T; returns x
+        auto Same = [&](const clang::Expr *X, const clang::Expr *Y) {
+            llvm::FoldingSetNodeID XID, YID;
+            X->IgnoreParenImpCasts()->Profile(XID, *Context, true);
+            Y->IgnoreParenImpCasts()->Profile(YID, *Context, true);
+            return XID == YID;
+        };
+        auto GetAddend = [&](const clang::Stmt *S, const clang::Expr *&Target) -> const clang::Expr* {
+            auto *BO = llvm::dyn_cast_or_null<clang::BinaryOperator>(S);
+            if (!BO) {
+                return nullptr;
+            }
+            Target = BO->getLHS()->IgnoreParenImpCasts();
+            if (BO->getOpcode() == clang::BO_AddAssign) {
+                return BO->getRHS();
+            }
+            auto *Add = llvm::dyn_cast<clang::BinaryOperator>(BO->getRHS()->IgnoreParenImpCasts());
+            if (BO->getOpcode() != clang::BO_Assign || !Add || Add->getOpcode() != clang::BO_Add) {
+                return nullptr;
+            }
+            if (Same(Add->getLHS(), Target)) {
+                return Add->getRHS();
+            }
+            return Same(Add->getRHS(), Target) ? Add->getLHS() : nullptr;
+        };
+
+        GemmInfo Gemm;
+        const clang::Expr *Target = nullptr;
+        const clang::Expr *Product = GetAddend(getOnlyStmt(InnerLoop->getBody()), Target);
+        const clang::Expr *CRef = Target;
+        Gemm.Accumulate = true;
+        if (Sum) {
+            // C = s, or C += s
+            auto *SumRef = llvm::dyn_cast_or_null<clang::DeclRefExpr>(Target);
+            auto *Assign = llvm::dyn_cast<clang::BinaryOperator>(Store);
+            auto *Value = Assign ? llvm::dyn_cast<clang::DeclRefExpr>(Assign->getRHS()->IgnoreParenImpCasts())
+                                 : nullptr;
+            if (!SumRef || SumRef->getDecl() != Sum || !Value || Value->getDecl() != Sum ||
+                (Assign->getOpcode() != clang::BO_Assign && Assign->getOpcode() != clang::BO_AddAssign)) {
+                return false;
+            }
+            CRef = Assign->getLHS();
+            Gemm.PartialSum = true;
+            Gemm.Accumulate = Assign->getOpcode() == clang::BO_AddAssign;
+        }
+        auto *Mul = Product ? llvm::dyn_cast<clang::BinaryOperator>(Product->IgnoreParenImpCasts()) : nullptr;
+        if (!CRef || !Mul || Mul->getOpcode() != clang::BO_Mul) {
+            return false;
+        }
+
+        // C names i and j; k is the remaining variable, and a scalar sum
+        // only runs over the inner loop
+        const clang::VarDecl *I, *J, *LeftRow, *LeftCol, *RightRow, *RightCol;
+        MatrixOperand Left, Right;
+        if (!matchMatrixOperand(CRef, Vars, *Context, Gemm.C, I, J) ||
+            !matchMatrixOperand(Mul->getLHS(), Vars, *Context, Left, LeftRow, LeftCol) ||
+            !matchMatrixOperand(Mul->getRHS(), Vars, *Context, Right, RightRow, RightCol)) {
+            return false;
+        }
+        const clang::VarDecl *K = nullptr;
+        for (const auto *Var : Vars) {
+            if (Var != I && Var != J) {
+                K = Var;
+            }
+        }
+        if (Sum && K != Inner.IV) {
+            return false;
+        }
+
+        // A is the operand indexed by i and k, B the one indexed by k and j
+        auto Indexes = [](const clang::VarDecl *Row, const clang::VarDecl *Col,
+                          const clang::VarDecl *X, const clang::VarDecl *Y) {
+            return (Row == X && Col == Y) || (Row == Y && Col == X);
+        };
+        if (Indexes(LeftRow, LeftCol, I, K) && Indexes(RightRow, RightCol, K, J)) {
+            Gemm.A = Left;
+            Gemm.A.Transposed = LeftRow == K;
+            Gemm.B = Right;
+            Gemm.B.Transposed = RightRow == J;
+        } else if (Indexes(RightRow, RightCol, I, K) && Indexes(LeftRow, LeftCol, K, J)) {
+            Gemm.A = Right;
+            Gemm.A.Transposed = RightRow == K;
+            Gemm.B = Left;
+            Gemm.B.Transposed = LeftRow == J;
+        } else {
+            return false;
+        }
+
+        // Bounds and leading dimensions must be launch constants
+        auto BoundOf = [&](const clang::VarDecl *Var) {
+            return (Var == Outer.IV ? Outer : Var == Middle.IV ? Middle : Inner).Upper->IgnoreParenImpCasts();
+        };
+        Gemm.M = BoundOf(I);
+        Gemm.N = BoundOf(J);
+        Gemm.K = BoundOf(K);
+        for (const auto *Bound : {Gemm.M, Gemm.N, Gemm.K}) {
+            auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(Bound);
+            if (DRE && (llvm::is_contained(Vars, DRE->getDecl()) || DRE->getDecl() == Sum)) {
+                return false;
+            }
+        }
+        if (Gemm.C.Array == Gemm.A.Array || Gemm.C.Array == Gemm.B.Array) {
+            Info.Reasons.push_back("GEMM nest writes an input matrix; not tiled");
+            return false;
+        }
+        for (const auto *Op : {&Gemm.A, &Gemm.B, &Gemm.C}) {
+            if (Op->Stride && Op->Stride == Sum) {
+                return false;
+            }
+        }
+
+        clang::QualType ElemTy = CRef->getType().getCanonicalType().getUnqualifiedType();
+        auto SameType = [&](clang::QualType QT) {
+            return QT.getCanonicalType().getUnqualifiedType() == ElemTy;
+        };
+        if (!ElemTy->isArithmeticType() || !SameType(Mul->getLHS()->IgnoreParenImpCasts()->getType()) ||
+            !SameType(Mul->getRHS()->IgnoreParenImpCasts()->getType()) ||
+            (Sum && !SameType(Sum->getType()))) {
+            Info.Reasons.push_back("GEMM nest mixes element types; not tiled");
+            return false;
+        }
+
+        auto Name = [](const clang::VarDecl *Var) { return Var->getNameAsString(); };
+        auto Bound = [&](const clang::Expr *E) { return printExpr(E, *Context); };
+        Info.Reasons.push_back("GEMM nest: " + describeElement(Gemm.C, I, J) +
+                               (Gemm.Accumulate ? " += " : " = ") + "sum over " + Name(K) + " < " +
+                               Bound(Gemm.K) + " of " + describeElement(Gemm.A, I, K) + " * " +
+                               describeElement(Gemm.B, K, J) + ", " + Name(I) + " < " + Bound(Gemm.M) +
+                               ", " + Name(J) + " < " + Bound(Gemm.N));
+
+        // Register tiles are one native vector wide
+        unsigned ElemBits = Context->getTypeSize(ElemTy);
+        Info.RecommendedWidth = std::max(1u, std::min(8u, Options.Device.PreferredVectorBits / ElemBits));
+        Info.Reasons.push_back("Register tile columns: " + std::to_string(Info.RecommendedWidth) +
+                               " from " + std::to_string(Options.Device.PreferredVectorBits) +
+                               "-bit registers (" + Options.Device.Name + " profile)");
+
+        // The kernel covers the whole nest; its inner loops get no kernels
+        NestedLoops.insert(MiddleLoop);
+        NestedLoops.insert(InnerLoop);
+        Info.Gemm = Gemm;
+        Info.ElementType = ElemTy;
+        Info.IsVectorizable = true;
+        return true;
+    }
+
+    bool LoopAnalyzer::analyzeTranspose(clang::ForStmt *FS, VectorizationInfo &Info) {
+        LoopBounds Outer, Inner;
+        auto *InnerLoop = llvm::dyn_cast_or_null<clang::ForStmt>(getOnlyStmt(FS->getBody()));
+        if (!getNestBounds(FS, Outer) || !getNestBounds(InnerLoop, Inner) || Outer.IV == Inner.IV) {
+            return false;
+        }
+        auto *Copy = llvm::dyn_cast_or_null<clang::BinaryOperator>(getOnlyStmt(InnerLoop->getBody()));
+        if (!Copy || Copy->getOpcode() != clang::BO_Assign) {
+            return false;
+        }
+
+        // i and j are the row and column of the element read; the one
+        // written swaps them
+        const clang::VarDecl *Vars[] = {Outer.IV, Inner.IV};
+        const clang::VarDecl *I, *J, *OutRow, *OutCol;
+        TransposeInfo Transpose;
+        if (!matchMatrixOperand(Copy->getRHS(), Vars, *Context, Transpose.In, I, J) ||
+            !matchMatrixOperand(Copy->getLHS(), Vars, *Context, Transpose.Out, OutRow, OutCol) ||
+            OutRow != J || OutCol != I) {
+            return false;
+        }
+        Transpose.Out.Transposed = true;
+        if (Transpose.In.Array == Transpose.Out.Array) {
+            Info.Reasons.push_back("Transpose in place; not tiled");
+            return false;
+        }
+
+        clang::QualType ElemTy = Copy->getType().getCanonicalType().getUnqualifiedType();
+        clang::QualType InTy = Copy->getRHS()->IgnoreParenImpCasts()->getType();
+        if (!ElemTy->isArithmeticType() || InTy.getCanonicalType().getUnqualifiedType() != ElemTy) {
+            Info.Reasons.push_back("Transpose converts its elements; not tiled");
+            return false;
+        }
+
+        Transpose.Rows = (I == Outer.IV ? Outer : Inner).Upper->IgnoreParenImpCasts();
+        Transpose.Columns = (J == Outer.IV ? Outer : Inner).Upper->IgnoreParenImpCasts();
+        Info.Reasons.push_back("Transpose: " + describeElement(Transpose.Out, I, J) + " = " +
+                               describeElement(Transpose.In, I, J) + ", " + I->getNameAsString() +
+                               " < " + printExpr(Transpose.Rows, *Context) + ", " +
+                               J->getNameAsString() + " < " + printExpr(Transpose.Columns, *Context));
+
+        NestedLoops.insert(InnerLoop);
+        Info.Transpose = Transpose;
+        Info.ElementType = ElemTy;
+        Info.RecommendedWidth = 1;
+        Info.IsVectorizable = true;
+        return true;
+    }
+
+    bool LoopAnalyzer::analyzeSearch(clang::ForStmt *FS, VectorizationInfo &Info) {
+        LoopBounds Bounds;
+        auto *If = llvm::dyn_cast_or_null<clang::IfStmt>(getOnlyStmt(FS->getBody()));
+        if (!If || If->getElse() || If->getInit() || If->getConditionVariable() ||
+            !getLoopBounds(FS, Bounds)) {
+            return false;
+        }
+
+        // The exit: assignments of iv or a literal, then break or return
+        llvm::SmallVector<const clang::Stmt*, 4> Exit;
+        if (auto *CS = llvm::dyn_cast<clang::CompoundStmt>(If->getThen())) {
+            Exit.append(CS->body_begin(), CS->body_end());
+        } else {
+            Exit.push_back(If->getThen());
+        }
+        if (Exit.empty() || (!llvm::isa<clang::BreakStmt>(Exit.back()) &&
+                             !llvm::isa<clang::ReturnStmt>(Exit.back()))) {
+            return false;
+        }
+
+        auto IsIV = [&](const clang::Expr *E) {
+            auto *DRE = llvm::dyn_cast<clang::DeclRefExpr>(E->IgnoreParenImpCasts());
+            return DRE && DRE->getDecl() == Bounds.IV;
+        };
+        auto IsLiteral = [](const clang::Expr *E) {
+            E = E->IgnoreParenImpCasts();
+            if (auto *UO = llvm::dyn_cast<clang::UnaryOperator>(E)) {
+                if (UO->getOpcode() == clang::UO_Minus || UO->getOpcode() == clang::UO_Plus) {
+                    E = UO->getSubExpr()->IgnoreParenImpCasts();
+                }
+            }
+            return llvm::isa<clang::IntegerLiteral>(E) || llvm::isa<clang::FloatingLiteral>(E) ||
+                   llvm::isa<clang::CharacterLiteral>(E);
+        };
+
+        SearchInfo Search;
+        Search.Condition = If->getCond();
+        for (const auto *S : llvm::makeArrayRef(Exit).drop_back()) {
+            auto *Assign = llvm::dyn_cast<clang::BinaryOperator>(S);
+            auto *LHS = Assign ? llvm::dyn_cast<clang::DeclRefExpr>(Assign->getLHS()->IgnoreParens())
+                               : nullptr;
+            auto *Var = LHS ? llvm::dyn_cast<clang::VarDecl>(LHS->getDecl()) : nullptr;
+            if (!Var || Assign->getOpcode() != clang::BO_Assign || Var == Bounds.IV ||
+                (!IsIV(Assign->getRHS()) && !IsLiteral(Assign->getRHS()))) {
+                Info.Reasons.push_back("Search loop exit does more than assign the index or a literal");
+                return false;
+            }
+            if (IsIV(Assign->getRHS()) && !Search.Index) {
+                Search.Index = Var;
+            }
+            Search.Assignments.push_back({Var, Assign->getRHS()});
+        }
+        if (auto *Return = llvm::dyn_cast<clang::ReturnStmt>(Exit.back())) {
+            Search.Returns = true;
+            Search.ReturnValue = Return->getRetValue();
+            if (Search.ReturnValue && !IsIV(Search.ReturnValue) && !IsLiteral(Search.ReturnValue)) {
+                Info.Reasons.push_back("Search loop returns more than the index or a literal");
+                return false;
+            }
+        }
+
+        // A break leaves an iv declared outside the loop at the first match
+        bool IVEscapes = !llvm::isa<clang::DeclStmt>(FS->getInit());
+        if (IVEscapes && !Search.Returns) {
+            Search.Index = Bounds.IV;
+        }
+        if (!Search.Index && Search.Assignments.empty() && !Search.Returns) {
+            Info.Reasons.push_back("Search loop has no observable result");
+            return false;
+        }
+        // The first-match buffer and its atomic min work in int
+        auto IsInt = [&](const clang::VarDecl *Var) {
+            return Context->hasSameType(Var->getType().getUnqualifiedType(), Context->IntTy);
+        };
+        if (!IsInt(Bounds.IV) || (Search.Index && !IsInt(Search.Index))) {
+            Info.Reasons.push_back("Search index is not int");
+            return false;
+        }
+
+        std::string Reason;
+        if (Search.Condition->HasSideEffects(*Context)) {
+            Info.Reasons.push_back("Search condition has side effects");
+            return false;
+        }
+        if (!ExprLowering::canLowerExpr(Search.Condition, Bounds.IV, Reason)) {
+            Info.Reasons.push_back("Search condition: " + Reason);
+            return false;
+        }
+
+        // Host side: what runs once the first match is known
+        std::string Epilogue;
+        for (const auto &Assignment : Search.Assignments) {
+            Epilogue += (Epilogue.empty() ? "" : ", ") + Assignment.first->getNameAsString() + " = " +
+                        printExpr(Assignment.second, *Context);
+        }
+        if (Search.Returns) {
+            Epilogue += (Epilogue.empty() ? "return" : ", return") +
+                        (Search.ReturnValue ? " " + printExpr(Search.ReturnValue, *Context) : "");
+        }
+        bool FindsIndex = Search.Index || (Search.ReturnValue && IsIV(Search.ReturnValue));
+        Info.Reasons.push_back(std::string(FindsIndex ? "Search: first " : "Search: any/all test, first ") +
+                               Bounds.IV->getNameAsString() + " with " +
+                               printExpr(Search.Condition, *Context) +
+                               (Epilogue.empty() ? "" : ", then " + Epilogue));
+
+        if (auto *Upper = llvm::dyn_cast<clang::IntegerLiteral>(Bounds.Upper->IgnoreParenImpCasts())) {
+            int64_t End = Upper->getValue().getSExtValue() + (Bounds.Inclusive ? 1 : 0);
+            Info.HasConstantTripCount = End > Bounds.Lower;
+            Info.TripCount = Info.HasConstantTripCount ? static_cast<uint64_t>(End - Bounds.Lower) : 0;
+        }
+        checkTypes(FS->getBody(), Info);
+        Info.Search = Search;
+        Info.IsVectorizable = true;
+        // Lanes only evaluate the condition; where the match lies decides
+        // a search's run time, so the tuner leaves it alone
+        Info.RecommendedWidth = selectVectorWidth(FS, Info);
+        return true;
+    }
+
     bool LoopAnalyzer::isSimpleVectorizablePattern(clang::ForStmt *FS) {
         class PatternMatcher : public clang::RecursiveASTVisitor<PatternMatcher> {
         public:
@@ -79,6 +873,7 @@ namespace cspir {
         class TypeChecker : public clang::RecursiveASTVisitor<TypeChecker> {
         public:
             bool HasMixedTypes = false;
+            clang::QualType ElementType;
             std::vector<std::string> &Reasons;
             llvm::SmallSet<clang::QualType, 4> ComputationTypes;
             llvm::SmallSet<clang::QualType, 4> IndexTypes;
@@ -93,6 +888,9 @@ namespace cspir {
                         Type = ASE->getType();
                         if (Type->isFloatingType() || Type->isIntegerType()) {
                             ComputationTypes.insert(Type);
+                            if (ElementType.isNull()) {
+                                ElementType = Type.getUnqualifiedType();
+                            }
                         }
                         // Index type should be ignored for mixed type check
                         IndexTypes.insert(ASE->getIdx()->getType());
@@ -131,6 +929,7 @@ namespace cspir {
 
         TypeChecker Checker(Info.Reasons);
         Checker.TraverseStmt(Body);
+        Info.ElementType = Checker.ElementType;
         return !Checker.HasMixedTypes;
     }
 
@@ -168,49 +967,45 @@ namespace cspir {
             .IsVectorizable = false,
             .Reasons = {},
             .RecommendedWidth = 0,
+            .MaxLegalWidth = 16,
+            .WorkGroupSize = 0,
+            .UnrollFactor = 0,
+            .CoarseningFactor = 0,
             .IsReduction = false,
             .IsSimplePattern = false,
+            .IsElementwise = false,
             .HasConstantTripCount = false,
-            .TripCount = 0
+            .TripCount = 0,
+            .ElementType = clang::QualType(),
+            .Stencil = {},
+            .Gemm = {},
+            .Transpose = {},
+            .Search = {}
         };
 
-        // First check for dependencies
-        class DependencyChecker : public clang::RecursiveASTVisitor<DependencyChecker> {
-        public:
-            bool HasDependencies = false;
-            std::vector<std::string>& Reasons;
-
-            explicit DependencyChecker(std::vector<std::string>& R) : Reasons(R) {}
+        // GEMM and transpose nests become one tiled kernel for all loops;
+        // search loops exit early, which no other pattern allows
+        if (analyzeGemm(FS, Info) || analyzeTranspose(FS, Info) || analyzeSearch(FS, Info)) {
+            return Info;
+        }
 
-            bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *ASE) {
-                if (auto *Idx = ASE->getIdx()->IgnoreParenImpCasts()) {
-                    if (auto *BO = llvm::dyn_cast<clang::BinaryOperator>(Idx)) {
-                        if (BO->getOpcode() == clang::BO_Sub) {
-                            if (auto *RHS = llvm::dyn_cast<clang::IntegerLiteral>(
-                                    BO->getRHS()->IgnoreParenImpCasts())) {
-                                if (RHS->getValue().getLimitedValue() == 1) {
-                                    HasDependencies = true;
-                                    Reasons.push_back("Loop-carried dependency detected: array[i-1] access pattern");
-                                }
-                            }
-                        }
-                    }
+        // First check for dependencies: an array the loop writes and also
+        // accesses at another offset from the induction variable couples
+        // iterations, whatever the offset, and those run on different
+        // work-items
+        bool HasDependencies = getDependenceDistance(FS, Info) > 0;
+
+        // Check trip count: a literal bound, counted from the lower bound
+        // and one further for <=
+        LoopBounds Bounds;
+        if (getLoopBounds(FS, Bounds)) {
+            if (auto *Upper = llvm::dyn_cast<clang::IntegerLiteral>(Bounds.Upper->IgnoreParenImpCasts())) {
+                int64_t End = Upper->getValue().getSExtValue() + (Bounds.Inclusive ? 1 : 0);
+                Info.HasConstantTripCount = End > Bounds.Lower;
+                Info.TripCount = Info.HasConstantTripCount ? static_cast<uint64_t>(End - Bounds.Lower) : 0;
+                if (Info.HasConstantTripCount) {
+                    Info.Reasons.push_back("Loop trip count: " + std::to_string(Info.TripCount));
                 }
-                return true;
-            }
-        };
-
-        DependencyChecker DepChecker(Info.Reasons);
-        DepChecker.TraverseStmt(FS->getBody());
-        bool HasDependencies = DepChecker.HasDependencies;
-
-        // Rest of your existing analysis...
-        // Check trip count
-        if (auto *Cond = llvm::dyn_cast<clang::BinaryOperator>(FS->getCond())) {
-            if (auto *RHS = llvm::dyn_cast<clang::IntegerLiteral>(Cond->getRHS())) {
-                Info.TripCount = RHS->getValue().getLimitedValue();
-                Info.HasConstantTripCount = true;
-                Info.Reasons.push_back("Loop trip count: " + std::to_string(Info.TripCount));
             }
         }
 
@@ -223,18 +1018,33 @@ namespace cspir {
         // Check for reduction pattern
         Info.IsReduction = isReductionLoop(FS, Info);
 
-        // Make vectorization decision
-        Info.IsVectorizable = (Info.HasConstantTripCount || Info.IsReduction || Info.IsSimplePattern) &&
-                             (!HasDependencies || Info.IsReduction) &&  // Changed this line
-                             checkTypes(FS->getBody(), Info);
+        // Any body the expression lowering handles, with no cross-iteration
+        // accesses, is a kernel regardless of its operators
+        if (!Info.IsReduction) {
+            std::string Reason;
+            Info.IsElementwise = ExprLowering::canLower(FS->getBody(), getInductionVariable(FS), Reason);
+            Info.Reasons.push_back(Info.IsElementwise
+                ? "Elementwise loop body: iterations only touch their own elements"
+                : "Not elementwise: " + Reason);
+            if (Info.IsElementwise) {
+                analyzeStencil(FS, Info);
+            }
+        }
+
+        // Make vectorization decision; the lowering inserts explicit
+        // conversions, so mixed types only block the other patterns
+        Info.IsVectorizable = (Info.HasConstantTripCount || Info.IsReduction ||
+                               Info.IsSimplePattern || Info.IsElementwise) &&
+                             !HasDependencies &&
+                             (checkTypes(FS->getBody(), Info) || Info.IsElementwise);
 
         if (Info.IsVectorizable) {
-            if (Info.IsReduction) {
-                Info.RecommendedWidth = 4;
-            } else if (Info.HasConstantTripCount && Info.TripCount >= 8) {
-                Info.RecommendedWidth = 8;
-            } else {
-                Info.RecommendedWidth = 4;
+            Info.RecommendedWidth = selectVectorWidth(FS, Info);
+            if (!Info.IsReduction && Info.Stencil.Inputs.empty()) {
+                Info.CoarseningFactor = selectCoarsening(FS, Info);
+            }
+            if (!Options.Tuning.DatabasePath.empty()) {
+                Tuner.apply(FS, Info);
             }
         } else if (HasDependencies) {  // Add this condition
             Info.Reasons.push_back("Loop cannot be vectorized due to dependencies");
@@ -245,6 +1055,11 @@ namespace cspir {
 
 
     bool LoopAnalyzer::isVectorizable(clang::ForStmt *FS) {
+        if (NestedLoops.count(FS)) {
+            llvm::outs() << "\nInner loop of a nest computed by the enclosing loop's kernel\n";
+            return false;
+        }
+
         auto Info = analyzeWithOptimizer(FS);
 
         // Print basic analysis header
@@ -265,18 +1080,26 @@ namespace cspir {
             // Print detailed analysis for vectorizable loops
             llvm::outs() << "\nVectorization Analysis Details:\n";
             llvm::outs() << "- Pattern: "
-                         << (Info.IsReduction ? "Reduction" :
-                            Info.IsSimplePattern ? "Simple arithmetic" : "General parallel") << "\n";
+                         << (Info.Gemm.C.Array ? "GEMM" :
+                            Info.Transpose.Out.Array ? "Transpose" :
+                            Info.Search.Condition ? "Search" :
+                            Info.IsReduction ? "Reduction" :
+                            Info.IsSimplePattern ? "Simple arithmetic" :
+                            Info.IsElementwise ? "Elementwise" : "General parallel") << "\n";
             llvm::outs() << "- Vector width: " << Info.RecommendedWidth << "\n";
+            if (!Info.ElementType.isNull()) {
+                llvm::outs() << "- Element type: " << Info.ElementType.getAsString() << "\n";
+            }
             llvm::outs() << "- Trip count: "
                          << (Info.HasConstantTripCount ? std::to_string(Info.TripCount) : "Variable") << "\n";
 
-            // Add kernel generation
-            SPIRVGenerator Generator(Context);
+            // Add the kernel to the TU module, emitted once after traversal
             if (Generator.generateKernel(FS, Info)) {
-                llvm::outs() << "\nGenerated SPIR-V kernel:\n";
-                llvm::outs() << "-------------------------\n";
-                Generator.getModule()->print(llvm::outs(), nullptr);
+                const auto &Kernel = Generator.getLastKernel();
+                llvm::outs() << "\nGenerated SPIR-V kernel: " << Kernel.Name << "\n";
+                for (const auto &Attr : Kernel.Attributes) {
+                    llvm::outs() << "- " << Attr.first << ": " << Attr.second << "\n";
+                }
             } else {
                 llvm::outs() << "\nFailed to generate SPIR-V kernel\n";
             }
@@ -287,6 +1110,60 @@ namespace cspir {
         return Info.IsVectorizable;
     }
 
+    void C89ASTConsumer::emitKernelModule(clang::ASTContext &Context) {
+        if (Generator.getNumKernels() == 0) {
+            return;
+        }
+
+        // An error diagnostic makes the tool run, and cspir, fail
+        auto &Diags = Context.getDiagnostics();
+        auto Fail = [&Diags](const char *Message) {
+            Diags.Report(Diags.getCustomDiagID(clang::DiagnosticsEngine::Error, "%0")) << Message;
+        };
+
+        if (!Generator.finalizeModule()) {
+            Fail("generated kernel module failed verification");
+            return;
+        }
+
+        KernelOptimizer Optimizer(Options.OptLevel);
+        KernelOptStats Stats;
+        if (!Optimizer.run(*Generator.getModule(), Stats)) {
+            Fail("kernel optimization pipeline failed");
+            return;
+        }
+
+        llvm::outs() << "\nKernel optimization ("
+                     << KernelOptimizer::getLevelName(Options.OptLevel) << "): "
+                     << Stats.InstructionsBefore << " -> " << Stats.InstructionsAfter
+                     << " instructions (";
+        if (Stats.InstructionsAfter <= Stats.InstructionsBefore) {
+            llvm::outs() << Stats.InstructionsBefore - Stats.InstructionsAfter << " removed)\n";
+        } else {
+            llvm::outs() << Stats.InstructionsAfter - Stats.InstructionsBefore << " added)\n";
+        }
+
+        if (Options.Run.Enabled) {
+            KernelRunner Runner(Options.Run);
+            if (!Runner.run(*Generator.getModule(), Generator.getKernels(), llvm::outs())) {
+                Fail("kernel run on the host CPU failed");
+                return;
+            }
+        }
+
+        // Without an output directory the textual IR goes to stdout as before
+        if (Options.Emit.OutputDir.empty()) {
+            llvm::outs() << "\nGenerated SPIR-V module (" << Generator.getNumKernels()
+                         << " kernels):\n";
+            llvm::outs() << "-------------------------\n";
+        }
+
+        KernelEmitter Emitter(Options.Emit);
+        if (!Emitter.emit(*Generator.getModule(), InFile)) {
+            Fail("failed to emit the kernel module");
+        }
+    }
+
     bool C89ASTVisitor::VisitRecordDecl(clang::RecordDecl *RD) {
         llvm::outs() << "\nRecord Declaration: (";
         RD->getLocation().print(llvm::outs(), Context->getSourceManager());
@@ -430,6 +1307,15 @@ namespace cspir {
         llvm::outs() << "\nFunction Call:\n";
         if (auto *FD = CE->getDirectCallee()) {
             llvm::outs() << "  Function: " << FD->getNameAsString() << "\n";
+            if (const MathBuiltin *Builtin = getMathBuiltin(FD)) {
+                llvm::outs() << "  OpenCL builtin: " << Builtin->Builtin;
+                if (Builtin->Native) {
+                    llvm::outs() << " (" << Builtin->Native
+                                 << (Builtin->Half ? std::string(" or ") + Builtin->Half : std::string())
+                                 << " with --precision=fast)";
+                }
+                llvm::outs() << "\n";
+            }
         }
 
         llvm::outs() << "  Arguments:\n";
@@ -530,7 +1416,8 @@ bool C89Parser::parseFile(const std::string &FileName) {
     );
 
     // Run the tool with our frontend action
-    return !Tool.run(clang::tooling::newFrontendActionFactory<C89FrontendAction>().get());
+    C89FrontendActionFactory Factory(Options);
+    return !Tool.run(&Factory);
 }
 void C89Parser::setupToolingArguments(std::vector<std::string>& Args) {
     // Add compiler name as first argument
@@ -541,7 +1428,14 @@ void C89Parser::setupToolingArguments(std::vector<std::string>& Args) {
     Args.push_back("-fvectorize");
     Args.push_back("-fslp-vectorize");
     Args.push_back("-march=native");
-    Args.push_back("-ffast-math");
+    // Keep the AST's floating-point options in line with the kernels
+    if (Options.Precision == PrecisionPolicy::Fast) {
+        Args.push_back("-ffast-math");
+    } else if (Options.Precision == PrecisionPolicy::Contract) {
+        Args.push_back("-ffp-contract=on");
+    } else {
+        Args.push_back("-ffp-contract=off");
+    }
 
     // Add basic C compilation flags
     Args.push_back("-x");
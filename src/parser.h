@@ -4,9 +4,11 @@
 
 #include "types.h"
 #include "spirv_generator.h"  // Include this first
+#include "autotuner.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/AST/ParentMapContext.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
@@ -26,8 +28,10 @@ namespace cspir {
 
     class LoopAnalyzer {
     public:
-        explicit LoopAnalyzer(clang::ASTContext *Context)
-            : Context(Context), Diags(Context->getDiagnostics()) {}
+        LoopAnalyzer(clang::ASTContext *Context, const CodeGenOptions &Options,
+                     SPIRVGenerator &Generator, Autotuner &Tuner)
+            : Context(Context), Diags(Context->getDiagnostics()), Options(Options),
+              Generator(Generator), Tuner(Tuner) {}
 
         bool isVectorizable(clang::ForStmt *FS);
         VectorizationInfo analyzeWithOptimizer(clang::ForStmt *FS);
@@ -38,16 +42,29 @@ namespace cspir {
         bool isReductionLoop(clang::ForStmt *FS, VectorizationInfo &Info);
         bool checkTypes(clang::Stmt *Body, VectorizationInfo &Info);
         bool isSimpleVectorizablePattern(clang::ForStmt *FS);  // Add this declaration
+        unsigned selectVectorWidth(clang::ForStmt *FS, VectorizationInfo &Info);
+        uint64_t getDependenceDistance(clang::ForStmt *FS, VectorizationInfo &Info);
+        unsigned selectCoarsening(clang::ForStmt *FS, VectorizationInfo &Info);
+        bool analyzeStencil(clang::ForStmt *FS, VectorizationInfo &Info);
+        bool analyzeGemm(clang::ForStmt *FS, VectorizationInfo &Info);
+        bool analyzeTranspose(clang::ForStmt *FS, VectorizationInfo &Info);
+        bool analyzeSearch(clang::ForStmt *FS, VectorizationInfo &Info);
 
         clang::ASTContext *Context;
         clang::DiagnosticsEngine &Diags;
+        const CodeGenOptions &Options;
+        SPIRVGenerator &Generator;  // Shared per translation unit
+        Autotuner &Tuner;
+        // Inner loops of nests already covered by the outer loop's kernel
+        llvm::SmallPtrSet<const clang::ForStmt*, 8> NestedLoops;
     };
 
 
 class C89ASTVisitor : public clang::RecursiveASTVisitor<C89ASTVisitor> {
 public:
-    explicit C89ASTVisitor(clang::ASTContext *Context)
-        : Context(Context), loopAnalyzer(Context) {} // Changed to lowercase
+    C89ASTVisitor(clang::ASTContext *Context, const CodeGenOptions &Options,
+                  SPIRVGenerator &Generator, Autotuner &Tuner)
+        : Context(Context), loopAnalyzer(Context, Options, Generator, Tuner) {} // Changed to lowercase
     virtual ~C89ASTVisitor() = default;
 
 
@@ -69,38 +86,73 @@ private:
 
 class C89ASTConsumer : public clang::ASTConsumer {
 public:
-    explicit C89ASTConsumer(clang::ASTContext *Context) : Visitor(Context) {}
+    C89ASTConsumer(clang::ASTContext *Context, const CodeGenOptions &Options,
+                   llvm::StringRef InFile)
+        : Options(Options), InFile(InFile.str()), Generator(Context, Options),
+          Tuner(Context, Options), Visitor(Context, Options, Generator, Tuner) {}
     virtual ~C89ASTConsumer() override = default;
 
     void HandleTranslationUnit(clang::ASTContext &Context) override {
         Visitor.TraverseDecl(Context.getTranslationUnitDecl());
+        emitKernelModule(Context);
+        if (!Tuner.save()) {
+            auto &Diags = Context.getDiagnostics();
+            Diags.Report(Diags.getCustomDiagID(clang::DiagnosticsEngine::Error,
+                                               "failed to write the tuning database"));
+        }
     }
 
 private:
+    void emitKernelModule(clang::ASTContext &Context);
+
+    const CodeGenOptions &Options;
+    std::string InFile;
+    SPIRVGenerator Generator;  // One kernel module for the whole TU
+    Autotuner Tuner;           // Tuning database, read and written per TU
     C89ASTVisitor Visitor;
 };
 
 class C89FrontendAction : public clang::ASTFrontendAction {
 public:
+    explicit C89FrontendAction(const CodeGenOptions &Options) : Options(Options) {}
+
     std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
-        clang::CompilerInstance &CI, llvm::StringRef /*InFile*/) override {
-        return std::make_unique<C89ASTConsumer>(&CI.getASTContext());
+        clang::CompilerInstance &CI, llvm::StringRef InFile) override {
+        return std::make_unique<C89ASTConsumer>(&CI.getASTContext(), Options, InFile);
     }
 
     bool BeginSourceFileAction(clang::CompilerInstance & /*CI*/) override {
         return true;
     }
+
+private:
+    const CodeGenOptions &Options;
+};
+
+class C89FrontendActionFactory : public clang::tooling::FrontendActionFactory {
+public:
+    explicit C89FrontendActionFactory(const CodeGenOptions &Options) : Options(Options) {}
+
+    std::unique_ptr<clang::FrontendAction> create() override {
+        return std::make_unique<C89FrontendAction>(Options);
+    }
+
+private:
+    const CodeGenOptions &Options;
 };
 
 class C89Parser {
 public:
-    C89Parser() = default;
+    explicit C89Parser(CodeGenOptions Options = CodeGenOptions())
+        : Options(std::move(Options)) {}
     ~C89Parser() = default;
 
     bool parseFile(const std::string &FileName);
 
 private:
     void setupToolingArguments(std::vector<std::string>& Args);
+
+    CodeGenOptions Options;
 };
 
 
@@ -1,10 +1,19 @@
 #include "spirv_generator.h"
 #include "types.h"
+#include "expr_lowering.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MathExtras.h"
 #include "clang/AST/Expr.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Basic/SourceManager.h"  // Add this include
+#include "llvm/ADT/SmallPtrSet.h"
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <tuple>
 
 
 namespace cspir {
@@ -18,10 +27,24 @@ llvm::FunctionCallee SPIRVGenerator::getOpenCLFunction(
     llvm::Type* RetTy,
     llvm::ArrayRef<llvm::Type*> ArgTypes) {
 
-    return Module->getOrInsertFunction(
+    auto Callee = Module->getOrInsertFunction(
         Name,
         llvm::FunctionType::get(RetTy, ArgTypes, false)
     );
+
+    // Let the optimizer CSE work-item queries but never move a barrier
+    // across control flow
+    if (auto* Func = llvm::dyn_cast<llvm::Function>(Callee.getCallee())) {
+        Func->addFnAttr(llvm::Attribute::NoUnwind);
+        if (Name == OpenCLBuiltins::BARRIER ||
+            llvm::StringRef(Name).contains(OpenCLBuiltins::SUB_GROUP_REDUCE_ADD)) {
+            Func->addFnAttr(llvm::Attribute::Convergent);
+        } else if (llvm::StringRef(Name).startswith("get_")) {
+            Func->addFnAttr(llvm::Attribute::ReadNone);
+            Func->addFnAttr(llvm::Attribute::WillReturn);
+        }
+    }
+    return Callee;
 }
 
 void SPIRVGenerator::addBarrier(unsigned Fence) {
@@ -38,10 +61,31 @@ void SPIRVGenerator::addBarrier(unsigned Fence) {
 }
 
 llvm::Value* SPIRVGenerator::performVectorReduction(llvm::Value* Vec, unsigned Width) {
-    auto* Sum = Builder.CreateExtractElement(Vec, (uint64_t)0);
+    // Width 1 code is scalar already
+    if (!Vec->getType()->isVectorTy()) {
+        return Vec;
+    }
+
+    // With reassociation the lanes combine pairwise in log2(Width) steps
+    if (!ElemIsFloat || Builder.getFastMathFlags().allowReassoc()) {
+        while (Width > 1) {
+            Width /= 2;
+            llvm::SmallVector<int, 16> Low, High;
+            for (unsigned i = 0; i < Width; ++i) {
+                Low.push_back(i);
+                High.push_back(i + Width);
+            }
+            Vec = createArithOp(clang::BO_Add, Builder.CreateShuffleVector(Vec, Low),
+                                Builder.CreateShuffleVector(Vec, High));
+        }
+        return Builder.CreateExtractElement(Vec, (uint64_t)0);
+    }
+
+    // Otherwise lane order, as the scalar loop would add them
+    llvm::Value* Sum = Builder.CreateExtractElement(Vec, (uint64_t)0);
     for (unsigned i = 1; i < Width; ++i) {
         auto* Elem = Builder.CreateExtractElement(Vec, i);
-        Sum = Builder.CreateFAdd(Sum, Elem);
+        Sum = createArithOp(clang::BO_Add, Sum, Elem);
     }
     return Sum;
 }
@@ -49,14 +93,161 @@ llvm::Value* SPIRVGenerator::performVectorReduction(llvm::Value* Vec, unsigned W
 void SPIRVGenerator::addMemoryAttributes(llvm::Function* Func, unsigned VectorWidth) {
     // Add alignment attributes to pointer arguments
     for (auto& Arg : Func->args()) {
-        if (Arg.getType()->isPointerTy()) {
+        if (auto* PtrTy = llvm::dyn_cast<llvm::PointerType>(Arg.getType())) {
+            unsigned Size = PtrTy->getPointerElementType()->getPrimitiveSizeInBits() / 8;
             Arg.addAttr(llvm::Attribute::getWithAlignment(
                 Builder.getContext(),
-                llvm::Align(VectorWidth * sizeof(float))));
+                llvm::Align(VectorWidth * std::max(Size, 1u))));
+        }
+    }
+}
+
+llvm::Type* SPIRVGenerator::getLLVMType(clang::QualType QT) {
+    return ExprLowering::convertType(*Context, Builder.getContext(), QT);
+}
+
+unsigned SPIRVGenerator::legalizeVectorWidth(unsigned Width) {
+    // OpenCL vectors come in 2, 3, 4, 8 and 16 lanes; we never emit 3
+    unsigned Legal = 1;
+    while (Legal * 2 <= Width && Legal < 16) {
+        Legal *= 2;
+    }
+    return Legal;
+}
+
+unsigned SPIRVGenerator::getElementSize() const {
+    return ElemTy ? ElemTy->getPrimitiveSizeInBits() / 8 : 4;
+}
+
+bool SPIRVGenerator::setElementType(clang::QualType QT, KernelInfo& KInfo) {
+    if (QT.isNull()) {
+        QT = Context->FloatTy;
+    }
+    QT = QT.getCanonicalType().getUnqualifiedType();
+
+    ElemTy = getLLVMType(QT);
+    if (!ElemTy) {
+        llvm::errs() << "Error: Unsupported kernel element type '"
+                     << QT.getAsString() << "'\n";
+        return false;
+    }
+
+    KInfo.ElementType = QT;
+    ElemIsFloat = QT->isFloatingType();
+    ElemIsSigned = QT->isSignedIntegerType();
+
+    // Record the OpenCL extensions the element type depends on
+    if (QT->isSpecificBuiltinType(clang::BuiltinType::Double)) {
+        KInfo.RequiredExtensions.push_back("cl_khr_fp64");
+    } else if (QT->isHalfType() || QT->isFloat16Type()) {
+        KInfo.RequiredExtensions.push_back("cl_khr_fp16");
+    }
+    return true;
+}
+
+llvm::Constant* SPIRVGenerator::getElementConstant(llvm::Type* Ty, double FPValue, int64_t IntValue) {
+    // Vector types produce a splat of the scalar value
+    if (Ty->getScalarType()->isFloatingPointTy()) {
+        return llvm::ConstantFP::get(Ty, FPValue);
+    }
+    return llvm::ConstantInt::get(Ty, static_cast<uint64_t>(IntValue), true);
+}
+
+llvm::Value* SPIRVGenerator::createArithOp(clang::BinaryOperatorKind Op,
+                                           llvm::Value* LHS, llvm::Value* RHS) {
+    switch (Op) {
+        case clang::BO_Add:
+            return ElemIsFloat ? Builder.CreateFAdd(LHS, RHS) : Builder.CreateAdd(LHS, RHS);
+        case clang::BO_Sub:
+            return ElemIsFloat ? Builder.CreateFSub(LHS, RHS) : Builder.CreateSub(LHS, RHS);
+        case clang::BO_Mul:
+            return ElemIsFloat ? Builder.CreateFMul(LHS, RHS) : Builder.CreateMul(LHS, RHS);
+        case clang::BO_Div:
+            if (ElemIsFloat) return Builder.CreateFDiv(LHS, RHS);
+            return ElemIsSigned ? Builder.CreateSDiv(LHS, RHS) : Builder.CreateUDiv(LHS, RHS);
+        case clang::BO_Rem:
+            if (ElemIsFloat) return Builder.CreateFRem(LHS, RHS);
+            return ElemIsSigned ? Builder.CreateSRem(LHS, RHS) : Builder.CreateURem(LHS, RHS);
+        default:
+            return LHS;
+    }
+}
+
+void SPIRVGenerator::addExtensionMetadata(const KernelInfo& KInfo) {
+    // opencl.used.extensions is what SPIR consumers read to enable capabilities
+    auto* UsedExts = Module->getOrInsertNamedMetadata("opencl.used.extensions");
+    std::set<std::string> Known;
+    for (auto* Node : UsedExts->operands()) {
+        for (const auto& Op : Node->operands()) {
+            if (auto* Str = llvm::dyn_cast<llvm::MDString>(Op)) {
+                Known.insert(Str->getString().str());
+            }
+        }
+    }
+
+    std::vector<llvm::Metadata*> NewExts;
+    for (const auto& Ext : KInfo.RequiredExtensions) {
+        if (Known.insert(Ext).second) {
+            NewExts.push_back(llvm::MDString::get(Builder.getContext(), Ext));
+        }
+    }
+    if (!NewExts.empty()) {
+        UsedExts->addOperand(llvm::MDNode::get(Builder.getContext(), NewExts));
+    }
+}
+
+
+static const char* getPrecisionName(PrecisionPolicy Precision) {
+    switch (Precision) {
+        case PrecisionPolicy::Strict:
+            return "strict";
+        case PrecisionPolicy::Contract:
+            return "contract";
+        case PrecisionPolicy::Fast:
+            return "fast";
+    }
+    return "strict";
+}
+
+// Every instruction of a kernel inherits the policy's flags
+static llvm::FastMathFlags getFastMathFlags(PrecisionPolicy Precision) {
+    llvm::FastMathFlags FMF;
+    if (Precision == PrecisionPolicy::Fast) {
+        FMF.setFast();
+    } else if (Precision == PrecisionPolicy::Contract) {
+        FMF.setAllowContract();
+    }
+    return FMF;
+}
+
+// Whether any instruction of Func computes with or converts doubles
+static bool usesDoubles(const llvm::Function* Func) {
+    for (const auto& I : llvm::instructions(Func)) {
+        if (I.getType()->getScalarType()->isDoubleTy()) {
+            return true;
+        }
+        for (const auto& Op : I.operands()) {
+            if (Op->getType()->getScalarType()->isDoubleTy()) {
+                return true;
+            }
         }
     }
+    return false;
 }
 
+// "a (read-only buffer), n (trip count)" for the generation report
+static std::string describeArguments(const std::vector<KernelArgument>& Arguments) {
+    static const char* const AccessNames[] = {"read-only", "write-only", "read-write"};
+    std::string Signature;
+    for (const auto& Arg : Arguments) {
+        Signature += Signature.empty() ? "" : ", ";
+        Signature += Arg.Name + " (" + (Arg.Kind == ArgKind::TripCount ? std::string("trip count")
+            : Arg.Kind == ArgKind::Scalar ? "scalar"
+            : AccessNames[static_cast<int>(Arg.Access)] +
+              std::string(Arg.AddressSpace == ADDRSPACE_CONSTANT ? " __constant buffer" : " buffer")) + ")";
+    }
+    return Signature;
+}
 
 bool SPIRVGenerator::generateKernel(clang::ForStmt* Loop,
                                   const VectorizationInfo& Info) {
@@ -64,62 +255,777 @@ bool SPIRVGenerator::generateKernel(clang::ForStmt* Loop,
         initializeModule();
     }
 
+    std::string LoopName = getKernelName(Loop);
+    // One blocked kernel for a whole nest; its tile is not a variant axis
+    if (Info.Gemm.C.Array) {
+        return generateGemmKernel(Loop, Info, LoopName);
+    }
+    if (Info.Transpose.Out.Array) {
+        return generateTransposeKernel(Loop, Info, LoopName);
+    }
+    unsigned Recommended = legalizeVectorWidth(Info.RecommendedWidth);
+    if (!Options.Variants.Enabled) {
+        // The analyzer already sized the width for the element type and device
+        KernelVariant Variant;
+        Variant.VectorWidth = Recommended;
+        if (Info.WorkGroupSize) {
+            Variant.WorkGroupSize = Info.WorkGroupSize;
+        }
+        if (Info.UnrollFactor) {
+            Variant.Unroll = Info.UnrollFactor;
+        }
+        if (Info.CoarseningFactor) {
+            Variant.Coarsening = Info.CoarseningFactor;
+        }
+        return generateVariant(Loop, Info, Variant, LoopName, LoopName);
+    }
+
+    clang::QualType QT = Info.ElementType.isNull() ? Context->FloatTy : Info.ElementType;
+    auto Variants = getKernelVariants(Options.Variants, Info.MaxLegalWidth,
+                                      Context->getTypeSize(QT), Info.IsReduction);
+    if (!Info.Stencil.Inputs.empty() || Info.Search.Condition) {
+        // Tiled stencils and searches compute one vector per work-item and step
+        Variants.erase(std::remove_if(Variants.begin(), Variants.end(),
+                                      [](const KernelVariant& V) { return V.Coarsening > 1; }),
+                       Variants.end());
+    }
+    std::vector<std::pair<llvm::Function*, KernelVariant>> Table;
+    KernelInfo Primary;
+    for (const auto& Variant : Variants) {
+        std::string Name = LoopName + Variant.getSuffix();
+        if (!generateVariant(Loop, Info, Variant, LoopName, Name)) {
+            continue;
+        }
+        // The table records the kernel as built: stencil tiles and static
+        // trip counts shrink the group and may fix it, and some shapes
+        // drop the unroll or coarsening they were asked for
+        KernelVariant Built = Variant;
+        Built.WorkGroupSize = LastKernel.Dispatch.RequiredWorkGroupSize
+            ? LastKernel.Dispatch.RequiredWorkGroupSize : LastKernel.PreferredWorkGroupSize;
+        Built.Unroll = LastKernel.UnrollFactor;
+        Built.Coarsening = LastKernel.Coarsening;
+        bool Duplicate = std::any_of(Table.begin(), Table.end(), [&](const auto& Entry) {
+            return std::make_tuple(Entry.second.VectorWidth, Entry.second.WorkGroupSize,
+                                   Entry.second.Unroll, Entry.second.Coarsening) ==
+                   std::make_tuple(Built.VectorWidth, Built.WorkGroupSize, Built.Unroll,
+                                   Built.Coarsening);
+        });
+        if (Duplicate) {
+            for (const auto& Kernel : {Name, Name + "_combine"}) {
+                if (auto* Func = Module->getFunction(Kernel)) {
+                    Func->eraseFromParent();
+                    --NumKernels;
+                }
+            }
+            continue;
+        }
+        Table.push_back({Module->getFunction(Name), Built});
+        // Report the variant closest to what a single-version build emits
+        if (Primary.Name.empty() || (Variant.VectorWidth == Recommended && Variant.Unroll == 1 &&
+                                     Primary.VectorWidth != Recommended)) {
+            Primary = LastKernel;
+        }
+    }
+    if (Table.empty()) {
+        return false;
+    }
+
+    addVariantTable(*Module, LoopName, Table);
+    Primary.Attributes.push_back({"Variants", std::to_string(Table.size()) + " distinct of " +
+        std::to_string(Variants.size()) + " built, selected at launch from !cspir.variants"});
+    LastKernel = Primary;
+    return true;
+}
+
+bool SPIRVGenerator::generateVariant(clang::ForStmt* Loop, const VectorizationInfo& Info,
+                                     const KernelVariant& Variant, const std::string& LoopName,
+                                     const std::string& Name) {
     KernelInfo KInfo;
-    KInfo.Name = getKernelName(Loop);
-    KInfo.VectorWidth = Info.RecommendedWidth;
+    KInfo.Name = Name;
     KInfo.IsReduction = Info.IsReduction;
     KInfo.OriginalLoop = Loop;
 
-    // Analyze loop for kernel arguments
+    if (!setElementType(Info.ElementType, KInfo)) {
+        return false;
+    }
+
+    KInfo.VectorWidth = Variant.VectorWidth;
+    KInfo.Search = Info.Search;
+    KInfo.UnrollFactor = KInfo.IsReduction ? Variant.Unroll : 1;
+    KInfo.Coarsening = KInfo.IsReduction || KInfo.Search.Condition ? 1 : Variant.Coarsening;
+    KInfo.StridedCoarsening = Options.Device.StridedAccess;
+    KInfo.MaxWorkGroupSize = Options.Device.MaxWorkGroupSize;
+    KInfo.PreferredWorkGroupSize = std::min(Variant.WorkGroupSize, KInfo.MaxWorkGroupSize);
+    KInfo.UsesLocalMemory = KInfo.IsReduction;
+    KInfo.Dispatch.ElementsPerWorkItem = KInfo.VectorWidth * KInfo.Coarsening;
+
+    if (KInfo.IsReduction) {
+        KInfo.Combine = Options.Combine;
+        if (std::find(Options.DeterministicKernels.begin(), Options.DeterministicKernels.end(),
+                      LoopName) != Options.DeterministicKernels.end()) {
+            KInfo.Combine = ReductionCombine::Deterministic;
+        }
+
+        // Global atomic adds start at 32 bits, so narrower sums combine
+        // through partials instead
+        bool NoNarrowAtomic = KInfo.Combine == ReductionCombine::Atomic && getElementSize() < 4;
+        if (NoNarrowAtomic) {
+            KInfo.Combine = ReductionCombine::TwoStage;
+        }
+
+        KInfo.Reduction = Options.Reduction;
+        if (KInfo.Combine == ReductionCombine::Deterministic) {
+            // Sub-group reductions leave the summation order to the device
+            KInfo.Reduction = ReductionStrategy::WorkGroupTree;
+            // One partial per combine work-item keeps the second stage a
+            // pure pairwise tree
+            KInfo.FixedNumGroups = KInfo.PreferredWorkGroupSize;
+        }
+
+        if (KInfo.Reduction == ReductionStrategy::SubGroup) {
+            KInfo.RequiredExtensions.push_back("cl_khr_subgroups");
+            KInfo.Attributes.push_back({"Reduction strategy",
+                "sub-group (1 barrier per work-group)"});
+        } else {
+            unsigned Steps = llvm::Log2_64_Ceil(KInfo.PreferredWorkGroupSize);
+            KInfo.Attributes.push_back({"Reduction strategy",
+                "work-group tree (" + std::to_string(Steps + 1) + " barriers per work-group)"});
+        }
+
+        if (KInfo.Combine == ReductionCombine::Atomic) {
+            // Global atomic add of the element type
+            if (ElemIsFloat) {
+                KInfo.RequiredExtensions.push_back("cl_ext_float_atomics");
+            } else if (getElementSize() == 8) {
+                KInfo.RequiredExtensions.push_back("cl_khr_int64_base_atomics");
+            }
+            KInfo.Attributes.push_back({"Combine", "relaxed atomic add per work-group"});
+        } else if (KInfo.Combine == ReductionCombine::Deterministic) {
+            size_t Groups = KInfo.FixedNumGroups;
+            KInfo.Attributes.push_back({"Combine", "deterministic pairwise tree over " +
+                std::to_string(Groups) + " partials in " + KInfo.Name + "_combine"});
+            KInfo.Attributes.push_back({"Launch", "exactly " + std::to_string(Groups) +
+                " work-groups of " + std::to_string(KInfo.PreferredWorkGroupSize)});
+            KInfo.Attributes.push_back({"Cost vs atomic", "+1 kernel launch, " +
+                std::to_string(Groups * getElementSize()) + " bytes of partials written and read, " +
+                std::to_string(llvm::Log2_64_Ceil(Groups)) + " extra tree steps"});
+        } else {
+            std::string Reason = NoNarrowAtomic ? "; no " + std::to_string(8 * getElementSize()) +
+                                                  "-bit atomic add" : "";
+            KInfo.Attributes.push_back({"Combine", "partials[num_groups] reduced by " +
+                                        KInfo.Name + "_combine (one work-group)" + Reason});
+        }
+    }
+
+    // The deterministic combine promises a fixed summation order, so
+    // drivers must not reassociate there
+    llvm::FastMathFlags FMF = getFastMathFlags(Options.Precision);
+    std::string Precision = getPrecisionName(Options.Precision);
+    if (KInfo.Combine == ReductionCombine::Deterministic && FMF.allowReassoc()) {
+        FMF.setAllowReassoc(false);
+        Precision += " without reassociation (deterministic combine)";
+    }
+    Builder.setFastMathFlags(FMF);
+    if (Options.Precision != PrecisionPolicy::Strict) {
+        KInfo.Attributes.push_back({"Precision", Precision});
+    }
+
+    if (KInfo.UnrollFactor > 1) {
+        KInfo.Attributes.push_back({"Unroll", "grid-stride loop x" +
+                                    std::to_string(KInfo.UnrollFactor)});
+    }
+
+    // Stencil tiles are sized for the work-group, so the group size they
+    // were laid out for becomes a launch requirement
+    KInfo.Stencil = Info.Stencil;
+    if (!KInfo.Stencil.Inputs.empty() && !selectStencilTile(KInfo)) {
+        KInfo.Attributes.push_back({"Stencil", "no tile fits " +
+            std::to_string(Options.Device.LocalMemBytes) +
+            " bytes of local memory, neighbours are read from global memory"});
+        KInfo.Stencil = StencilInfo();
+    }
+
+    if (KInfo.IsReduction) {
+        KInfo.Dispatch.StaticGlobalSize = KInfo.FixedNumGroups * KInfo.PreferredWorkGroupSize;
+        KInfo.Dispatch.RequiredWorkGroupSize = KInfo.PreferredWorkGroupSize;
+        if (!KInfo.FixedNumGroups) {
+            KInfo.Attributes.push_back({"Dispatch",
+                "any global size (grid-stride, " + std::to_string(KInfo.VectorWidth) +
+                " elements per step)"});
+        }
+    }
+
+    LoopBounds Bounds;
+    if (!getLoopBounds(Loop, Bounds)) {
+        llvm::errs() << "Error: Loop is not of the form for (i = c; i < n; i++)\n";
+        return false;
+    }
+    KInfo.LowerBound = Bounds.Lower;
+    KInfo.InclusiveBound = Bounds.Inclusive;
+    auto* BoundRef = llvm::dyn_cast<clang::DeclRefExpr>(Bounds.Upper->IgnoreParenImpCasts());
+    auto* BoundVar = BoundRef ? llvm::dyn_cast<clang::VarDecl>(BoundRef->getDecl()) : nullptr;
+
+    // A literal bound bakes the whole iteration space into the kernel
+    auto* BoundLit = llvm::dyn_cast<clang::IntegerLiteral>(Bounds.Upper->IgnoreParenImpCasts());
+    if (!KInfo.IsReduction && !KInfo.Search.Condition && BoundLit) {
+        int64_t End = BoundLit->getValue().getSExtValue() + (Bounds.Inclusive ? 1 : 0);
+        if (End > Bounds.Lower) {
+            KInfo.StaticTripCount = static_cast<uint64_t>(End - Bounds.Lower);
+        }
+    }
+
+    if (!KInfo.Stencil.Inputs.empty()) {
+        KInfo.Coarsening = 1;
+        KInfo.UsesLocalMemory = true;
+        KInfo.Dispatch.ElementsPerWorkItem = KInfo.VectorWidth;
+        KInfo.Dispatch.RequiredWorkGroupSize = KInfo.PreferredWorkGroupSize;
+        std::string WorkItems = "ceil(N/" + std::to_string(KInfo.VectorWidth) + ")";
+        if (KInfo.StaticTripCount) {
+            // A literal bound fixes the launch; the kernel still walks tiles
+            uint64_t Vectors = (KInfo.StaticTripCount + KInfo.VectorWidth - 1) / KInfo.VectorWidth;
+            uint64_t Groups = (Vectors + KInfo.PreferredWorkGroupSize - 1) / KInfo.PreferredWorkGroupSize;
+            KInfo.Dispatch.NeedsSizeArg = false;
+            KInfo.Dispatch.StaticGlobalSize = Groups * KInfo.PreferredWorkGroupSize;
+            WorkItems = std::to_string(KInfo.Dispatch.StaticGlobalSize);
+        }
+        KInfo.Attributes.push_back({"Dispatch", WorkItems + " work-items in work-groups of exactly " +
+            std::to_string(KInfo.PreferredWorkGroupSize) + ", grid-stride over tiles"});
+
+        uint64_t Rows = KInfo.TileRows;
+        uint64_t Columns = KInfo.PreferredWorkGroupSize / Rows * KInfo.VectorWidth;
+        KInfo.Attributes.push_back({"Stencil", KInfo.Stencil.Pitch
+            ? "2-D tiles of " + std::to_string(Rows) + "x" + std::to_string(Columns) +
+              " outputs, rows " + KInfo.Stencil.Pitch->getNameAsString() + " apart"
+            : "1-D tiles of " + std::to_string(Columns) + " outputs"});
+        for (const auto& Input : KInfo.Stencil.Inputs) {
+            uint64_t TileRows = Rows + Input.MaxRow - Input.MinRow;
+            uint64_t TileColumns = Columns + Input.MaxCol - Input.MinCol;
+            double Loads = static_cast<double>(TileRows * TileColumns) / (Rows * Columns);
+            KInfo.Attributes.push_back({"Tile " + Input.Array->getNameAsString(), "__local " +
+                (KInfo.Stencil.Pitch ? std::to_string(TileRows) + "x" : std::string()) +
+                std::to_string(TileColumns) + " with halo, " +
+                llvm::formatv("{0:F2}", Loads).str() + " global reads per element instead of " +
+                std::to_string(Input.Offsets.size())});
+        }
+    } else if (KInfo.StaticTripCount) {
+        // Few vectors run as one fully unrolled work-item; otherwise one
+        // vector per work-item plus one for the remainder
+        uint64_t Vectors = KInfo.StaticTripCount / KInfo.VectorWidth;
+        uint64_t Remainder = KInfo.StaticTripCount % KInfo.VectorWidth;
+        uint64_t WorkItems = Vectors <= MaxUnrolledVectors ? 1 : Vectors + (Remainder ? 1 : 0);
+        // The exact NDRange already leaves nothing to amortize
+        KInfo.Coarsening = 1;
+        KInfo.Dispatch.ElementsPerWorkItem = KInfo.VectorWidth;
+
+        // An exact split into work-groups needs no bounds check, but a
+        // prime count would shrink the groups to a handful of work-items;
+        // below half the preferred size the NDRange is rounded up instead
+        // and the extra work-items return at once
+        uint64_t GroupSize = std::min<uint64_t>(KInfo.PreferredWorkGroupSize, WorkItems);
+        uint64_t Divisor = GroupSize;
+        while (WorkItems % Divisor != 0) {
+            --Divisor;
+        }
+        if (2 * Divisor >= GroupSize) {
+            GroupSize = Divisor;
+        }
+        uint64_t GlobalSize = (WorkItems + GroupSize - 1) / GroupSize * GroupSize;
+        KInfo.PreferredWorkGroupSize = GroupSize;
+        KInfo.Dispatch.NeedsSizeArg = false;
+        KInfo.Dispatch.StaticGlobalSize = GlobalSize;
+        KInfo.Dispatch.RequiredWorkGroupSize = GroupSize;
+        KInfo.Attributes.push_back({"Dispatch", "static NDRange " + std::to_string(GlobalSize) +
+            " x reqd_work_group_size " + std::to_string(GroupSize) + ", no size argument" +
+            (GlobalSize > WorkItems ? ", " + std::to_string(GlobalSize - WorkItems) + " idle work-items"
+                                    : std::string())});
+        KInfo.Attributes.push_back({"Specialization", "trip count " +
+            std::to_string(KInfo.StaticTripCount) +
+            (WorkItems == 1 ? ", fully unrolled" : "") +
+            (Remainder ? ", " + std::to_string(Remainder) + "-iteration unrolled tail" : "")});
+    } else if (KInfo.Search.Condition) {
+        KInfo.Attributes.push_back({"Dispatch",
+            "any global size (grid-stride, " + std::to_string(KInfo.VectorWidth) +
+            " elements per step)"});
+    } else if (!KInfo.IsReduction) {
+        KInfo.Attributes.push_back({"Dispatch",
+            "ceil(N/" + std::to_string(KInfo.Dispatch.ElementsPerWorkItem) +
+            ") work-items, masked tail"});
+        if (KInfo.Coarsening > 1) {
+            KInfo.Attributes.push_back({"Coarsening", std::to_string(KInfo.Coarsening) +
+                (KInfo.StridedCoarsening ? " vectors per work-item, global-size apart"
+                                         : " consecutive vectors per work-item")});
+        }
+    }
+
+    // Kernel arguments: every buffer and every scalar the body uses that
+    // is declared outside the loop, once each in order of first use
     class ArgumentCollector : public clang::RecursiveASTVisitor<ArgumentCollector> {
     public:
-        std::vector<std::string>& Args;
-        explicit ArgumentCollector(std::vector<std::string>& Args) : Args(Args) {}
+        std::vector<KernelArgument>& Args;
+        clang::ASTContext& Context;
+        llvm::SmallPtrSet<const clang::VarDecl*, 8> Excluded;
+        llvm::SmallPtrSet<const clang::ArraySubscriptExpr*, 8> PlainStores;
+        // Arrays with a subscript that moves with the iteration; the others
+        // are read at fixed or data-dependent indices, like lookup tables
+        llvm::SmallPtrSet<const clang::VarDecl*, 8> Streamed;
+        const clang::VarDecl* ReductionVar = nullptr;
+
+        ArgumentCollector(std::vector<KernelArgument>& Args, clang::ASTContext& Context)
+            : Args(Args), Context(Context) {}
+
+        // Locals of the body
+        bool VisitVarDecl(clang::VarDecl* VD) {
+            Excluded.insert(VD);
+            return true;
+        }
 
-        bool VisitDeclRefExpr(clang::DeclRefExpr* Expr) {
-            if (auto VD = llvm::dyn_cast<clang::VarDecl>(Expr->getDecl())) {
-                if (VD->hasGlobalStorage() || VD->getType()->isPointerType()) {
-                    Args.push_back(VD->getNameAsString());
+        bool VisitBinaryOperator(clang::BinaryOperator* BO) {
+            if (!BO->isAssignmentOp()) {
+                return true;
+            }
+            auto* LHS = BO->getLHS()->IgnoreParenImpCasts();
+            if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(LHS)) {
+                markAccess(ASE, ArgAccess::Write);
+                if (!BO->isCompoundAssignmentOp()) {
+                    PlainStores.insert(ASE);
+                }
+            } else if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(LHS)) {
+                // The reduction variable becomes the result buffer
+                if (auto* VD = llvm::dyn_cast<clang::VarDecl>(DRE->getDecl())) {
+                    if (BO->isCompoundAssignmentOp() && !ReductionVar) {
+                        ReductionVar = VD;
+                    }
+                    Excluded.insert(VD);
                 }
             }
             return true;
         }
+
+        bool VisitUnaryOperator(clang::UnaryOperator* UO) {
+            if (UO->isIncrementDecrementOp()) {
+                if (auto* ASE = llvm::dyn_cast<clang::ArraySubscriptExpr>(
+                        UO->getSubExpr()->IgnoreParenImpCasts())) {
+                    markAccess(ASE, ArgAccess::Write);
+                }
+            }
+            return true;
+        }
+
+        bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr* ASE) {
+            if (!PlainStores.count(ASE)) {
+                markAccess(ASE, ArgAccess::Read);
+            }
+            auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts());
+            auto* VD = DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+            if (VD && variesWithLoop(ASE->getIdx())) {
+                Streamed.insert(VD);
+            }
+            return true;
+        }
+
+        bool VisitDeclRefExpr(clang::DeclRefExpr* Expr) {
+            auto* VD = llvm::dyn_cast<clang::VarDecl>(Expr->getDecl());
+            if (VD && !Excluded.count(VD)) {
+                getArgument(VD);
+            }
+            return true;
+        }
+
+    private:
+        // The induction variable and body locals vary; values loaded from
+        // memory only pick an element
+        bool variesWithLoop(const clang::Stmt* S) const {
+            if (auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(S)) {
+                auto* VD = llvm::dyn_cast<clang::VarDecl>(DRE->getDecl());
+                return VD && Excluded.count(VD);
+            }
+            if (llvm::isa<clang::ArraySubscriptExpr>(S)) {
+                return false;
+            }
+            for (const clang::Stmt* Child : S->children()) {
+                if (Child && variesWithLoop(Child)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        KernelArgument* getArgument(const clang::VarDecl* VD) {
+            for (auto& Arg : Args) {
+                if (Arg.Decl == VD) {
+                    return &Arg;
+                }
+            }
+
+            auto Type = VD->getType();
+            KernelArgument Arg;
+            Arg.Name = VD->getNameAsString();
+            Arg.Decl = VD;
+            if (Type->isPointerType() || Type->isArrayType()) {
+                Arg.Kind = ArgKind::Buffer;
+                Arg.Type = Type->isPointerType() ? Type->getPointeeType()
+                                                 : Context.getAsArrayType(Type)->getElementType();
+                Arg.AddressSpace = ADDRSPACE_GLOBAL;
+            } else if (Type->isArithmeticType()) {
+                Arg.Type = Type;
+            } else {
+                return nullptr;
+            }
+            Args.push_back(Arg);
+            Accessed.push_back(false);
+            return &Args.back();
+        }
+
+        void markAccess(clang::ArraySubscriptExpr* ASE, ArgAccess Access) {
+            auto* DRE = llvm::dyn_cast<clang::DeclRefExpr>(ASE->getBase()->IgnoreParenImpCasts());
+            auto* VD = DRE ? llvm::dyn_cast<clang::VarDecl>(DRE->getDecl()) : nullptr;
+            auto* Arg = VD && !Excluded.count(VD) ? getArgument(VD) : nullptr;
+            if (!Arg) {
+                return;
+            }
+            size_t Index = Arg - Args.data();
+            if (!Accessed[Index]) {
+                Arg->Access = Access;
+                Accessed[Index] = true;
+            } else if (Arg->Access != Access) {
+                Arg->Access = ArgAccess::ReadWrite;
+            }
+        }
+
+        std::vector<bool> Accessed;
     };
 
-    ArgumentCollector Collector(KInfo.Arguments);
+    ArgumentCollector Collector(KInfo.Arguments, *Context);
+    Collector.Excluded.insert(Bounds.IV);
+    if (BoundVar) {
+        Collector.Excluded.insert(BoundVar);
+    }
     Collector.TraverseStmt(Loop->getBody());
 
+    // Small read-only tables go to __constant memory, whose cache
+    // broadcasts one element to every work-item reading it: const arrays
+    // with a known initializer become module constants, and other arrays
+    // read only at fixed or data-dependent indices become __constant
+    // arguments. Pointers stay __global: with no size known here, a large
+    // gather source would exceed the device's constant buffer at launch.
+    uint64_t ConstantBytes = 0;
+    std::string Embedded, ConstantArgs;
+    for (auto Arg = KInfo.Arguments.begin(); Arg != KInfo.Arguments.end();) {
+        bool IsStencilInput = std::any_of(KInfo.Stencil.Inputs.begin(), KInfo.Stencil.Inputs.end(),
+            [&](const StencilInput& Input) { return Input.Array == Arg->Decl; });
+        if (Arg->Kind != ArgKind::Buffer || Arg->Access != ArgAccess::Read || !Arg->Decl ||
+            IsStencilInput) {
+            ++Arg;
+            continue;
+        }
+        auto* ArrayTy = Context->getAsConstantArrayType(Arg->Decl->getType());
+        uint64_t Bytes = ArrayTy ? Context->getTypeSizeInChars(ArrayTy).getQuantity() : 0;
+        if (!ArrayTy || ConstantBytes + Bytes > Options.Device.ConstantMemBytes) {
+            ++Arg;
+            continue;
+        }
+        if (getTableInitializer(Arg->Decl)) {
+            ConstantBytes += Bytes;
+            Embedded += (Embedded.empty() ? "" : ", ") + Arg->Name + " (" + std::to_string(Bytes) + " bytes)";
+            KInfo.ConstantTables.push_back(Arg->Decl);
+            Arg = KInfo.Arguments.erase(Arg);
+            continue;
+        }
+        if (!Collector.Streamed.count(Arg->Decl)) {
+            ConstantBytes += Bytes;
+            ConstantArgs += (ConstantArgs.empty() ? "" : ", ") + Arg->Name + " (" + std::to_string(Bytes) + " bytes)";
+            Arg->AddressSpace = ADDRSPACE_CONSTANT;
+        }
+        ++Arg;
+    }
+    if (!Embedded.empty()) {
+        KInfo.Attributes.push_back({"Constant memory", "embedded " + Embedded});
+    }
+    if (!ConstantArgs.empty()) {
+        KInfo.Attributes.push_back({"Constant memory", "__constant " + ConstantArgs});
+    }
+
+    // Selected float buffers move 16 bits per element; stencil inputs are
+    // staged into float tiles straight from global memory and keep float,
+    // and tables already sit in the constant cache
+    if (Options.Storage != StorageFormat::Native) {
+        std::string Stored;
+        uint64_t Bytes = 0, StoredBytes = 0;
+        for (auto& Arg : KInfo.Arguments) {
+            if (Arg.Kind != ArgKind::Buffer || !Arg.Decl || Arg.AddressSpace == ADDRSPACE_CONSTANT) {
+                continue;
+            }
+            bool IsStencilInput = std::any_of(KInfo.Stencil.Inputs.begin(), KInfo.Stencil.Inputs.end(),
+                [&](const StencilInput& Input) { return Input.Array == Arg.Decl; });
+            bool Selected = Options.StorageBuffers.empty() ||
+                std::find(Options.StorageBuffers.begin(), Options.StorageBuffers.end(), Arg.Name) !=
+                    Options.StorageBuffers.end();
+            uint64_t Size = Context->getTypeSizeInChars(Arg.Type).getQuantity();
+            uint64_t Accesses = Arg.Access == ArgAccess::ReadWrite ? 2 : 1;
+            if (Selected && !IsStencilInput &&
+                Arg.Type.getCanonicalType()->isSpecificBuiltinType(clang::BuiltinType::Float)) {
+                Arg.Storage = Options.Storage;
+                Stored += (Stored.empty() ? "" : ", ") + Arg.Name;
+                Size = 2;
+            }
+            Bytes += Accesses * Context->getTypeSizeInChars(Arg.Type).getQuantity();
+            StoredBytes += Accesses * Size;
+        }
+        if (!Stored.empty()) {
+            // Round to nearest: every stored value is off by at most half
+            // an ulp of its 11- or 8-bit significand
+            bool IsHalf = Options.Storage == StorageFormat::Half;
+            KInfo.Attributes.push_back({"Storage", std::string(IsHalf ? "half" : "bf16") + " for " +
+                Stored + ", float compute; relative error per stored value <= " +
+                (IsHalf ? "2^-11 (4.9e-4), |x| > 65504 becomes inf, |x| < 6.1e-5 loses bits"
+                        : "2^-8 (3.9e-3), float range kept") +
+                (KInfo.IsReduction ? "; the sum is off by at most that times sum |x|" : "")});
+            KInfo.Attributes.push_back({"Memory traffic", std::to_string(Bytes) + " -> " +
+                std::to_string(StoredBytes) + " bytes per iteration"});
+        }
+    }
+
     if (KInfo.IsReduction) {
-        return generateReductionKernel(KInfo);
+        // Written once per work-group; the atomic combine also reads it
+        KernelArgument Result;
+        Result.Name = KInfo.Combine == ReductionCombine::Atomic && Collector.ReductionVar
+            ? Collector.ReductionVar->getNameAsString() : "partials";
+        Result.Kind = ArgKind::Buffer;
+        Result.Access = KInfo.Combine == ReductionCombine::Atomic ? ArgAccess::ReadWrite
+                                                                  : ArgAccess::Write;
+        Result.Type = KInfo.ElementType;
+        Result.AddressSpace = ADDRSPACE_GLOBAL;
+        KInfo.Arguments.push_back(Result);
+    }
+
+    if (KInfo.Search.Condition) {
+        // Lowered to the first match by atomic min; the host stores the
+        // loop's end there first, which is also the no-match answer
+        KernelArgument Result;
+        Result.Name = KInfo.Search.Index ? KInfo.Search.Index->getNameAsString() : "first";
+        Result.Kind = ArgKind::Buffer;
+        Result.Access = ArgAccess::ReadWrite;
+        Result.Type = Context->IntTy;
+        Result.AddressSpace = ADDRSPACE_GLOBAL;
+        KInfo.Arguments.push_back(Result);
+        KInfo.Attributes.push_back({"Search", "first match by atomic min on " + Result.Name +
+            ", work-items stop once a lower match is known"});
+        KInfo.Attributes.push_back({"Result", Result.Name + " must hold the loop end before launch"
+            " and keeps it when nothing matches"});
+    }
+
+    if (KInfo.Dispatch.NeedsSizeArg) {
+        KernelArgument TripCount;
+        TripCount.Name = BoundVar ? BoundVar->getNameAsString() : "n";
+        TripCount.Decl = BoundVar;
+        TripCount.Kind = ArgKind::TripCount;
+        TripCount.Type = Context->IntTy;
+        KInfo.Arguments.push_back(TripCount);
+    }
+
+    KInfo.Attributes.push_back({"Arguments", describeArguments(KInfo.Arguments)});
+    if (KInfo.LowerBound != 0) {
+        KInfo.Attributes.push_back({"Iteration offset", std::to_string(KInfo.LowerBound)});
+    }
+
+    bool TwoStage = KInfo.IsReduction && KInfo.Combine != ReductionCombine::Atomic;
+    bool Success = KInfo.IsReduction ? generateReductionKernel(KInfo)
+                 : KInfo.Search.Condition ? generateSearchKernel(KInfo)
+                                          : generateVectorizedLoop(KInfo);
+    if (Success && TwoStage) {
+        Success = generateCombineKernel(KInfo);
+    }
+
+    if (Success) {
+        // C promotes float operands to double, as in sqrt(x[i]) or
+        // x[i] * 2.0, so the kernel rather than its element type decides
+        if (!llvm::is_contained(KInfo.RequiredExtensions, "cl_khr_fp64") &&
+            usesDoubles(Module->getFunction(KInfo.Name))) {
+            KInfo.RequiredExtensions.push_back("cl_khr_fp64");
+            KInfo.Attributes.push_back({"Double precision",
+                "float operands promoted by C, requires cl_khr_fp64"});
+        }
+        addExtensionMetadata(KInfo);
+        LastKernel = KInfo;
+        Kernels.push_back(KInfo);
+        NumKernels += TwoStage ? 2 : 1;
     } else {
-        return generateVectorizedLoop(KInfo);
+        // Keep a broken kernel from invalidating the shared TU module
+        for (const auto& Name : {KInfo.Name, KInfo.Name + "_combine"}) {
+            if (auto* Func = Module->getFunction(Name)) {
+                Func->eraseFromParent();
+            }
+        }
     }
+    return Success;
 }
 
-void SPIRVGenerator::improveReductionKernel(const KernelInfo& KInfo, llvm::Function* Func) {
-    Input = Func->arg_begin();
-
-    // Get global ID
-    auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {
-        llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0))
-    });
+bool SPIRVGenerator::improveReductionKernel(const KernelInfo& KInfo, llvm::Function* Func,
+                                            ExprLowering& Lowering, const clang::Expr* Value) {
+    // (loop arguments..., result, N)
+    auto* Result = std::prev(Func->arg_end(), 2);
+    auto* N = getLoopEnd(KInfo, Func);
 
-    // Create local memory
-    auto* LocalMemTy = llvm::ArrayType::get(FloatTy, KInfo.PreferredWorkGroupSize);
-    auto* LocalMem = Builder.CreateAlloca(LocalMemTy, nullptr, "local_mem");
+    // Work-group shared scratch buffer in __local memory
+    auto* LocalMem = createLocalBuffer(KInfo.Name + ".local_mem", ElemTy,
+                                       KInfo.PreferredWorkGroupSize);
 
     // Get work-item ID
     auto* LocalId = Builder.CreateCall(getGetLocalId(), {
         llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0))
     });
 
-    // Load and reduce vector
-    auto* Vec = createVectorLoad(Input, KInfo.VectorWidth);
-    auto* LocalSum = performVectorReduction(Vec, KInfo.VectorWidth);
+    // Each work-item folds many elements before any synchronization
+    auto* LocalSum = createGridStrideAccumulation(KInfo, Func, N, Lowering, Value);
+    if (!LocalSum) {
+        return false;
+    }
+    auto* GroupSum = createGroupCombine(KInfo, LocalMem, LocalSum, LocalId);
+
+    // Only leader thread publishes the work-group result
+    auto* IsLeader = Builder.CreateICmpEQ(LocalId,
+        llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0)));
+
+    auto* LeaderBlock = llvm::BasicBlock::Create(Builder.getContext(),
+        KInfo.Combine == ReductionCombine::Atomic ? "atomic" : "store_partial", Func);
+    auto* ExitBlock = llvm::BasicBlock::Create(Builder.getContext(), "exit", Func);
+
+    Builder.CreateCondBr(IsLeader, LeaderBlock, ExitBlock);
+    Builder.SetInsertPoint(LeaderBlock);
+
+    if (KInfo.Combine != ReductionCombine::Atomic) {
+        // Result is the per-group partials buffer read by the combine kernel
+        auto* GroupId = Builder.CreateCall(getGetGroupId(), {Builder.getInt32(0)});
+        Builder.CreateStore(GroupSum, Builder.CreateInBoundsGEP(ElemTy, Result, {GroupId}));
+    } else {
+        // Addition commutes, so no ordering beyond atomicity is needed
+        Builder.CreateAtomicRMW(
+            ElemIsFloat ? llvm::AtomicRMWInst::FAdd : llvm::AtomicRMWInst::Add,
+            Result,
+            GroupSum,
+            llvm::MaybeAlign(getElementSize()),
+            llvm::AtomicOrdering::Monotonic
+        );
+    }
+
+    Builder.CreateBr(ExitBlock);
+
+    // Set insertion point to exit block
+    Builder.SetInsertPoint(ExitBlock);
+    return true;
+}
+
+llvm::Value* SPIRVGenerator::createGridStrideAccumulation(const KernelInfo& KInfo,
+                                                          llvm::Function* Func,
+                                                          llvm::Value* N,
+                                                          ExprLowering& Lowering,
+                                                          const clang::Expr* Value) {
+    auto& Ctx = Builder.getContext();
+    auto* Width = Builder.getInt32(KInfo.VectorWidth);
+    // The lowering emits plain scalars for width 1
+    auto* VecTy = KInfo.VectorWidth > 1 ? getVectorType(ElemTy, KInfo.VectorWidth) : ElemTy;
+
+    // Work-item g starts at vector g and strides by the whole NDRange, so
+    // consecutive work-items always touch consecutive vectors
+    auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {Builder.getInt32(0)});
+    // The stride follows the actual launch, so every element is summed
+    // exactly once whatever the NDRange; a deterministic reduction fixes
+    // its summation order through the launch recorded in its dispatch
+    // metadata, which also sizes the partials its combine kernel reads
+    auto* GlobalSize = Builder.CreateCall(getGetGlobalSize(), {Builder.getInt32(0)});
+    auto* Lower = Builder.getInt32(static_cast<uint32_t>(KInfo.LowerBound));
+    auto* Start = Builder.CreateAdd(Builder.CreateMul(GlobalId, Width), Lower, "stride_start");
+    auto* Stride = Builder.CreateMul(GlobalSize, Width, "stride");
+
+    auto* Preheader = Builder.GetInsertBlock();
+    auto* LoopBlock = llvm::BasicBlock::Create(Ctx, "stride_loop", Func);
+    auto* BodyBlock = llvm::BasicBlock::Create(Ctx, "stride_body", Func);
+    auto* TailBlock = llvm::BasicBlock::Create(Ctx, "stride_tail", Func);
+    auto* TailLoopBlock = llvm::BasicBlock::Create(Ctx, "tail_loop", Func);
+    auto* TailLoadBlock = llvm::BasicBlock::Create(Ctx, "tail_element", Func);
+    auto* TailDoneBlock = llvm::BasicBlock::Create(Ctx, "tail_done", Func);
+    Builder.CreateBr(LoopBlock);
+
+    Builder.SetInsertPoint(LoopBlock);
+    auto* Index = Builder.CreatePHI(Builder.getInt32Ty(), 2, "stride_index");
+    auto* Acc = Builder.CreatePHI(VecTy, 2, "stride_acc");
+    Index->addIncoming(Start, Preheader);
+    Acc->addIncoming(getElementConstant(VecTy, 0.0, 0), Preheader);
+    Builder.CreateCondBr(Builder.CreateICmpULE(Builder.CreateAdd(Index, Width), N),
+                         BodyBlock, TailBlock);
+
+    Builder.SetInsertPoint(BodyBlock);
+    Lowering.setIteration(Index, KInfo.VectorWidth, KInfo.LowerBound % KInfo.VectorWidth == 0);
+    llvm::Value* Next;
+    if (auto* Mul = Lowering.getContractibleMul(Value, KInfo.ElementType)) {
+        // sum += a[i] * b[i] contracts like any other a*b+c
+        Next = Lowering.createMulAdd(Mul, Acc, false);
+    } else {
+        auto* Vec = Lowering.convert(Lowering.lowerExpr(Value), Value->getType(), KInfo.ElementType);
+        Next = Vec ? createArithOp(clang::BO_Add, Acc, Vec) : nullptr;
+    }
+    if (!Next) {
+        return nullptr;
+    }
+    Acc->addIncoming(Next, Builder.GetInsertBlock());
+    Index->addIncoming(Builder.CreateAdd(Index, Stride), Builder.GetInsertBlock());
+    auto* Backedge = Builder.CreateBr(LoopBlock);
+    if (KInfo.UnrollFactor > 1) {
+        // The kernel pipeline's loop-unroll honours the count; the
+        // accumulation order is unchanged
+        auto Self = llvm::MDNode::getTemporary(Ctx, llvm::None);
+        llvm::Metadata* Count[] = {
+            llvm::MDString::get(Ctx, "llvm.loop.unroll.count"),
+            llvm::ConstantAsMetadata::get(Builder.getInt32(KInfo.UnrollFactor))
+        };
+        auto* LoopID = llvm::MDNode::get(Ctx, {Self.get(), llvm::MDNode::get(Ctx, Count)});
+        LoopID->replaceOperandWith(0, LoopID);
+        Backedge->setMetadata(llvm::LLVMContext::MD_loop, LoopID);
+    }
+
+    // The N % W leftover elements go to the first work-items, striding by
+    // the NDRange so a launch narrower than a vector still sums them all
+    Builder.SetInsertPoint(TailBlock);
+    auto* Partial = performVectorReduction(Acc, KInfo.VectorWidth);
+    auto* VectorEnd = Builder.CreateAdd(Lower, Builder.CreateAnd(Builder.CreateSub(N, Lower),
+                                        Builder.getInt32(~(KInfo.VectorWidth - 1))));
+    auto* TailStart = Builder.CreateAdd(VectorEnd, GlobalId, "tail_start");
+    auto* TailEntry = Builder.GetInsertBlock();
+    Builder.CreateBr(TailLoopBlock);
+
+    Builder.SetInsertPoint(TailLoopBlock);
+    auto* TailIndex = Builder.CreatePHI(Builder.getInt32Ty(), 2, "tail_index");
+    auto* Sum = Builder.CreatePHI(ElemTy, 2, "item_sum");
+    TailIndex->addIncoming(TailStart, TailEntry);
+    Sum->addIncoming(Partial, TailEntry);
+    Builder.CreateCondBr(Builder.CreateICmpULT(TailIndex, N), TailLoadBlock, TailDoneBlock);
+
+    Builder.SetInsertPoint(TailLoadBlock);
+    Lowering.setIteration(TailIndex, 1);
+    auto* TailVal = Lowering.convert(Lowering.lowerExpr(Value), Value->getType(), KInfo.ElementType);
+    if (!TailVal) {
+        return nullptr;
+    }
+    Sum->addIncoming(createArithOp(clang::BO_Add, Sum, TailVal), Builder.GetInsertBlock());
+    TailIndex->addIncoming(Builder.CreateAdd(TailIndex, GlobalSize), Builder.GetInsertBlock());
+    Builder.CreateBr(TailLoopBlock);
+
+    Builder.SetInsertPoint(TailDoneBlock);
+    return Sum;
+}
+
+llvm::Value* SPIRVGenerator::createGroupCombine(const KernelInfo& KInfo,
+                                                llvm::GlobalVariable* LocalMem,
+                                                llvm::Value* Value,
+                                                llvm::Value* LocalId) {
+    // The returned value is only meaningful in work-item 0
+    if (KInfo.Reduction == ReductionStrategy::SubGroup) {
+        return createSubGroupReduction(Value, LocalMem);
+    }
 
     // Store to local memory
-    auto* LocalPtr = Builder.CreateInBoundsGEP(FloatTy, LocalMem, {LocalId});
-    Builder.CreateStore(LocalSum, LocalPtr);
+    auto* LocalPtr = getLocalElementPtr(LocalMem, LocalId);
+    Builder.CreateStore(Value, LocalPtr);
 
     // Add barrier
     addBarrier(CLK_LOCAL_MEM_FENCE);
@@ -131,46 +1037,204 @@ void SPIRVGenerator::improveReductionKernel(const KernelInfo& KInfo, llvm::Funct
 
     // Create work-group reduction
     createWorkGroupReduction(LocalMem, WGSize, LocalId, KInfo);
+    return Builder.CreateLoad(ElemTy, getLocalElementPtr(LocalMem, Builder.getInt32(0)));
+}
 
-    // Only leader thread performs atomic update
-    auto* IsLeader = Builder.CreateICmpEQ(LocalId,
-        llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0)));
-
-    auto* AtomicBlock = llvm::BasicBlock::Create(Builder.getContext(), "atomic", Func);
-    auto* ExitBlock = llvm::BasicBlock::Create(Builder.getContext(), "exit", Func);
+bool SPIRVGenerator::generateCombineKernel(const KernelInfo& KInfo) {
+    auto& Ctx = Builder.getContext();
 
-    Builder.CreateCondBr(IsLeader, AtomicBlock, ExitBlock);
+    // (partials, result, number of partials)
+    std::vector<llvm::Type*> ArgTypes = {
+        llvm::PointerType::get(ElemTy, ADDRSPACE_GLOBAL),
+        llvm::PointerType::get(ElemTy, ADDRSPACE_GLOBAL),
+        llvm::Type::getInt32Ty(Ctx)
+    };
+    auto* Func = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), ArgTypes, false),
+        llvm::Function::ExternalLinkage,
+        KInfo.Name + "_combine",
+        Module.get()
+    );
+    addSPIRVMetadata(Func);
 
-    // Generate atomic update code
-    Builder.SetInsertPoint(AtomicBlock);
+    std::vector<KernelArgument> Arguments(3);
+    for (unsigned I = 0; I < 2; ++I) {
+        Arguments[I].Kind = ArgKind::Buffer;
+        Arguments[I].Type = KInfo.ElementType;
+        Arguments[I].AddressSpace = ADDRSPACE_GLOBAL;
+    }
+    Arguments[0].Name = "partials";
+    Arguments[1].Name = "result";
+    Arguments[1].Access = ArgAccess::Write;
+    Arguments[CombineCountArg].Name = "num_partials";
+    Arguments[CombineCountArg].Kind = ArgKind::TripCount;
+    for (auto& Arg : Func->args()) {
+        Arg.setName(Arguments[Arg.getArgNo()].Name);
+    }
+    addArgumentAttributes(Func, Arguments);
 
+    auto* Partials = Func->arg_begin();
     auto* Result = std::next(Func->arg_begin());
-    auto* FinalSum = Builder.CreateLoad(FloatTy, LocalMem);
-
-    Builder.CreateAtomicRMW(
-        llvm::AtomicRMWInst::FAdd,
-        Result,
-        FinalSum,
-        llvm::MaybeAlign(4),
-        llvm::AtomicOrdering::SequentiallyConsistent
-    );
+    auto* NumPartials = std::next(Func->arg_begin(), CombineCountArg);
+
+    auto* Entry = llvm::BasicBlock::Create(Ctx, "entry", Func);
+    auto* LoopBlock = llvm::BasicBlock::Create(Ctx, "partial_loop", Func);
+    auto* BodyBlock = llvm::BasicBlock::Create(Ctx, "partial_body", Func);
+    auto* DoneBlock = llvm::BasicBlock::Create(Ctx, "partial_done", Func);
+    Builder.SetInsertPoint(Entry);
 
+    // Launched as a single work-group; each work-item folds a strided
+    // slice of the partials
+    auto* LocalId = Builder.CreateCall(getGetLocalId(), {Builder.getInt32(0)});
+    auto* LocalSize = Builder.CreateCall(getGetLocalSize(), {Builder.getInt32(0)});
+    Builder.CreateBr(LoopBlock);
+
+    Builder.SetInsertPoint(LoopBlock);
+    auto* Index = Builder.CreatePHI(Builder.getInt32Ty(), 2, "partial_index");
+    auto* Acc = Builder.CreatePHI(ElemTy, 2, "partial_acc");
+    Index->addIncoming(LocalId, Entry);
+    Acc->addIncoming(getElementConstant(ElemTy, 0.0, 0), Entry);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Index, NumPartials), BodyBlock, DoneBlock);
+
+    Builder.SetInsertPoint(BodyBlock);
+    auto* Partial = Builder.CreateLoad(ElemTy, Builder.CreateInBoundsGEP(ElemTy, Partials, {Index}));
+    Acc->addIncoming(createArithOp(clang::BO_Add, Acc, Partial), BodyBlock);
+    Index->addIncoming(Builder.CreateAdd(Index, LocalSize), BodyBlock);
+    Builder.CreateBr(LoopBlock);
+
+    Builder.SetInsertPoint(DoneBlock);
+    auto* LocalMem = createLocalBuffer(Func->getName().str() + ".local_mem", ElemTy,
+                                       KInfo.PreferredWorkGroupSize);
+    auto* Total = createGroupCombine(KInfo, LocalMem, Acc, LocalId);
+
+    // The only writer of the result, so a plain store suffices
+    auto* StoreBlock = llvm::BasicBlock::Create(Ctx, "store_result", Func);
+    auto* ExitBlock = llvm::BasicBlock::Create(Ctx, "exit", Func);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(LocalId, Builder.getInt32(0)), StoreBlock, ExitBlock);
+
+    Builder.SetInsertPoint(StoreBlock);
+    Builder.CreateStore(Total, Result);
     Builder.CreateBr(ExitBlock);
 
-    // Set insertion point to exit block
     Builder.SetInsertPoint(ExitBlock);
+    Builder.CreateRetVoid();
+
+    addMemoryAttributes(Func, 1);
+    addWorkGroupMetadata(Func, KInfo.PreferredWorkGroupSize);
+
+    DispatchInfo Dispatch;
+    Dispatch.StaticGlobalSize = KInfo.PreferredWorkGroupSize;
+    Dispatch.RequiredWorkGroupSize = KInfo.PreferredWorkGroupSize;
+    addDispatchMetadata(Func, Dispatch);
+
+    return !llvm::verifyFunction(*Func, &llvm::errs());
+}
+
+llvm::Value* SPIRVGenerator::createSubGroupReduceAdd(llvm::Value* Value) {
+    // cl_khr_subgroups has no char or short overloads; the sum modulo
+    // 2^8 or 2^16 is the truncated int sum
+    llvm::Type* ArgTy = ElemTy;
+    if (ElemTy->isIntegerTy() && ElemTy->getIntegerBitWidth() < 32) {
+        ArgTy = Builder.getInt32Ty();
+        Value = Builder.CreateIntCast(Value, ArgTy, ElemIsSigned);
+    }
+    auto Callee = getOpenCLFunction(
+        getMangledBuiltinName(OpenCLBuiltins::SUB_GROUP_REDUCE_ADD, ArgTy),
+        ArgTy, {ArgTy});
+    return Builder.CreateTrunc(Builder.CreateCall(Callee, {Value}), ElemTy);
+}
+
+llvm::Value* SPIRVGenerator::createSubGroupReduction(
+    llvm::Value* Value,
+    llvm::GlobalVariable* LocalMem) {
+    auto& Ctx = Builder.getContext();
+    auto* Func = Builder.GetInsertBlock()->getParent();
+    auto* Zero = getElementConstant(ElemTy, 0.0, 0);
+
+    // Reduce within each sub-group without touching local memory
+    auto* SubGroupSum = createSubGroupReduceAdd(Value);
+    auto* SubGroupId = Builder.CreateCall(getSubGroupQuery(OpenCLBuiltins::GET_SUB_GROUP_ID));
+    auto* SubGroupLocalId = Builder.CreateCall(
+        getSubGroupQuery(OpenCLBuiltins::GET_SUB_GROUP_LOCAL_ID));
+
+    // One value per sub-group goes through local memory
+    auto* StoreBlock = llvm::BasicBlock::Create(Ctx, "sg_store", Func);
+    auto* SyncBlock = llvm::BasicBlock::Create(Ctx, "sg_sync", Func);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(SubGroupLocalId, Builder.getInt32(0)),
+                         StoreBlock, SyncBlock);
+
+    Builder.SetInsertPoint(StoreBlock);
+    Builder.CreateStore(SubGroupSum, getLocalElementPtr(LocalMem, SubGroupId));
+    Builder.CreateBr(SyncBlock);
+
+    Builder.SetInsertPoint(SyncBlock);
+    addBarrier(CLK_LOCAL_MEM_FENCE);
+
+    // The first sub-group folds the per-sub-group values, striding by its
+    // size in case there are more sub-groups than lanes
+    auto* FinalBlock = llvm::BasicBlock::Create(Ctx, "sg_final", Func);
+    auto* LoopBlock = llvm::BasicBlock::Create(Ctx, "sg_gather", Func);
+    auto* BodyBlock = llvm::BasicBlock::Create(Ctx, "sg_gather_body", Func);
+    auto* DoneBlock = llvm::BasicBlock::Create(Ctx, "sg_gather_done", Func);
+    auto* MergeBlock = llvm::BasicBlock::Create(Ctx, "sg_merge", Func);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(SubGroupId, Builder.getInt32(0)),
+                         FinalBlock, MergeBlock);
+
+    Builder.SetInsertPoint(FinalBlock);
+    auto* NumSubGroups = Builder.CreateCall(
+        getSubGroupQuery(OpenCLBuiltins::GET_NUM_SUB_GROUPS));
+    auto* SubGroupSize = Builder.CreateCall(
+        getSubGroupQuery(OpenCLBuiltins::GET_SUB_GROUP_SIZE));
+    Builder.CreateBr(LoopBlock);
+
+    Builder.SetInsertPoint(LoopBlock);
+    auto* Index = Builder.CreatePHI(Builder.getInt32Ty(), 2, "sg_index");
+    auto* Acc = Builder.CreatePHI(ElemTy, 2, "sg_acc");
+    Index->addIncoming(SubGroupLocalId, FinalBlock);
+    Acc->addIncoming(Zero, FinalBlock);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Index, NumSubGroups), BodyBlock, DoneBlock);
+
+    Builder.SetInsertPoint(BodyBlock);
+    auto* Partial = Builder.CreateLoad(ElemTy, getLocalElementPtr(LocalMem, Index));
+    auto* NextAcc = createArithOp(clang::BO_Add, Acc, Partial);
+    auto* NextIndex = Builder.CreateAdd(Index, SubGroupSize);
+    Index->addIncoming(NextIndex, BodyBlock);
+    Acc->addIncoming(NextAcc, BodyBlock);
+    Builder.CreateBr(LoopBlock);
+
+    Builder.SetInsertPoint(DoneBlock);
+    auto* Total = createSubGroupReduceAdd(Acc);
+    Builder.CreateBr(MergeBlock);
+
+    // Only work-item 0 (in sub-group 0) consumes the result
+    Builder.SetInsertPoint(MergeBlock);
+    auto* Result = Builder.CreatePHI(ElemTy, 2, "group_sum");
+    Result->addIncoming(Total, DoneBlock);
+    Result->addIncoming(Zero, SyncBlock);
+    return Result;
 }
 
 void SPIRVGenerator::addSPIRVMetadata(llvm::Function* Func) {
     // Add SPIR-V calling convention
     Func->setCallingConv(llvm::CallingConv::SPIR_KERNEL);
 
-    // Add SPIR-V memory model metadata
-    llvm::Module* M = Func->getParent();
+    // Add kernel attribute
+    Func->addFnAttr("opencl.kernels", Func->getName());
+}
+
+void SPIRVGenerator::addMemoryModelMetadata(llvm::Module* M) {
+    // Module-wide metadata is shared by every kernel in the TU, so it is
+    // only added once when the module is finalized
+    if (M->getModuleFlag("spirv.MemoryModel")) {
+        return;
+    }
+    auto& Ctx = Builder.getContext();
+    auto* Int32Ty = llvm::Type::getInt32Ty(Ctx);
+
     // Create constant metadata values
-    auto* SourceVal = llvm::ConstantInt::get(llvm::Type::getInt32Ty(Builder.getContext()), 0);
-    auto* VersionVal = llvm::ConstantInt::get(llvm::Type::getInt32Ty(Builder.getContext()), 100);
-    auto* MemModelVal = llvm::ConstantInt::get(llvm::Type::getInt32Ty(Builder.getContext()), 1);
+    auto* SourceVal = llvm::ConstantInt::get(Int32Ty, 0);
+    auto* VersionVal = llvm::ConstantInt::get(Int32Ty, 100);
+    auto* MemModelVal = llvm::ConstantInt::get(Int32Ty, 1);
 
     M->addModuleFlag(llvm::Module::Warning, "spirv.Source",
                      llvm::ConstantAsMetadata::get(SourceVal));
@@ -179,362 +1243,1428 @@ void SPIRVGenerator::addSPIRVMetadata(llvm::Function* Func) {
     M->addModuleFlag(llvm::Module::Warning, "spirv.MemoryModel",
                      llvm::ConstantAsMetadata::get(MemModelVal));
 
-    // Add kernel attribute
-    Func->addFnAttr("opencl.kernels", Func->getName());
+    // OpenCL C 1.2 / SPIR 1.2, as expected by SPIR-V consumers
+    auto AddVersion = [&](llvm::StringRef Name, unsigned Major, unsigned Minor) {
+        llvm::Metadata* Version[] = {
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(Int32Ty, Major)),
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(Int32Ty, Minor))
+        };
+        M->getOrInsertNamedMetadata(Name)->addOperand(llvm::MDNode::get(Ctx, Version));
+    };
+    AddVersion("opencl.spir.version", 1, 2);
+    AddVersion("opencl.ocl.version", 1, 2);
+
+    // Record the precision policy so results can be traced to it; SPIR
+    // consumers read FP_CONTRACT as permission to fuse
+    M->getOrInsertNamedMetadata("cspir.precision")->addOperand(
+        llvm::MDNode::get(Ctx, {llvm::MDString::get(Ctx, getPrecisionName(Options.Precision))}));
+    if (Options.Precision != PrecisionPolicy::Strict) {
+        M->getOrInsertNamedMetadata("opencl.enable.FP_CONTRACT");
+    }
+}
+
+bool SPIRVGenerator::finalizeModule() {
+    addMemoryModelMetadata(Module.get());
+    return !llvm::verifyModule(*Module, &llvm::errs());
+}
+
+llvm::GlobalVariable* SPIRVGenerator::createLocalBuffer(const std::string& Name,
+                                                       llvm::Type* ElemTy,
+                                                       uint64_t NumElements) {
+    // __local variables are module-scope in SPIR; one instance is shared
+    // by every work-item of a work-group
+    auto* BufferTy = llvm::ArrayType::get(ElemTy, NumElements);
+    auto* Buffer = new llvm::GlobalVariable(
+        *Module, BufferTy, false, llvm::GlobalValue::InternalLinkage,
+        llvm::UndefValue::get(BufferTy), Name, nullptr,
+        llvm::GlobalValue::NotThreadLocal, ADDRSPACE_LOCAL);
+    Buffer->setAlignment(llvm::Align(ElemTy->getPrimitiveSizeInBits() / 8));
+    return Buffer;
+}
+
+llvm::Value* SPIRVGenerator::getLocalElementPtr(llvm::GlobalVariable* Buffer, llvm::Value* Index) {
+    return Builder.CreateInBoundsGEP(Buffer->getValueType(), Buffer,
+                                     {Builder.getInt32(0), Index});
+}
+
+llvm::Constant* SPIRVGenerator::getTableInitializer(const clang::VarDecl* VD) {
+    auto* ArrayTy = Context->getAsConstantArrayType(VD->getType());
+    const clang::VarDecl* Definition = nullptr;
+    if (!ArrayTy || !ArrayTy->getElementType()->isArithmeticType() ||
+        !ArrayTy->getElementType().isConstQualified() || !VD->getAnyInitializer(Definition)) {
+        return nullptr;
+    }
+    const clang::APValue* Value = Definition->evaluateValue();
+    llvm::Type* ElemTy = getLLVMType(ArrayTy->getElementType());
+    if (!Value || !Value->isArray() || !ElemTy) {
+        return nullptr;
+    }
+
+    // Elements past the initializer list take the array filler, zero in C
+    uint64_t Size = ArrayTy->getSize().getZExtValue();
+    std::vector<llvm::Constant*> Elements;
+    for (uint64_t I = 0; I < Size; ++I) {
+        if (I >= Value->getArrayInitializedElts() && !Value->hasArrayFiller()) {
+            return nullptr;
+        }
+        const clang::APValue& Element = I < Value->getArrayInitializedElts()
+            ? Value->getArrayInitializedElt(I) : Value->getArrayFiller();
+        llvm::Constant* C = nullptr;
+        if (Element.isFloat()) {
+            C = llvm::ConstantFP::get(Builder.getContext(), Element.getFloat());
+        } else if (Element.isInt() && ElemTy->isIntegerTy()) {
+            C = llvm::ConstantInt::get(ElemTy, Element.getInt().extOrTrunc(ElemTy->getIntegerBitWidth()));
+        }
+        if (!C || C->getType() != ElemTy) {
+            return nullptr;
+        }
+        Elements.push_back(C);
+    }
+    return llvm::ConstantArray::get(llvm::ArrayType::get(ElemTy, Size), Elements);
+}
+
+llvm::Constant* SPIRVGenerator::getConstantTable(const clang::VarDecl* VD) {
+    // One module constant per array, whatever kernels and variants read it
+    auto*& Table = ConstantTables[VD];
+    if (!Table) {
+        auto* Init = getTableInitializer(VD);
+        if (!Init) {
+            return nullptr;
+        }
+        Table = new llvm::GlobalVariable(
+            *Module, Init->getType(), true, llvm::GlobalValue::InternalLinkage, Init,
+            VD->getNameAsString(), nullptr, llvm::GlobalValue::NotThreadLocal, ADDRSPACE_CONSTANT);
+        Table->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        // Aligned vector loads of up to 16 elements may start at index 0
+        auto* ElemTy = Table->getValueType()->getArrayElementType();
+        Table->setAlignment(llvm::Align(16 * std::max<uint64_t>(ElemTy->getPrimitiveSizeInBits() / 8, 1)));
+    }
+    // Bound like a buffer argument: a pointer to the first element
+    return llvm::ConstantExpr::getInBoundsGetElementPtr(
+        Table->getValueType(), Table,
+        llvm::ArrayRef<llvm::Constant*>{Builder.getInt32(0), Builder.getInt32(0)});
 }
 
 void SPIRVGenerator::createWorkGroupReduction(
-    llvm::Value* LocalMem,
+    llvm::GlobalVariable* LocalMem,
     llvm::Value* WGSize,
     llvm::Value* LocalId,
     const KernelInfo& KInfo) {
 
-    auto* Func = Builder.GetInsertBlock()->getParent();
+    auto* Func = Builder.GetInsertBlock()->getParent();
+
+    // Create reduction loop blocks
+    auto* ReduceEntry = llvm::BasicBlock::Create(Builder.getContext(), "reduce_entry", Func);
+    Builder.CreateBr(ReduceEntry);
+    Builder.SetInsertPoint(ReduceEntry);
+
+    // Halve the number of active work-items each step so that no slot is
+    // read and written by different work-items within the same step. The
+    // first step covers the next power of two, so groups of other sizes
+    // fold their upper slots too
+    for (unsigned StepSize = llvm::PowerOf2Ceil(KInfo.PreferredWorkGroupSize) / 2; StepSize > 0;
+         StepSize /= 2) {
+        auto* ReduceBlock = llvm::BasicBlock::Create(
+            Builder.getContext(), "reduce_" + std::to_string(StepSize), Func);
+        auto* ContinueBlock = llvm::BasicBlock::Create(
+            Builder.getContext(), "continue_" + std::to_string(StepSize), Func);
+
+        // Create condition for this reduction step
+        auto* StepVal = llvm::ConstantInt::get(
+            llvm::Type::getInt32Ty(Builder.getContext()), StepSize);
+        auto* InRange = Builder.CreateAnd(
+            Builder.CreateICmpULT(LocalId, StepVal),
+            Builder.CreateICmpULT(Builder.CreateAdd(LocalId, StepVal), WGSize)
+        );
+
+        Builder.CreateCondBr(InRange, ReduceBlock, ContinueBlock);
+
+        // Generate reduction code
+        Builder.SetInsertPoint(ReduceBlock);
+        auto* Ptr1 = getLocalElementPtr(LocalMem, LocalId);
+        auto* Ptr2 = getLocalElementPtr(LocalMem, Builder.CreateAdd(LocalId, StepVal));
+
+        auto* Val1 = Builder.CreateLoad(ElemTy, Ptr1);
+        auto* Val2 = Builder.CreateLoad(ElemTy, Ptr2);
+        auto* Sum = createArithOp(clang::BO_Add, Val1, Val2);
+        Builder.CreateStore(Sum, Ptr1);
+        Builder.CreateBr(ContinueBlock);
+
+        // Continue with next iteration
+        Builder.SetInsertPoint(ContinueBlock);
+        addBarrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+void SPIRVGenerator::addWorkGroupSizeHint(llvm::Function* Func, unsigned Size) {
+    llvm::Metadata* MDArgs[] = {
+        llvm::ConstantAsMetadata::get(Builder.getInt32(Size)),
+        llvm::ConstantAsMetadata::get(Builder.getInt32(1)),
+        llvm::ConstantAsMetadata::get(Builder.getInt32(1))
+    };
+    Func->setMetadata("work_group_size_hint",
+        llvm::MDNode::get(Builder.getContext(), MDArgs));
+}
+
+void SPIRVGenerator::addDispatchMetadata(llvm::Function* Func, const DispatchInfo& Dispatch) {
+    // !{kernel, elements per work-item, needs N, static global size, reqd WG size}
+    auto* MD = Module->getOrInsertNamedMetadata("cspir.dispatch");
+    llvm::Metadata* MDArgs[] = {
+        llvm::ValueAsMetadata::get(Func),
+        llvm::ConstantAsMetadata::get(Builder.getInt32(Dispatch.ElementsPerWorkItem)),
+        llvm::ConstantAsMetadata::get(Builder.getInt1(Dispatch.NeedsSizeArg)),
+        llvm::ConstantAsMetadata::get(Builder.getInt64(Dispatch.StaticGlobalSize)),
+        llvm::ConstantAsMetadata::get(Builder.getInt32(Dispatch.RequiredWorkGroupSize))
+    };
+    MD->addOperand(llvm::MDNode::get(Builder.getContext(), MDArgs));
+}
+
+void SPIRVGenerator::addWorkGroupMetadata(llvm::Function* Func, unsigned Size) {
+    // Kernels that size local memory by the work-group require it exactly
+    llvm::Metadata* MDArgs[] = {
+        llvm::ConstantAsMetadata::get(Builder.getInt32(Size)),
+        llvm::ConstantAsMetadata::get(Builder.getInt32(1)),
+        llvm::ConstantAsMetadata::get(Builder.getInt32(1))
+    };
+    Func->setMetadata("reqd_work_group_size",
+        llvm::MDNode::get(Builder.getContext(), MDArgs));
+}
+
+bool SPIRVGenerator::generateVectorizedLoop(const KernelInfo& KInfo) {
+    const auto* IV = getInductionVariable(KInfo.OriginalLoop);
+    if (!IV) {
+        llvm::errs() << "Error: Loop has no induction variable\n";
+        return false;
+    }
+
+    // Loop arguments, then the trip count
+    std::vector<llvm::Type*> ArgTypes;
+    if (!getArgumentTypes(KInfo, ArgTypes)) {
+        return false;
+    }
+
+    auto* FuncTy = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(Builder.getContext()),
+        ArgTypes,
+        false
+    );
+
+    // Create kernel function
+    auto* Func = llvm::Function::Create(
+        FuncTy,
+        llvm::Function::ExternalLinkage,
+        KInfo.Name,
+        Module.get()
+    );
+
+    // Add OpenCL kernel calling convention and attribute
+    addSPIRVMetadata(Func);
+
+    // Create entry block
+    auto* Entry = llvm::BasicBlock::Create(Builder.getContext(), "entry", Func);
+    Builder.SetInsertPoint(Entry);
+
+    // Get global ID
+    auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {
+        llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0))
+    });
+
+    ExprLowering Lowering(*Context, Builder, IV);
+    bindArguments(KInfo, Func, Lowering);
+    if (!KInfo.Stencil.Inputs.empty()) {
+        return generateStencilBody(KInfo, Func, Lowering);
+    }
+    if (KInfo.StaticTripCount) {
+        return generateStaticLoopBody(KInfo, Func, GlobalId, Lowering);
+    }
+    auto* N = getLoopEnd(KInfo, Func);
+    auto* Width = Builder.getInt32(KInfo.VectorWidth);
+    auto* Lower = Builder.getInt32(static_cast<uint32_t>(KInfo.LowerBound));
+    bool Aligned = KInfo.LowerBound % KInfo.VectorWidth == 0;
+
+    // Work-item g owns vector g*C + c, or g + c*global_size when strided,
+    // for c < C; either way later vectors start at higher iterations
+    llvm::Value* Stride = Width;
+    llvm::Value* First = Builder.CreateMul(
+        GlobalId, Builder.getInt32(KInfo.VectorWidth * KInfo.Coarsening));
+    if (KInfo.Coarsening > 1 && KInfo.StridedCoarsening) {
+        auto* GlobalSize = Builder.CreateCall(getGetGlobalSize(), {Builder.getInt32(0)});
+        Stride = Builder.CreateMul(GlobalSize, Width, "stride");
+        First = Builder.CreateMul(GlobalId, Width);
+    }
+    auto* Base = Builder.CreateAdd(First, Lower, "base");
+    auto* Head = Builder.GetInsertBlock();
+
+    auto* TailBlock = llvm::BasicBlock::Create(Builder.getContext(), "tail", Func);
+    auto* TailBodyBlock = llvm::BasicBlock::Create(Builder.getContext(), "tail_lane", Func);
+    auto* ExitBlock = llvm::BasicBlock::Create(Builder.getContext(), "exit", Func);
+
+    // Unrolled over the C vectors; the first one that is not full hands its
+    // start to the masked tail, and none after it has any iterations
+    Builder.SetInsertPoint(TailBlock);
+    auto* TailStart = Builder.CreatePHI(Builder.getInt32Ty(), KInfo.Coarsening, "tail_start");
+    Builder.SetInsertPoint(Head);
+
+    llvm::Value* Index = Base;
+    for (unsigned C = 0; C < KInfo.Coarsening; ++C) {
+        if (C > 0) {
+            Index = Builder.CreateAdd(Index, Stride, "base");
+        }
+        auto* VectorBlock = llvm::BasicBlock::Create(Builder.getContext(), "vector", Func, TailBlock);
+        TailStart->addIncoming(Index, Builder.GetInsertBlock());
+        Builder.CreateCondBr(Builder.CreateICmpULE(Builder.CreateAdd(Index, Width), N),
+                             VectorBlock, TailBlock);
+
+        // The whole loop body, W iterations at once. Adjacent vectors run
+        // in blocks the previous ones dominate, so their loads carry over.
+        Builder.SetInsertPoint(VectorBlock);
+        if (C > 0 && !KInfo.StridedCoarsening) {
+            Lowering.continueIteration(Index, KInfo.VectorWidth);
+        } else {
+            Lowering.setIteration(Index, KInfo.VectorWidth, Aligned);
+        }
+        if (!Lowering.lowerBody(KInfo.OriginalLoop->getBody())) {
+            llvm::errs() << "Error: Cannot lower loop body: " << Lowering.getError() << "\n";
+            return false;
+        }
+    }
+    Builder.CreateBr(ExitBlock);
+
+    // Masked tail: lanes past N are neither loaded nor stored
+    Builder.SetInsertPoint(TailBlock);
+    Builder.CreateCondBr(Builder.CreateICmpULT(TailStart, N), TailBodyBlock, ExitBlock);
+
+    Builder.SetInsertPoint(TailBodyBlock);
+    auto* Lane = Builder.CreatePHI(Builder.getInt32Ty(), 2, "lane");
+    Lane->addIncoming(TailStart, TailBlock);
+    Lowering.setIteration(Lane, 1);
+    if (!Lowering.lowerBody(KInfo.OriginalLoop->getBody())) {
+        llvm::errs() << "Error: Cannot lower loop body: " << Lowering.getError() << "\n";
+        return false;
+    }
+    auto* NextLane = Builder.CreateAdd(Lane, Builder.getInt32(1));
+    Lane->addIncoming(NextLane, Builder.GetInsertBlock());
+    Builder.CreateCondBr(Builder.CreateICmpULT(NextLane, N), TailBodyBlock, ExitBlock);
+
+    // Set up exit block
+    Builder.SetInsertPoint(ExitBlock);
+    Builder.CreateRetVoid();
+
+    // Add attributes and metadata
+    addMemoryAttributes(Func, KInfo.VectorWidth);
+    addWorkGroupSizeHint(Func, KInfo.PreferredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
+
+    return !llvm::verifyFunction(*Func, &llvm::errs());
+}
+
+bool SPIRVGenerator::generateStaticLoopBody(const KernelInfo& KInfo, llvm::Function* Func,
+                                            llvm::Value* GlobalId, ExprLowering& Lowering) {
+    const auto* Body = KInfo.OriginalLoop->getBody();
+    uint64_t Width = KInfo.VectorWidth;
+    uint64_t Vectors = KInfo.StaticTripCount / Width;
+    uint64_t Remainder = KInfo.StaticTripCount % Width;
+    bool Aligned = KInfo.LowerBound % KInfo.VectorWidth == 0;
+    auto Iteration = [&](uint64_t I) {
+        return Builder.getInt32(static_cast<uint32_t>(KInfo.LowerBound + I));
+    };
+    // Shift > 0 continues the previous iterations in the same block
+    auto Lower = [&](llvm::Value* Index, unsigned W, int64_t Shift) {
+        if (Shift) {
+            Lowering.continueIteration(Index, Shift);
+        } else {
+            Lowering.setIteration(Index, W, W == 1 || Aligned);
+        }
+        if (!Lowering.lowerBody(Body)) {
+            llvm::errs() << "Error: Cannot lower loop body: " << Lowering.getError() << "\n";
+            return false;
+        }
+        return true;
+    };
+
+    auto LowerTail = [&]() {
+        for (uint64_t R = 0; R < Remainder; ++R) {
+            if (!Lower(Iteration(Vectors * Width + R), 1, 0)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // The NDRange matches the iteration space up to whole work-groups, so
+    // only the work-items rounding it up need a check
+    if (KInfo.Dispatch.StaticGlobalSize == 1) {
+        for (uint64_t V = 0; V < Vectors; ++V) {
+            if (!Lower(Iteration(V * Width), KInfo.VectorWidth, V > 0 ? Width : 0)) {
+                return false;
+            }
+        }
+        if (!LowerTail()) {
+            return false;
+        }
+        Builder.CreateRetVoid();
+    } else {
+        auto* VectorBlock = llvm::BasicBlock::Create(Builder.getContext(), "vector", Func);
+        auto* ExitBlock = llvm::BasicBlock::Create(Builder.getContext(), "exit", Func);
+        uint64_t WorkItems = Vectors + (Remainder ? 1 : 0);
+        if (KInfo.Dispatch.StaticGlobalSize > WorkItems) {
+            // Work-items that only round the NDRange up to whole groups
+            auto* WorkBlock = llvm::BasicBlock::Create(Builder.getContext(), "work", Func);
+            Builder.CreateCondBr(Builder.CreateICmpULT(GlobalId, Builder.getInt32(WorkItems)),
+                                 WorkBlock, ExitBlock);
+            Builder.SetInsertPoint(WorkBlock);
+        }
+        if (Remainder) {
+            // Only the extra last work-item owns the remainder
+            auto* TailBlock = llvm::BasicBlock::Create(Builder.getContext(), "tail", Func);
+            Builder.CreateCondBr(Builder.CreateICmpEQ(GlobalId, Builder.getInt32(Vectors)),
+                                 TailBlock, VectorBlock);
+            Builder.SetInsertPoint(TailBlock);
+            if (!LowerTail()) {
+                return false;
+            }
+            Builder.CreateBr(ExitBlock);
+        } else {
+            Builder.CreateBr(VectorBlock);
+        }
+
+        Builder.SetInsertPoint(VectorBlock);
+        auto* Base = Builder.CreateAdd(Builder.CreateMul(GlobalId, Builder.getInt32(KInfo.VectorWidth)),
+                                       Iteration(0), "base");
+        if (!Lower(Base, KInfo.VectorWidth, 0)) {
+            return false;
+        }
+        Builder.CreateBr(ExitBlock);
+
+        Builder.SetInsertPoint(ExitBlock);
+        Builder.CreateRetVoid();
+    }
+
+    addMemoryAttributes(Func, KInfo.VectorWidth);
+    addWorkGroupMetadata(Func, KInfo.Dispatch.RequiredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
+
+    return !llvm::verifyFunction(*Func, &llvm::errs());
+}
+
+bool SPIRVGenerator::selectStencilTile(KernelInfo& KInfo) {
+    const auto& Inputs = KInfo.Stencil.Inputs;
+    for (const auto& Input : Inputs) {
+        if (!getLLVMType(Input.Type)) {
+            return false;
+        }
+    }
+
+    // Elements staged per tile of Rows x Columns outputs
+    auto Staged = [&](uint64_t Rows, uint64_t Columns, uint64_t& Bytes) {
+        uint64_t Elements = 0;
+        Bytes = 0;
+        for (const auto& Input : Inputs) {
+            uint64_t Tile = (Rows + Input.MaxRow - Input.MinRow) *
+                            (Columns + Input.MaxCol - Input.MinCol);
+            Elements += Tile;
+            Bytes += Tile * Context->getTypeSize(Input.Type) / 8;
+        }
+        return Elements;
+    };
+
+    // Every shape of a group covers the same outputs, so the one staging
+    // the fewest halo elements wins; smaller groups only when none fits
+    for (size_t GroupSize = KInfo.PreferredWorkGroupSize; GroupSize > 0; GroupSize /= 2) {
+        uint64_t BestRows = 0, BestElements = 0, BestBytes = 0;
+        for (uint64_t Rows = 1; GroupSize % Rows == 0; Rows *= 2) {
+            uint64_t Bytes;
+            uint64_t Elements = Staged(Rows, GroupSize / Rows * KInfo.VectorWidth, Bytes);
+            if (!BestRows || Elements < BestElements) {
+                BestRows = Rows;
+                BestElements = Elements;
+                BestBytes = Bytes;
+            }
+            if (!KInfo.Stencil.Pitch) {
+                break;
+            }
+        }
+        if (BestBytes <= Options.Device.LocalMemBytes) {
+            KInfo.PreferredWorkGroupSize = GroupSize;
+            KInfo.TileRows = BestRows;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SPIRVGenerator::generateStencilBody(const KernelInfo& KInfo, llvm::Function* Func,
+                                         ExprLowering& Lowering) {
+    const auto& Stencil = KInfo.Stencil;
+    const auto* Body = KInfo.OriginalLoop->getBody();
+    uint64_t Width = KInfo.VectorWidth;
+    uint64_t GroupSize = KInfo.PreferredWorkGroupSize;
+    uint64_t Rows = KInfo.TileRows;
+    uint64_t Columns = GroupSize / Rows;        // Work-items per tile row
+    uint64_t TileWidth = Columns * Width;       // Outputs per tile row
+    bool Aligned = !Stencil.Pitch && KInfo.LowerBound % KInfo.VectorWidth == 0;
+    auto& Ctx = Builder.getContext();
+    auto Int = [&](int64_t Value) { return Builder.getInt32(static_cast<uint32_t>(Value)); };
+
+    auto* ExitBlock = llvm::BasicBlock::Create(Ctx, "exit", Func);
+    auto* N = getLoopEnd(KInfo, Func);
+    auto* Lower = Int(KInfo.LowerBound);
+    auto* Span = Builder.CreateSelect(Builder.CreateICmpSGT(N, Lower), Builder.CreateSub(N, Lower),
+                                      Int(0), "span");
+
+    // Iterations [Index, Limit) of one work-item: a full vector, or the
+    // lanes that remain
+    auto LowerIterations = [&](llvm::Value* Index, llvm::Value* Limit, bool IsAligned,
+                               llvm::BasicBlock* Next) {
+        auto* VectorBlock = llvm::BasicBlock::Create(Ctx, "vector", Func, ExitBlock);
+        auto* TailBlock = llvm::BasicBlock::Create(Ctx, "tail", Func, ExitBlock);
+        auto* LaneBlock = llvm::BasicBlock::Create(Ctx, "tail_lane", Func, ExitBlock);
+        Builder.CreateCondBr(Builder.CreateICmpSLE(Builder.CreateAdd(Index, Int(Width)), Limit),
+                             VectorBlock, TailBlock);
+
+        Builder.SetInsertPoint(VectorBlock);
+        Lowering.setIteration(Index, Width, IsAligned);
+        if (!Lowering.lowerBody(Body)) {
+            llvm::errs() << "Error: Cannot lower loop body: " << Lowering.getError() << "\n";
+            return false;
+        }
+        Builder.CreateBr(Next);
+
+        Builder.SetInsertPoint(TailBlock);
+        Builder.CreateCondBr(Builder.CreateICmpSLT(Index, Limit), LaneBlock, Next);
+        Builder.SetInsertPoint(LaneBlock);
+        auto* Lane = Builder.CreatePHI(Builder.getInt32Ty(), 2, "lane");
+        Lane->addIncoming(Index, TailBlock);
+        Lowering.setIteration(Lane, 1);
+        if (!Lowering.lowerBody(Body)) {
+            llvm::errs() << "Error: Cannot lower loop body: " << Lowering.getError() << "\n";
+            return false;
+        }
+        auto* NextLane = Builder.CreateAdd(Lane, Int(1));
+        Lane->addIncoming(NextLane, Builder.GetInsertBlock());
+        Builder.CreateCondBr(Builder.CreateICmpSLT(NextLane, Limit), LaneBlock, Next);
+        return true;
+    };
+
+    auto* LocalId = Builder.CreateCall(getGetLocalId(), {Int(0)});
+    llvm::Value* Column = LocalId;
+    llvm::Value* Row = Int(0);
+    llvm::Value* Pitch = nullptr;
+    llvm::Value* TilesPerRow = nullptr;
+    llvm::Value* NumTiles;
+    if (Stencil.Pitch) {
+        auto Arg = Func->arg_begin();
+        for (const auto& KArg : KInfo.Arguments) {
+            if (KArg.Decl == Stencil.Pitch) {
+                Pitch = Builder.CreateIntCast(&*Arg, Builder.getInt32Ty(),
+                                              KArg.Type->isSignedIntegerType(), "pitch");
+            }
+            ++Arg;
+        }
+        if (!Pitch) {
+            llvm::errs() << "Error: Stencil pitch is not a kernel argument\n";
+            return false;
+        }
+
+        // Without a positive pitch there are no rows to tile; such a
+        // launch reads its neighbours straight from global memory, one
+        // vector per work-item and grid stride, as the launch is sized
+        // for tiles rather than for the span
+        auto* TiledBlock = llvm::BasicBlock::Create(Ctx, "tiled", Func, ExitBlock);
+        auto* UntiledBlock = llvm::BasicBlock::Create(Ctx, "untiled", Func, ExitBlock);
+        auto* UntiledHeader = llvm::BasicBlock::Create(Ctx, "untiled_loop", Func, ExitBlock);
+        auto* UntiledBody = llvm::BasicBlock::Create(Ctx, "untiled_body", Func, ExitBlock);
+        auto* UntiledLatch = llvm::BasicBlock::Create(Ctx, "untiled_next", Func, ExitBlock);
+        Builder.CreateCondBr(Builder.CreateICmpSGT(Pitch, Int(0)), TiledBlock, UntiledBlock);
+
+        Builder.SetInsertPoint(UntiledBlock);
+        auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {Int(0)});
+        auto* Stride = Builder.CreateMul(Builder.CreateCall(getGetGlobalSize(), {Int(0)}), Int(Width),
+                                         "stride");
+        auto* Start = Builder.CreateAdd(Builder.CreateMul(GlobalId, Int(Width)), Lower);
+        Builder.CreateBr(UntiledHeader);
+
+        Builder.SetInsertPoint(UntiledHeader);
+        auto* Index = Builder.CreatePHI(Builder.getInt32Ty(), 2, "base");
+        Index->addIncoming(Start, UntiledBlock);
+        Builder.CreateCondBr(Builder.CreateICmpSLT(Index, N), UntiledBody, ExitBlock);
+
+        Builder.SetInsertPoint(UntiledBody);
+        if (!LowerIterations(Index, N, KInfo.LowerBound % KInfo.VectorWidth == 0, UntiledLatch)) {
+            return false;
+        }
+        Builder.SetInsertPoint(UntiledLatch);
+        Index->addIncoming(Builder.CreateAdd(Index, Stride), UntiledLatch);
+        Builder.CreateBr(UntiledHeader);
+
+        Builder.SetInsertPoint(TiledBlock);
+
+        // Tiles of Rows grid rows by TileWidth columns, row-major over the grid
+        Column = Builder.CreateURem(LocalId, Int(Columns));
+        Row = Builder.CreateUDiv(LocalId, Int(Columns));
+        auto* GridRows = Builder.CreateUDiv(Builder.CreateAdd(Span, Builder.CreateSub(Pitch, Int(1))),
+                                            Pitch, "grid_rows");
+        TilesPerRow = Builder.CreateUDiv(Builder.CreateAdd(Pitch, Int(TileWidth - 1)), Int(TileWidth));
+        NumTiles = Builder.CreateMul(TilesPerRow, Builder.CreateUDiv(
+            Builder.CreateAdd(GridRows, Int(Rows - 1)), Int(Rows)), "num_tiles");
+    } else {
+        NumTiles = Builder.CreateUDiv(Builder.CreateAdd(Span, Int(TileWidth - 1)), Int(TileWidth),
+                                      "num_tiles");
+    }
+    auto* NumGroups = Builder.CreateUDiv(Builder.CreateCall(getGetGlobalSize(), {Int(0)}),
+                                         Int(GroupSize), "num_groups");
+    auto* FirstTile = Builder.CreateCall(getGetGroupId(), {Int(0)});
+
+    // The footprint each input's loop reads, [Lo, Hi); halo elements
+    // outside it are never loaded
+    std::vector<std::pair<llvm::Value*, llvm::Value*>> Footprints;
+    for (const auto& Input : Stencil.Inputs) {
+        llvm::Value* Lo = nullptr;
+        llvm::Value* Hi = nullptr;
+        for (const auto& Offset : Input.Offsets) {
+            llvm::Value* Shift = Int(Offset.second);
+            if (Offset.first) {
+                Shift = Builder.CreateAdd(Builder.CreateMul(Pitch, Int(Offset.first)), Shift);
+            }
+            Lo = Lo ? Builder.CreateSelect(Builder.CreateICmpSLT(Shift, Lo), Shift, Lo) : Shift;
+            Hi = Hi ? Builder.CreateSelect(Builder.CreateICmpSGT(Shift, Hi), Shift, Hi) : Shift;
+        }
+        Footprints.push_back({Builder.CreateAdd(Lower, Lo, "lo"), Builder.CreateAdd(N, Hi, "hi")});
+    }
+
+    // Work-groups stride over the tiles, like the untiled fallback over
+    // work-items, so any launch size is correct
+    auto* Preheader = Builder.GetInsertBlock();
+    auto* HeaderBlock = llvm::BasicBlock::Create(Ctx, "tile", Func, ExitBlock);
+    auto* LoadBlock = llvm::BasicBlock::Create(Ctx, "tile_load", Func, ExitBlock);
+    auto* LatchBlock = llvm::BasicBlock::Create(Ctx, "tile_next", Func, ExitBlock);
+    Builder.CreateBr(HeaderBlock);
+    Builder.SetInsertPoint(HeaderBlock);
+    auto* Tile = Builder.CreatePHI(Builder.getInt32Ty(), 2, "tile");
+    Tile->addIncoming(FirstTile, Preheader);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Tile, NumTiles), LoadBlock, ExitBlock);
+
+    Builder.SetInsertPoint(LoadBlock);
+    llvm::Value* Origin;
+    llvm::Value* Index;
+    llvm::Value* Limit = N;
+    if (Stencil.Pitch) {
+        auto* TileColumn = Builder.CreateMul(Builder.CreateURem(Tile, TilesPerRow), Int(TileWidth));
+        auto* TileRow = Builder.CreateMul(Builder.CreateUDiv(Tile, TilesPerRow), Int(Rows));
+        Origin = Builder.CreateAdd(Lower, Builder.CreateAdd(Builder.CreateMul(TileRow, Pitch), TileColumn),
+                                   "origin");
+        // Lanes past the end of their grid row belong to the next row
+        auto* GridColumn = Builder.CreateAdd(TileColumn, Builder.CreateMul(Column, Int(Width)));
+        Index = Builder.CreateAdd(Origin, Builder.CreateAdd(Builder.CreateMul(Row, Pitch),
+                                                            Builder.CreateMul(Column, Int(Width))), "base");
+        auto* RowEnd = Builder.CreateAdd(Builder.CreateSub(Index, GridColumn), Pitch);
+        Limit = Builder.CreateSelect(Builder.CreateICmpSLT(RowEnd, N), RowEnd, N, "limit");
+    } else {
+        Origin = Builder.CreateAdd(Lower, Builder.CreateMul(Tile, Int(TileWidth)), "origin");
+        Index = Builder.CreateAdd(Origin, Builder.CreateMul(Column, Int(Width)), "base");
+    }
+
+    // Every work-item copies a strided share of each tile and its halo
+    for (size_t I = 0; I < Stencil.Inputs.size(); ++I) {
+        const auto& Input = Stencil.Inputs[I];
+        llvm::Value* Buffer = nullptr;
+        auto Arg = Func->arg_begin();
+        for (const auto& KArg : KInfo.Arguments) {
+            if (KArg.Decl == Input.Array) {
+                Buffer = &*Arg;
+            }
+            ++Arg;
+        }
+        auto* InputTy = getLLVMType(Input.Type);
+        if (!Buffer || !InputTy) {
+            llvm::errs() << "Error: Stencil input '" << Input.Array->getNameAsString()
+                         << "' is not a kernel buffer\n";
+            return false;
+        }
+
+        uint64_t TileColumns = TileWidth + Input.MaxCol - Input.MinCol;
+        uint64_t Elements = (Rows + Input.MaxRow - Input.MinRow) * TileColumns;
+        auto* TileBuffer = createLocalBuffer(KInfo.Name + "_" + Input.Array->getNameAsString() + "_tile",
+                                             InputTy, Elements);
+        for (uint64_t First = 0; First < Elements; First += GroupSize) {
+            auto* Slot = Builder.CreateAdd(LocalId, Int(First));
+            llvm::Value* Global;
+            if (Stencil.Pitch) {
+                auto* SlotRow = Builder.CreateAdd(Builder.CreateUDiv(Slot, Int(TileColumns)), Int(Input.MinRow));
+                auto* SlotColumn = Builder.CreateURem(Slot, Int(TileColumns));
+                Global = Builder.CreateAdd(Origin, Builder.CreateAdd(Builder.CreateMul(SlotRow, Pitch),
+                                                                     SlotColumn));
+            } else {
+                Global = Builder.CreateAdd(Origin, Slot);
+            }
+            Global = Builder.CreateAdd(Global, Int(Input.MinCol), "global");
 
-    // Create reduction loop blocks
-    auto* ReduceEntry = llvm::BasicBlock::Create(Builder.getContext(), "reduce_entry", Func);
-    Builder.CreateBr(ReduceEntry);
-    Builder.SetInsertPoint(ReduceEntry);
+            auto* InRange = Builder.CreateAnd(Builder.CreateICmpSGE(Global, Footprints[I].first),
+                                              Builder.CreateICmpSLT(Global, Footprints[I].second));
+            if (First + GroupSize > Elements) {
+                InRange = Builder.CreateAnd(InRange, Builder.CreateICmpULT(Slot, Int(Elements)));
+            }
+            auto* CopyBlock = llvm::BasicBlock::Create(Ctx, "tile_copy", Func, LatchBlock);
+            auto* NextBlock = llvm::BasicBlock::Create(Ctx, "tile_copied", Func, LatchBlock);
+            Builder.CreateCondBr(InRange, CopyBlock, NextBlock);
+            Builder.SetInsertPoint(CopyBlock);
+            auto* Value = Builder.CreateLoad(InputTy, Builder.CreateInBoundsGEP(InputTy, Buffer, {Global}));
+            Builder.CreateStore(Value, getLocalElementPtr(TileBuffer, Slot));
+            Builder.CreateBr(NextBlock);
+            Builder.SetInsertPoint(NextBlock);
+        }
 
-    for (unsigned StepSize = 1; StepSize < KInfo.PreferredWorkGroupSize; StepSize *= 2) {
-        auto* ReduceBlock = llvm::BasicBlock::Create(
-            Builder.getContext(), "reduce_" + std::to_string(StepSize), Func);
-        auto* ContinueBlock = llvm::BasicBlock::Create(
-            Builder.getContext(), "continue_" + std::to_string(StepSize), Func);
+        ExprLowering::TileBinding Binding;
+        Binding.Tile = TileBuffer;
+        Binding.Origin = Builder.CreateAdd(
+            Builder.CreateMul(Builder.CreateSub(Row, Int(Input.MinRow)), Int(TileColumns)),
+            Builder.CreateSub(Builder.CreateMul(Column, Int(Width)), Int(Input.MinCol)), "tile_origin");
+        Binding.Anchor = Index;
+        Binding.TilePitch = TileColumns;
+        Binding.RowPitch = Stencil.Pitch;
+        Lowering.bindTile(Input.Array, Binding);
+    }
+    addBarrier(CLK_LOCAL_MEM_FENCE);
 
-        // Create condition for this reduction step
-        auto* StepVal = llvm::ConstantInt::get(
-            llvm::Type::getInt32Ty(Builder.getContext()), StepSize);
-        auto* InRange = Builder.CreateICmpULT(
-            Builder.CreateAdd(LocalId, StepVal),
-            WGSize
-        );
+    if (!LowerIterations(Index, Limit, Aligned, LatchBlock)) {
+        return false;
+    }
 
-        Builder.CreateCondBr(InRange, ReduceBlock, ContinueBlock);
+    // The next tile overwrites local memory others may still be reading
+    Builder.SetInsertPoint(LatchBlock);
+    addBarrier(CLK_LOCAL_MEM_FENCE);
+    auto* NextTile = Builder.CreateAdd(Tile, NumGroups);
+    Tile->addIncoming(NextTile, LatchBlock);
+    Builder.CreateBr(HeaderBlock);
 
-        // Generate reduction code
-        Builder.SetInsertPoint(ReduceBlock);
-        auto* Ptr1 = Builder.CreateInBoundsGEP(FloatTy, LocalMem, {LocalId});
-        auto* Ptr2 = Builder.CreateInBoundsGEP(FloatTy, LocalMem,
-            {Builder.CreateAdd(LocalId, StepVal)});
+    Builder.SetInsertPoint(ExitBlock);
+    Builder.CreateRetVoid();
 
-        auto* Val1 = Builder.CreateLoad(FloatTy, Ptr1);
-        auto* Val2 = Builder.CreateLoad(FloatTy, Ptr2);
-        auto* Sum = Builder.CreateFAdd(Val1, Val2);
-        Builder.CreateStore(Sum, Ptr1);
-        Builder.CreateBr(ContinueBlock);
+    addMemoryAttributes(Func, KInfo.VectorWidth);
+    addWorkGroupMetadata(Func, KInfo.PreferredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
 
-        // Continue with next iteration
-        Builder.SetInsertPoint(ContinueBlock);
-        addBarrier(CLK_LOCAL_MEM_FENCE);
+    return !llvm::verifyFunction(*Func, &llvm::errs());
+}
+
+void SPIRVGenerator::addNestArgument(KernelInfo& KInfo, const clang::VarDecl* VD, ArgKind Kind,
+                                     ArgAccess Access) {
+    for (const auto& Arg : KInfo.Arguments) {
+        if (Arg.Decl == VD) {
+            return;
+        }
     }
+    KernelArgument Arg;
+    Arg.Name = VD->getNameAsString();
+    Arg.Decl = VD;
+    Arg.Kind = Kind;
+    Arg.Access = Access;
+    Arg.Type = Kind == ArgKind::Buffer ? KInfo.ElementType : VD->getType();
+    Arg.AddressSpace = Kind == ArgKind::Buffer ? ADDRSPACE_GLOBAL : ADDRSPACE_PRIVATE;
+    KInfo.Arguments.push_back(Arg);
 }
 
-void SPIRVGenerator::addWorkGroupSizeHint(llvm::Function* Func, unsigned Size) {
-    llvm::Metadata* MDArgs[] = {
-        llvm::MDString::get(Builder.getContext(), "reqd_work_group_size"),
-        llvm::ConstantAsMetadata::get(
-            llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, Size)))
-    };
-    Func->addMetadata("opencl.kernels",
-        *llvm::MDNode::get(Builder.getContext(), MDArgs));
+void SPIRVGenerator::addNestArguments(KernelInfo& KInfo,
+                                      std::initializer_list<const clang::Expr*> Bounds,
+                                      std::initializer_list<const MatrixOperand*> Operands) {
+    for (const auto* Bound : Bounds) {
+        if (auto* Ref = llvm::dyn_cast<clang::DeclRefExpr>(Bound)) {
+            addNestArgument(KInfo, llvm::cast<clang::VarDecl>(Ref->getDecl()), ArgKind::Scalar,
+                            ArgAccess::Read);
+        }
+    }
+    for (const auto* Op : Operands) {
+        if (Op->Stride) {
+            addNestArgument(KInfo, Op->Stride, ArgKind::Scalar, ArgAccess::Read);
+        }
+    }
 }
 
-void SPIRVGenerator::improveSimpleVectorization(const KernelInfo& KInfo, llvm::Function* Func) {
-    // Initialize FloatTy if not already done
-    FloatTy = llvm::Type::getFloatTy(Builder.getContext());
+void SPIRVGenerator::setBlockedDispatch(KernelInfo& KInfo, const clang::Expr* Rows,
+                                        const clang::Expr* Columns, uint64_t BlockRows,
+                                        uint64_t BlockColumns) {
+    // Work-groups stride over the blocks, so any launch is correct;
+    // literal sizes give every group exactly one block
+    auto* RowsLit = llvm::dyn_cast<clang::IntegerLiteral>(Rows);
+    auto* ColumnsLit = llvm::dyn_cast<clang::IntegerLiteral>(Columns);
+    uint64_t Groups = BlockedLaunchGroups;
+    if (RowsLit && ColumnsLit) {
+        uint64_t R = RowsLit->getValue().getZExtValue();
+        uint64_t C = ColumnsLit->getValue().getZExtValue();
+        Groups = std::max<uint64_t>(1, ((R + BlockRows - 1) / BlockRows) *
+                                       ((C + BlockColumns - 1) / BlockColumns));
+    }
+    KInfo.Dispatch.NeedsSizeArg = false;
+    KInfo.Dispatch.StaticGlobalSize = Groups * KInfo.PreferredWorkGroupSize;
+    KInfo.Dispatch.RequiredWorkGroupSize = KInfo.PreferredWorkGroupSize;
+    KInfo.Attributes.push_back({"Dispatch", std::to_string(KInfo.Dispatch.StaticGlobalSize) +
+        " work-items in work-groups of exactly " + std::to_string(KInfo.PreferredWorkGroupSize) +
+        ", grid-stride over " + std::to_string(BlockRows) + "x" + std::to_string(BlockColumns) +
+        " blocks"});
+}
 
-    // Create entry block
-    auto* Entry = llvm::BasicBlock::Create(Builder.getContext(), "entry", Func);
-    Builder.SetInsertPoint(Entry);
+llvm::Function* SPIRVGenerator::createNestKernel(const KernelInfo& KInfo) {
+    std::vector<llvm::Type*> ArgTypes;
+    if (!getArgumentTypes(KInfo, ArgTypes)) {
+        return nullptr;
+    }
+    auto* Func = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(Builder.getContext()), ArgTypes, false),
+        llvm::Function::ExternalLinkage, KInfo.Name, Module.get());
+    addSPIRVMetadata(Func);
+    Builder.SetInsertPoint(llvm::BasicBlock::Create(Builder.getContext(), "entry", Func));
+    auto Arg = Func->arg_begin();
+    for (const auto& KArg : KInfo.Arguments) {
+        (Arg++)->setName(KArg.Name);
+    }
+    addArgumentAttributes(Func, KInfo.Arguments);
+    return Func;
+}
 
-    // Get global ID
-    auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {
-        llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0))
-    });
+llvm::Value* SPIRVGenerator::getNestArgument(const KernelInfo& KInfo, llvm::Function* Func,
+                                             const clang::VarDecl* VD) {
+    auto Arg = Func->arg_begin();
+    for (const auto& KArg : KInfo.Arguments) {
+        if (KArg.Decl == VD) {
+            if (KArg.Kind == ArgKind::Buffer) {
+                return &*Arg;
+            }
+            return Builder.CreateIntCast(&*Arg, Builder.getInt32Ty(),
+                                         VD->getType()->isSignedIntegerType(), VD->getName());
+        }
+        ++Arg;
+    }
+    return nullptr;
+}
 
-    // Ensure we have valid arguments
-    if (Func->arg_size() < 3) {
-        llvm::errs() << "Error: Function requires at least 3 arguments\n";
-        Builder.CreateRetVoid();
-        return;
+llvm::Value* SPIRVGenerator::getNestValue(const KernelInfo& KInfo, llvm::Function* Func,
+                                          const clang::Expr* Bound) {
+    if (auto* Lit = llvm::dyn_cast<clang::IntegerLiteral>(Bound)) {
+        return Builder.getInt32(static_cast<uint32_t>(Lit->getValue().getSExtValue()));
+    }
+    auto* Ref = llvm::cast<clang::DeclRefExpr>(Bound);
+    return getNestArgument(KInfo, Func, llvm::cast<clang::VarDecl>(Ref->getDecl()));
+}
+
+llvm::Value* SPIRVGenerator::getNestStride(const KernelInfo& KInfo, llvm::Function* Func,
+                                           const MatrixOperand& Op) {
+    if (Op.Stride) {
+        return getNestArgument(KInfo, Func, Op.Stride);
     }
+    return Builder.getInt32(static_cast<uint32_t>(Op.ConstantStride));
+}
 
-    auto* Input = Func->arg_begin();
-    auto* Output = std::next(Func->arg_begin());
-    auto* N = std::next(Func->arg_begin(), 2);  // Global size argument
+bool SPIRVGenerator::selectGemmTile(GemmTile& Tile) {
+    // Each step stages a Depth-deep slice of A's rows and B's columns
+    for (;;) {
+        uint64_t Bytes = Tile.Depth * (Tile.getRows() + Tile.getColumns()) * getElementSize();
+        if (Tile.getGroupSize() <= Options.Device.MaxWorkGroupSize &&
+            Bytes <= Options.Device.LocalMemBytes) {
+            return true;
+        }
+        if (Tile.ThreadRows == 1 && Tile.ThreadColumns == 1) {
+            return false;
+        }
+        if (Tile.ThreadColumns >= Tile.ThreadRows) {
+            Tile.ThreadColumns /= 2;
+        } else {
+            Tile.ThreadRows /= 2;
+        }
+    }
+}
 
-    // Create vector and scalar blocks
-    auto* VectorBlock = llvm::BasicBlock::Create(Builder.getContext(), "vector", Func);
-    auto* ScalarBlock = llvm::BasicBlock::Create(Builder.getContext(), "scalar", Func);
-    auto* ExitBlock = llvm::BasicBlock::Create(Builder.getContext(), "exit", Func);
+bool SPIRVGenerator::generateGemmKernel(clang::ForStmt* Loop, const VectorizationInfo& Info,
+                                        const std::string& Name) {
+    const GemmInfo& Gemm = Info.Gemm;
+    KernelInfo KInfo;
+    KInfo.Name = Name;
+    KInfo.IsReduction = false;
+    KInfo.OriginalLoop = Loop;
+    if (!setElementType(Info.ElementType, KInfo)) {
+        return false;
+    }
 
-    // Create branch condition
-    auto* VecCheck = Builder.CreateICmpULT(
-        Builder.CreateAdd(GlobalId,
-            llvm::ConstantInt::get(Builder.getContext(),
-                llvm::APInt(32, KInfo.VectorWidth - 1))),
-        N
-    );
+    Builder.setFastMathFlags(getFastMathFlags(Options.Precision));
+    if (Options.Precision != PrecisionPolicy::Strict) {
+        KInfo.Attributes.push_back({"Precision", getPrecisionName(Options.Precision)});
+    }
 
-    // Branch from entry to vector/scalar blocks
-    Builder.CreateCondBr(VecCheck, VectorBlock, ScalarBlock);
+    GemmTile Tile;
+    Tile.RegColumns = legalizeVectorWidth(Info.RecommendedWidth);
+    if (!selectGemmTile(Tile)) {
+        llvm::errs() << "Error: No GEMM tile fits " << Options.Device.LocalMemBytes
+                     << " bytes of local memory\n";
+        return false;
+    }
+    KInfo.VectorWidth = Tile.RegColumns;
+    KInfo.MaxWorkGroupSize = Options.Device.MaxWorkGroupSize;
+    KInfo.PreferredWorkGroupSize = Tile.getGroupSize();
+    KInfo.UsesLocalMemory = true;
+
+    // The matrices, then every bound and leading dimension passed at launch
+    addNestArgument(KInfo, Gemm.A.Array, ArgKind::Buffer, ArgAccess::Read);
+    addNestArgument(KInfo, Gemm.B.Array, ArgKind::Buffer, ArgAccess::Read);
+    addNestArgument(KInfo, Gemm.C.Array, ArgKind::Buffer,
+                    Gemm.Accumulate ? ArgAccess::ReadWrite : ArgAccess::Write);
+    addNestArguments(KInfo, {Gemm.M, Gemm.N, Gemm.K}, {&Gemm.A, &Gemm.B, &Gemm.C});
+    KInfo.Dispatch.ElementsPerWorkItem = Tile.RegRows * Tile.RegColumns;
+    setBlockedDispatch(KInfo, Gemm.M, Gemm.N, Tile.getRows(), Tile.getColumns());
+
+    KInfo.Attributes.push_back({"GEMM", std::to_string(Tile.getRows()) + "x" +
+        std::to_string(Tile.getColumns()) + " blocks of " + Gemm.C.Array->getNameAsString() +
+        " per work-group, " + std::to_string(Tile.RegRows) + "x" + std::to_string(Tile.RegColumns) +
+        " register tile per work-item"});
+    uint64_t TileBytes = Tile.Depth * (Tile.getRows() + Tile.getColumns()) * getElementSize();
+    KInfo.Attributes.push_back({"Local memory", "k-steps of " + std::to_string(Tile.Depth) +
+        " through __local " + Gemm.A.Array->getNameAsString() + " and " +
+        Gemm.B.Array->getNameAsString() + " tiles (" + std::to_string(TileBytes) + " bytes), " +
+        std::to_string(Tile.getRows() * Tile.getColumns() / (Tile.getRows() + Tile.getColumns())) +
+        " multiply-adds per element staged"});
+    KInfo.Attributes.push_back({"Arguments", describeArguments(KInfo.Arguments)});
+
+    auto* Func = createNestKernel(KInfo);
+    if (!Func || !generateGemmBody(KInfo, Gemm, Tile, Func)) {
+        if (Func) {
+            Func->eraseFromParent();
+        }
+        return false;
+    }
+    addExtensionMetadata(KInfo);
+    LastKernel = KInfo;
+    Kernels.push_back(KInfo);
+    ++NumKernels;
+    return true;
+}
 
-    // Set up vector block
-    Builder.SetInsertPoint(VectorBlock);
-    auto* VecPtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Input,
-        {GlobalId},
-        "vec_load_ptr"
-    );
-    auto* Vec = createVectorLoad(VecPtr, KInfo.VectorWidth);
+bool SPIRVGenerator::generateGemmBody(const KernelInfo& KInfo, const GemmInfo& Gemm,
+                                      const GemmTile& Tile, llvm::Function* Func) {
+    auto& Ctx = Builder.getContext();
+    auto Int = [&](int64_t Value) { return Builder.getInt32(static_cast<uint32_t>(Value)); };
+    auto Min = [&](llvm::Value* X, llvm::Value* Y) {
+        return Builder.CreateSelect(Builder.CreateICmpSLT(X, Y), X, Y);
+    };
 
-    // Apply vector operation
-    auto* Result = Vec;  // This will be modified based on the operation type
+    uint64_t Rows = Tile.getRows();
+    uint64_t Columns = Tile.getColumns();
+    uint64_t Depth = Tile.Depth;
+    uint64_t GroupSize = Tile.getGroupSize();
+    unsigned Size = getElementSize();
+    auto* RowTy = getVectorType(ElemTy, Tile.RegColumns);
+    auto* ColumnTy = getVectorType(ElemTy, Tile.RegRows);
+
+    auto* M = getNestValue(KInfo, Func, Gemm.M);
+    auto* N = getNestValue(KInfo, Func, Gemm.N);
+    auto* K = getNestValue(KInfo, Func, Gemm.K);
+    auto* LDA = getNestStride(KInfo, Func, Gemm.A);
+    auto* LDB = getNestStride(KInfo, Func, Gemm.B);
+    auto* LDC = getNestStride(KInfo, Func, Gemm.C);
+    auto* A = getNestArgument(KInfo, Func, Gemm.A.Array);
+    auto* B = getNestArgument(KInfo, Func, Gemm.B.Array);
+    auto* C = getNestArgument(KInfo, Func, Gemm.C.Array);
+
+    auto* LocalId = Builder.CreateCall(getGetLocalId(), {Int(0)});
+    auto* ThreadColumn = Builder.CreateURem(LocalId, Int(Tile.ThreadColumns));
+    auto* ThreadRow = Builder.CreateUDiv(LocalId, Int(Tile.ThreadColumns));
+    auto Positive = [&](llvm::Value* X) {
+        return Builder.CreateSelect(Builder.CreateICmpSGT(X, Int(0)), X, Int(0));
+    };
+    auto* BlocksPerRow = Builder.CreateUDiv(Builder.CreateAdd(Positive(N), Int(Columns - 1)),
+                                            Int(Columns), "blocks_per_row");
+    auto* NumBlocks = Builder.CreateMul(Builder.CreateUDiv(Builder.CreateAdd(Positive(M), Int(Rows - 1)),
+                                                           Int(Rows)), BlocksPerRow, "num_blocks");
+    auto* NumGroups = Builder.CreateUDiv(Builder.CreateCall(getGetGlobalSize(), {Int(0)}),
+                                         Int(GroupSize), "num_groups");
+    auto* FirstBlock = Builder.CreateCall(getGetGroupId(), {Int(0)});
+
+    // k-major tiles, so a work-item's rows of A and columns of B are
+    // adjacent and load as vectors
+    auto* ATile = createLocalBuffer(KInfo.Name + "_a_tile", ElemTy, Depth * Rows);
+    ATile->setAlignment(llvm::Align(Size * Tile.RegRows));
+    auto* BTile = createLocalBuffer(KInfo.Name + "_b_tile", ElemTy, Depth * Columns);
+    BTile->setAlignment(llvm::Align(Size * Tile.RegColumns));
+
+    auto* Preheader = Builder.GetInsertBlock();
+    auto* BlockHeader = llvm::BasicBlock::Create(Ctx, "block", Func);
+    auto* BlockBody = llvm::BasicBlock::Create(Ctx, "block_body", Func);
+    auto* StepHeader = llvm::BasicBlock::Create(Ctx, "step", Func);
+    auto* StepBody = llvm::BasicBlock::Create(Ctx, "step_body", Func);
+    auto* StoreBlock = llvm::BasicBlock::Create(Ctx, "store", Func);
+    auto* FullBlock = llvm::BasicBlock::Create(Ctx, "store_full", Func);
+    auto* EdgeBlock = llvm::BasicBlock::Create(Ctx, "store_edge", Func);
+    auto* LatchBlock = llvm::BasicBlock::Create(Ctx, "block_next", Func);
+    auto* ExitBlock = llvm::BasicBlock::Create(Ctx, "exit", Func);
+    Builder.CreateBr(BlockHeader);
+
+    Builder.SetInsertPoint(BlockHeader);
+    auto* Block = Builder.CreatePHI(Builder.getInt32Ty(), 2, "block");
+    Block->addIncoming(FirstBlock, Preheader);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Block, NumBlocks), BlockBody, ExitBlock);
+
+    // Blocks only exist when M and N are positive, so clamped indices are
+    // always in range
+    Builder.SetInsertPoint(BlockBody);
+    auto* RowBase = Builder.CreateMul(Builder.CreateUDiv(Block, BlocksPerRow), Int(Rows), "row_base");
+    auto* ColumnBase = Builder.CreateMul(Builder.CreateURem(Block, BlocksPerRow), Int(Columns),
+                                         "column_base");
+    auto* Row0 = Builder.CreateAdd(RowBase, Builder.CreateMul(ThreadRow, Int(Tile.RegRows)), "row");
+    auto* Column0 = Builder.CreateAdd(ColumnBase, Builder.CreateMul(ThreadColumn, Int(Tile.RegColumns)),
+                                      "column");
+    auto* LastRow = Builder.CreateSub(M, Int(1));
+    auto* LastColumn = Builder.CreateSub(N, Int(1));
+    auto CElementPtr = [&](llvm::Value* Row, llvm::Value* Column) {
+        return Builder.CreateInBoundsGEP(ElemTy, C, {Builder.CreateAdd(Builder.CreateMul(Row, LDC), Column)});
+    };
 
-    // Create vector store pointer
-    auto* VecStorePtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Output,
-        {GlobalId},
-        "vec_store_ptr"
-    );
-    createVectorStore(Result, VecStorePtr);
-    Builder.CreateBr(ExitBlock);
+    // Products added one by one start from C, which keeps their order
+    std::vector<llvm::Value*> Init;
+    for (unsigned R = 0; R < Tile.RegRows; ++R) {
+        llvm::Value* Acc = getElementConstant(RowTy, 0.0, 0);
+        if (Gemm.Accumulate && !Gemm.PartialSum) {
+            auto* Row = Min(Builder.CreateAdd(Row0, Int(R)), LastRow);
+            for (unsigned L = 0; L < Tile.RegColumns; ++L) {
+                auto* Column = Min(Builder.CreateAdd(Column0, Int(L)), LastColumn);
+                Acc = Builder.CreateInsertElement(Acc, Builder.CreateLoad(ElemTy, CElementPtr(Row, Column)), L);
+            }
+        }
+        Init.push_back(Acc);
+    }
+    Builder.CreateBr(StepHeader);
+
+    Builder.SetInsertPoint(StepHeader);
+    auto* KBase = Builder.CreatePHI(Builder.getInt32Ty(), 2, "k_base");
+    KBase->addIncoming(Int(0), BlockBody);
+    std::vector<llvm::PHINode*> Acc;
+    for (unsigned R = 0; R < Tile.RegRows; ++R) {
+        Acc.push_back(Builder.CreatePHI(RowTy, 2, "acc"));
+        Acc.back()->addIncoming(Init[R], BlockBody);
+    }
+    Builder.CreateCondBr(Builder.CreateICmpSLT(KBase, K), StepBody, StoreBlock);
+
+    // Every work-item copies its share of both tiles. Padding A with -0.0
+    // and B with +0.0 makes padded products -0.0, which leaves any sum
+    // unchanged.
+    Builder.SetInsertPoint(StepBody);
+    auto* LastK = Builder.CreateSub(K, Int(1));
+    // Element (o, k) of a tile is Matrix[o*LD + k], or Matrix[k*LD + o]
+    // when KMajor; neighbouring work-items read neighbouring elements
+    auto Stage = [&](llvm::Value* Matrix, llvm::Value* LD, bool KMajor, llvm::Value* Base,
+                     llvm::Value* Limit, llvm::Value* Last, uint64_t Extent,
+                     llvm::GlobalVariable* TileBuffer, double Padding) {
+        for (uint64_t First = 0; First < Depth * Extent; First += GroupSize) {
+            auto* Slot = Builder.CreateAdd(LocalId, Int(First));
+            auto* Offset = KMajor ? Builder.CreateURem(Slot, Int(Extent)) : Builder.CreateUDiv(Slot, Int(Depth));
+            auto* Step = KMajor ? Builder.CreateUDiv(Slot, Int(Extent)) : Builder.CreateURem(Slot, Int(Depth));
+            auto* Outer = Builder.CreateAdd(Base, Offset);
+            auto* Inner = Builder.CreateAdd(KBase, Step);
+            auto* InRange = Builder.CreateAnd(Builder.CreateICmpSLT(Outer, Limit),
+                                              Builder.CreateICmpSLT(Inner, K));
+            auto* O = Min(Outer, Last);
+            auto* I = Min(Inner, LastK);
+            auto* Index = KMajor ? Builder.CreateAdd(Builder.CreateMul(I, LD), O)
+                                 : Builder.CreateAdd(Builder.CreateMul(O, LD), I);
+            auto* Value = Builder.CreateLoad(ElemTy, Builder.CreateInBoundsGEP(ElemTy, Matrix, {Index}));
+            Value = Builder.CreateSelect(InRange, Value, getElementConstant(ElemTy, Padding, 0));
+            Builder.CreateStore(Value, getLocalElementPtr(TileBuffer,
+                Builder.CreateAdd(Builder.CreateMul(Step, Int(Extent)), Offset)));
+        }
+    };
+    Stage(A, LDA, Gemm.A.Transposed, RowBase, M, LastRow, Rows, ATile, -0.0);
+    Stage(B, LDB, !Gemm.B.Transposed, ColumnBase, N, LastColumn, Columns, BTile, 0.0);
+    addBarrier(CLK_LOCAL_MEM_FENCE);
 
-    // Set up scalar block
-    Builder.SetInsertPoint(ScalarBlock);
-    auto* ScalarLoadPtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Input,
-        {GlobalId},
-        "scalar_load_ptr"
-    );
-    auto* ScalarVal = Builder.CreateLoad(FloatTy, ScalarLoadPtr);
+    bool Fuse = ElemIsFloat && Builder.getFastMathFlags().allowContract();
+    std::vector<llvm::Value*> Next(Acc.begin(), Acc.end());
+    for (uint64_t Step = 0; Step < Depth; ++Step) {
+        auto* AIndex = Builder.CreateAdd(Int(Step * Rows), Builder.CreateMul(ThreadRow, Int(Tile.RegRows)));
+        auto* BIndex = Builder.CreateAdd(Int(Step * Columns), Builder.CreateMul(ThreadColumn, Int(Tile.RegColumns)));
+        auto* APtr = Builder.CreateBitCast(getLocalElementPtr(ATile, AIndex),
+                                           llvm::PointerType::get(ColumnTy, ADDRSPACE_LOCAL));
+        auto* BPtr = Builder.CreateBitCast(getLocalElementPtr(BTile, BIndex),
+                                           llvm::PointerType::get(RowTy, ADDRSPACE_LOCAL));
+        auto* AColumn = Builder.CreateAlignedLoad(ColumnTy, APtr, llvm::Align(Size * Tile.RegRows));
+        auto* BRow = Builder.CreateAlignedLoad(RowTy, BPtr, llvm::Align(Size * Tile.RegColumns));
+        for (unsigned R = 0; R < Tile.RegRows; ++R) {
+            auto* Splat = Builder.CreateVectorSplat(Tile.RegColumns, Builder.CreateExtractElement(AColumn, R));
+            Next[R] = Fuse ? Builder.CreateIntrinsic(llvm::Intrinsic::fmuladd, {RowTy}, {Splat, BRow, Next[R]})
+                           : createArithOp(clang::BO_Add, Next[R], createArithOp(clang::BO_Mul, Splat, BRow));
+        }
+    }
+    // The next step overwrites tiles others may still be reading
+    addBarrier(CLK_LOCAL_MEM_FENCE);
+    KBase->addIncoming(Builder.CreateAdd(KBase, Int(Depth)), Builder.GetInsertBlock());
+    for (unsigned R = 0; R < Tile.RegRows; ++R) {
+        Acc[R]->addIncoming(Next[R], Builder.GetInsertBlock());
+    }
+    Builder.CreateBr(StepHeader);
+
+    // A summed product is added to C at the end; otherwise the
+    // accumulator already is the result
+    Builder.SetInsertPoint(StoreBlock);
+    bool AddToC = Gemm.Accumulate && Gemm.PartialSum;
+    auto* Full = Builder.CreateAnd(Builder.CreateICmpSLE(Builder.CreateAdd(Row0, Int(Tile.RegRows)), M),
+                                   Builder.CreateICmpSLE(Builder.CreateAdd(Column0, Int(Tile.RegColumns)), N));
+    Builder.CreateCondBr(Full, FullBlock, EdgeBlock);
+
+    Builder.SetInsertPoint(FullBlock);
+    for (unsigned R = 0; R < Tile.RegRows; ++R) {
+        auto* Ptr = Builder.CreateBitCast(CElementPtr(Builder.CreateAdd(Row0, Int(R)), Column0),
+                                          llvm::PointerType::get(RowTy, ADDRSPACE_GLOBAL));
+        llvm::Value* Value = Acc[R];
+        if (AddToC) {
+            Value = createArithOp(clang::BO_Add, Builder.CreateAlignedLoad(RowTy, Ptr, llvm::Align(Size)), Value);
+        }
+        Builder.CreateAlignedStore(Value, Ptr, llvm::Align(Size));
+    }
+    Builder.CreateBr(LatchBlock);
+
+    Builder.SetInsertPoint(EdgeBlock);
+    for (unsigned R = 0; R < Tile.RegRows; ++R) {
+        auto* Row = Builder.CreateAdd(Row0, Int(R));
+        for (unsigned L = 0; L < Tile.RegColumns; ++L) {
+            auto* Column = Builder.CreateAdd(Column0, Int(L));
+            auto* ElementBlock = llvm::BasicBlock::Create(Ctx, "store_element", Func, LatchBlock);
+            auto* NextBlock = llvm::BasicBlock::Create(Ctx, "store_edge", Func, LatchBlock);
+            Builder.CreateCondBr(Builder.CreateAnd(Builder.CreateICmpSLT(Row, M), Builder.CreateICmpSLT(Column, N)),
+                                 ElementBlock, NextBlock);
+            Builder.SetInsertPoint(ElementBlock);
+            auto* Ptr = CElementPtr(Row, Column);
+            llvm::Value* Value = Builder.CreateExtractElement(Acc[R], L);
+            if (AddToC) {
+                Value = createArithOp(clang::BO_Add, Builder.CreateLoad(ElemTy, Ptr), Value);
+            }
+            Builder.CreateStore(Value, Ptr);
+            Builder.CreateBr(NextBlock);
+            Builder.SetInsertPoint(NextBlock);
+        }
+    }
+    Builder.CreateBr(LatchBlock);
 
-    auto* ScalarStorePtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Output,
-        {GlobalId},
-        "scalar_store_ptr"
-    );
-    Builder.CreateStore(ScalarVal, ScalarStorePtr);
-    Builder.CreateBr(ExitBlock);
+    Builder.SetInsertPoint(LatchBlock);
+    Block->addIncoming(Builder.CreateAdd(Block, NumGroups), LatchBlock);
+    Builder.CreateBr(BlockHeader);
 
-    // Set up exit block
     Builder.SetInsertPoint(ExitBlock);
     Builder.CreateRetVoid();
 
-    // Add attributes and metadata
-    addMemoryAttributes(Func, KInfo.VectorWidth);
-    addWorkGroupSizeHint(Func, KInfo.PreferredWorkGroupSize);
-}
+    // Rows of C are only element-aligned
+    addMemoryAttributes(Func, 1);
+    addWorkGroupMetadata(Func, KInfo.PreferredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
 
-bool SPIRVGenerator::generateVectorizedLoop(const KernelInfo& KInfo) {
-    // Initialize FloatTy if not already done
-    FloatTy = llvm::Type::getFloatTy(Builder.getContext());
+    return !llvm::verifyFunction(*Func, &llvm::errs());
+}
 
-    // Create kernel function type
-    std::vector<llvm::Type*> ArgTypes;
-    for (const auto& _ : KInfo.Arguments) {
-        ArgTypes.push_back(llvm::PointerType::get(FloatTy, 0));
+bool SPIRVGenerator::generateTransposeKernel(clang::ForStmt* Loop, const VectorizationInfo& Info,
+                                             const std::string& Name) {
+    const TransposeInfo& Transpose = Info.Transpose;
+    KernelInfo KInfo;
+    KInfo.Name = Name;
+    KInfo.IsReduction = false;
+    KInfo.OriginalLoop = Loop;
+    if (!setElementType(Info.ElementType, KInfo)) {
+        return false;
     }
-    ArgTypes.push_back(llvm::Type::getInt32Ty(Builder.getContext()));
-
-    auto* FuncTy = llvm::FunctionType::get(
-        llvm::Type::getVoidTy(Builder.getContext()),
-        ArgTypes,
-        false
-    );
-
-    // Create kernel function
-    auto* Func = llvm::Function::Create(
-        FuncTy,
-        llvm::Function::ExternalLinkage,
-        KInfo.Name,
-        Module.get()
-    );
-
-    // Add OpenCL kernel attribute
-    Func->addFnAttr("opencl.kernels", KInfo.Name);
-
-    // Create entry block
-    auto* Entry = llvm::BasicBlock::Create(Builder.getContext(), "entry", Func);
-    Builder.SetInsertPoint(Entry);
 
-    // Get global ID
-    auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {
-        llvm::ConstantInt::get(Builder.getContext(), llvm::APInt(32, 0))
-    });
+    // Square tiles, one work-item per tile column and TileSize/ThreadRows
+    // rows of it; one column of padding puts the elements of a tile
+    // column in different banks
+    uint64_t TileSize = 32;
+    uint64_t ThreadRows = 8;
+    auto Fits = [&] {
+        return TileSize * ThreadRows <= Options.Device.MaxWorkGroupSize &&
+               TileSize * (TileSize + 1) * getElementSize() <= Options.Device.LocalMemBytes;
+    };
+    while (!Fits() && ThreadRows > 1) {
+        ThreadRows /= 2;
+    }
+    while (!Fits() && TileSize > 1) {
+        TileSize /= 2;
+        ThreadRows = std::min(ThreadRows, TileSize);
+    }
+    if (!Fits()) {
+        llvm::errs() << "Error: No transpose tile fits " << Options.Device.LocalMemBytes
+                     << " bytes of local memory\n";
+        return false;
+    }
+    KInfo.VectorWidth = 1;
+    KInfo.MaxWorkGroupSize = Options.Device.MaxWorkGroupSize;
+    KInfo.PreferredWorkGroupSize = TileSize * ThreadRows;
+    KInfo.UsesLocalMemory = true;
+
+    addNestArgument(KInfo, Transpose.In.Array, ArgKind::Buffer, ArgAccess::Read);
+    addNestArgument(KInfo, Transpose.Out.Array, ArgKind::Buffer, ArgAccess::Write);
+    addNestArguments(KInfo, {Transpose.Rows, Transpose.Columns}, {&Transpose.In, &Transpose.Out});
+    KInfo.Dispatch.ElementsPerWorkItem = TileSize / ThreadRows;
+    setBlockedDispatch(KInfo, Transpose.Rows, Transpose.Columns, TileSize, TileSize);
+    KInfo.Attributes.push_back({"Transpose", std::to_string(TileSize) + "x" + std::to_string(TileSize) +
+        " tiles through __local memory padded to " + std::to_string(TileSize + 1) +
+        " columns; rows of " + Transpose.In.Array->getNameAsString() + " and " +
+        Transpose.Out.Array->getNameAsString() + " are read and written contiguously"});
+    KInfo.Attributes.push_back({"Arguments", describeArguments(KInfo.Arguments)});
+
+    auto* Func = createNestKernel(KInfo);
+    if (!Func) {
+        return false;
+    }
 
-    auto* Input = Func->arg_begin();
-    auto* Output = std::next(Func->arg_begin());
-    auto* N = std::next(Func->arg_begin(), 2);
+    auto& Ctx = Builder.getContext();
+    auto Int = [&](int64_t Value) { return Builder.getInt32(static_cast<uint32_t>(Value)); };
+    auto* Rows = getNestValue(KInfo, Func, Transpose.Rows);
+    auto* Columns = getNestValue(KInfo, Func, Transpose.Columns);
+    auto* In = getNestArgument(KInfo, Func, Transpose.In.Array);
+    auto* Out = getNestArgument(KInfo, Func, Transpose.Out.Array);
+    auto ElementPtr = [&](llvm::Value* Matrix, const MatrixOperand& Op, llvm::Value* Row,
+                          llvm::Value* Column) {
+        auto* LD = getNestStride(KInfo, Func, Op);
+        auto* Index = Op.Transposed ? Builder.CreateAdd(Builder.CreateMul(Column, LD), Row)
+                                    : Builder.CreateAdd(Builder.CreateMul(Row, LD), Column);
+        return Builder.CreateInBoundsGEP(ElemTy, Matrix, {Index});
+    };
+    auto Positive = [&](llvm::Value* X) {
+        return Builder.CreateSelect(Builder.CreateICmpSGT(X, Int(0)), X, Int(0));
+    };
 
-    // Create vector and scalar blocks
-    auto* VectorBlock = llvm::BasicBlock::Create(Builder.getContext(), "vector", Func);
-    auto* ScalarBlock = llvm::BasicBlock::Create(Builder.getContext(), "scalar", Func);
-    auto* ExitBlock = llvm::BasicBlock::Create(Builder.getContext(), "exit", Func);
+    auto* LocalId = Builder.CreateCall(getGetLocalId(), {Int(0)});
+    auto* ThreadColumn = Builder.CreateURem(LocalId, Int(TileSize));
+    auto* ThreadRow = Builder.CreateUDiv(LocalId, Int(TileSize));
+    auto* BlocksPerRow = Builder.CreateUDiv(Builder.CreateAdd(Positive(Columns), Int(TileSize - 1)),
+                                            Int(TileSize), "blocks_per_row");
+    auto* NumBlocks = Builder.CreateMul(Builder.CreateUDiv(Builder.CreateAdd(Positive(Rows), Int(TileSize - 1)),
+                                                           Int(TileSize)), BlocksPerRow, "num_blocks");
+    auto* NumGroups = Builder.CreateUDiv(Builder.CreateCall(getGetGlobalSize(), {Int(0)}),
+                                         Int(KInfo.PreferredWorkGroupSize), "num_groups");
+    auto* FirstBlock = Builder.CreateCall(getGetGroupId(), {Int(0)});
+    auto* Tile = createLocalBuffer(KInfo.Name + "_tile", ElemTy, TileSize * (TileSize + 1));
+
+    auto* Preheader = Builder.GetInsertBlock();
+    auto* HeaderBlock = llvm::BasicBlock::Create(Ctx, "block", Func);
+    auto* BodyBlock = llvm::BasicBlock::Create(Ctx, "block_body", Func);
+    auto* LatchBlock = llvm::BasicBlock::Create(Ctx, "block_next", Func);
+    auto* ExitBlock = llvm::BasicBlock::Create(Ctx, "exit", Func);
+    Builder.CreateBr(HeaderBlock);
+
+    Builder.SetInsertPoint(HeaderBlock);
+    auto* Block = Builder.CreatePHI(Builder.getInt32Ty(), 2, "block");
+    Block->addIncoming(FirstBlock, Preheader);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Block, NumBlocks), BodyBlock, ExitBlock);
+
+    Builder.SetInsertPoint(BodyBlock);
+    auto* RowBase = Builder.CreateMul(Builder.CreateUDiv(Block, BlocksPerRow), Int(TileSize), "row_base");
+    auto* ColumnBase = Builder.CreateMul(Builder.CreateURem(Block, BlocksPerRow), Int(TileSize),
+                                         "column_base");
+
+    // Element (i, j) of the input with i = Row, j = Column, where it lies
+    // inside the matrix
+    auto Guarded = [&](llvm::Value* Row, llvm::Value* Column, const char* BlockName,
+                       const std::function<void()>& Body) {
+        auto* ThenBlock = llvm::BasicBlock::Create(Ctx, BlockName, Func, LatchBlock);
+        auto* NextBlock = llvm::BasicBlock::Create(Ctx, std::string(BlockName) + "_next", Func, LatchBlock);
+        Builder.CreateCondBr(Builder.CreateAnd(Builder.CreateICmpSLT(Row, Rows),
+                                               Builder.CreateICmpSLT(Column, Columns)),
+                             ThenBlock, NextBlock);
+        Builder.SetInsertPoint(ThenBlock);
+        Body();
+        Builder.CreateBr(NextBlock);
+        Builder.SetInsertPoint(NextBlock);
+    };
 
-    // Create branch condition
-    auto* VecCheck = Builder.CreateICmpULT(
-        Builder.CreateAdd(GlobalId,
-            llvm::ConstantInt::get(Builder.getContext(),
-                llvm::APInt(32, KInfo.VectorWidth - 1))),
-        N
-    );
+    // Work-items of a tile row read along a row of the input...
+    for (uint64_t First = 0; First < TileSize; First += ThreadRows) {
+        auto* TileRow = Builder.CreateAdd(ThreadRow, Int(First));
+        auto* Row = Builder.CreateAdd(RowBase, TileRow);
+        auto* Column = Builder.CreateAdd(ColumnBase, ThreadColumn);
+        Guarded(Row, Column, "tile_load", [&] {
+            auto* Value = Builder.CreateLoad(ElemTy, ElementPtr(In, Transpose.In, Row, Column));
+            Builder.CreateStore(Value, getLocalElementPtr(Tile, Builder.CreateAdd(
+                Builder.CreateMul(TileRow, Int(TileSize + 1)), ThreadColumn)));
+        });
+    }
+    addBarrier(CLK_LOCAL_MEM_FENCE);
 
-    Builder.CreateCondBr(VecCheck, VectorBlock, ScalarBlock);
+    // ...and write along a row of the output, reading a tile column
+    for (uint64_t First = 0; First < TileSize; First += ThreadRows) {
+        auto* TileRow = Builder.CreateAdd(ThreadRow, Int(First));
+        auto* Row = Builder.CreateAdd(RowBase, ThreadColumn);
+        auto* Column = Builder.CreateAdd(ColumnBase, TileRow);
+        Guarded(Row, Column, "tile_store", [&] {
+            auto* Value = Builder.CreateLoad(ElemTy, getLocalElementPtr(Tile, Builder.CreateAdd(
+                Builder.CreateMul(ThreadColumn, Int(TileSize + 1)), TileRow)));
+            Builder.CreateStore(Value, ElementPtr(Out, Transpose.Out, Row, Column));
+        });
+    }
+    Builder.CreateBr(LatchBlock);
 
-    // Set up vector block
-    Builder.SetInsertPoint(VectorBlock);
-    auto* VecPtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Input,
-        {GlobalId},
-        "vec_load_ptr"
-    );
+    // The next tile overwrites local memory others may still be reading
+    Builder.SetInsertPoint(LatchBlock);
+    addBarrier(CLK_LOCAL_MEM_FENCE);
+    Block->addIncoming(Builder.CreateAdd(Block, NumGroups), LatchBlock);
+    Builder.CreateBr(HeaderBlock);
 
-    // Load vector
-    auto* Vec = createVectorLoad(VecPtr, KInfo.VectorWidth);
+    Builder.SetInsertPoint(ExitBlock);
+    Builder.CreateRetVoid();
 
-    // Analyze and generate vector operation
-    class OperationAnalyzer : public clang::RecursiveASTVisitor<OperationAnalyzer> {
-    public:
-        enum OpType { None, Add, Mul, Sub, Div };
-        OpType Operation = None;
-        llvm::APFloat Constant = llvm::APFloat(0.0f);
-        bool HasOperation = false;
+    addMemoryAttributes(Func, 1);
+    addWorkGroupMetadata(Func, KInfo.PreferredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
+    if (llvm::verifyFunction(*Func, &llvm::errs())) {
+        Func->eraseFromParent();
+        return false;
+    }
 
-        bool VisitBinaryOperator(clang::BinaryOperator* BO) {
-            if (BO->isAssignmentOp()) {
-                if (auto* RHS = llvm::dyn_cast<clang::BinaryOperator>(
-                        BO->getRHS()->IgnoreParenImpCasts())) {
-                    switch (RHS->getOpcode()) {
-                        case clang::BO_Add: Operation = Add; break;
-                        case clang::BO_Mul: Operation = Mul; break;
-                        case clang::BO_Sub: Operation = Sub; break;
-                        case clang::BO_Div: Operation = Div; break;
-                        default: break;
-                    }
+    addExtensionMetadata(KInfo);
+    LastKernel = KInfo;
+    Kernels.push_back(KInfo);
+    ++NumKernels;
+    return true;
+}
 
-                    if (auto* FL = llvm::dyn_cast<clang::FloatingLiteral>(
-                            RHS->getRHS()->IgnoreParenImpCasts())) {
-                        Constant = FL->getValue();
-                        HasOperation = true;
-                    }
-                }
-            }
-            return true;
+bool SPIRVGenerator::getArgumentTypes(const KernelInfo& KInfo, std::vector<llvm::Type*>& ArgTypes) {
+    for (const auto& Arg : KInfo.Arguments) {
+        auto* Ty = Arg.Kind == ArgKind::TripCount ? Builder.getInt32Ty() : getLLVMType(Arg.Type);
+        if (Arg.Storage != StorageFormat::Native) {
+            Ty = Arg.Storage == StorageFormat::Half ? Builder.getHalfTy() : Builder.getInt16Ty();
         }
-    };
-
-    OperationAnalyzer OpAnalyzer;
-    OpAnalyzer.TraverseStmt(KInfo.OriginalLoop->getBody());
-
-    llvm::Value* Result = Vec;
-    if (OpAnalyzer.HasOperation) {
-        auto* Constant = llvm::ConstantVector::getSplat(
-            llvm::ElementCount::getFixed(KInfo.VectorWidth),
-            llvm::ConstantFP::get(Builder.getContext(), OpAnalyzer.Constant)
-        );
+        if (!Ty) {
+            llvm::errs() << "Error: Unsupported kernel argument '" << Arg.Name
+                         << "' of type '" << Arg.Type.getAsString() << "'\n";
+            return false;
+        }
+        // Buffers live in __global memory, scalars are passed by value
+        ArgTypes.push_back(Arg.Kind == ArgKind::Buffer
+            ? llvm::PointerType::get(Ty, Arg.AddressSpace) : Ty);
+    }
+    return true;
+}
 
-        switch (OpAnalyzer.Operation) {
-            case OperationAnalyzer::Add:
-                Result = Builder.CreateFAdd(Vec, Constant);
-                break;
-            case OperationAnalyzer::Mul:
-                Result = Builder.CreateFMul(Vec, Constant);
-                break;
-            case OperationAnalyzer::Sub:
-                Result = Builder.CreateFSub(Vec, Constant);
-                break;
-            case OperationAnalyzer::Div:
-                Result = Builder.CreateFDiv(Vec, Constant);
-                break;
-            default:
-                Result = Vec;
+void SPIRVGenerator::bindArguments(const KernelInfo& KInfo, llvm::Function* Func,
+                                   ExprLowering& Lowering) {
+    auto Arg = Func->arg_begin();
+    for (const auto& KArg : KInfo.Arguments) {
+        Arg->setName(KArg.Name);
+        if (KArg.Decl && KArg.Kind == ArgKind::Buffer) {
+            Lowering.bindArray(KArg.Decl, &*Arg, KArg.Storage);
+        } else if (KArg.Decl && KArg.Kind == ArgKind::Scalar) {
+            Lowering.bindScalar(KArg.Decl, &*Arg);
+        } else if (KArg.Decl) {
+            // The body may read the loop bound as a value of its own type
+            Lowering.bindScalar(KArg.Decl, Lowering.convert(&*Arg, Context->IntTy, KArg.Decl->getType()));
         }
+        ++Arg;
+    }
+    for (const auto* Table : KInfo.ConstantTables) {
+        Lowering.bindArray(Table, getConstantTable(Table));
     }
+    addArgumentAttributes(Func, KInfo.Arguments);
+}
 
-    // Store vector result
-    auto* VecStorePtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Output,
-        {GlobalId},
-        "vec_store_ptr"
-    );
-    createVectorStore(Result, VecStorePtr);
-    Builder.CreateBr(ExitBlock);
+llvm::Value* SPIRVGenerator::getLoopEnd(const KernelInfo& KInfo, llvm::Function* Func) {
+    if (!KInfo.Dispatch.NeedsSizeArg) {
+        return Builder.getInt32(static_cast<uint32_t>(KInfo.LowerBound + KInfo.StaticTripCount));
+    }
 
-    // Set up scalar block
-    Builder.SetInsertPoint(ScalarBlock);
-    auto* ScalarLoadPtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Input,
-        {GlobalId},
-        "scalar_load_ptr"
-    );
-    llvm::Value* ScalarVal = Builder.CreateLoad(FloatTy, ScalarLoadPtr);  // Change type to llvm::Value*
+    // One past the last iteration, never below the first one. The index
+    // compares against it are unsigned, so a negative n must become the
+    // lower bound here rather than a huge trip count
+    llvm::Value* End = std::prev(Func->arg_end());
+    if (KInfo.InclusiveBound) {
+        End = Builder.CreateAdd(End, Builder.getInt32(1), "end");
+    }
+    auto* Lower = Builder.getInt32(static_cast<uint32_t>(KInfo.LowerBound));
+    return Builder.CreateSelect(Builder.CreateICmpSLT(End, Lower), Lower, End, "end");
+}
 
-    if (OpAnalyzer.HasOperation) {
-        auto* Constant = llvm::ConstantFP::get(
-            Builder.getContext(),
-            OpAnalyzer.Constant
-        );
-        switch (OpAnalyzer.Operation) {
-            case OperationAnalyzer::Add:
-                ScalarVal = Builder.CreateFAdd(ScalarVal, Constant);
-                break;
-            case OperationAnalyzer::Mul:
-                ScalarVal = Builder.CreateFMul(ScalarVal, Constant);
-                break;
-            case OperationAnalyzer::Sub:
-                ScalarVal = Builder.CreateFSub(ScalarVal, Constant);
-                break;
-            case OperationAnalyzer::Div:
-                ScalarVal = Builder.CreateFDiv(ScalarVal, Constant);
-                break;
-            default:
-                break;
-        }
+std::string SPIRVGenerator::getOpenCLTypeName(clang::QualType QT) {
+    QT = QT.getCanonicalType().getUnqualifiedType();
+    if (QT->isHalfType() || QT->isFloat16Type()) return "half";
+    if (QT->isSpecificBuiltinType(clang::BuiltinType::Float)) return "float";
+    if (QT->isSpecificBuiltinType(clang::BuiltinType::Double)) return "double";
+    if (QT->isBooleanType()) return "bool";
+
+    std::string Name;
+    switch (Context->getTypeSize(QT)) {
+        case 8:  Name = "char"; break;
+        case 16: Name = "short"; break;
+        case 32: Name = "int"; break;
+        default: Name = "long"; break;
     }
+    return QT->isUnsignedIntegerType() ? "u" + Name : Name;
+}
 
-    auto* ScalarStorePtr = Builder.CreateInBoundsGEP(
-        FloatTy,
-        Output,
-        {GlobalId},
-        "scalar_store_ptr"
-    );
-    Builder.CreateStore(ScalarVal, ScalarStorePtr);
-    Builder.CreateBr(ExitBlock);
+void SPIRVGenerator::addArgumentAttributes(llvm::Function* Func,
+                                           const std::vector<KernelArgument>& Arguments) {
+    auto& Ctx = Builder.getContext();
+    std::vector<llvm::Metadata*> AddrSpaces, AccessQuals, Types, BaseTypes, TypeQuals, Names;
 
-    // Set up exit block
-    Builder.SetInsertPoint(ExitBlock);
-    Builder.CreateRetVoid();
+    auto Arg = Func->arg_begin();
+    for (const auto& KArg : Arguments) {
+        std::string Type = KArg.Kind == ArgKind::TripCount ? "int" : getOpenCLTypeName(KArg.Type);
+        if (KArg.Storage != StorageFormat::Native) {
+            Type = KArg.Storage == StorageFormat::Half ? "half" : "ushort";
+        }
+        std::string Qual;
+        if (KArg.Kind == ArgKind::Buffer) {
+            Type += "*";
+            // Kernels never keep a buffer pointer past their own execution
+            Arg->addAttr(llvm::Attribute::NoCapture);
+            if (KArg.Access == ArgAccess::Read) {
+                // Read-only buffers are declared "const restrict", which
+                // lets drivers serve them from read-only caches
+                Arg->addAttr(llvm::Attribute::ReadOnly);
+                Arg->addAttr(llvm::Attribute::NoAlias);
+                Qual = "const restrict";
+            } else if (KArg.Access == ArgAccess::Write) {
+                Arg->addAttr(llvm::Attribute::WriteOnly);
+            }
+        }
 
-    // Add attributes and metadata
-    addMemoryAttributes(Func, KInfo.VectorWidth);
-    addWorkGroupSizeHint(Func, KInfo.PreferredWorkGroupSize);
+        AddrSpaces.push_back(llvm::ConstantAsMetadata::get(Builder.getInt32(KArg.AddressSpace)));
+        AccessQuals.push_back(llvm::MDString::get(Ctx, "none"));
+        Types.push_back(llvm::MDString::get(Ctx, Type));
+        BaseTypes.push_back(llvm::MDString::get(Ctx, Type));
+        TypeQuals.push_back(llvm::MDString::get(Ctx, Qual));
+        Names.push_back(llvm::MDString::get(Ctx, KArg.Name));
+        ++Arg;
+    }
 
-    return !llvm::verifyFunction(*Func, &llvm::errs());
+    Func->setMetadata("kernel_arg_addr_space", llvm::MDNode::get(Ctx, AddrSpaces));
+    Func->setMetadata("kernel_arg_access_qual", llvm::MDNode::get(Ctx, AccessQuals));
+    Func->setMetadata("kernel_arg_type", llvm::MDNode::get(Ctx, Types));
+    Func->setMetadata("kernel_arg_base_type", llvm::MDNode::get(Ctx, BaseTypes));
+    Func->setMetadata("kernel_arg_type_qual", llvm::MDNode::get(Ctx, TypeQuals));
+    Func->setMetadata("kernel_arg_name", llvm::MDNode::get(Ctx, Names));
 }
 
 
 bool SPIRVGenerator::generateReductionKernel(const KernelInfo& KInfo) {
-    // Initialize types
-    FloatTy = llvm::Type::getFloatTy(Builder.getContext());
+    // The reduced value is the right-hand side of "sum += expr"
+    class ReductionFinder : public clang::RecursiveASTVisitor<ReductionFinder> {
+    public:
+        const clang::CompoundAssignOperator* Reduction = nullptr;
+
+        bool VisitCompoundAssignOperator(clang::CompoundAssignOperator* CAO) {
+            if (!Reduction && llvm::isa<clang::DeclRefExpr>(CAO->getLHS()->IgnoreParenImpCasts())) {
+                Reduction = CAO;
+            }
+            return true;
+        }
+    };
+
+    ReductionFinder Finder;
+    Finder.TraverseStmt(KInfo.OriginalLoop->getBody());
+    const auto* IV = getInductionVariable(KInfo.OriginalLoop);
+    if (!IV || !Finder.Reduction || Finder.Reduction->getOpcode() != clang::BO_AddAssign) {
+        llvm::errs() << "Error: Only \"+=\" reductions over a counted loop are supported\n";
+        return false;
+    }
 
     // Create kernel function type
     std::vector<llvm::Type*> ArgTypes;
 
-    // Input array
-    ArgTypes.push_back(llvm::PointerType::get(FloatTy, 0));
-    // Result buffer
-    ArgTypes.push_back(llvm::PointerType::get(FloatTy, 0));
-    // Global size
-    ArgTypes.push_back(llvm::Type::getInt32Ty(Builder.getContext()));
+    // Loop arguments, the result buffer (per-group partials for the
+    // two-stage combine) and the trip count
+    if (!getArgumentTypes(KInfo, ArgTypes)) {
+        return false;
+    }
 
     auto* FuncTy = llvm::FunctionType::get(
         llvm::Type::getVoidTy(Builder.getContext()),
@@ -551,14 +2681,20 @@ bool SPIRVGenerator::generateReductionKernel(const KernelInfo& KInfo) {
     );
 
     // Add attributes
-    Func->addFnAttr("opencl.kernels", KInfo.Name);
+    addSPIRVMetadata(Func);
 
     // Create entry block first
     auto* Entry = llvm::BasicBlock::Create(Builder.getContext(), "entry", Func);
     Builder.SetInsertPoint(Entry);
 
+    ExprLowering Lowering(*Context, Builder, IV);
+    bindArguments(KInfo, Func, Lowering);
+
     // Now that we have a basic block, improve the reduction kernel
-    improveReductionKernel(KInfo, Func);
+    if (!improveReductionKernel(KInfo, Func, Lowering, Finder.Reduction->getRHS())) {
+        llvm::errs() << "Error: Cannot lower reduction: " << Lowering.getError() << "\n";
+        return false;
+    }
 
     // Create return
     Builder.CreateRetVoid();
@@ -566,43 +2702,176 @@ bool SPIRVGenerator::generateReductionKernel(const KernelInfo& KInfo) {
     // Add memory attributes
     addMemoryAttributes(Func, KInfo.VectorWidth);
 
+    // The unrolled tree reduction is sized for exactly this work-group
+    addWorkGroupMetadata(Func, KInfo.PreferredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
+
     return !llvm::verifyFunction(*Func, &llvm::errs());
 }
 
 
+bool SPIRVGenerator::generateSearchKernel(const KernelInfo& KInfo) {
+    const auto* IV = getInductionVariable(KInfo.OriginalLoop);
+    if (!IV) {
+        llvm::errs() << "Error: Loop has no induction variable\n";
+        return false;
+    }
+
+    // Condition arguments, the first-match buffer and the trip count
+    std::vector<llvm::Type*> ArgTypes;
+    if (!getArgumentTypes(KInfo, ArgTypes)) {
+        return false;
+    }
+    auto* FuncTy = llvm::FunctionType::get(llvm::Type::getVoidTy(Builder.getContext()), ArgTypes, false);
+    auto* Func = llvm::Function::Create(FuncTy, llvm::Function::ExternalLinkage, KInfo.Name, Module.get());
+    addSPIRVMetadata(Func);
+
+    auto& Ctx = Builder.getContext();
+    auto* Entry = llvm::BasicBlock::Create(Ctx, "entry", Func);
+    Builder.SetInsertPoint(Entry);
+
+    ExprLowering Lowering(*Context, Builder, IV);
+    bindArguments(KInfo, Func, Lowering);
+    auto* First = &*std::prev(Func->arg_end(), 2);
+    auto* N = getLoopEnd(KInfo, Func);
+
+    auto* Width = Builder.getInt32(KInfo.VectorWidth);
+    auto* GlobalId = Builder.CreateCall(getGetGlobalId(), {Builder.getInt32(0)});
+    auto* GlobalSize = Builder.CreateCall(getGetGlobalSize(), {Builder.getInt32(0)});
+    auto* Lower = Builder.getInt32(static_cast<uint32_t>(KInfo.LowerBound));
+    auto* Start = Builder.CreateAdd(Builder.CreateMul(GlobalId, Width), Lower, "stride_start");
+    auto* Stride = Builder.CreateMul(GlobalSize, Width, "stride");
+    auto IsTrue = [&](llvm::Value* V) {
+        auto* Zero = llvm::Constant::getNullValue(V->getType());
+        return V->getType()->isFPOrFPVectorTy() ? Builder.CreateFCmpUNE(V, Zero)
+                                                : Builder.CreateICmpNE(V, Zero);
+    };
+
+    auto* Preheader = Builder.GetInsertBlock();
+    auto* LoopBlock = llvm::BasicBlock::Create(Ctx, "search", Func);
+    auto* StepBlock = llvm::BasicBlock::Create(Ctx, "search_step", Func);
+    auto* BodyBlock = llvm::BasicBlock::Create(Ctx, "search_body", Func);
+    auto* TailBlock = llvm::BasicBlock::Create(Ctx, "search_tail", Func);
+    auto* LaneBlock = llvm::BasicBlock::Create(Ctx, "search_lane", Func);
+    auto* NextLaneBlock = llvm::BasicBlock::Create(Ctx, "search_next_lane", Func);
+    auto* MatchBlock = llvm::BasicBlock::Create(Ctx, "match", Func);
+    auto* ExitBlock = llvm::BasicBlock::Create(Ctx, "exit", Func);
+    Builder.CreateBr(LoopBlock);
+
+    // Steps only move to higher iterations, so a work-item is done once
+    // some work-item has matched below its current step
+    Builder.SetInsertPoint(LoopBlock);
+    auto* Index = Builder.CreatePHI(Builder.getInt32Ty(), 2, "stride_index");
+    Index->addIncoming(Start, Preheader);
+    auto* Known = Builder.CreateAlignedLoad(Builder.getInt32Ty(), First, llvm::MaybeAlign(4), "known");
+    Known->setAtomic(llvm::AtomicOrdering::Monotonic);
+    Builder.CreateCondBr(Builder.CreateICmpSLT(Index, Known), StepBlock, ExitBlock);
+
+    Builder.SetInsertPoint(StepBlock);
+    Builder.CreateCondBr(Builder.CreateICmpULE(Builder.CreateAdd(Index, Width), N), BodyBlock, TailBlock);
+
+    // The lowest lane whose condition holds, or N when none does
+    Builder.SetInsertPoint(BodyBlock);
+    Lowering.setIteration(Index, KInfo.VectorWidth, KInfo.LowerBound % KInfo.VectorWidth == 0);
+    auto* Cond = Lowering.lowerExpr(KInfo.Search.Condition);
+    if (!Cond) {
+        llvm::errs() << "Error: Cannot lower search condition: " << Lowering.getError() << "\n";
+        return false;
+    }
+    auto* Mask = IsTrue(Cond);
+    llvm::Value* Match = N;
+    for (unsigned Lane = KInfo.VectorWidth; Lane-- > 0;) {
+        auto* Hit = KInfo.VectorWidth > 1 ? Builder.CreateExtractElement(Mask, Lane) : Mask;
+        Match = Builder.CreateSelect(Hit, Builder.CreateAdd(Index, Builder.getInt32(Lane)), Match);
+    }
+    auto* BodyEnd = Builder.GetInsertBlock();
+    auto* Backedge = llvm::BasicBlock::Create(Ctx, "search_next", Func, TailBlock);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Match, N), MatchBlock, Backedge);
+
+    Builder.SetInsertPoint(Backedge);
+    Index->addIncoming(Builder.CreateAdd(Index, Stride), Backedge);
+    Builder.CreateBr(LoopBlock);
+
+    // The last, partial step of this work-item, one lane at a time
+    Builder.SetInsertPoint(TailBlock);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Index, N), LaneBlock, ExitBlock);
+
+    Builder.SetInsertPoint(LaneBlock);
+    auto* Lane = Builder.CreatePHI(Builder.getInt32Ty(), 2, "lane");
+    Lane->addIncoming(Index, TailBlock);
+    Lowering.setIteration(Lane, 1);
+    auto* LaneCond = Lowering.lowerExpr(KInfo.Search.Condition);
+    if (!LaneCond) {
+        llvm::errs() << "Error: Cannot lower search condition: " << Lowering.getError() << "\n";
+        return false;
+    }
+    auto* LaneEnd = Builder.GetInsertBlock();
+    Builder.CreateCondBr(IsTrue(LaneCond), MatchBlock, NextLaneBlock);
+
+    Builder.SetInsertPoint(NextLaneBlock);
+    auto* NextLane = Builder.CreateAdd(Lane, Builder.getInt32(1));
+    Lane->addIncoming(NextLane, NextLaneBlock);
+    Builder.CreateCondBr(Builder.CreateICmpULT(NextLane, N), LaneBlock, ExitBlock);
+
+    // Later steps of this work-item can only match higher up
+    Builder.SetInsertPoint(MatchBlock);
+    auto* Matched = Builder.CreatePHI(Builder.getInt32Ty(), 2, "matched");
+    Matched->addIncoming(Match, BodyEnd);
+    Matched->addIncoming(Lane, LaneEnd);
+    Builder.CreateAtomicRMW(llvm::AtomicRMWInst::Min, First, Matched, llvm::MaybeAlign(4),
+                            llvm::AtomicOrdering::Monotonic);
+    Builder.CreateBr(ExitBlock);
+
+    Builder.SetInsertPoint(ExitBlock);
+    Builder.CreateRetVoid();
+
+    // The result is a single int, not one of the vectorized buffers
+    addMemoryAttributes(Func, KInfo.VectorWidth);
+    First->removeAttr(llvm::Attribute::Alignment);
+    First->addAttr(llvm::Attribute::getWithAlignment(Ctx, llvm::Align(4)));
+    addWorkGroupSizeHint(Func, KInfo.PreferredWorkGroupSize);
+    addDispatchMetadata(Func, KInfo.Dispatch);
+
+    return !llvm::verifyFunction(*Func, &llvm::errs());
+}
+
 std::string SPIRVGenerator::getKernelName(clang::ForStmt* Loop) {
     // Generate a unique name based on location
     auto& SM = Context->getSourceManager();
     auto Loc = SM.getSpellingLineNumber(Loop->getBeginLoc());
-    return "kernel_line_" + std::to_string(Loc);
-}
+    std::string Name = "kernel_line_" + std::to_string(Loc);
 
-llvm::Type* SPIRVGenerator::getVectorType(llvm::Type* ElemTy, unsigned Width) {
-    return llvm::VectorType::get(ElemTy, Width, false);
+    // Several loops on one line share the module, so disambiguate; with
+    // variants the loop name itself never becomes a function
+    std::string Unique = Name;
+    for (unsigned Suffix = 1; LoopNames.count(Unique); ++Suffix) {
+        Unique = Name + "_" + std::to_string(Suffix);
+    }
+    LoopNames.insert(Unique);
+    return Unique;
 }
 
-llvm::Value* SPIRVGenerator::createVectorLoad(llvm::Value* Ptr, unsigned Width) {
-    auto* VecTy = llvm::VectorType::get(
-        llvm::Type::getFloatTy(Builder.getContext()),
-        Width,
-        false
-    );
-    auto* CastPtr = Builder.CreateBitCast(
-        Ptr,
-        llvm::PointerType::get(VecTy, 0),
-        "vecptr_cast"
-    );
-    return Builder.CreateLoad(VecTy, CastPtr);
+std::string SPIRVGenerator::getMangledBuiltinName(llvm::StringRef Name, llvm::Type* ArgTy) {
+    // Itanium mangling of overloaded OpenCL builtins, e.g. _Z20sub_group_reduce_addf,
+    // so the float and int overloads can share one module
+    std::string Code;
+    if (ArgTy->isHalfTy()) {
+        Code = "Dh";
+    } else if (ArgTy->isFloatTy()) {
+        Code = "f";
+    } else if (ArgTy->isDoubleTy()) {
+        Code = "d";
+    } else {
+        switch (ArgTy->getIntegerBitWidth()) {
+            case 64: Code = ElemIsSigned ? "l" : "m"; break;
+            default: Code = ElemIsSigned ? "i" : "j"; break;
+        }
+    }
+    return "_Z" + std::to_string(Name.size()) + Name.str() + Code;
 }
 
-llvm::Value* SPIRVGenerator::createVectorStore(llvm::Value* Val, llvm::Value* Ptr) {
-    auto* VecTy = llvm::cast<llvm::VectorType>(Val->getType());
-    auto* CastPtr = Builder.CreateBitCast(
-        Ptr,
-        llvm::PointerType::get(VecTy, 0),
-        "vecptr_cast"
-    );
-    return Builder.CreateStore(Val, CastPtr);
+llvm::Type* SPIRVGenerator::getVectorType(llvm::Type* ElemTy, unsigned Width) {
+    return llvm::VectorType::get(ElemTy, Width, false);
 }
 
 } // namespace cspir
@@ -2,6 +2,8 @@
 
 #include "types.h"
 #include "clang/AST/ASTContext.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/OperationKinds.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
@@ -9,26 +11,69 @@
 #include "llvm/IR/Type.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Constants.h"
+#include <initializer_list>
+#include <map>
 #include <memory>
+#include <set>
 
 namespace cspir {
+    class ExprLowering;
+
     class SPIRVGenerator {
     public:
-        explicit SPIRVGenerator(clang::ASTContext* Context)
+        SPIRVGenerator(clang::ASTContext* Context, const CodeGenOptions& Options)
             : Context(Context),
+                Options(Options),
                 LLVMCtx(std::make_unique<llvm::LLVMContext>()),
-                FloatTy(nullptr),
+                ElemTy(nullptr),
                 Input(nullptr),
                 Builder(*LLVMCtx)  // Move Builder initialization to match declaration order
         {
             initializeModule();
         }
 
+        // Kernels accumulate in one module per translation unit; call
+        // finalizeModule once after the last kernel has been generated
         bool generateKernel(clang::ForStmt* Loop, const VectorizationInfo& Info);
+        bool finalizeModule();
+        unsigned getNumKernels() const { return NumKernels; }
+        const KernelInfo& getLastKernel() const { return LastKernel; }
+        // Every kernel generated so far, variants included. A two-stage
+        // reduction's <name>_combine kernel has no entry of its own.
+        const std::vector<KernelInfo>& getKernels() const { return Kernels; }
         llvm::Module* getModule() { return Module.get(); }
+
+        // One configuration of a loop kernel, named Name; LoopName selects
+        // the per-loop options. Used directly by the autotuner.
+        bool generateVariant(clang::ForStmt* Loop, const VectorizationInfo& Info,
+                             const KernelVariant& Variant, const std::string& LoopName,
+                             const std::string& Name);
+        std::string getKernelName(clang::ForStmt* Loop);
+
+        // A two-stage reduction's <name>_combine kernel takes (partials,
+        // result, number of partials); this is the count's position
+        static constexpr unsigned CombineCountArg = 2;
     private:
+        // Blocking of a GEMM kernel: a work-group of ThreadRows x
+        // ThreadColumns work-items computes one block of C in Depth-deep
+        // steps through local memory, each work-item RegRows x RegColumns
+        // elements of it in registers
+        struct GemmTile {
+            unsigned RegRows = 4;
+            unsigned RegColumns = 4;
+            unsigned ThreadRows = 16;
+            unsigned ThreadColumns = 16;
+            unsigned Depth = 16;
+
+            uint64_t getRows() const { return static_cast<uint64_t>(ThreadRows) * RegRows; }
+            uint64_t getColumns() const { return static_cast<uint64_t>(ThreadColumns) * RegColumns; }
+            size_t getGroupSize() const { return static_cast<size_t>(ThreadRows) * ThreadColumns; }
+        };
+
     // Add member variables for commonly used types
-       llvm::Type* FloatTy = nullptr;
+       llvm::Type* ElemTy = nullptr;  // Scalar element type of the kernel being generated
+       bool ElemIsFloat = true;
+       bool ElemIsSigned = true;
        llvm::Value* Input = nullptr;  // Add Input member variable
 
        // OpenCL function declarations
@@ -56,34 +101,99 @@ namespace cspir {
                 {llvm::Type::getInt32Ty(Builder.getContext())});
         }
 
+        llvm::FunctionCallee getGetGlobalSize() {
+            return getOpenCLFunction(OpenCLBuiltins::GET_GLOBAL_SIZE,
+                llvm::Type::getInt32Ty(Builder.getContext()),
+                {llvm::Type::getInt32Ty(Builder.getContext())});
+        }
+
+        // Sub-group queries take no dimension argument
+        llvm::FunctionCallee getSubGroupQuery(const char* Name) {
+            return getOpenCLFunction(Name,
+                llvm::Type::getInt32Ty(Builder.getContext()), {});
+        }
+
         // Kernel generation helpers
-        void addBarrier();
-        void addBarrier(unsigned Fence);  // Add overload for fence type
+        void addBarrier(unsigned Fence);
         void addMemoryAttributes(llvm::Function* Func, unsigned VectorWidth);
 
         void addSPIRVMetadata(llvm::Function* Func);
 
         void addWorkGroupSizeHint(llvm::Function* Func, unsigned Size);
         // Helper functions for metadata
-        void addKernelMetadata(llvm::Function* Func);
         void addWorkGroupMetadata(llvm::Function* Func, unsigned Size);
+        void addDispatchMetadata(llvm::Function* Func, const DispatchInfo& Dispatch);
         void addMemoryModelMetadata(llvm::Module* M);
 
         // Main kernel generation functions
         bool generateVectorizedLoop(const KernelInfo& KInfo);
         bool generateReductionKernel(const KernelInfo& KInfo);
+        bool generateCombineKernel(const KernelInfo& KInfo);
+        bool generateSearchKernel(const KernelInfo& KInfo);
+        bool generateStaticLoopBody(const KernelInfo& KInfo, llvm::Function* Func,
+                                    llvm::Value* GlobalId, ExprLowering& Lowering);
+        bool generateStencilBody(const KernelInfo& KInfo, llvm::Function* Func,
+                                 ExprLowering& Lowering);
+        // Work-group size and tile rows whose tiles fit local memory
+        bool selectStencilTile(KernelInfo& KInfo);
+        // Shared by the kernels of loop nests. Arguments are added once each;
+        // bounds and leading dimensions are read as i32.
+        void addNestArgument(KernelInfo& KInfo, const clang::VarDecl* VD, ArgKind Kind,
+                             ArgAccess Access);
+        void addNestArguments(KernelInfo& KInfo, std::initializer_list<const clang::Expr*> Bounds,
+                              std::initializer_list<const MatrixOperand*> Operands);
+        void setBlockedDispatch(KernelInfo& KInfo, const clang::Expr* Rows, const clang::Expr* Columns,
+                                uint64_t BlockRows, uint64_t BlockColumns);
+        llvm::Function* createNestKernel(const KernelInfo& KInfo);
+        llvm::Value* getNestArgument(const KernelInfo& KInfo, llvm::Function* Func,
+                                     const clang::VarDecl* VD);
+        llvm::Value* getNestValue(const KernelInfo& KInfo, llvm::Function* Func, const clang::Expr* Bound);
+        llvm::Value* getNestStride(const KernelInfo& KInfo, llvm::Function* Func, const MatrixOperand& Op);
+        bool generateGemmKernel(clang::ForStmt* Loop, const VectorizationInfo& Info,
+                                const std::string& Name);
+        bool generateGemmBody(const KernelInfo& KInfo, const GemmInfo& Gemm, const GemmTile& Tile,
+                              llvm::Function* Func);
+        // Shrinks the work-group until it and its tiles fit the device
+        bool selectGemmTile(GemmTile& Tile);
+        bool generateTransposeKernel(clang::ForStmt* Loop, const VectorizationInfo& Info,
+                                     const std::string& Name);
+        bool getArgumentTypes(const KernelInfo& KInfo, std::vector<llvm::Type*>& ArgTypes);
+        void bindArguments(const KernelInfo& KInfo, llvm::Function* Func, ExprLowering& Lowering);
+        void addArgumentAttributes(llvm::Function* Func, const std::vector<KernelArgument>& Arguments);
+        llvm::Value* getLoopEnd(const KernelInfo& KInfo, llvm::Function* Func);
+
+        // Local memory helpers
+        llvm::GlobalVariable* createLocalBuffer(const std::string& Name, llvm::Type* ElemTy,
+                                                uint64_t NumElements);
+        llvm::Value* getLocalElementPtr(llvm::GlobalVariable* Buffer, llvm::Value* Index);
+
+        // Constant memory helpers. The initializer is null unless the
+        // array's elements are arithmetic and all known at compile time.
+        llvm::Constant* getTableInitializer(const clang::VarDecl* VD);
+        llvm::Constant* getConstantTable(const clang::VarDecl* VD);
 
         // Vector operation helpers
-        llvm::Value* createVectorLoad(llvm::Value* Ptr, unsigned Width);
-        llvm::Value* createVectorStore(llvm::Value* Val, llvm::Value* Ptr);
         llvm::Value* performVectorReduction(llvm::Value* Vec, unsigned Width);
 
         // Optimization helpers
-        void improveSimpleVectorization(const KernelInfo& KInfo, llvm::Function* Func);
-        void improveReductionKernel(const KernelInfo& KInfo, llvm::Function* Func);
+        bool improveReductionKernel(const KernelInfo& KInfo, llvm::Function* Func,
+                                    ExprLowering& Lowering, const clang::Expr* Value);
+        llvm::Value* createGridStrideAccumulation(const KernelInfo& KInfo,
+                                                  llvm::Function* Func,
+                                                  llvm::Value* N,
+                                                  ExprLowering& Lowering,
+                                                  const clang::Expr* Value);
+        llvm::Value* createGroupCombine(const KernelInfo& KInfo,
+                                        llvm::GlobalVariable* LocalMem,
+                                        llvm::Value* Value,
+                                        llvm::Value* LocalId);
+        llvm::Value* createSubGroupReduction(
+                llvm::Value* Value,
+                llvm::GlobalVariable* LocalMem);
+        llvm::Value* createSubGroupReduceAdd(llvm::Value* Value);
         // Update createWorkGroupReduction declaration to include KInfo
             void createWorkGroupReduction(
-                llvm::Value* LocalMem,
+                llvm::GlobalVariable* LocalMem,
                 llvm::Value* WGSize,
                 llvm::Value* LocalId,
                 const KernelInfo& KInfo);
@@ -93,15 +203,37 @@ namespace cspir {
                                                 llvm::Type* RetTy,
                                                 llvm::ArrayRef<llvm::Type*> ArgTypes);
 
+        // Element type helpers
+        bool setElementType(clang::QualType QT, KernelInfo& KInfo);
+        llvm::Type* getLLVMType(clang::QualType QT);
+        unsigned legalizeVectorWidth(unsigned Width);
+        unsigned getElementSize() const;
+        llvm::Constant* getElementConstant(llvm::Type* Ty, double FPValue, int64_t IntValue);
+        llvm::Value* createArithOp(clang::BinaryOperatorKind Op, llvm::Value* LHS, llvm::Value* RHS);
+        void addExtensionMetadata(const KernelInfo& KInfo);
+
         // Utility functions
-        std::string getKernelName(clang::ForStmt* Loop);
+        std::string getOpenCLTypeName(clang::QualType QT);
+        std::string getMangledBuiltinName(llvm::StringRef Name, llvm::Type* ArgTy);
         llvm::Type* getVectorType(llvm::Type* ElemTy, unsigned Width);
         void initializeModule();
 
+        // Constant trip counts up to this many vectors become one work-item
+        static constexpr uint64_t MaxUnrolledVectors = 4;
+        // Work-groups launched for a blocked nest whose sizes are only
+        // known at launch; the kernel strides over its blocks
+        static constexpr uint64_t BlockedLaunchGroups = 256;
+
         // Class members
         clang::ASTContext* Context;
+        const CodeGenOptions& Options;
         std::unique_ptr<llvm::LLVMContext> LLVMCtx;
         llvm::IRBuilder<> Builder;
         std::unique_ptr<llvm::Module> Module;
+        unsigned NumKernels = 0;
+        KernelInfo LastKernel;
+        std::vector<KernelInfo> Kernels;
+        std::set<std::string> LoopNames;
+        std::map<const clang::VarDecl*, llvm::GlobalVariable*> ConstantTables;  // Shared by kernels
     };
 } // namespace cspir
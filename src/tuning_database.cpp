@@ -0,0 +1,122 @@
+#include "tuning_database.h"
+#include "device_profile.h"
+#include "kernel_variants.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <limits>
+
+namespace cspir {
+
+static const int64_t DatabaseVersion = 1;
+
+bool TuningDatabase::load(llvm::StringRef Path) {
+    if (!llvm::sys::fs::exists(Path)) {
+        return true;
+    }
+
+    auto Buffer = llvm::MemoryBuffer::getFile(Path);
+    if (!Buffer) {
+        llvm::errs() << "Error: Cannot read tuning database " << Path << ": "
+                     << Buffer.getError().message() << "\n";
+        return false;
+    }
+    auto Root = llvm::json::parse((*Buffer)->getBuffer());
+    if (!Root) {
+        llvm::errs() << "Error: Malformed tuning database " << Path << ": "
+                     << llvm::toString(Root.takeError()) << "\n";
+        return false;
+    }
+
+    auto* Object = Root->getAsObject();
+    auto* Entries = Object ? Object->getArray("records") : nullptr;
+    if (!Entries || Object->getInteger("version").getValueOr(0) != DatabaseVersion) {
+        llvm::errs() << "Error: Unsupported tuning database format in " << Path << "\n";
+        return false;
+    }
+
+    for (const auto& Entry : *Entries) {
+        auto* E = Entry.getAsObject();
+        if (!E) {
+            continue;
+        }
+        auto Loop = E->getString("loop");
+        auto Device = E->getString("device");
+        auto Width = E->getInteger("width");
+        auto GroupSize = E->getInteger("work_group_size");
+        if (!Loop || !Device || !Width || !GroupSize || *Width <= 0 || *GroupSize <= 0) {
+            continue;
+        }
+        // A size the reduction tree cannot halve or the device cannot
+        // launch would only surface as a broken kernel
+        const DeviceProfile* Profile = findDeviceProfile(*Device);
+        size_t MaxSize = Profile ? Profile->MaxWorkGroupSize : std::numeric_limits<size_t>::max();
+        if (!isValidWorkGroupSize(static_cast<size_t>(*GroupSize), MaxSize)) {
+            llvm::errs() << "Warning: Ignoring tuning record for loop " << *Loop << " on " << *Device
+                         << " in " << Path << ": work-group size " << *GroupSize
+                         << " must be a power of two";
+            if (Profile) {
+                llvm::errs() << " no larger than " << MaxSize;
+            }
+            llvm::errs() << "\n";
+            continue;
+        }
+
+        TuningRecord Record;
+        Record.VectorWidth = static_cast<unsigned>(*Width);
+        Record.WorkGroupSize = static_cast<size_t>(*GroupSize);
+        Record.Unroll = static_cast<unsigned>(std::max<int64_t>(E->getInteger("unroll").getValueOr(1), 1));
+        Record.Coarsening = static_cast<unsigned>(
+            std::max<int64_t>(E->getInteger("coarsening").getValueOr(1), 1));
+        Record.Seconds = E->getNumber("seconds").getValueOr(0);
+        Record.Candidates = static_cast<unsigned>(E->getInteger("candidates").getValueOr(0));
+        Records[{Loop->str(), Device->str()}] = Record;
+    }
+    return true;
+}
+
+bool TuningDatabase::save(llvm::StringRef Path) const {
+    llvm::json::Array Entries;
+    for (const auto& Entry : Records) {
+        const auto& Record = Entry.second;
+        Entries.push_back(llvm::json::Object{
+            {"loop", Entry.first.first},
+            {"device", Entry.first.second},
+            {"width", Record.VectorWidth},
+            {"work_group_size", static_cast<int64_t>(Record.WorkGroupSize)},
+            {"unroll", Record.Unroll},
+            {"coarsening", Record.Coarsening},
+            {"seconds", Record.Seconds},
+            {"candidates", Record.Candidates}
+        });
+    }
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Text);
+    if (EC) {
+        llvm::errs() << "Error: Cannot write tuning database " << Path << ": "
+                     << EC.message() << "\n";
+        return false;
+    }
+    OS << llvm::formatv("{0:2}", llvm::json::Value(llvm::json::Object{
+        {"version", DatabaseVersion},
+        {"records", std::move(Entries)}
+    })) << "\n";
+    return true;
+}
+
+const TuningRecord* TuningDatabase::lookup(llvm::StringRef LoopHash, llvm::StringRef Device) const {
+    auto It = Records.find({LoopHash.str(), Device.str()});
+    return It == Records.end() ? nullptr : &It->second;
+}
+
+void TuningDatabase::insert(llvm::StringRef LoopHash, llvm::StringRef Device,
+                            const TuningRecord& Record) {
+    Records[{LoopHash.str(), Device.str()}] = Record;
+    Modified = true;
+}
+
+} // namespace cspir
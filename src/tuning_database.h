@@ -0,0 +1,46 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace cspir {
+    struct TuningOptions {
+        std::string DatabasePath;  // Empty keeps the tuner out of the way
+        bool Autotune = false;  // Benchmark loops the database has no record for
+        std::vector<uint64_t> Sizes = {1 << 16, 1 << 20};  // Trip counts timed per variant
+        unsigned Repetitions = 3;  // Best of this many timed launches
+    };
+
+    // The measured winner for one loop on one device profile
+    struct TuningRecord {
+        unsigned VectorWidth = 1;
+        size_t WorkGroupSize = 256;
+        unsigned Unroll = 1;
+        unsigned Coarsening = 1;
+        double Seconds = 0;  // Summed over the tuning sizes
+        unsigned Candidates = 0;
+    };
+
+    // On-disk JSON map from (loop hash, device) to the tuned configuration:
+    //   {"version": 1, "records": [{"loop": ..., "device": ..., "width": ...,
+    //     "work_group_size": ..., "unroll": ..., "coarsening": ..., "seconds": ...,
+    //     "candidates": ...}]}
+    class TuningDatabase {
+    public:
+        // A missing file is an empty database
+        bool load(llvm::StringRef Path);
+        bool save(llvm::StringRef Path) const;
+
+        const TuningRecord* lookup(llvm::StringRef LoopHash, llvm::StringRef Device) const;
+        void insert(llvm::StringRef LoopHash, llvm::StringRef Device, const TuningRecord& Record);
+        bool isModified() const { return Modified; }
+
+    private:
+        std::map<std::pair<std::string, std::string>, TuningRecord> Records;
+        bool Modified = false;
+    };
+} // namespace cspir
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "clang/AST/Decl.h"
 #include "clang/AST/Stmt.h"
+#include "clang/AST/Type.h"
 #include "clang/Basic/SourceLocation.h"
+#include "device_profile.h"
+#include "kernel_emitter.h"
+#include "kernel_optimizer.h"
+#include "kernel_runner.h"
+#include "kernel_variants.h"
+#include "tuning_database.h"
 #include <string>
 #include <vector>
 
@@ -12,13 +20,55 @@ namespace cspir {
         CLK_GLOBAL_MEM_FENCE = 2
     };
 
+    // SPIR address spaces
+    enum OpenCLAddressSpace {
+        ADDRSPACE_PRIVATE  = 0,
+        ADDRSPACE_GLOBAL   = 1,
+        ADDRSPACE_CONSTANT = 2,
+        ADDRSPACE_LOCAL    = 3
+    };
+
     // OpenCL Built-in Functions
     struct OpenCLBuiltins {
         static constexpr const char* GET_GLOBAL_ID = "get_global_id";
         static constexpr const char* GET_LOCAL_ID  = "get_local_id";
         static constexpr const char* GET_GROUP_ID  = "get_group_id";
         static constexpr const char* GET_LOCAL_SIZE = "get_local_size";
+        static constexpr const char* GET_GLOBAL_SIZE = "get_global_size";
         static constexpr const char* BARRIER = "barrier";
+        // cl_khr_subgroups
+        static constexpr const char* GET_SUB_GROUP_ID = "get_sub_group_id";
+        static constexpr const char* GET_SUB_GROUP_LOCAL_ID = "get_sub_group_local_id";
+        static constexpr const char* GET_SUB_GROUP_SIZE = "get_sub_group_size";
+        static constexpr const char* GET_NUM_SUB_GROUPS = "get_num_sub_groups";
+        static constexpr const char* SUB_GROUP_REDUCE_ADD = "sub_group_reduce_add";
+    };
+
+    // How a work-group combines its per-work-item partial results
+    enum class ReductionStrategy {
+        WorkGroupTree,  // log2(WG) local-memory steps, one barrier each
+        SubGroup        // sub_group_reduce_add, one value per sub-group in local memory
+    };
+
+    // How work-group results are merged into the final value
+    enum class ReductionCombine {
+        Atomic,        // Relaxed atomic add per work-group
+        TwoStage,      // Per-group partials plus a single-work-group combine kernel
+        Deterministic  // Two-stage over a fixed grid; bitwise reproducible
+    };
+
+    // Floating-point freedom given to the generated kernels
+    enum class PrecisionPolicy {
+        Strict,    // IEEE operations exactly as written
+        Contract,  // a*b+c within one expression may fuse into llvm.fmuladd
+        Fast       // All fast-math flags; reductions may reassociate
+    };
+
+    // In-memory format of selected float buffers; kernels compute in float
+    enum class StorageFormat {
+        Native,   // As declared
+        Half,     // IEEE binary16 through vload_half/vstore_half_rte
+        BFloat16  // Upper half of a float, rounded to nearest even
     };
 
 // Forward declarations
@@ -26,30 +76,149 @@ class LoopAnalyzer;
 class SPIRVGenerator;
 
 // Common structures
+
+// A read-only array of a stencil loop, read at iv + Row*pitch + Col for
+// each of its Offsets
+struct StencilInput {
+    const clang::VarDecl* Array = nullptr;
+    clang::QualType Type;  // Element type
+    std::vector<std::pair<int64_t, int64_t>> Offsets;  // Distinct (Row, Col) pairs
+    int64_t MinRow = 0, MaxRow = 0;
+    int64_t MinCol = 0, MaxCol = 0;
+};
+
+// Loops whose neighbouring iterations read overlapping elements of arrays
+// they never write; those inputs are staged through __local tiles
+struct StencilInfo {
+    std::vector<StencilInput> Inputs;       // Empty when the loop is no stencil
+    const clang::VarDecl* Pitch = nullptr;  // Row pitch of 2-D stencils, null for 1-D
+};
+
+// One matrix of a loop nest: element (r, c) is Array[r*Stride + c], or
+// Array[c*Stride + r] when Transposed
+struct MatrixOperand {
+    const clang::VarDecl* Array = nullptr;
+    bool Transposed = false;
+    const clang::VarDecl* Stride = nullptr;  // Leading dimension passed at launch
+    uint64_t ConstantStride = 0;             // Literal or 2-D array row length otherwise
+};
+
+// C[i][j] = sum over k of A[i][k] * B[k][j] as three nested loops from 0;
+// bounds are loop-invariant variables or literals
+struct GemmInfo {
+    MatrixOperand A, B, C;               // C.Array is null when the loop is no GEMM
+    const clang::Expr* M = nullptr;      // Bounds of i, j and k
+    const clang::Expr* N = nullptr;
+    const clang::Expr* K = nullptr;
+    bool Accumulate = false;             // Products are added to C's old value
+    bool PartialSum = false;             // A scalar sums them before C is updated
+};
+
+// Out[j][i] = In[i][j] as two nested loops from 0, in either order
+struct TransposeInfo {
+    MatrixOperand In, Out;               // Out.Array is null when the loop is no transpose
+    const clang::Expr* Rows = nullptr;   // Bounds of i and j
+    const clang::Expr* Columns = nullptr;
+};
+
+// for (...) if (Condition) { v = iv; w = literal; ... break; }, or the
+// same ending in "return" or a bare "break": the kernel finds the first
+// iteration whose condition holds, the host applies the exit to it
+struct SearchInfo {
+    const clang::Expr* Condition = nullptr;  // Null when the loop is no search
+    const clang::VarDecl* Index = nullptr;   // Receives the first match; null for any/all tests
+    std::vector<std::pair<const clang::VarDecl*, const clang::Expr*>> Assignments;
+    bool Returns = false;                    // Exits the function rather than the loop
+    const clang::Expr* ReturnValue = nullptr;
+};
+
 struct VectorizationInfo {
     bool IsVectorizable;
     std::vector<std::string> Reasons;
     unsigned RecommendedWidth;
+    unsigned MaxLegalWidth;  // Widest vector the trip count allows
+    size_t WorkGroupSize;    // From the tuning database; 0 keeps the default
+    unsigned UnrollFactor;   // From the tuning database; 0 keeps the default
+    unsigned CoarseningFactor;  // Vectors per work-item of elementwise kernels
     bool IsReduction;
     bool IsSimplePattern;
+    bool IsElementwise;  // Body lowers to a kernel and iterations are independent
     bool HasConstantTripCount;
     uint64_t TripCount;
+    clang::QualType ElementType;  // Element type of the arrays the loop computes on
+    StencilInfo Stencil;
+    GemmInfo Gemm;
+    TransposeInfo Transpose;
+    SearchInfo Search;
+};
+
+// How the host must launch a kernel, mirrored in !cspir.dispatch
+struct DispatchInfo {
+    unsigned ElementsPerWorkItem = 1;
+    bool NeedsSizeArg = true;          // Trailing i32 N argument present
+    uint64_t StaticGlobalSize = 0;     // 0 when derived from N at launch
+    size_t RequiredWorkGroupSize = 0;  // 0 when any work-group size works
+};
+
+enum class ArgKind { Buffer, Scalar, TripCount };
+enum class ArgAccess { Read, Write, ReadWrite };
+
+// One kernel parameter, derived from how the loop uses the variable
+struct KernelArgument {
+    std::string Name;
+    const clang::VarDecl* Decl = nullptr;  // Null for generated buffers and a literal bound
+    ArgKind Kind = ArgKind::Scalar;
+    ArgAccess Access = ArgAccess::Read;
+    clang::QualType Type;                  // Element type for buffers, value type otherwise
+    unsigned AddressSpace = ADDRSPACE_PRIVATE;
+    StorageFormat Storage = StorageFormat::Native;  // Of float buffers only
 };
 
 struct KernelInfo {
     std::string Name;
     unsigned VectorWidth;
     bool IsReduction;
-    std::vector<std::string> Arguments;
+    clang::QualType ElementType;  // Defaults to float when the analyzer found none
+    std::vector<KernelArgument> Arguments;  // Loop buffers and scalars, then result and trip count
+    std::vector<const clang::VarDecl*> ConstantTables;  // Const arrays embedded in the module
+    int64_t LowerBound = 0;       // First iteration; work-item indices start here
+    bool InclusiveBound = false;  // "i <= n": the trip count argument is the last index
+    uint64_t StaticTripCount = 0; // Literal bound baked into the kernel; 0 when passed at launch
     clang::ForStmt* OriginalLoop;
     // Work-group related
     size_t PreferredWorkGroupSize = 256;  // Default size
     size_t MaxWorkGroupSize = 1024;       // Hardware limit
     bool UsesLocalMemory = false;
+    ReductionStrategy Reduction = ReductionStrategy::WorkGroupTree;
+    ReductionCombine Combine = ReductionCombine::Atomic;
+    size_t FixedNumGroups = 0;  // Required launch size in groups; 0 when any size works
+    unsigned UnrollFactor = 1;  // llvm.loop.unroll.count hint on the grid-stride loop
+    unsigned Coarsening = 1;    // Vectors per work-item of elementwise kernels
+    bool StridedCoarsening = false;  // Those vectors are global-size apart, not adjacent
+    StencilInfo Stencil;        // Inputs read through __local tiles
+    size_t TileRows = 1;        // Work-item rows of a 2-D stencil tile
+    SearchInfo Search;          // Condition of a search loop's kernel
+    DispatchInfo Dispatch;
 
     // OpenCL specific
     std::vector<std::string> RequiredExtensions;
-    std::vector<std::pair<std::string, std::string>> Attributes;
+    std::vector<std::pair<std::string, std::string>> Attributes;  // Reported after generation
+};
+
+// Command-line controlled settings shared by the analyzer and generator
+struct CodeGenOptions {
+    DeviceProfile Device = getDefaultDeviceProfile();
+    KernelOptLevel OptLevel = KernelOptLevel::Kernel;
+    ReductionStrategy Reduction = ReductionStrategy::WorkGroupTree;
+    ReductionCombine Combine = ReductionCombine::Atomic;
+    PrecisionPolicy Precision = PrecisionPolicy::Strict;
+    StorageFormat Storage = StorageFormat::Native;
+    std::vector<std::string> StorageBuffers;  // Buffers stored in Storage; empty selects all
+    std::vector<std::string> DeterministicKernels;  // Per-kernel override of Combine
+    VariantOptions Variants;
+    TuningOptions Tuning;
+    RunOptions Run;
+    EmitterOptions Emit;
 };
 
 } // namespace cspir
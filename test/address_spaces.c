@@ -0,0 +1,19 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ *
+ * Buffers are __global, and the reduction's scratch is a true __local
+ * array shared by the work-group rather than private memory
+ * CHECK: @kernel_line_{{[0-9]+}}.local_mem = internal addrspace(3) global [{{[0-9]+}} x float] undef
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(float addrspace(1)*
+ * CHECK: store float {{.*}}, float addrspace(3)*
+ * CHECK: call void @barrier(i32 1)
+ * CHECK: load float, float addrspace(3)*
+ */
+float sum_loop(float* a, int n) {
+    int i;
+    float sum = 0.0f;
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
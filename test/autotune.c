@@ -0,0 +1,56 @@
+/*
+ * RUN: rm -f %t.json
+ * RUN: cspir --device=cpu-avx2 --tuning-db=%t.json --autotune --tune-sizes=4096 %s | FileCheck %s
+ * RUN: cspir --device=cpu-avx2 --tuning-db=%t.json %s | FileCheck %s
+ * RUN: cspir %s | FileCheck --check-prefix=NODB %s
+ * RUN: not cspir --autotune %s 2>&1 | FileCheck --check-prefix=NOPATH %s
+ * RUN: not cspir --device=gpu --tuning-db=%t.json --autotune %s 2>&1 | FileCheck --check-prefix=NOCPU %s
+ * RUN: rm -f %t.builtins.json
+ * RUN: cspir --device=cpu-avx2 --tuning-db=%t.builtins.json --autotune --tune-sizes=4096 --reduction-strategy=subgroup --storage=half %s 2>&1 | FileCheck --check-prefix=BUILTINS --implicit-check-not="Cannot time variant" %s
+ * RUN: echo '{"version": 1, "records": [{"loop": "odd", "device": "generic", "width": 4, "work_group_size": 96}, {"loop": "large", "device": "igpu", "width": 4, "work_group_size": 512}]}' > %t.sizes.json
+ * RUN: cspir --tuning-db=%t.sizes.json %s 2>&1 | FileCheck --check-prefix=SIZES %s
+ *
+ * The second run reads back the record the first one wrote
+ * CHECK: - Tuning database: width {{[0-9]+}}, work-group {{[0-9]+}}
+ * CHECK-SAME: variants on the host CPU
+ *
+ * Without --tuning-db the heuristics decide alone
+ * NODB-NOT: Tuning database
+ * NODB: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * NOPATH: --autotune needs a --tuning-db file to record into
+ *
+ * Host timings would be recorded under a device they do not describe
+ * NOCPU: --autotune times kernels on the host CPU; pick a cpu-* --device, not 'gpu'
+ *
+ * Mangled math, vload_half/vstore_half and sub-group builtins all have
+ * host definitions, so every loop gets timed
+ * BUILTINS-COUNT-3: variants on the host CPU
+ *
+ * Records whose work-group size the device could not use are dropped
+ * SIZES: Warning: Ignoring tuning record for loop odd on generic in {{.*}}: work-group size 96 must be a power of two no larger than 1024
+ * SIZES: Warning: Ignoring tuning record for loop large on igpu in {{.*}}: work-group size 512 must be a power of two no larger than 256
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s + 1.0f;
+    }
+}
+
+float tanhf(float x);
+
+void squash(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = tanhf(x[i]);
+    }
+}
+
+float total(float* a, int n) {
+    int i;
+    float sum = 0.0f;
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
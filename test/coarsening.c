@@ -0,0 +1,35 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --device=cpu-avx2 %s | FileCheck --check-prefix=CPU %s
+ *
+ * A cheap body is spread over fewer work-items; GPUs keep neighbouring
+ * work-items on neighbouring vectors, CPUs give each a contiguous run
+ * CHECK: - Body cost ~3 against a work-item overhead of 8: coarsening by 2
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Dispatch: ceil(N/16) work-items, masked tail
+ * CHECK: - Coarsening: 2 vectors per work-item, global-size apart
+ *
+ * CPU: - Body cost ~3 against a work-item overhead of 32: coarsening by 8
+ * CPU-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CPU: - Dispatch: ceil(N/128) work-items, masked tail
+ * CPU: - Coarsening: 8 consecutive vectors per work-item
+ *
+ * An expensive body keeps one vector per work-item
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK-NOT: - Coarsening:
+ * CHECK: Kernel optimization
+ * CHECK: call i32 @get_global_size(i32 0)
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s;
+    }
+}
+
+void madd(float* o, float* a, float* b, float* c, float* d, float* e, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        o[i] = a[i] * b[i] + c[i] * d[i] + e[i];
+    }
+}
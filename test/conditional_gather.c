@@ -0,0 +1,36 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ *
+ * Every lane evaluates both arms, so a read C would skip is rejected
+ * unless it is the iteration's own element
+ * CHECK: - Not elementwise: array 'table' is gathered under a condition
+ * CHECK: - Not elementwise: array 'a' is read at offset 1 under a condition
+ *
+ * a[i] under a condition stays in range, and an integer division only
+ * sees the lanes that take its arm
+ * CHECK: - Elementwise loop body: iterations only touch their own elements
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: select <{{[0-9]+}} x i1>
+ * CHECK: sdiv <{{[0-9]+}} x i32>
+ */
+void lookup(float* out, float* table, int* idx, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        out[i] = idx[i] >= 0 ? table[idx[i]] : 0.0f;
+    }
+}
+
+void shift(float* b, float* a, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        b[i] = i + 1 < n ? a[i + 1] : a[i];
+    }
+}
+
+void ratio(int* q, int* num, int* den, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        q[i] = den[i] != 0 ? num[i] / den[i] : 0;
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ *
+ * An initialized const table becomes a module constant; a sized array
+ * the loop only gathers from becomes a __constant argument. Neither
+ * takes a __global buffer.
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Constant memory: embedded weights (16 bytes)
+ * CHECK: - Constant memory: __constant coeffs (32 bytes)
+ * CHECK: - Arguments: y (write-only buffer), x (read-only buffer), k (read-only buffer), coeffs (read-only __constant buffer), n (trip count)
+ *
+ * An array read at the iteration's own index stays __global
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK-NOT: - Constant memory:
+ * CHECK: - Arguments: y (write-only buffer), ramp (read-only buffer)
+ *
+ * CHECK: @weights = internal unnamed_addr addrspace(2) constant [4 x float]
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK-SAME: float addrspace(2)* {{.*}}%coeffs
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK-SAME: float addrspace(1)* {{.*}}%ramp
+ */
+static const float weights[4] = {0.125f, 0.25f, 0.5f, 1.0f};
+float coeffs[8];
+float ramp[64];
+
+void weigh(float* y, float* x, int* k, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = x[i] * weights[k[i]] + coeffs[k[i]];
+    }
+}
+
+void copy_ramp(float* y, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = ramp[i];
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ *
+ * Each loop's kernel computes in the element type of its arrays
+ * CHECK: - Element type: int
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Element type: double
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Element type: short
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Element type: char
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ *
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(i32 addrspace(1)*
+ * CHECK: mul <{{[0-9]+}} x i32>
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(double addrspace(1)*
+ * CHECK: fadd <{{[0-9]+}} x double>
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(i16 addrspace(1)*
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(i8 addrspace(1)*
+ * CHECK: !{!"cl_khr_fp64"}
+ */
+void scale_int(int* a, int s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s;
+    }
+}
+
+void add_double(double* c, double* a, double* b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+void add_short(short* c, short* a, short* b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+void add_char(char* c, char* a, char* b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
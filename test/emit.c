@@ -0,0 +1,54 @@
+/*
+ * RUN: rm -rf %t && mkdir -p %t
+ * RUN: cspir --emit=ll,bc -o %t/whole %s | FileCheck %s
+ * RUN: FileCheck --check-prefix=LL %s < %t/whole/emit.ll
+ * RUN: cspir -o %t/default %s | FileCheck --check-prefix=DEFAULT %s
+ * RUN: cspir --emit=ll --split-kernels --multi-version --variant-widths=4,8 --variant-group-sizes=64 --variant-coarsening=1 -o %t/split %s | FileCheck --check-prefix=SPLIT %s
+ * RUN: cspir --emit=ll --split-kernels --reduction-combine=two-stage -o %t/stages %s | FileCheck --check-prefix=STAGES %s
+ * RUN: cat %t/stages/emit.*.ll | FileCheck --check-prefix=PAIR %s
+ *
+ * With an output directory the module goes to files, not stdout
+ * CHECK-NOT: define spir_kernel
+ * CHECK-DAG: Wrote {{.*}}emit.ll ({{[0-9]+}} bytes)
+ * CHECK-DAG: Wrote {{.*}}emit.bc ({{[0-9]+}} bytes)
+ * LL: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ *
+ * SPIR-V when LLVM has the backend, bitcode for llvm-spirv otherwise
+ * DEFAULT: Wrote {{.*}}emit.{{spv|bc}} ({{[0-9]+}} bytes)
+ *
+ * One file per kernel, each keeping only its own selector row, which
+ * then matches on any device
+ * SPLIT-DAG: Wrote {{.*}}emit.kernel_line_{{[0-9]+}}_w4_g64.ll
+ * SPLIT-DAG: Wrote {{.*}}emit.kernel_line_{{[0-9]+}}_w8_g64.ll
+ * W4: define spir_kernel void @kernel_line_{{[0-9]+}}_w4_g64(
+ * W4-NOT: define spir_kernel
+ * W4: !cspir.variants = !{![[ROW:[0-9]+]]}
+ * W4: ![[ROW]] = !{!"kernel_line_{{[0-9]+}}", {{.*}}@kernel_line_{{[0-9]+}}_w4_g64, i32 4, i32 64, i32 1, i32 1, i32 0, i64 0}
+ *
+ * A two-stage reduction's combine kernel shares its first stage's file
+ * STAGES-NOT: _combine.ll
+ * STAGES: Wrote {{.*}}emit.kernel_line_{{[0-9]+}}.ll
+ * STAGES: Wrote {{.*}}emit.kernel_line_{{[0-9]+}}.ll
+ * STAGES-NOT: _combine.ll
+ * PAIR: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * PAIR-NOT: define spir_kernel
+ * PAIR: ; ModuleID
+ * PAIR: define spir_kernel void @kernel_line_[[SUM:[0-9]+]](
+ * PAIR: define spir_kernel void @kernel_line_[[SUM]]_combine(
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    /* RUN: cat %t/split/emit.kernel_line_%(line+1)_w4_g64.ll | FileCheck --check-prefix=W4 %s */
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s;
+    }
+}
+
+float sum(float* a, int n) {
+    int i;
+    float s = 0.0f;
+    for (i = 0; i < n; i++) {
+        s += a[i];
+    }
+    return s;
+}
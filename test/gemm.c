@@ -0,0 +1,26 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --run=20 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * CHECK: - GEMM nest: C[
+ * CHECK: - Pattern: GEMM
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - GEMM: {{[0-9]+}}x{{[0-9]+}} blocks of C per work-group, {{[0-9]+}}x{{[0-9]+}} register tile per work-item
+ * CHECK: - Local memory: k-steps of {{[0-9]+}} through __local A and B tiles
+ * CHECK-NOT: Generated SPIR-V kernel
+ * CHECK: Inner loop of a nest computed by the enclosing loop's kernel
+ *
+ * 20 leaves partial blocks and a partial last k-step
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 20:
+ * EXEC-NEXT: - C: checksum 32890600
+ */
+void gemm(float* C, float* A, float* B, int n) {
+    int i, j, k;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            for (k = 0; k < n; k++) {
+                C[i * n + j] += A[i * n + k] * B[k * n + j];
+            }
+        }
+    }
+}
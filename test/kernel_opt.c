@@ -0,0 +1,19 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --kernel-opt=O0 %s | FileCheck --check-prefix=O0 %s
+ * RUN: cspir --kernel-opt=O3 %s | FileCheck --check-prefix=O3 %s
+ *
+ * The pipeline runs once over the whole module, before it is printed
+ * CHECK: Kernel optimization (kernel): {{[0-9]+}} -> {{[0-9]+}} instructions ({{[0-9]+}} {{removed|added}})
+ * CHECK: Generated SPIR-V module (1 kernels):
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ *
+ * O0: Kernel optimization (O0): [[N:[0-9]+]] -> [[N]] instructions (0 removed)
+ * O3: Kernel optimization (O3): {{[0-9]+}} -> {{[0-9]+}} instructions
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s + 1.0f;
+    }
+}
@@ -0,0 +1,20 @@
+# -*- Python -*-
+import os
+
+import lit.formats
+from lit.llvm import llvm_config
+
+config.name = 'cspir'
+config.test_format = lit.formats.ShTest(not llvm_config.use_lit_shell)
+
+# One C input per kernel shape; text1.c is a plain sample without RUN lines
+config.suffixes = ['.c']
+config.excludes = ['text1.c']
+
+config.test_source_root = os.path.dirname(__file__)
+config.test_exec_root = os.path.join(config.cspir_obj_root, 'test')
+
+# FileCheck and not, including a not that starts a RUN line
+llvm_config.with_environment('PATH', config.llvm_tools_dir, append_path=True)
+llvm_config.use_default_substitutions()
+llvm_config.add_tool_substitutions(['cspir'], [config.cspir_tools_dir])
@@ -0,0 +1,36 @@
+/*
+ * RUN: cspir --kernel-opt=O0 %s | FileCheck %s
+ *
+ * Without the optimizer, the lowering itself loads x[i] once for all
+ * three reads
+ * CHECK-LABEL: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: vector:
+ * CHECK: load <[[W:[0-9]+]] x float>
+ * CHECK-NOT: load <
+ * CHECK: store <[[W]] x float>
+ * CHECK: tail:
+ *
+ * A read of an element the body just stored takes the stored value
+ * CHECK-LABEL: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: vector:
+ * CHECK: load <[[W2:[0-9]+]] x float>
+ * CHECK-NOT: load <
+ * CHECK: store <[[W2]] x float>
+ * CHECK-NOT: load <
+ * CHECK: store <[[W2]] x float>
+ * CHECK: tail:
+ */
+void twice(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = x[i] * x[i] + x[i];
+    }
+}
+
+void chain(float* c, float* b, float* a, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        b[i] = a[i] * 2.0f;
+        c[i] = b[i] + 1.0f;
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * RUN: cspir --kernel-opt=O0 %s | FileCheck %s
+ * RUN: cspir --run=13 %s | FileCheck --check-prefix=EXEC %s
+ * RUN: cspir --run=-5 %s | FileCheck --check-prefix=EMPTY %s
+ *
+ * Each work-item owns one whole vector; the last one finishes the
+ * iterations past the final full vector lane by lane, so N need not be a
+ * multiple of the width and no lane reads or writes past it
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Dispatch: ceil(N/[[W:[0-9]+]]) work-items, masked tail
+ * CHECK-NOT: - Coarsening:
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: vector:
+ * CHECK: load <[[W]] x float>
+ * CHECK: tail:
+ * CHECK: tail_lane:
+ * CHECK: load float, float addrspace(1)*
+ *
+ * 13 is no multiple of any width, so the tail lanes run too
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 13:
+ * EXEC-NEXT: - o: checksum 69414
+ *
+ * A negative n runs no iterations: o keeps its initial contents
+ * EMPTY-LABEL: Run of kernel_line_{{[0-9]+}} with n = -5:
+ * EMPTY-NEXT: - o: checksum 1501
+ */
+void madd(float* o, float* a, float* b, float* c, float* d, float* e, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        o[i] = a[i] * b[i] + c[i] * d[i] + e[i];
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --precision=fast %s | FileCheck --check-prefix=FAST %s
+ * RUN: cspir --precision=contract %s | FileCheck --check-prefix=CONTRACT %s
+ *
+ * Calls LLVM models exactly become intrinsics, the others OpenCL
+ * builtins overloaded on the kernel's vector type
+ * CHECK: - Not elementwise: call to 'sqrtl' has no kernel equivalent
+ * CHECK: - Not elementwise: call to 'clamp01' has no kernel equivalent
+ *
+ * sqrt(x[i]) * 0.5 on float data computes in double as C promotes it,
+ * so the kernel needs fp64 although no buffer holds doubles
+ * CHECK: - Double precision: float operands promoted by C, requires cl_khr_fp64
+ * CHECK: Generated SPIR-V module
+ * CHECK: call <{{[0-9]+}} x float> @llvm.sqrt.v{{[0-9]+}}f32(
+ * CHECK: call <{{[0-9]+}} x float> @_Z4tanhDv{{[0-9]+}}_f(
+ * CHECK: call <{{[0-9]+}} x float> @_Z5atan2Dv{{[0-9]+}}_fS_(
+ * CHECK: call <{{[0-9]+}} x double> @llvm.sqrt.v{{[0-9]+}}f64(
+ *
+ * Contract narrows only a lone + - * / or sqrt, whose double result
+ * rounds to the float one, so x[i] * 2.5 computes in float while the
+ * product of a square root keeps its double intermediate
+ * CONTRACT: - Double precision: float operands promoted by C, requires cl_khr_fp64
+ * CONTRACT-NOT: - Double precision:
+ * CONTRACT: Generated SPIR-V module
+ * CONTRACT: fmul contract <{{[0-9]+}} x double>
+ * CONTRACT: fmul contract <{{[0-9]+}} x float>
+ *
+ * Fast narrows both
+ * FAST-NOT: - Double precision:
+ *
+ * Fast precision swaps in native_ variants where OpenCL has them
+ * FAST: Generated SPIR-V module
+ * FAST: call fast <{{[0-9]+}} x float> @_Z11native_sqrtDv{{[0-9]+}}_f(
+ * FAST: call fast <{{[0-9]+}} x float> @_Z4tanhDv{{[0-9]+}}_f(
+ */
+float sqrtf(float x);
+float tanhf(float x);
+float atan2f(float y, float x);
+double sqrt(double x);
+long double sqrtl(long double x);
+
+static float clamp01(float x) {
+    return x < 0.0f ? 0.0f : x > 1.0f ? 1.0f : x;
+}
+
+void roots(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = sqrtf(x[i]);
+    }
+}
+
+void squash(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = tanhf(x[i]);
+    }
+}
+
+void angles(float* t, float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        t[i] = atan2f(y[i], x[i]);
+    }
+}
+
+void roots_double(double* y, double* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = sqrt(x[i]);
+    }
+}
+
+void roots_long(long double* y, long double* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = sqrtl(x[i]);
+    }
+}
+
+void clamp(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = clamp01(x[i]);
+    }
+}
+
+void promoted(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = sqrt(x[i]) * 0.5;
+    }
+}
+
+void scaled(float* y, float* x, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = x[i] * 2.5;
+    }
+}
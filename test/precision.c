@@ -0,0 +1,31 @@
+/*
+ * RUN: cspir %s | FileCheck --check-prefix=STRICT --implicit-check-not=fmuladd %s
+ * RUN: cspir --precision=contract %s | FileCheck --check-prefix=CONTRACT %s
+ * RUN: cspir --precision=fast %s | FileCheck --check-prefix=FAST %s
+ *
+ * Strict keeps the multiply and add separate and unflagged
+ * STRICT-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * STRICT-NOT: - Precision:
+ * STRICT: fmul <{{[0-9]+}} x float>
+ * STRICT: !cspir.precision = !{![[P:[0-9]+]]}
+ * STRICT-NOT: !opencl.enable.FP_CONTRACT
+ * STRICT: ![[P]] = !{!"strict"}
+ *
+ * Contract lets the device fuse a*b+c within the expression
+ * CONTRACT: - Precision: contract
+ * CONTRACT: call {{.*}}@llvm.fmuladd.v{{[0-9]+}}f32(
+ * CONTRACT-DAG: !opencl.enable.FP_CONTRACT
+ * CONTRACT-DAG: !{!"contract"}
+ *
+ * Fast puts every fast-math flag on every instruction
+ * FAST: - Precision: fast
+ * FAST: fmul fast <{{[0-9]+}} x float>
+ * FAST-DAG: !opencl.enable.FP_CONTRACT
+ * FAST-DAG: !{!"fast"}
+ */
+void saxpy(float* y, float* x, float alpha, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = alpha * x[i] + y[i];
+    }
+}
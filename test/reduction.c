@@ -0,0 +1,63 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --reduction-combine=two-stage %s | FileCheck --check-prefix=TWO %s
+ * RUN: cspir --run=3000 %s | FileCheck --check-prefix=EXEC %s
+ * RUN: cspir --reduction-combine=two-stage --run=3000 %s | FileCheck --check-prefix=EXEC %s
+ * RUN: cspir --run=-5 %s | FileCheck --check-prefix=EMPTY %s
+ * RUN: cspir --reduction-combine=two-stage --run=-5 %s | FileCheck --check-prefix=EMPTY %s
+ * RUN: cspir %s | FileCheck --check-prefix=SHORT %s
+ * RUN: cspir --multi-version --variant-widths=16 --variant-group-sizes=1 --variant-unroll=1 --run=15 %s | FileCheck --check-prefix=NARROW %s
+ *
+ * CHECK: - Pattern: Reduction
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Reduction strategy: work-group tree
+ * CHECK: - Combine: relaxed atomic add per work-group
+ * CHECK: - Dispatch: any global size (grid-stride
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: call i32 @get_global_size(i32 0)
+ *
+ * Without atomics a second one-work-group kernel folds the partials
+ * TWO: - Combine: partials[num_groups] reduced by kernel_line_[[LINE:[0-9]+]]_combine (one work-group)
+ * TWO: define spir_kernel void @kernel_line_[[LINE]](
+ * TWO: define spir_kernel void @kernel_line_[[LINE]]_combine(
+ * TWO-SAME: i32 %num_partials
+ *
+ * Both combines add up every group's elements exactly once
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 3000:
+ * EXEC-NEXT: - result: 13500
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 3000:
+ * EXEC-NEXT: - result: 13500
+ *
+ * even when the launch has fewer work-items than leftover elements
+ * NARROW-LABEL: Run of kernel_line_{{[0-9]+}}_w{{[0-9]+}}_g1 with n = 15:
+ * NARROW-NEXT: - result: 64
+ * NARROW-LABEL: Run of kernel_line_{{[0-9]+}}_w{{[0-9]+}}_g1 with n = 15:
+ * NARROW-NEXT: - result: 64
+ *
+ * and nothing at all for a negative n
+ * EMPTY-LABEL: Run of kernel_line_{{[0-9]+}} with n = -5:
+ * EMPTY-NEXT: - result: 0
+ *
+ * There is no 16-bit atomic add, so a short sum takes the two-stage
+ * path even when atomics are the default
+ * SHORT: - Combine: partials[num_groups] reduced by kernel_line_[[LINE:[0-9]+]]_combine (one work-group); no 16-bit atomic add
+ * SHORT-NOT: atomicrmw add i16
+ * SHORT: define spir_kernel void @kernel_line_[[LINE]]_combine(
+ */
+float sum_loop(float* a, int n) {
+    int i;
+    float sum = 0.0f;
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+short sum_shorts(short* s, int n) {
+    int i;
+    short sum = 0;
+    for (i = 0; i < n; i++) {
+        sum += s[i];
+    }
+    return sum;
+}
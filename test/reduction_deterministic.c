@@ -0,0 +1,46 @@
+/*
+ * RUN: cspir --reduction-combine=deterministic %s | FileCheck %s
+ * RUN: cspir --reduction-combine=deterministic --run=3000 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * The fixed grid only sizes the partials; the stride still follows the
+ * launch
+ * CHECK: - Combine: deterministic pairwise tree over {{[0-9]+}} partials in kernel_line_{{[0-9]+}}_combine
+ * CHECK: - Launch: exactly {{[0-9]+}} work-groups of {{[0-9]+}}
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: call i32 @get_global_size(i32 0)
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}_combine(
+ *
+ * --deterministic picks single loops, and the fixed summation order
+ * survives --precision=fast
+ * ONE-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * ONE: - Combine: deterministic pairwise tree
+ * ONE: - Precision: fast without reassociation (deterministic combine)
+ * ONE-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * ONE: - Combine: relaxed atomic add per work-group
+ * ONE: - Precision: fast
+ * ONE-NOT: without reassociation
+ *
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 3000:
+ * EXEC-NEXT: - result: 13500
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 3000:
+ * EXEC-NEXT: - result: 76500
+ */
+float sum_loop(float* a, int n) {
+    int i;
+    float sum = 0.0f;
+    /* RUN: cspir --deterministic=kernel_line_%(line+1) --precision=fast %s | FileCheck --check-prefix=ONE %s */
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+float sum_squares(float* a, int n) {
+    int i;
+    float sum = 0.0f;
+    for (i = 0; i < n; i++) {
+        sum += a[i] * a[i];
+    }
+    return sum;
+}
+
@@ -0,0 +1,43 @@
+/*
+ * RUN: cspir --reduction-strategy=subgroup --reduction-combine=two-stage %s | FileCheck %s
+ * RUN: cspir --reduction-strategy=subgroup --reduction-combine=two-stage --run=3000 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * sub_group_reduce_add has no char overload, so the sum is taken as int
+ * and truncated
+ * CHECK: - Element type: char
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Reduction strategy: sub-group (1 barrier per work-group)
+ * CHECK: - Combine: partials[num_groups] reduced by kernel_line_{{[0-9]+}}_combine (one work-group)
+ * CHECK: - Element type: float
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Reduction strategy: sub-group (1 barrier per work-group)
+ *
+ * CHECK-NOT: @_Z20sub_group_reduce_addc
+ * CHECK: call i32 @_Z20sub_group_reduce_addi(
+ * CHECK-NOT: @_Z20sub_group_reduce_addc
+ * CHECK: call float @_Z20sub_group_reduce_addf(
+ * CHECK: !{!"cl_khr_subgroups"}
+ *
+ * The char sum wraps as C's does: 13500 mod 256 is -68
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 3000:
+ * EXEC-NEXT: - result: -68
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 3000:
+ * EXEC-NEXT: - result: 13500
+ */
+char checksum(char* bytes, int n) {
+    int i;
+    char sum = 0;
+    for (i = 0; i < n; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+float total(float* a, int n) {
+    int i;
+    float sum = 0.0f;
+    for (i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
@@ -0,0 +1,70 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --run=7 %s | FileCheck --check-prefix=EXEC %s
+ * RUN: cspir --run=100 %s | FileCheck --check-prefix=NONE %s
+ * RUN: cspir --run=-5 %s | FileCheck --check-prefix=EMPTY %s
+ *
+ * CHECK: - Search: first i with a[i] == key
+ * CHECK: - Pattern: Search
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Dispatch: any global size (grid-stride, {{[0-9]+}} elements per step)
+ * CHECK: - Search: first match by atomic min on i, work-items stop once a lower match is known
+ * CHECK: - Result: i must hold the loop end before launch and keeps it when nothing matches
+ *
+ * CHECK: - Search index is not int
+ * CHECK-NOT: first match by atomic min on j
+ *
+ * Every i below n evaluates the condition, also past the match where C
+ * stops, so it may neither divide nor gather
+ * CHECK: - Search condition: integer division at iterations C may never reach
+ * CHECK: - Search condition: array 'b' is gathered at iterations C may never reach
+ *
+ * a[i] is 1 + i mod 8, so key 7 first matches at 6 and key 100 never
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 7:
+ * EXEC-NEXT: - result: 6
+ * NONE-LABEL: Run of kernel_line_{{[0-9]+}} with n = 100:
+ * NONE-NEXT: - result: 100
+ *
+ * A negative n searches nothing; i stays at the lower bound, as in C
+ * EMPTY-LABEL: Run of kernel_line_{{[0-9]+}} with n = -5:
+ * EMPTY-NEXT: - result: 0
+ */
+int find(int* a, int key, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (a[i] == key) {
+            break;
+        }
+    }
+    return i;
+}
+
+long find_long(int* a, int key, long n) {
+    long j;
+    for (j = 0; j < n; j++) {
+        if (a[j] == key) {
+            break;
+        }
+    }
+    return j;
+}
+
+int find_quotient(int* a, int k, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (k / a[i] == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+int find_gathered(int* a, int* b, int key, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (b[a[i]] == key) {
+            break;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,26 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ *
+ * Every loop of the translation unit lands in one module; loops that
+ * share a line get distinct kernel names
+ * CHECK: Generated SPIR-V kernel: kernel_line_[[LINE:[0-9]+]]
+ * CHECK: Generated SPIR-V kernel: kernel_line_[[SAME:[0-9]+]]{{$}}
+ * CHECK: Generated SPIR-V kernel: kernel_line_[[SAME]]_1
+ * CHECK: Generated SPIR-V module (3 kernels):
+ * CHECK: ; ModuleID
+ * CHECK-NOT: ; ModuleID
+ * CHECK: define spir_kernel void @kernel_line_[[LINE]](
+ * CHECK: define spir_kernel void @kernel_line_[[SAME]](
+ * CHECK: define spir_kernel void @kernel_line_[[SAME]]_1(
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s;
+    }
+}
+
+void fill(float* a, float* b, int n) {
+    int i;
+    for (i = 0; i < n; i++) { a[i] = 1.0f; } for (i = 0; i < n; i++) { b[i] = 2.0f; }
+}
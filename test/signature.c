@@ -0,0 +1,32 @@
+/*
+ * RUN: cspir --kernel-opt=O0 %s | FileCheck %s
+ *
+ * Arguments follow first use in the body; only buffers the loop never
+ * writes are declared const restrict
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Arguments: y (read-write buffer), alpha (scalar), x (read-only buffer), n (trip count)
+ *
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK-SAME: float addrspace(1)* nocapture align {{[0-9]+}} %y,
+ * CHECK-SAME: float %alpha,
+ * CHECK-SAME: float addrspace(1)* noalias nocapture readonly align {{[0-9]+}} %x,
+ * CHECK-SAME: i32 %n)
+ * CHECK-SAME: !kernel_arg_addr_space ![[AS:[0-9]+]]
+ * CHECK-SAME: !kernel_arg_access_qual ![[ACCESS:[0-9]+]]
+ * CHECK-SAME: !kernel_arg_type ![[TYPE:[0-9]+]]
+ * CHECK-SAME: !kernel_arg_base_type ![[TYPE]]
+ * CHECK-SAME: !kernel_arg_type_qual ![[QUAL:[0-9]+]]
+ * CHECK-SAME: !kernel_arg_name ![[NAME:[0-9]+]]
+ *
+ * CHECK-DAG: ![[AS]] = !{i32 1, i32 0, i32 1, i32 0}
+ * CHECK-DAG: ![[ACCESS]] = !{!"none", !"none", !"none", !"none"}
+ * CHECK-DAG: ![[TYPE]] = !{!"float*", !"float", !"float*", !"int"}
+ * CHECK-DAG: ![[QUAL]] = !{!"", !"", !"const restrict", !""}
+ * CHECK-DAG: ![[NAME]] = !{!"y", !"alpha", !"x", !"n"}
+ */
+void saxpy(float* y, float* x, float alpha, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = alpha * x[i] + y[i];
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --run=10 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * 8168 = 8 * 1021 leaves no useful divisor for any vector width, so the
+ * NDRange is rounded up and the extra work-items return at once instead
+ * of shrinking the work-groups
+ * CHECK: - Loop trip count: 8168
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Dispatch: static NDRange {{[0-9]+}} x reqd_work_group_size {{[0-9][0-9]+}}, no size argument, {{[0-9]+}} idle work-items
+ * CHECK: - Specialization: trip count 8168
+ *
+ * One full vector and a remainder fit a single unrolled work-item
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Dispatch: static NDRange 1 x reqd_work_group_size 1, no size argument
+ * CHECK: - Specialization: trip count 12, fully unrolled, 4-iteration unrolled tail
+ *
+ * The count starts at the lower bound and includes an inclusive end
+ * CHECK: - Loop trip count: 8{{$}}
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Specialization: trip count 8{{$|,}}
+ *
+ * The idle work-items write nothing, and n does not move a literal bound
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 10:
+ * EXEC-NEXT: - a: checksum 300345528
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 10:
+ * EXEC-NEXT: - a: checksum 22760
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 10:
+ * EXEC-NEXT: - a: checksum 22730
+ */
+void scale(float* a) {
+    int i;
+    for (i = 0; i < 8168; i++) {
+        a[i] = a[i] * 2.0f;
+    }
+}
+
+void scale12(float* a) {
+    int i;
+    for (i = 0; i < 12; i++) {
+        a[i] = a[i] * 2.0f;
+    }
+}
+
+void scale_middle(float* a) {
+    int i;
+    for (i = 4; i <= 11; i++) {
+        a[i] = a[i] * 2.0f;
+    }
+}
@@ -0,0 +1,20 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --run=50 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * CHECK: - Stencil input 'a': 3 neighbouring reads (columns -1..1)
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Dispatch: ceil(N/{{[0-9]+}}) work-items in work-groups of exactly {{[0-9]+}}, grid-stride over tiles
+ * CHECK: - Stencil: 1-D tiles of {{[0-9]+}} outputs
+ * CHECK: - Tile a: __local {{[0-9]+}} with halo
+ *
+ * Tiles load their halo but write only b[1..n-2]
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 50:
+ * EXEC-NEXT: - b: checksum 14061142.000039101
+ */
+void blur(float* b, float* a, int n) {
+    int i;
+    for (i = 1; i < n - 1; i++) {
+        b[i] = (a[i - 1] + a[i] + a[i + 1]) / 3.0f;
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --run=40 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * CHECK: - Stencil input 'a': 5 neighbouring reads (rows -1..1 of pitch w, columns -1..1)
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Stencil: 2-D tiles of {{[0-9]+}}x{{[0-9]+}} outputs, rows w apart
+ *
+ * A pitch of zero or less has no rows to tile; that fallback strides
+ * over the launch like the tiled path strides over tiles
+ * CHECK: define spir_kernel void @kernel_line_{{[0-9]+}}(
+ * CHECK: untiled_loop:
+ * CHECK: call i32 @get_global_size(i32 0)
+ *
+ * With w = n the rows above and below come from a's padding
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 40:
+ * EXEC-NEXT: - b: checksum 5768140
+ */
+void laplace(float* b, float* a, int w, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        b[i] = a[i - w] + a[i - 1] - 4.0f * a[i] + a[i + 1] + a[i + w];
+    }
+}
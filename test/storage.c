@@ -0,0 +1,18 @@
+/*
+ * RUN: cspir --storage=half %s | FileCheck %s
+ * RUN: cspir --storage=bf16 --storage-buffers=x %s | FileCheck --check-prefix=BF16 %s
+ *
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Storage: half for y, x, float compute; relative error per stored value <= 2^-11
+ * CHECK: - Memory traffic: 12 -> 6 bytes per iteration
+ *
+ * BF16-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * BF16: - Storage: bf16 for x, float compute; relative error per stored value <= 2^-8 (3.9e-3), float range kept
+ * BF16: - Memory traffic: 12 -> 10 bytes per iteration
+ */
+void saxpy(float* y, float* x, float alpha, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        y[i] = alpha * x[i] + y[i];
+    }
+}
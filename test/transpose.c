@@ -0,0 +1,20 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --run=20 %s | FileCheck --check-prefix=EXEC %s
+ *
+ * CHECK: - Transpose: out[
+ * CHECK: - Pattern: Transpose
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Transpose: {{[0-9]+}}x{{[0-9]+}} tiles through __local memory padded to {{[0-9]+}} columns; rows of in and out are read and written contiguously
+ *
+ * EXEC-LABEL: Run of kernel_line_{{[0-9]+}} with n = 20:
+ * EXEC-NEXT: - out: checksum 358940
+ */
+void transpose(float* out, float* in, int rows, int cols) {
+    int i, j;
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            out[j * rows + i] = in[i * cols + j];
+        }
+    }
+}
@@ -0,0 +1,22 @@
+/*
+ * RUN: cspir --multi-version --variant-widths=4,8 --variant-group-sizes=64,256 --variant-coarsening=1 %s | FileCheck %s
+ * RUN: not cspir --multi-version --variant-group-sizes=64,96 %s 2>&1 | FileCheck --check-prefix=ODD %s
+ * RUN: not cspir --device=igpu --multi-version --variant-group-sizes=512 %s 2>&1 | FileCheck --check-prefix=LARGE %s
+ *
+ * The table records what each kernel was built with, one row per
+ * distinct kernel
+ * CHECK-LABEL: Generated SPIR-V kernel: kernel_line_{{[0-9]+}}
+ * CHECK: - Variants: {{[0-9]+}} distinct of 4 built, selected at launch from !cspir.variants
+ * CHECK: !cspir.variants = !{
+ *
+ * Sizes the reduction tree cannot halve, or the device cannot launch,
+ * are rejected up front
+ * ODD: --variant-group-sizes: 96 must be a power of two no larger than 1024 (device 'generic')
+ * LARGE: --variant-group-sizes: 512 must be a power of two no larger than 256 (device 'igpu')
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s;
+    }
+}
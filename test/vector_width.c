@@ -0,0 +1,53 @@
+/*
+ * RUN: cspir %s | FileCheck %s
+ * RUN: cspir --device=cpu-avx512 %s | FileCheck --check-prefix=AVX512 %s
+ *
+ * Two registers' worth of elements, capped at 16 lanes
+ * CHECK: - Vector width 8 from 32-bit float elements and 128-bit registers (generic profile)
+ * CHECK: - Vector width 16 from 8-bit char elements and 128-bit registers (generic profile)
+ * AVX512: - Vector width 16 from 32-bit float elements and 512-bit registers (cpu-avx512 profile)
+ * AVX512: - Vector width 16 from 8-bit char elements and 512-bit registers (cpu-avx512 profile)
+ *
+ * Nine live values of two registers each do not fit in 16
+ * CHECK: - Register pressure (~9 live vectors, 16 registers) limits vector width to 4
+ * CHECK: - Trip count limits vector width to 4
+ *
+ * A read of an element the loop writes at another offset is a
+ * loop-carried dependence whatever the distance
+ * CHECK: - Dependence distance 2 on array: b
+ * CHECK: Loop is not vectorizable
+ */
+void scale(float* a, float s, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        a[i] = a[i] * s;
+    }
+}
+
+void add_char(char* c, char* a, char* b, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+void dot2(float* o, float* a, float* b, float* c, float* d, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        o[i] = a[i] * b[i] + c[i] * d[i];
+    }
+}
+
+void short_loop(float* a) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        a[i] = a[i] + 1.0f;
+    }
+}
+
+void recurrence(float* b, int n) {
+    int i;
+    for (i = 2; i < n; i++) {
+        b[i] = b[i - 2] + 1.0f;
+    }
+}